@@ -163,6 +163,7 @@ frame_ended(void *user_ctx, int frame_idx, bool completed, const katherine_frame
     printf(" - tpx3->katherine lost %lu pixels\n", info->lost_pixels);
     printf(" - katherine->pc sent %lu pixels\n", info->sent_pixels);
     printf(" - katherine->pc received %lu pixels\n", info->received_pixels);
+    printf(" - pc dropped %lu datagrams\n", info->host_dropped_datagrams);
     printf(" - state: %s\n", (completed ? "completed" : "not completed"));
     printf(" - start time: %lu\n", info->start_time.d);
     printf(" - end time: %lu\n", info->end_time.d);
@@ -199,7 +200,11 @@ run_acquisition(katherine_device_t *dev, const katherine_config_t *c)
     int res;
     katherine_acquisition_t acq;
 
-    res = katherine_acquisition_init(&acq, dev, NULL, KATHERINE_MD_SIZE * 34952533, sizeof(px_t) * 65536, 500, 10000);
+    // One batch of datagrams is all the read receives at once, and the
+    // buffers are faulted in up front, so that the first frame does not
+    // wait for the kernel to back them.
+    const katherine_allocator_t alloc = {NULL, NULL, NULL, KATHERINE_ALLOC_HUGEPAGES | KATHERINE_ALLOC_PREFAULT};
+    res = katherine_acquisition_init_with_allocator(&acq, dev, NULL, KATHERINE_MD_DATAGRAM_MAX_SIZE * KATHERINE_MD_BATCH_MAX, sizeof(px_t) * 65536, 500, 10000, &alloc);
     if (res != 0) {
         printf("Cannot initialize acquisition. Is the configuration valid?\n");
         printf("Reason: %s\n", strerror(res));
@@ -20,6 +20,7 @@
 #include <katherine/device.h>
 #include <katherine/config.h>
 #include <katherine/px.h>
+#include <katherine/px_filter.h>
 
 /**
  * @addtogroup c_api
@@ -28,6 +29,16 @@
 
 #define KATHERINE_MD_SIZE 6
 
+/* Largest measurement data datagram the readout sends: it chunks the stream
+ * into datagrams of at most 226 whole data. */
+#define KATHERINE_MD_DATAGRAM_MAX_SIZE (226 * KATHERINE_MD_SIZE)
+
+/* Datagrams the read loop receives per system call, at most. The
+ * measurement data buffer is split into this many slots of one datagram
+ * each, or into fewer if it is too small to give every slot room for a
+ * datagram of KATHERINE_MD_DATAGRAM_MAX_SIZE. */
+#define KATHERINE_MD_BATCH_MAX         64
+
 // Uncomment the following line to enable acquisition logging:
 // #define KATHERINE_DEBUG_ACQ 2
 
@@ -44,10 +55,30 @@ typedef union katherine_frame_info_time {
     uint64_t d;
 } katherine_frame_info_time_t;
 
+/** Pixels of a row of the detector, and of a column (see katherine_frame_maps_t). */
+#define KATHERINE_FRAME_MAP_WIDTH 256
+
+/** Pixels of the detector, and so elements of a map (see katherine_frame_maps_t). */
+#define KATHERINE_FRAME_MAP_SIZE (KATHERINE_FRAME_MAP_WIDTH * KATHERINE_FRAME_MAP_WIDTH)
+
+/**
+ * Maps of a frame, accumulated by the decoder (see katherine_acquisition_set_frame_maps()).
+ *
+ * Both maps are indexed by y * KATHERINE_FRAME_MAP_WIDTH + x.
+ */
+typedef struct katherine_frame_maps {
+    uint32_t counts[KATHERINE_FRAME_MAP_SIZE];         ///< Hits of each pixel, or its events in the event modes
+    uint32_t integrated_tot[KATHERINE_FRAME_MAP_SIZE]; ///< Sum of the ToT of each pixel, or of its integral ToT in the event modes; zero in the ToA-only modes
+    uint64_t pixels;                                   ///< Pixel measurement data accumulated
+} katherine_frame_maps_t;
+
 typedef struct katherine_frame_info {
     uint64_t received_pixels; ///< The number of hit pixels actually received by libkatherine
     uint64_t sent_pixels;     ///< The number of hit pixels reported sent by Katherine device
     uint64_t lost_pixels;     ///< The number of hit pixels reported lost by Katherine device
+    uint64_t filtered_pixels; ///< The number of hit pixels received but dropped by the pixel filter (see katherine_acquisition_set_px_filter())
+
+    uint64_t host_dropped_datagrams; ///< Datagrams of measurement data the host dropped while the frame was running, before libkatherine could receive them
 
     katherine_frame_info_time_t start_time; ///< Timestamp of frame start reported by Katherine device
     katherine_frame_info_time_t end_time;   ///< Timestamp of frame end, only valid after the frame has ended
@@ -55,16 +86,84 @@ typedef struct katherine_frame_info {
     time_t start_time_observed; ///< Timestamp of when libkatherine received 'frame started' event, in local time reference
     time_t end_time_observed;   ///< Timestamp of when libkatherine received 'frame ended' event, only valid after the frame has ended
 
+    uint64_t start_time_observed_ns; ///< Time (ns) from the start of the acquisition to when libkatherine received 'frame started' event, on a monotonic clock
+    uint64_t end_time_observed_ns;   ///< Time (ns) from the start of the acquisition to when libkatherine received 'frame ended' event, only valid after the frame has ended
+    uint64_t max_receive_gap_ns;     ///< Longest wait (ns) for measurement data while the frame was running
+
     bool completed; ///< Set to true if the frame was correctly terminated ahead of the 'frame ended' event. Otherwise this indicates missing data.
+
+    const katherine_frame_maps_t *maps; ///< Maps of the frame, only valid after the frame has ended and if accumulated (see katherine_acquisition_set_frame_maps()), otherwise NULL
 } katherine_frame_info_t;
 
+/**
+ * Datagram of raw measurement data leased to the application (see katherine_acquisition_set_md_pool()).
+ */
+typedef struct katherine_md_lease {
+    const char *data; ///< The datagram, valid until the lease is released
+    size_t length;    ///< Its size in bytes
+    uint64_t next;    ///< Internal link of the pool, must not be modified
+} katherine_md_lease_t;
+
+/**
+ * Cluster of neighbouring pixels hit close in time (see katherine_acquisition_set_clustering()).
+ */
+typedef struct katherine_cluster {
+    uint64_t first_toa; ///< Earliest time of arrival of its pixels, in the timestamp unit of the acquisition
+    uint64_t last_toa;  ///< Latest time of arrival of its pixels
+    uint32_t size;      ///< Pixel hits of the cluster
+    uint32_t sum_tot;   ///< Sum of the ToT of its pixels, zero in the ToA-only modes
+    float x;            ///< Centroid, weighted by the ToT where there is one
+    float y;            ///< Centroid, weighted by the ToT where there is one
+    uint8_t min_x;      ///< Bounding box, inclusive
+    uint8_t min_y;      ///< Bounding box, inclusive
+    uint8_t max_x;      ///< Bounding box, inclusive
+    uint8_t max_y;      ///< Bounding box, inclusive
+} katherine_cluster_t;
+
+/**
+ * Parameters of the clustering of an acquisition (see katherine_acquisition_set_clustering()).
+ */
+typedef struct katherine_clustering {
+    uint64_t toa_window; ///< Largest difference of the times of arrival of two neighbouring pixels of a cluster, in the timestamp unit
+    size_t max_open;     ///< Clusters open at once, at most, which bounds the memory of the clustering
+} katherine_clustering_t;
+
+/**
+ * Parameters of the time ordering of the decoded pixels (see katherine_acquisition_set_reordering()).
+ */
+typedef struct katherine_reordering {
+    uint64_t window;    ///< Largest lateness of a pixel, behind the latest time of arrival seen, still delivered in order, in the timestamp unit
+    size_t max_pending; ///< Pixels held back at once, at most, which bounds the memory of the reordering
+} katherine_reordering_t;
+
 typedef struct katherine_acquisition_handlers {
     void (*pixels_received)(void *, const void *, size_t);
     void (*frame_started)(void *, int);
     void (*frame_ended)(void *, int, bool, const katherine_frame_info_t *);
     void (*data_received)(void *, const char *, size_t);
+    void (*pixel_columns_received)(void *, const katherine_px_columns_t *);
+    void (*data_leased)(void *, katherine_md_lease_t *);
+    void (*clusters_received)(void *, const katherine_cluster_t *, size_t);
 } katherine_acquisition_handlers_t;
 
+/**
+ * Layout of the decoded pixels, as delivered to the handlers (see katherine_acquisition_set_px_layout()).
+ */
+typedef enum katherine_px_layout {
+    KATHERINE_PX_LAYOUT_STRUCTS  = 0, ///< Array of katherine_px_*_t records, delivered by pixels_received
+    KATHERINE_PX_LAYOUT_COLUMNS  = 1, ///< One array per field (katherine_px_columns_t), delivered by pixel_columns_received
+    KATHERINE_PX_LAYOUT_PACKED16 = 2, ///< Array of katherine_px_*_p16_t records, delivered by pixels_received
+    KATHERINE_PX_LAYOUT_PACKED12 = 3  ///< Array of katherine_px_*_p12_t records, delivered by pixels_received
+} katherine_px_layout_t;
+
+/**
+ * Unit of the time of arrival of the decoded pixels (see katherine_acquisition_set_timestamp_unit()).
+ */
+typedef enum katherine_timestamp_unit {
+    KATHERINE_TIMESTAMP_TOA  = 0, ///< Ticks of the 40 MHz ToA clock (25 ns) since the frame started, fToA left apart
+    KATHERINE_TIMESTAMP_FINE = 1  ///< Ticks of the 640 MHz fToA clock (1.5625 ns) on the clock of the device, fToA included
+} katherine_timestamp_unit_t;
+
 typedef enum katherine_readout_type {
     READOUT_SEQUENTIAL  = 0,
     READOUT_DATA_DRIVEN = 1
@@ -77,6 +176,106 @@ typedef enum katherine_acquisition_state {
     ACQUISITION_TIMED_OUT   = 3
 } katherine_acquisition_state_t;
 
+/**
+ * Snapshot of the datagram ring of a pipelined acquisition (see katherine_acquisition_set_pipeline()).
+ */
+typedef struct katherine_pipeline_stats {
+    size_t capacity;    ///< Datagram slots of the ring
+    size_t depth;       ///< Datagrams queued for the decoder when the snapshot was taken
+    size_t high_water;  ///< Most datagrams ever queued at once since the read began
+    uint64_t datagrams; ///< Datagrams received into the ring since the read began
+    uint64_t stalls;    ///< Times the receiver found the ring full and had to wait for the decoder
+} katherine_pipeline_stats_t;
+
+/**
+ * Snapshot of the lease pool of an acquisition (see katherine_acquisition_set_md_pool()).
+ */
+typedef struct katherine_md_pool_stats {
+    size_t capacity; ///< Leases of the pool
+    size_t leased;   ///< Leases held by the application when the snapshot was taken
+    uint64_t stalls; ///< Times the read found every lease held and had to wait for a release
+} katherine_md_pool_stats_t;
+
+/**
+ * Snapshot of the performance counters of an acquisition (see katherine_acquisition_get_stats()).
+ *
+ * The counters run from the beginning of the acquisition, over all of its reads.
+ */
+typedef struct katherine_acquisition_stats {
+    uint64_t datagrams;         ///< Datagrams of measurement data received
+    uint64_t bytes;             ///< Bytes of measurement data received
+    uint64_t max_datagram_size; ///< Largest datagram received, in bytes
+    double mean_datagram_size;  ///< Mean size of the datagrams received, in bytes (filled in by the snapshot)
+    uint64_t receive_timeouts;  ///< Times the read found the stream quiet for a receive timeout
+
+    uint64_t host_dropped_datagrams; ///< Datagrams the network stack of the host dropped, where the platform reports them (see katherine_udp_track_drops())
+
+    uint64_t decode_ns;   ///< Time (ns) spent handling received datagrams, the handlers excluded
+    uint64_t callback_ns; ///< Time (ns) spent in the handlers
+
+    uint64_t flushes_full;           ///< Pixel buffers delivered because they filled up
+    uint64_t flushes_report_timeout; ///< Partial pixel buffers delivered because the report timeout passed
+    uint64_t flushes_frame_end;      ///< Pixel buffers delivered at the end of a frame or of the read
+
+    uint64_t md_by_header[16]; ///< Measurement data decoded, indexed by their 4-bit header (pixels at 0x4)
+
+    uint64_t late_pixels;   ///< Pixels which arrived later than the reordering window allowed, and were delivered out of order
+    uint64_t forced_pixels; ///< Pixels delivered before the reordering window passed them, to make room in a full reordering buffer
+} katherine_acquisition_stats_t;
+
+/** Back the buffers of the default allocator by huge pages, where the platform allows (see katherine_allocator_t). */
+#define KATHERINE_ALLOC_HUGEPAGES 0x1
+
+/** Fault in every page of the buffers as they are allocated (see katherine_allocator_t). */
+#define KATHERINE_ALLOC_PREFAULT 0x2
+
+/**
+ * Allocator of the buffers of an acquisition (see katherine_acquisition_init_with_allocator()).
+ *
+ * The buffers the stream is received into and decoded to -- the measurement data buffer, the pixel
+ * buffer, the ring of a pipeline and the buffers of a lease pool -- are taken from alloc and given
+ * back to free, with the size they were allocated with. Without alloc, they come from the C heap,
+ * or are mapped in whole huge pages with KATHERINE_ALLOC_HUGEPAGES.
+ */
+typedef struct katherine_allocator {
+    void *(*alloc)(void *ctx, size_t size);          ///< Allocate a buffer, or NULL for the default allocator
+    void (*free)(void *ctx, void *ptr, size_t size); ///< Free a buffer of alloc
+    void *ctx;                                       ///< Passed to both
+    unsigned flags;                                  ///< KATHERINE_ALLOC_* flags
+} katherine_allocator_t;
+
+/** Words of a CPU set (see katherine_realtime_t), which covers CPUs 0 to 1023. */
+#define KATHERINE_CPU_SET_WORDS 16
+
+/**
+ * Real-time tuning of the thread receiving the measurement data (see katherine_acquisition_set_realtime()).
+ */
+typedef struct katherine_realtime {
+    uint64_t cpus[KATHERINE_CPU_SET_WORDS]; ///< CPUs the thread may run on, CPU i being bit i % 64 of word i / 64, or none to leave the affinity as it is
+    int priority;                           ///< SCHED_FIFO priority (1 to 99), or zero to leave the scheduling as it is
+    bool lock_memory;                       ///< Lock the buffers of the acquisition in memory
+    bool required;                          ///< Fail the read if a part of the tuning cannot be applied, rather than read without it
+} katherine_realtime_t;
+
+/**
+ * Outcome of the real-time tuning of the last read (see katherine_acquisition_get_realtime_status()).
+ *
+ * Each member is the error code of a part of the tuning, zero if it was applied or not requested.
+ */
+typedef struct katherine_realtime_status {
+    int affinity;    ///< Pinning the thread to the CPUs
+    int priority;    ///< Raising the thread to the real-time priority
+    int lock_memory; ///< Locking the buffers in memory
+} katherine_realtime_status_t;
+
+struct katherine_acquisition_pipeline;
+struct katherine_md_pool;
+struct katherine_decode_pool;
+struct katherine_clusterer;
+struct katherine_reorder;
+struct katherine_recorder;
+struct katherine_sink;
+
 typedef struct katherine_acquisition {
     katherine_device_t *device;
     void *user_ctx;
@@ -89,12 +288,19 @@ typedef struct katherine_acquisition {
 
     char *md_buffer;
     size_t md_buffer_size;
+    size_t md_slot_size;
+    size_t md_slots;
 
     bool decode_data;
     char *pixel_buffer;
     size_t pixel_buffer_size;
     size_t pixel_buffer_valid;
     size_t pixel_buffer_max_valid;
+    size_t pixel_size; ///< Bytes of a pixel record of the read, zero in the columnar layout
+    char px_layout;
+    char timestamp_unit;
+    uint8_t toa_shift; ///< Bits the coarse ToA is shifted by to the timestamp unit
+    katherine_px_columns_t px_columns; ///< Columns carved out of the pixel buffer by the columnar layout
 
     int requested_frames;
     double requested_frame_duration; // s
@@ -102,20 +308,47 @@ typedef struct katherine_acquisition {
     size_t dropped_measurement_data;
 
     time_t acq_start_time;
+    uint64_t acq_start_time_ns; ///< Monotonic time (ns) of the start of the acquisition
+    uint64_t last_received_ns;  ///< Monotonic time (ns) of when the datagrams being handled were received
     int report_timeout;
     int fail_timeout;
 
     katherine_acquisition_handlers_t handlers;
     katherine_frame_info_t current_frame_info;
+    katherine_acquisition_stats_t stats; ///< Performance counters, kept by the read (see katherine_acquisition_get_stats())
+    uint64_t host_drops_seen;            ///< Datagrams dropped by the data socket when last looked
 
-    uint64_t last_toa_offset;
+    uint64_t last_toa_offset;  ///< Added to the time of arrival of the pixels being decoded, in the timestamp unit
+    uint64_t frame_toa_offset; ///< Part of the above which is the start of the running frame
 
     bool frame_active;
+    bool pumping;   ///< Set while a step-wise read (katherine_acquisition_pump()) holds the data socket
+    bool replaying; ///< Set while a replay (katherine_acquisition_replay()) drives the decoder
+
+    struct katherine_acquisition_pipeline *pipeline; ///< Receiver thread and ring, NULL unless pipelined
+    struct katherine_md_pool *md_pool;               ///< Leased datagram buffers, NULL unless enabled
+    struct katherine_decode_pool *decode_pool;       ///< Decoding threads, NULL unless decoding in parallel
+    struct katherine_clusterer *clusterer;           ///< Clustering stage, NULL unless clustering
+    struct katherine_reorder *reorder;               ///< Time ordering stage, NULL unless reordering
+    katherine_px_filter_t *px_filter;                ///< Pixels the decoder passes on, NULL to pass all
+    struct katherine_recorder *recorder;             ///< Recorder of the datagrams received, NULL unless recording
+    struct katherine_sink *sink;                     ///< Sink of the datagrams or the pixels, NULL unless writing one
+
+    katherine_allocator_t allocator; ///< Allocator of the buffers
+
+    katherine_frame_maps_t *frame_maps[2]; ///< Maps accumulated and handed over in turns, NULL unless enabled
+    unsigned frame_maps_current;           ///< Index of the maps of the running frame
+
+    katherine_realtime_t realtime;               ///< Real-time tuning of the reads, all zero for none
+    katherine_realtime_status_t realtime_status; ///< Outcome of the tuning of the last read
 } katherine_acquisition_t;
 
 KATHERINE_EXPORTED int
 katherine_acquisition_init(katherine_acquisition_t *acq, katherine_device_t *device, void *ctx, size_t md_buffer_size, size_t pixel_buffer_size, int report_timeout, int fail_timeout);
 
+KATHERINE_EXPORTED int
+katherine_acquisition_init_with_allocator(katherine_acquisition_t *acq, katherine_device_t *device, void *ctx, size_t md_buffer_size, size_t pixel_buffer_size, int report_timeout, int fail_timeout, const katherine_allocator_t *allocator);
+
 KATHERINE_EXPORTED void
 katherine_acquisition_fini(katherine_acquisition_t *acq);
 
@@ -131,6 +364,63 @@ katherine_acquisition_stop(katherine_acquisition_t *acq);
 KATHERINE_EXPORTED int
 katherine_acquisition_read(katherine_acquisition_t *acq);
 
+KATHERINE_EXPORTED katherine_socket_t
+katherine_acquisition_get_fd(const katherine_acquisition_t *acq);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_pump(katherine_acquisition_t *acq, size_t max_datagrams);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_poll_timeouts(katherine_acquisition_t *acq);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_finish(katherine_acquisition_t *acq);
+
+KATHERINE_EXPORTED void
+katherine_acquisition_get_stats(const katherine_acquisition_t *acq, katherine_acquisition_stats_t *stats);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_pipeline(katherine_acquisition_t *acq, size_t depth);
+
+KATHERINE_EXPORTED void
+katherine_acquisition_get_pipeline_stats(const katherine_acquisition_t *acq, katherine_pipeline_stats_t *stats);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_decode_threads(katherine_acquisition_t *acq, size_t threads);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_clustering(katherine_acquisition_t *acq, const katherine_clustering_t *clustering);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_px_filter(katherine_acquisition_t *acq, const katherine_px_filter_t *filter);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_reordering(katherine_acquisition_t *acq, const katherine_reordering_t *reordering);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_frame_maps(katherine_acquisition_t *acq, bool enabled);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_realtime(katherine_acquisition_t *acq, const katherine_realtime_t *rt);
+
+KATHERINE_EXPORTED void
+katherine_acquisition_get_realtime_status(const katherine_acquisition_t *acq, katherine_realtime_status_t *status);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_md_pool(katherine_acquisition_t *acq, size_t leases);
+
+KATHERINE_EXPORTED void
+katherine_acquisition_release_lease(katherine_acquisition_t *acq, katherine_md_lease_t *lease);
+
+KATHERINE_EXPORTED void
+katherine_acquisition_get_md_pool_stats(const katherine_acquisition_t *acq, katherine_md_pool_stats_t *stats);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_px_layout(katherine_acquisition_t *acq, katherine_px_layout_t layout);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_timestamp_unit(katherine_acquisition_t *acq, katherine_timestamp_unit_t unit);
+
 KATHERINE_EXPORTED const char *
 katherine_str_acquisition_status(char status);
 
@@ -0,0 +1,70 @@
+/**
+ * @file
+ * @brief Functions related to the compression of raw measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/global.h>
+
+/**
+ * @addtogroup c_api
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The codec compresses a stream of raw measurement data losslessly, a block at a time -- such as a
+ * datagram, or a few of them. A block is encoded as runs of data of the same header, each a varint
+ * of its length and header, followed by the data of the run:
+ *
+ *  - a pixel as the change of its coarse time of arrival from the pixel before it, then the change of
+ *    its row if it stays in the column of that pixel, or its column and row otherwise, and its
+ *    remaining 14 bits,
+ *  - a timestamp offset as its change from the offset before it, and
+ *  - any other datum as its payload,
+ *
+ * all as varints, the signed ones zigzag-coded, save for a column and a row, a byte each. A fragment of a datum ending the block follows as a run
+ * of length zero. The changes are taken across blocks, so that the blocks must be decoded in the order
+ * they were encoded, each whole, by a codec which has started over as the encoding one did.
+ */
+
+/**
+ * State of the encoding or the decoding of a stream, carried from one block to the next.
+ */
+typedef struct katherine_md_codec {
+    uint64_t offset; ///< Payload of the last timestamp offset
+    uint16_t toa;    ///< Coarse time of arrival of the last pixel
+    uint8_t x;       ///< Column of the last pixel
+    uint8_t y;       ///< Row of the last pixel
+} katherine_md_codec_t;
+
+KATHERINE_EXPORTED void
+katherine_md_codec_init(katherine_md_codec_t *codec);
+
+KATHERINE_EXPORTED size_t
+katherine_md_codec_bound(size_t length);
+
+KATHERINE_EXPORTED int
+katherine_md_encode(katherine_md_codec_t *codec, const void *src, size_t length, void *dst, size_t capacity, size_t *written);
+
+KATHERINE_EXPORTED int
+katherine_md_decode(katherine_md_codec_t *codec, const void *src, size_t length, void *dst, size_t capacity, size_t *written);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
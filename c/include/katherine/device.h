@@ -32,6 +32,9 @@ typedef struct katherine_device {
 KATHERINE_EXPORTED int
 katherine_device_init(katherine_device_t *device, const char *addr);
 
+KATHERINE_EXPORTED int
+katherine_device_init_tuned(katherine_device_t *device, const char *addr, const katherine_udp_tuning_t *data_tuning, katherine_udp_tuning_t *granted);
+
 KATHERINE_EXPORTED void
 katherine_device_fini(katherine_device_t *device);
 
@@ -0,0 +1,197 @@
+/**
+ * @file
+ * @brief Functions related to columnar files of decoded hits.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <katherine/global.h>
+#include <katherine/acquisition.h>
+#include <katherine/px.h>
+
+/**
+ * @addtogroup c_api
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A hit file is a file of three parts:
+ *
+ *  1. the header (katherine_hitfile_header_t),
+ *  2. the chunks, each of a fixed number of hits but the last one, stored a column per field: the
+ *     times of arrival, the times over threshold, the event counts, the integral times over
+ *     threshold, the columns, the rows, the fine times of arrival and the hit counts, whichever of
+ *     them the mode of the acquisition has, each an array of the hits of the chunk, and the chunk
+ *     padded to 8 bytes, and
+ *  3. the index, one katherine_hitfile_chunk_t per chunk, with the ranges of the times of arrival
+ *     and of the coordinates of its hits, followed by the trailer (katherine_hitfile_trailer_t),
+ *     which ends the file.
+ *
+ * All integers are in the byte order of the host which wrote the file. A reader which looks for the
+ * hits of a time window or of a region of the matrix skips the chunks whose ranges miss it, and of
+ * the others, reads the columns it needs.
+ */
+
+/** Magic of the header of a hit file. */
+#define KATHERINE_HITFILE_MAGIC "KATHHIT"
+
+/** Magic of the trailer of a hit file. */
+#define KATHERINE_HITFILE_TRAILER_MAGIC "KATHHIX"
+
+/** Version of the hit file format written by this library. */
+#define KATHERINE_HITFILE_FORMAT 1
+
+/** Hits of a chunk, unless told otherwise. */
+#define KATHERINE_HITFILE_DEFAULT_CHUNK_SIZE 65536
+
+/** Columns of a hit file, as flags. */
+#define KATHERINE_HIT_TOA          (1u << 0) ///< Times of arrival
+#define KATHERINE_HIT_FTOA         (1u << 1) ///< Fine times of arrival
+#define KATHERINE_HIT_HIT_COUNT    (1u << 2) ///< Hit counts
+#define KATHERINE_HIT_TOT          (1u << 3) ///< Times over threshold
+#define KATHERINE_HIT_EVENT_COUNT  (1u << 4) ///< Event counts
+#define KATHERINE_HIT_INTEGRAL_TOT (1u << 5) ///< Integral times over threshold
+#define KATHERINE_HIT_X            (1u << 6) ///< Columns
+#define KATHERINE_HIT_Y            (1u << 7) ///< Rows
+#define KATHERINE_HIT_ALL          0xFFu     ///< All columns a file has
+
+/**
+ * Header of a hit file, which describes the hits it holds.
+ */
+typedef struct katherine_hitfile_header {
+    char magic[8];         ///< KATHERINE_HITFILE_MAGIC
+    uint32_t byte_order;   ///< 0x01020304 as written by the writing host
+    uint32_t format;       ///< KATHERINE_HITFILE_FORMAT
+    uint32_t header_size;  ///< Size of this header, where the chunks begin
+    uint32_t columns;      ///< KATHERINE_HIT_* flags of the columns of the chunks
+    uint32_t chunk_size;   ///< Hits of a chunk, save for the last one
+    char acq_mode;         ///< katherine_acquisition_mode_t of the acquisition
+    bool fast_vco_enabled; ///< Whether the acquisition ran with the fast VCO
+    char timestamp_unit;   ///< katherine_timestamp_unit_t of the times of arrival
+    char reserved[9];
+} katherine_hitfile_header_t;
+
+/**
+ * Entry of the index of a hit file: where a chunk is, and the ranges of its hits.
+ */
+typedef struct katherine_hitfile_chunk {
+    uint64_t offset;  ///< File offset of the chunk
+    uint64_t min_toa; ///< Earliest time of arrival, zero without the column
+    uint64_t max_toa; ///< Latest time of arrival, zero without the column
+    uint32_t count;   ///< Hits of the chunk
+    uint8_t min_x;    ///< Bounding box of the coordinates
+    uint8_t max_x;
+    uint8_t min_y;
+    uint8_t max_y;
+} katherine_hitfile_chunk_t;
+
+/**
+ * Trailer of a hit file, which ends the file.
+ */
+typedef struct katherine_hitfile_trailer {
+    uint64_t index_offset; ///< File offset of the index, just past the last chunk
+    uint64_t chunks;       ///< Entries of the index
+    uint64_t hits;         ///< Hits of the file
+    char magic[8];         ///< KATHERINE_HITFILE_TRAILER_MAGIC
+} katherine_hitfile_trailer_t;
+
+/**
+ * Hits looked for in a hit file: those within all of the ranges, each inclusive.
+ *
+ * The range of the times of arrival is ignored in a file without them.
+ */
+typedef struct katherine_hitfile_query {
+    uint64_t min_toa;
+    uint64_t max_toa;
+    uint8_t min_x;
+    uint8_t max_x;
+    uint8_t min_y;
+    uint8_t max_y;
+} katherine_hitfile_query_t;
+
+/**
+ * Writer of a hit file.
+ */
+typedef struct katherine_hitfile_writer {
+    FILE *file;
+    katherine_hitfile_header_t header;
+
+    char *buffer;                 ///< Columns of the chunk being filled
+    katherine_px_columns_t chunk; ///< Columns carved out of the buffer, with the hits of the chunk so far
+
+    katherine_hitfile_chunk_t *chunks; ///< Index of the chunks written
+    size_t chunk_count;                ///< Entries of the index
+    size_t chunk_capacity;             ///< Entries the index has room for
+
+    uint64_t offset; ///< File offset of the next chunk
+    uint64_t hits;   ///< Hits written
+} katherine_hitfile_writer_t;
+
+/**
+ * Hit file open for reading.
+ */
+typedef struct katherine_hitfile {
+    FILE *file;
+    katherine_hitfile_header_t header;
+
+    katherine_hitfile_chunk_t *chunks; ///< Index of the chunks
+    size_t chunk_count;                ///< Entries of the index
+    uint64_t hits;                     ///< Hits of the file
+
+    char *buffer;                   ///< Columns of the chunk read last
+    katherine_px_columns_t columns; ///< Columns carved out of the buffer
+    uint64_t bytes_read;            ///< Bytes of the columns read from the file so far
+} katherine_hitfile_t;
+
+/**
+ * Handler of the hits of a chunk found by katherine_hitfile_query(), valid for the duration of the call.
+ */
+typedef void (*katherine_hitfile_handler_t)(void *ctx, const katherine_px_columns_t *hits);
+
+KATHERINE_EXPORTED int
+katherine_hitfile_create(katherine_hitfile_writer_t *writer, const char *file_path, katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled, katherine_timestamp_unit_t timestamp_unit, size_t chunk_size);
+
+KATHERINE_EXPORTED int
+katherine_hitfile_write(katherine_hitfile_writer_t *writer, const katherine_px_columns_t *hits);
+
+KATHERINE_EXPORTED int
+katherine_hitfile_finish(katherine_hitfile_writer_t *writer);
+
+KATHERINE_EXPORTED int
+katherine_hitfile_open(katherine_hitfile_t *file, const char *file_path);
+
+KATHERINE_EXPORTED void
+katherine_hitfile_query_all(katherine_hitfile_query_t *query);
+
+KATHERINE_EXPORTED bool
+katherine_hitfile_chunk_matches(const katherine_hitfile_t *file, size_t chunk, const katherine_hitfile_query_t *query);
+
+KATHERINE_EXPORTED int
+katherine_hitfile_read_chunk(katherine_hitfile_t *file, size_t chunk, unsigned columns);
+
+KATHERINE_EXPORTED int
+katherine_hitfile_query(katherine_hitfile_t *file, const katherine_hitfile_query_t *query, unsigned columns, katherine_hitfile_handler_t handler, void *ctx);
+
+KATHERINE_EXPORTED void
+katherine_hitfile_close(katherine_hitfile_t *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
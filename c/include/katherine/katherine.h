@@ -20,7 +20,13 @@
 #include <katherine/version.h>
 #include <katherine/global.h>
 #include <katherine/acquisition.h>
+#include <katherine/codec.h>
+#include <katherine/hitfile.h>
 #include <katherine/px_config.h>
+#include <katherine/px_filter.h>
+#include <katherine/recording.h>
+#include <katherine/replay.h>
+#include <katherine/sink.h>
 #include <katherine/config.h>
 #include <katherine/device.h>
 #include <katherine/status.h>
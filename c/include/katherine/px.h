@@ -12,6 +12,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -67,6 +68,100 @@ typedef struct katherine_px_event_itot {
     uint16_t integral_tot;
 } katherine_px_event_itot_t;
 
+/*
+ * Packed records of the modes with a ToA (see katherine_acquisition_set_px_layout()). The records
+ * above spend 3 bytes on the fields in front of the 64-bit ToA and are padded around it to 16 or 24
+ * bytes; these put the ToA first and pack the rest behind it. The 12-byte ones split the ToA into its
+ * low 32 and high 16 bits, which hold a ToA in ToA ticks (KATHERINE_TIMESTAMP_TOA) only: the coarse
+ * ToA counts 14 bits and the offset 32 more. The fine unit needs 4 bits more, and is refused with
+ * this layout. KATHERINE_PX_TOA48() puts the halves back together. Reserved bytes are zero.
+ */
+
+typedef struct katherine_px_f_toa_tot_p16 {
+    uint64_t toa;
+    katherine_coord_t coord;
+    uint16_t tot;
+    uint8_t ftoa;
+    uint8_t reserved[3];
+} katherine_px_f_toa_tot_p16_t;
+
+typedef struct katherine_px_f_toa_tot_p12 {
+    uint32_t toa_lo;
+    uint16_t toa_hi;
+    katherine_coord_t coord;
+    uint16_t tot;
+    uint8_t ftoa;
+    uint8_t reserved[1];
+} katherine_px_f_toa_tot_p12_t;
+
+typedef struct katherine_px_toa_tot_p16 {
+    uint64_t toa;
+    katherine_coord_t coord;
+    uint16_t tot;
+    uint8_t hit_count;
+    uint8_t reserved[3];
+} katherine_px_toa_tot_p16_t;
+
+typedef struct katherine_px_toa_tot_p12 {
+    uint32_t toa_lo;
+    uint16_t toa_hi;
+    katherine_coord_t coord;
+    uint16_t tot;
+    uint8_t hit_count;
+    uint8_t reserved[1];
+} katherine_px_toa_tot_p12_t;
+
+typedef struct katherine_px_f_toa_only_p16 {
+    uint64_t toa;
+    katherine_coord_t coord;
+    uint8_t ftoa;
+    uint8_t reserved[5];
+} katherine_px_f_toa_only_p16_t;
+
+typedef struct katherine_px_f_toa_only_p12 {
+    uint32_t toa_lo;
+    uint16_t toa_hi;
+    katherine_coord_t coord;
+    uint8_t ftoa;
+    uint8_t reserved[3];
+} katherine_px_f_toa_only_p12_t;
+
+typedef struct katherine_px_toa_only_p16 {
+    uint64_t toa;
+    katherine_coord_t coord;
+    uint8_t hit_count;
+    uint8_t reserved[5];
+} katherine_px_toa_only_p16_t;
+
+typedef struct katherine_px_toa_only_p12 {
+    uint32_t toa_lo;
+    uint16_t toa_hi;
+    katherine_coord_t coord;
+    uint8_t hit_count;
+    uint8_t reserved[3];
+} katherine_px_toa_only_p12_t;
+
+/** ToA of a 12-byte packed record. */
+#define KATHERINE_PX_TOA48(px) (((uint64_t) (px)->toa_hi << 32) | (uint64_t) (px)->toa_lo)
+
+/**
+ * Pixels of the columnar layout (see katherine_acquisition_set_px_layout()), one array per field.
+ *
+ * Element i of every array belongs to the i-th pixel. Only the fields of the pixel type of the
+ * acquisition mode are delivered; the arrays of the others are NULL.
+ */
+typedef struct katherine_px_columns {
+    size_t count;           ///< Number of pixels, i.e. of elements of every array
+    uint8_t *x;             ///< Column coordinates
+    uint8_t *y;             ///< Row coordinates
+    uint64_t *toa;          ///< Times of arrival
+    uint8_t *ftoa;          ///< Fine times of arrival
+    uint8_t *hit_count;     ///< Hit counts
+    uint16_t *tot;          ///< Times over threshold
+    uint16_t *event_count;  ///< Event counts
+    uint16_t *integral_tot; ///< Integral times over threshold
+} katherine_px_columns_t;
+
 #ifdef __cplusplus
 }
 #endif
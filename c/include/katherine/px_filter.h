@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @brief Functions related to filtering decoded pixels by their coordinates.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <katherine/global.h>
+#include <katherine/px.h>
+#include <katherine/px_config.h>
+
+/**
+ * @addtogroup c_api
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Words of a pixel filter, one bit per pixel of the matrix. */
+#define KATHERINE_PX_FILTER_WORDS 1024
+
+/**
+ * Pixels of the matrix which the decoder passes on (see katherine_acquisition_set_px_filter()).
+ *
+ * The pixel at (x, y) passes if bit (y * 256 + x) % 64 of word (y * 256 + x) / 64 is set.
+ */
+typedef struct katherine_px_filter {
+    uint64_t words[KATHERINE_PX_FILTER_WORDS];
+} katherine_px_filter_t;
+
+KATHERINE_EXPORTED void
+katherine_px_filter_fill(katherine_px_filter_t *filter, bool passed);
+
+KATHERINE_EXPORTED void
+katherine_px_filter_set(katherine_px_filter_t *filter, katherine_coord_t coord, bool passed);
+
+KATHERINE_EXPORTED bool
+katherine_px_filter_get(const katherine_px_filter_t *filter, katherine_coord_t coord);
+
+KATHERINE_EXPORTED void
+katherine_px_filter_set_rect(katherine_px_filter_t *filter, katherine_coord_t from, katherine_coord_t to, bool passed);
+
+KATHERINE_EXPORTED void
+katherine_px_filter_load_mask(katherine_px_filter_t *filter, const katherine_px_config_t *px_config);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
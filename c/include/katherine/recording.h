@@ -0,0 +1,161 @@
+/**
+ * @file
+ * @brief Functions related to recordings of raw measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <katherine/global.h>
+#include <katherine/acquisition.h>
+#include <katherine/config.h>
+
+/**
+ * @addtogroup c_api
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A recording is a file of three parts:
+ *
+ *  1. the header (katherine_recording_header_t),
+ *  2. the records, one per datagram of measurement data in the order they were received: its
+ *     length in bytes as a 32-bit integer, and the datagram itself, and
+ *  3. the index, one katherine_recording_frame_t per frame, followed by the trailer
+ *     (katherine_recording_trailer_t), which ends the file.
+ *
+ * All integers are in the byte order of the host which recorded the file, which the magic of the
+ * header tells. A reader finds the index from the trailer, and a frame from the index, without
+ * reading any of the records before it.
+ */
+
+/** Magic of the header of a recording. */
+#define KATHERINE_RECORDING_MAGIC "KATHREC"
+
+/** Magic of the trailer of a recording. */
+#define KATHERINE_RECORDING_TRAILER_MAGIC "KATHIDX"
+
+/** Version of the recording format written by this library. */
+#define KATHERINE_RECORDING_FORMAT 1
+
+/**
+ * Header of a recording, which describes the acquisition it was recorded from.
+ */
+typedef struct katherine_recording_header {
+    char magic[8];                   ///< KATHERINE_RECORDING_MAGIC
+    uint32_t byte_order;             ///< 0x01020304 as written by the recording host
+    uint32_t format;                 ///< KATHERINE_RECORDING_FORMAT
+    uint32_t header_size;            ///< Size of this header, where the records begin
+    uint32_t config_size;            ///< Size of the configuration below
+    uint64_t library_version;        ///< katherine_version() of the recording library
+    char library_version_string[32]; ///< katherine_version_string() of the recording library
+    char readout_mode;               ///< READOUT_* of the acquisition
+    char acq_mode;                   ///< katherine_acquisition_mode_t of the acquisition
+    bool fast_vco_enabled;           ///< Whether the acquisition ran with the fast VCO
+    char reserved[5];
+    katherine_config_t config; ///< Configuration of the acquisition, as passed to katherine_acquisition_begin()
+} katherine_recording_header_t;
+
+/**
+ * Entry of the index of a recording: where a frame is, and what the device told of it.
+ */
+typedef struct katherine_recording_frame {
+    uint64_t start_offset;                  ///< File offset of the record holding the new frame datum
+    uint64_t end_offset;                    ///< File offset just past the record holding the frame finished datum, or the last record if the frame did not finish
+    katherine_frame_info_time_t start_time; ///< Timestamp of frame start reported by the device
+    katherine_frame_info_time_t end_time;   ///< Timestamp of frame end reported by the device
+    uint64_t sent_pixels;                   ///< The number of hit pixels reported sent by the device
+    uint32_t completed;                     ///< Nonzero if the frame finished
+    uint32_t reserved;
+} katherine_recording_frame_t;
+
+/**
+ * Trailer of a recording, which ends the file.
+ */
+typedef struct katherine_recording_trailer {
+    uint64_t index_offset; ///< File offset of the index, just past the last record
+    uint64_t frames;       ///< Entries of the index
+    uint64_t datagrams;    ///< Records of the file
+    char magic[8];         ///< KATHERINE_RECORDING_TRAILER_MAGIC
+} katherine_recording_trailer_t;
+
+/**
+ * Counters of a recorder (see katherine_recorder_get_stats()).
+ */
+typedef struct katherine_recorder_stats {
+    uint64_t datagrams; ///< Datagrams written to the file
+    uint64_t bytes;     ///< Bytes written to the file
+    uint64_t frames;    ///< Frames indexed
+    uint64_t stalls;    ///< Times the recording thread waited for room in the buffer
+} katherine_recorder_stats_t;
+
+struct katherine_recorder_writer;
+
+/**
+ * Recorder of raw measurement data, which writes a recording from a background thread.
+ */
+typedef struct katherine_recorder {
+    struct katherine_recorder_writer *writer; ///< Internal state, NULL unless open
+} katherine_recorder_t;
+
+/**
+ * Recording open for reading.
+ */
+typedef struct katherine_recording {
+    FILE *file;
+    katherine_recording_header_t header;
+
+    katherine_recording_frame_t *frames; ///< Index of the frames
+    size_t frame_count;                  ///< Entries of the index
+    uint64_t datagrams;                  ///< Records of the file
+
+    uint64_t index_offset; ///< File offset just past the last record
+    uint64_t position;     ///< File offset of the next record read
+} katherine_recording_t;
+
+KATHERINE_EXPORTED int
+katherine_recorder_open(katherine_recorder_t *recorder, const char *file_path, const katherine_config_t *config, char readout_mode, katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled, size_t buffer_size);
+
+KATHERINE_EXPORTED int
+katherine_recorder_write(katherine_recorder_t *recorder, const char *data, size_t length);
+
+KATHERINE_EXPORTED void
+katherine_recorder_get_stats(const katherine_recorder_t *recorder, katherine_recorder_stats_t *stats);
+
+KATHERINE_EXPORTED int
+katherine_recorder_close(katherine_recorder_t *recorder);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_recorder(katherine_acquisition_t *acq, katherine_recorder_t *recorder);
+
+KATHERINE_EXPORTED int
+katherine_recording_open(katherine_recording_t *recording, const char *file_path);
+
+KATHERINE_EXPORTED int
+katherine_recording_seek_frame(katherine_recording_t *recording, size_t frame);
+
+KATHERINE_EXPORTED int
+katherine_recording_next(katherine_recording_t *recording, char *buffer, size_t buffer_size, size_t *length);
+
+KATHERINE_EXPORTED void
+katherine_recording_close(katherine_recording_t *recording);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
@@ -0,0 +1,83 @@
+/**
+ * @file
+ * @brief Functions related to the offline replay of measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/global.h>
+#include <katherine/acquisition.h>
+#include <katherine/recording.h>
+
+/**
+ * @addtogroup c_api
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Kinds of sources of measurement data to replay.
+ */
+typedef enum katherine_replay_kind {
+    KATHERINE_REPLAY_MEMORY    = 0, ///< A raw stream in memory, cut into datagrams of a fixed size
+    KATHERINE_REPLAY_RECORDS   = 1, ///< The records of a recording mapped to memory
+    KATHERINE_REPLAY_RECORDING = 2, ///< The records of a recording open for reading, from its position on
+} katherine_replay_kind_t;
+
+/**
+ * Source of measurement data replayed by katherine_acquisition_replay().
+ *
+ * Initialized by one of the katherine_replay_source_*() functions, which tell the mode of the
+ * acquisition the data were measured in, so that they are decoded as they were.
+ */
+typedef struct katherine_replay_source {
+    char kind; ///< katherine_replay_kind_t of the source
+
+    char readout_mode;                     ///< READOUT_* of the acquisition replayed
+    katherine_acquisition_mode_t acq_mode; ///< Mode of the acquisition replayed
+    bool fast_vco_enabled;                 ///< Whether the acquisition replayed ran with the fast VCO
+
+    const char *data;     ///< Stream or records in memory
+    size_t length;        ///< Bytes of the stream or records
+    size_t position;      ///< Offset of the next datagram in the data
+    size_t datagram_size; ///< Bytes of the datagrams the stream is cut into
+
+    katherine_recording_t *recording; ///< Recording read, not owned by the source
+
+    void *mapping;       ///< Mapping of a recording file, NULL unless mapped
+    size_t mapping_size; ///< Bytes of the mapping
+} katherine_replay_source_t;
+
+KATHERINE_EXPORTED int
+katherine_replay_source_memory(katherine_replay_source_t *source, const void *data, size_t length, size_t datagram_size, katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled);
+
+KATHERINE_EXPORTED int
+katherine_replay_source_recording(katherine_replay_source_t *source, katherine_recording_t *recording);
+
+KATHERINE_EXPORTED int
+katherine_replay_source_map(katherine_replay_source_t *source, const char *file_path, size_t first_frame, size_t frame_count);
+
+KATHERINE_EXPORTED void
+katherine_replay_source_unmap(katherine_replay_source_t *source);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_replay(katherine_acquisition_t *acq, katherine_replay_source_t *source);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
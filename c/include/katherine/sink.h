@@ -0,0 +1,152 @@
+/**
+ * @file
+ * @brief Functions related to the asynchronous writing of acquired data to files.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/global.h>
+#include <katherine/acquisition.h>
+
+/**
+ * @addtogroup c_api
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A file of a raw sink holds the datagrams of measurement data, back to back. A file of a pixel sink
+ * attached to an acquisition holds:
+ *
+ *  1. the pixel records, back to back, as the pixels_received handler receives them, padded to
+ *     8 bytes,
+ *  2. the index, one katherine_sink_frame_t per frame which ended, telling its records, and
+ *  3. the trailer (katherine_sink_trailer_t), which ends the file and describes the records.
+ *
+ * All integers are in the byte order of the host which wrote the file. The records are not copied
+ * to be read: a reader maps the file and takes them where they are.
+ */
+
+/** Magic of the trailer of the file of a pixel sink. */
+#define KATHERINE_SINK_TRAILER_MAGIC "KATHPXT"
+
+/** Alignment of the buffers of a sink, and of their sizes, which suits direct I/O. */
+#define KATHERINE_SINK_ALIGNMENT 4096
+
+/** Bytes of a buffer of a sink, unless told otherwise. */
+#define KATHERINE_SINK_DEFAULT_BUFFER_SIZE (1 << 20)
+
+/**
+ * What a sink attached to an acquisition writes.
+ */
+typedef enum katherine_sink_content {
+    KATHERINE_SINK_PIXELS = 0, ///< The pixel records passed to the pixels_received handler, back to back
+    KATHERINE_SINK_RAW    = 1, ///< The datagrams of measurement data received, back to back
+} katherine_sink_content_t;
+
+/**
+ * Ways of a sink to write its buffers.
+ */
+typedef enum katherine_sink_backend {
+    KATHERINE_SINK_AUTO     = 0, ///< io_uring where the kernel offers it, the writer thread elsewhere
+    KATHERINE_SINK_IO_URING = 1, ///< Writes submitted to an io_uring of the sink, Linux only
+    KATHERINE_SINK_THREAD   = 2, ///< Writes issued by a thread of the sink
+} katherine_sink_backend_t;
+
+/**
+ * Parameters of a sink (see katherine_sink_open()).
+ */
+typedef struct katherine_sink_params {
+    size_t buffer_size; ///< Bytes of a buffer, rounded up to KATHERINE_SINK_ALIGNMENT; zero for KATHERINE_SINK_DEFAULT_BUFFER_SIZE
+    size_t buffers;     ///< Buffers, at least two, and the most writes in flight but one; zero for two
+    bool direct;        ///< Whether to open the file for direct I/O, past the page cache
+    char backend;       ///< katherine_sink_backend_t to write with
+} katherine_sink_params_t;
+
+/**
+ * Counters of a sink (see katherine_sink_get_stats()).
+ */
+typedef struct katherine_sink_stats {
+    uint64_t bytes;           ///< Bytes written to the file
+    uint64_t writes;          ///< Writes completed
+    uint64_t stalls;          ///< Times the writing thread waited for a buffer to be written
+    uint64_t queue_depth;     ///< Writes in flight
+    uint64_t max_queue_depth; ///< Most writes in flight at once
+    uint64_t elapsed_ns;      ///< Time since the sink was opened
+    double throughput;        ///< Bytes written per second since the sink was opened
+    char backend;             ///< katherine_sink_backend_t the sink writes with
+} katherine_sink_stats_t;
+
+/**
+ * Entry of the index of the file of a pixel sink: the records of a frame, and what the device told of it.
+ */
+typedef struct katherine_sink_frame {
+    uint64_t first_pixel;                   ///< Index of the first record of the frame
+    uint64_t pixels;                        ///< Records of the frame
+    katherine_frame_info_time_t start_time; ///< Timestamp of frame start reported by the device
+    katherine_frame_info_time_t end_time;   ///< Timestamp of frame end reported by the device
+    uint64_t sent_pixels;                   ///< The number of hit pixels reported sent by the device
+    uint32_t completed;                     ///< Nonzero if the frame finished
+    uint32_t reserved;
+} katherine_sink_frame_t;
+
+/**
+ * Trailer of the file of a pixel sink, which ends the file.
+ */
+typedef struct katherine_sink_trailer {
+    uint64_t index_offset; ///< File offset of the index, just past the padded records
+    uint64_t pixels;       ///< Records of the file
+    uint64_t frames;       ///< Entries of the index
+    uint32_t record_size;  ///< Bytes of a record, zero if no acquisition has described them
+    uint32_t byte_order;   ///< 0x01020304 as written by the writing host
+    char acq_mode;         ///< katherine_acquisition_mode_t of the acquisition
+    bool fast_vco_enabled; ///< Whether the acquisition ran with the fast VCO
+    char px_layout;        ///< katherine_px_layout_t of the records
+    char timestamp_unit;   ///< katherine_timestamp_unit_t of their times of arrival
+    char reserved[4];
+    char magic[8];         ///< KATHERINE_SINK_TRAILER_MAGIC
+} katherine_sink_trailer_t;
+
+struct katherine_sink_writer;
+
+/**
+ * Sink which writes the data of an acquisition to a file without blocking the read on the storage.
+ */
+typedef struct katherine_sink {
+    struct katherine_sink_writer *writer; ///< Internal state, NULL unless open
+    char content;                         ///< katherine_sink_content_t of the file
+} katherine_sink_t;
+
+KATHERINE_EXPORTED int
+katherine_sink_open(katherine_sink_t *sink, const char *file_path, katherine_sink_content_t content, const katherine_sink_params_t *params);
+
+KATHERINE_EXPORTED int
+katherine_sink_write(katherine_sink_t *sink, const void *data, size_t length);
+
+KATHERINE_EXPORTED void
+katherine_sink_get_stats(const katherine_sink_t *sink, katherine_sink_stats_t *stats);
+
+KATHERINE_EXPORTED int
+katherine_sink_close(katherine_sink_t *sink);
+
+KATHERINE_EXPORTED int
+katherine_acquisition_set_sink(katherine_acquisition_t *acq, katherine_sink_t *sink);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
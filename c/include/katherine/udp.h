@@ -32,6 +32,28 @@
  * 100 ms timeout for as long as it kept sending. */
 #define KATHERINE_UDP_PIN_MAX_DISCARDS 32
 
+/* Datagrams one call of katherine_udp_recv_batch() receives, at most. A
+ * larger batch is cut to this size, which bounds the per-call bookkeeping
+ * the receive keeps on the stack. */
+#define KATHERINE_UDP_BATCH_MAX        64
+
+/**
+ * Tuning of the socket of a UDP session (see katherine_udp_tune()).
+ *
+ * Zero leaves an option as it is, except for incoming_cpu, which -1 leaves. The options are Linux
+ * ones; elsewhere, only the receive buffer and the timeout are tuned.
+ */
+typedef struct katherine_udp_tuning {
+    size_t rcvbuf;         ///< Receive buffer in bytes (SO_RCVBUFFORCE, or SO_RCVBUF up to the limit of the system)
+    uint32_t busy_poll_us; ///< Time (us) a receive busy polls the device queue before it sleeps (SO_BUSY_POLL)
+    bool timestamps;       ///< Have the kernel timestamp every datagram received (SO_TIMESTAMPNS)
+    int incoming_cpu;      ///< CPU whose receive queue the socket is to be served by (SO_INCOMING_CPU)
+    uint32_t timeout_ms;   ///< Receive timeout in milliseconds
+} katherine_udp_tuning_t;
+
+/** Tuning which leaves every option as it is. */
+#define KATHERINE_UDP_TUNING_INIT {0, 0, false, -1, 0}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,12 +76,27 @@ katherine_udp_recv_exact(katherine_udp_t *u, void *data, size_t count);
 KATHERINE_EXPORTED int
 katherine_udp_recv(katherine_udp_t *u, void *data, size_t *count);
 
+KATHERINE_EXPORTED int
+katherine_udp_recv_batch(katherine_udp_t *u, void *const *data, size_t size, size_t *received, size_t *count);
+
 KATHERINE_EXPORTED int
 katherine_udp_set_remote(katherine_udp_t *u, const char *remote_addr, uint16_t remote_port);
 
 KATHERINE_EXPORTED void
 katherine_udp_pin_remote(katherine_udp_t *u);
 
+KATHERINE_EXPORTED int
+katherine_udp_set_blocking(katherine_udp_t *u, bool blocking);
+
+KATHERINE_EXPORTED int
+katherine_udp_tune(katherine_udp_t *u, const katherine_udp_tuning_t *requested, katherine_udp_tuning_t *granted);
+
+KATHERINE_EXPORTED int
+katherine_udp_track_drops(katherine_udp_t *u);
+
+KATHERINE_EXPORTED uint64_t
+katherine_udp_dropped(const katherine_udp_t *u);
+
 KATHERINE_EXPORTED int
 katherine_udp_mutex_lock(katherine_udp_t *u);
 
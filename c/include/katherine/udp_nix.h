@@ -24,19 +24,29 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef int katherine_socket_t;
+
 typedef struct katherine_udp {
-    int sock;
+    katherine_socket_t sock;
     struct sockaddr_in addr_local;
     struct sockaddr_in addr_remote;
 
     pthread_mutex_t mutex;
 
     bool remote_pinned;
+
+    bool track_drops;    ///< Set by katherine_udp_track_drops()
+    uint32_t drops_seen; ///< Last value of the drop counter of the socket received
+    uint64_t dropped;    ///< Datagrams dropped by the socket, as far as noticed
+
+    bool timestamps;     ///< Set by katherine_udp_tune()
+    uint64_t rx_time_ns; ///< Kernel receive time (ns since the epoch) of the last datagram of the last batch, if timestamped
 } katherine_udp_t;
 
 #ifdef __cplusplus
@@ -30,8 +30,10 @@
 extern "C" {
 #endif
 
+typedef SOCKET katherine_socket_t;
+
 typedef struct katherine_udp {
-    SOCKET sock;
+    katherine_socket_t sock;
     SOCKADDR_IN addr_local;
     SOCKADDR_IN addr_remote;
 
@@ -15,18 +15,166 @@
 #include <string.h>
 #include <katherine/global.h>
 #include <katherine/acquisition.h>
+#include <katherine/recording.h>
+#include <katherine/sink.h>
+#include "clock.h"
+#include "cluster.h"
 #include "command_interface.h"
+#include "decode_pool.h"
 #include "md.h"
+#include "md_pool.h"
+#include "md_simd.h"
+#include "alloc.h"
+#include "pipeline.h"
+#include "realtime.h"
+#include "reorder.h"
+#include "replay.h"
+#include "sink.h"
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 
+/* Wall-clock time of when the datagrams being handled were received, told
+   from the monotonic clock the read loop samples anyway. */
+static inline time_t
+observed_time(const katherine_acquisition_t *acq)
+{
+    return acq->acq_start_time + (time_t) ((acq->last_received_ns - acq->acq_start_time_ns) / 1000000000ull);
+}
+
+/* Notes that a batch of datagrams was received at the given time, before
+   handling it, and how long the running frame, if any, waited for it. */
 static inline void
-flush_buffer(katherine_acquisition_t *acq)
+mark_received(katherine_acquisition_t *acq, uint64_t now)
 {
-    if (acq->handlers.pixels_received != NULL) {
-        acq->handlers.pixels_received(acq->user_ctx, acq->pixel_buffer, acq->pixel_buffer_valid);
+    const uint64_t gap = now - acq->last_received_ns;
+
+    if (acq->frame_active && gap > acq->current_frame_info.max_receive_gap_ns) {
+        acq->current_frame_info.max_receive_gap_ns = gap;
+    }
+    acq->last_received_ns = now;
+}
+
+/* Adds to a performance counter. The read is the only writer of the
+   counters, so it may read them plainly; the atomic store is for a snapshot
+   taken by another thread, which must see whole values. */
+static inline void
+count_stat(uint64_t *counter, uint64_t n)
+{
+    katherine_atomic_store(counter, *counter + n);
+}
+
+/* Counts the datagrams the host has dropped since the last look, to the
+   acquisition and to the running frame, if any. A drop is only noticed with
+   the datagrams received after it, so it goes to the frame they belong to.
+   A replay has no socket to drop any. */
+static inline void
+count_host_drops(katherine_acquisition_t *acq)
+{
+    if (acq->replaying) {
+        return;
+    }
+
+    const uint64_t dropped = katherine_udp_dropped(&acq->device->data_socket);
+
+    if (dropped != acq->host_drops_seen) {
+        count_stat(&acq->stats.host_dropped_datagrams, dropped - acq->host_drops_seen);
+        if (acq->frame_active) {
+            acq->current_frame_info.host_dropped_datagrams += dropped - acq->host_drops_seen;
+        }
+        acq->host_drops_seen = dropped;
+    }
+}
+
+/* Notes a batch of datagrams about to be handled in the counters. */
+static inline void
+count_received(katherine_acquisition_t *acq, const size_t *lengths, size_t count)
+{
+    uint64_t bytes = 0;
+    uint64_t max   = acq->stats.max_datagram_size;
+
+    for (size_t s = 0; s < count; ++s) {
+        bytes += lengths[s];
+        if (lengths[s] > max) max = lengths[s];
+    }
+
+    count_stat(&acq->stats.datagrams, count);
+    count_stat(&acq->stats.bytes, bytes);
+    if (max != acq->stats.max_datagram_size) {
+        katherine_atomic_store(&acq->stats.max_datagram_size, max);
+    }
+
+    count_host_drops(acq);
+}
+
+/* Hands a batch of datagrams about to be handled to the recorder and the
+   raw sink, if any. Either keeps an error, and reports it when closed. */
+static inline void
+record_datagrams(katherine_acquisition_t *acq, const char *const *data, const size_t *lengths, size_t count)
+{
+    if (acq->recorder != NULL) {
+        for (size_t s = 0; s < count; ++s) {
+            (void) katherine_recorder_write(acq->recorder, data[s], lengths[s]);
+        }
+    }
+
+    if (acq->sink != NULL && acq->sink->content == KATHERINE_SINK_RAW) {
+        for (size_t s = 0; s < count; ++s) {
+            (void) katherine_sink_write(acq->sink, data[s], lengths[s]);
+        }
+    }
+}
+
+/* Hands pixel records about to be delivered to the pixel sink, if any. */
+static inline void
+sink_pixels(katherine_acquisition_t *acq, const void *px, size_t count)
+{
+    if (acq->sink != NULL && acq->sink->content == KATHERINE_SINK_PIXELS) {
+        (void) katherine_sink_write(acq->sink, px, count * acq->pixel_size);
+    }
+}
+
+/* Indexes the frame which has ended in the pixel sink, if any, once its pixels are delivered. */
+static inline void
+sink_frame_ended(katherine_acquisition_t *acq)
+{
+    if (acq->sink != NULL && acq->sink->content == KATHERINE_SINK_PIXELS && acq->pixel_size > 0) {
+        (void) katherine_sink_end_frame(acq->sink, &acq->current_frame_info);
+    }
+}
+
+/* Runs a handler, which must be set, and counts the time spent in it. */
+#define RUN_HANDLER(acq, NAME, ...) \
+    do { \
+        const uint64_t called_ = katherine_clock_ns(); \
+        (acq)->handlers.NAME((acq)->user_ctx, __VA_ARGS__); \
+        count_stat(&(acq)->stats.callback_ns, katherine_clock_ns() - called_); \
+    } while (0)
+
+/* Delivers the pixel buffer, counting the delivery under the given cause
+   (one of the flushes_* counters). */
+static inline void
+flush_buffer(katherine_acquisition_t *acq, uint64_t *cause)
+{
+    if (acq->px_layout == KATHERINE_PX_LAYOUT_COLUMNS) {
+        if (acq->handlers.pixel_columns_received != NULL) {
+            acq->px_columns.count = acq->pixel_buffer_valid;
+            RUN_HANDLER(acq, pixel_columns_received, &acq->px_columns);
+        }
+    } else if (katherine_reorder_active(acq->reorder)) {
+        katherine_reorder_push(acq->reorder, acq->pixel_buffer, acq->pixel_buffer_valid);
+    } else {
+        sink_pixels(acq, acq->pixel_buffer, acq->pixel_buffer_valid);
+        if (acq->handlers.pixels_received != NULL) {
+            RUN_HANDLER(acq, pixels_received, acq->pixel_buffer, acq->pixel_buffer_valid);
+        }
+    }
+
+    if (acq->clusterer != NULL) {
+        katherine_clusterer_deliver(acq->clusterer);
     }
 
+    count_stat(cause, 1);
+
     acq->current_frame_info.received_pixels += acq->pixel_buffer_valid;
     acq->pixel_buffer_valid = 0;
 }
@@ -35,39 +183,84 @@ static inline void
 handle_new_frame(katherine_acquisition_t *acq, const uint64_t *data)
 {
     memset(&acq->current_frame_info, 0, sizeof(katherine_frame_info_t));
-    acq->current_frame_info.start_time_observed = time(NULL);
-    acq->current_frame_info.completed           = false;
-    acq->frame_active                           = true;
+    acq->current_frame_info.start_time_observed    = observed_time(acq);
+    acq->current_frame_info.start_time_observed_ns = acq->last_received_ns - acq->acq_start_time_ns;
+    acq->current_frame_info.completed              = false;
+    acq->frame_active                              = true;
 
     // The coarse time of arrival restarts with the frame, so the offset the
     // previous frame delivered no longer applies: the hits arriving before
     // the first offset of this frame belong to its first window.
-    acq->last_toa_offset = 0;
+    acq->last_toa_offset  = 0;
+    acq->frame_toa_offset = 0;
+
+    // The maps of the frame before last have been with the application for a
+    // whole frame by now, and take this one.
+    if (acq->frame_maps[0] != NULL) {
+        memset(acq->frame_maps[acq->frame_maps_current], 0, sizeof(katherine_frame_maps_t));
+    }
 
     if (acq->handlers.frame_started != NULL) {
-        acq->handlers.frame_started(acq->user_ctx, acq->completed_frames);
+        RUN_HANDLER(acq, frame_started, acq->completed_frames);
     }
 }
 
 static inline void
 handle_timestamp_offset_driven_mode(katherine_acquisition_t *acq, const uint64_t *data)
 {
-    acq->last_toa_offset = ((uint64_t) EXTRACT(*data, md_time_offset, offset) << 14);
+    acq->last_toa_offset = acq->frame_toa_offset + (((uint64_t) EXTRACT(*data, md_time_offset, offset) << 14) << acq->toa_shift);
+}
+
+/* Closes the clusters of the ending frame, whose time of arrival restarts
+   with the next one. They go out with the pixels flushed next. */
+static inline void
+close_clusters(katherine_acquisition_t *acq)
+{
+    if (acq->clusterer != NULL) {
+        katherine_clusterer_close_all(acq->clusterer);
+    }
+}
+
+/* Hands out the pixels the time ordering holds back at the end of a frame,
+   whose time of arrival restarts with the next one. */
+static inline void
+drain_reorder(katherine_acquisition_t *acq)
+{
+    if (katherine_reorder_active(acq->reorder)) {
+        katherine_reorder_flush(acq->reorder);
+        katherine_reorder_restart(acq->reorder);
+    }
+}
+
+/* Hands the maps of the ending frame over with its info, and turns to the
+   other ones for the next frame. */
+static inline void
+hand_over_frame_maps(katherine_acquisition_t *acq)
+{
+    if (acq->frame_maps[0] != NULL) {
+        acq->current_frame_info.maps = acq->frame_maps[acq->frame_maps_current];
+        acq->frame_maps_current ^= 1;
+    }
 }
 
 static inline void
 handle_current_frame_finished(katherine_acquisition_t *acq, const uint64_t *data)
 {
-    acq->current_frame_info.end_time_observed = time(NULL);
+    acq->current_frame_info.end_time_observed    = observed_time(acq);
+    acq->current_frame_info.end_time_observed_ns = acq->last_received_ns - acq->acq_start_time_ns;
 
-    flush_buffer(acq);
+    close_clusters(acq);
+    flush_buffer(acq, &acq->stats.flushes_frame_end);
+    drain_reorder(acq);
 
     acq->current_frame_info.sent_pixels = EXTRACT(*data, md_frame_finished, n_sent);
     acq->current_frame_info.completed   = true;
     acq->frame_active                   = false;
+    hand_over_frame_maps(acq);
+    sink_frame_ended(acq);
 
     if (acq->handlers.frame_ended != NULL) {
-        acq->handlers.frame_ended(acq->user_ctx, acq->completed_frames, true, &acq->current_frame_info);
+        RUN_HANDLER(acq, frame_ended, acq->completed_frames, true, &acq->current_frame_info);
     }
 
     ++acq->completed_frames;
@@ -80,29 +273,56 @@ handle_current_frame_finished(katherine_acquisition_t *acq, const uint64_t *data
 static inline void
 handle_acquisition_interrupted(katherine_acquisition_t *acq)
 {
-    acq->current_frame_info.end_time_observed = time(NULL);
+    acq->current_frame_info.end_time_observed    = observed_time(acq);
+    acq->current_frame_info.end_time_observed_ns = acq->last_received_ns - acq->acq_start_time_ns;
 
-    flush_buffer(acq);
+    close_clusters(acq);
+    flush_buffer(acq, &acq->stats.flushes_frame_end);
+    drain_reorder(acq);
 
     acq->frame_active = false;
+    hand_over_frame_maps(acq);
+    sink_frame_ended(acq);
 
     // The frame-finished MD did not arrive, so sent_pixels is unknown and
     // current_frame_info.completed remains false.
     if (acq->handlers.frame_ended != NULL) {
-        acq->handlers.frame_ended(acq->user_ctx, acq->completed_frames, false, &acq->current_frame_info);
+        RUN_HANDLER(acq, frame_ended, acq->completed_frames, false, &acq->current_frame_info);
+    }
+}
+
+/* Moves the time of arrival of the pixels of the running frame by where the
+   device reports the frame started, in the absolute timestamp unit. The start
+   counts ticks of the ToA clock, as the coarse ToA does, and arrives in two
+   halves, each of which moves the pixels decoded after it by the difference.
+   The data-driven readout has a single frame, whose ToA runs from the start
+   of the acquisition already. */
+static inline void
+update_frame_toa_offset(katherine_acquisition_t *acq)
+{
+    if (acq->timestamp_unit != KATHERINE_TIMESTAMP_FINE || acq->readout_mode == READOUT_DATA_DRIVEN) {
+        return;
     }
+
+    const katherine_frame_info_time_split_t *start = &acq->current_frame_info.start_time.b;
+    const uint64_t offset                          = (((uint64_t) start->msb << 32) | start->lsb) << acq->toa_shift;
+
+    acq->last_toa_offset += offset - acq->frame_toa_offset;
+    acq->frame_toa_offset = offset;
 }
 
 static inline void
 handle_frame_start_timestamp_lsb(katherine_acquisition_t *acq, const uint64_t *data)
 {
     acq->current_frame_info.start_time.b.lsb = EXTRACT(*data, md_time_lsb, lsb);
+    update_frame_toa_offset(acq);
 }
 
 static inline void
 handle_frame_start_timestamp_msb(katherine_acquisition_t *acq, const uint64_t *data)
 {
     acq->current_frame_info.start_time.b.msb = EXTRACT(*data, md_time_msb, msb);
+    update_frame_toa_offset(acq);
 }
 
 static inline void
@@ -143,6 +363,280 @@ handle_unknown_msg(katherine_acquisition_t *acq, const uint64_t *data)
     ++acq->dropped_measurement_data;
 }
 
+/* Nanoseconds since the beginning of the acquisition after which it is
+   declared timed out, or zero if it never is. */
+static inline uint64_t
+kill_off_time(const katherine_acquisition_t *acq)
+{
+    return acq->fail_timeout <= 0 ? 0 : (uint64_t) (1e9 * (acq->requested_frames * acq->requested_frame_duration + (double) acq->fail_timeout / 1000.0));
+}
+
+/* Splits the pixel buffer into the given columns (PMD_COLUMN_*, besides
+   the coordinates) of equal length and returns the length. The columns of
+   wider elements go first, so that each starts aligned for its type. */
+static size_t
+carve_columns(katherine_acquisition_t *acq, unsigned columns)
+{
+    katherine_px_columns_t *c = &acq->px_columns;
+    size_t pixel_size         = 2 * sizeof(uint8_t);
+    size_t count;
+    char *it;
+
+    if (columns & PMD_COLUMN_TOA) pixel_size += sizeof(uint64_t);
+    if (columns & PMD_COLUMN_TOT) pixel_size += sizeof(uint16_t);
+    if (columns & PMD_COLUMN_EVENT_COUNT) pixel_size += sizeof(uint16_t);
+    if (columns & PMD_COLUMN_INTEGRAL_TOT) pixel_size += sizeof(uint16_t);
+    if (columns & PMD_COLUMN_FTOA) pixel_size += sizeof(uint8_t);
+    if (columns & PMD_COLUMN_HIT_COUNT) pixel_size += sizeof(uint8_t);
+
+    count = acq->pixel_buffer_size / pixel_size;
+
+    memset(c, 0, sizeof(*c));
+    it = acq->pixel_buffer;
+
+#define CARVE(NAME, FLAG, TYPE) \
+    if (columns & (FLAG)) { \
+        c->NAME = (TYPE *) it; \
+        it += count * sizeof(TYPE); \
+    }
+
+    CARVE(toa, PMD_COLUMN_TOA, uint64_t);
+    CARVE(tot, PMD_COLUMN_TOT, uint16_t);
+    CARVE(event_count, PMD_COLUMN_EVENT_COUNT, uint16_t);
+    CARVE(integral_tot, PMD_COLUMN_INTEGRAL_TOT, uint16_t);
+
+    c->x = (uint8_t *) it;
+    it += count;
+    c->y = (uint8_t *) it;
+    it += count;
+
+    CARVE(ftoa, PMD_COLUMN_FTOA, uint8_t);
+    CARVE(hit_count, PMD_COLUMN_HIT_COUNT, uint8_t);
+
+#undef CARVE
+
+    return count;
+}
+
+/* Counts pixel MD's the filter drops, which are decoded all the same. */
+static inline void
+drop_pixels(katherine_acquisition_t *acq, size_t count)
+{
+    acq->current_frame_info.filtered_pixels += count;
+    count_stat(&acq->stats.md_by_header[0x4], count);
+}
+
+/* Offset of the time of arrival in the plain pixel records of the mode of
+   an acquisition, which must have one. */
+static inline size_t
+px_toa_offset(const katherine_acquisition_t *acq)
+{
+    if (acq->acq_mode == ACQUISITION_MODE_ONLY_TOA) {
+        return acq->fast_vco_enabled ? offsetof(katherine_px_f_toa_only_t, toa) : offsetof(katherine_px_toa_only_t, toa);
+    }
+    return acq->fast_vco_enabled ? offsetof(katherine_px_f_toa_tot_t, toa) : offsetof(katherine_px_toa_tot_t, toa);
+}
+
+/* Whether the time of arrival in the given unit fits the records of the
+   given layout. The 12-byte records hold 48 bits of it, which the coarse
+   ToA and its offset fill; fToA ticks are four bits more. */
+static inline bool
+timestamp_fits_layout(char unit, char layout)
+{
+    return unit != KATHERINE_TIMESTAMP_FINE || layout != KATHERINE_PX_LAYOUT_PACKED12;
+}
+
+/* Prepares the pixel buffer for records of the given size, or for the given
+   columns if the acquisition delivers them instead. */
+static inline int
+begin_decode(katherine_acquisition_t *acq, size_t pixel_size, unsigned columns)
+{
+    // Either setter may have been called first, or the fields set directly.
+    if (!timestamp_fits_layout(acq->timestamp_unit, acq->px_layout)) {
+        return EINVAL;
+    }
+
+    acq->last_received_ns   = katherine_clock_ns();
+    acq->pixel_buffer_valid = 0;
+    if (acq->px_layout == KATHERINE_PX_LAYOUT_COLUMNS) {
+        acq->pixel_buffer_max_valid = carve_columns(acq, columns);
+        acq->pixel_size             = 0;
+    } else {
+        acq->pixel_buffer_max_valid = acq->pixel_buffer_size / pixel_size;
+        acq->pixel_size             = pixel_size;
+    }
+
+    if (acq->sink != NULL && acq->sink->content == KATHERINE_SINK_PIXELS) {
+        katherine_sink_describe(acq->sink, acq);
+    }
+
+    if (acq->reorder != NULL) {
+        const bool ordered = acq->px_layout == KATHERINE_PX_LAYOUT_STRUCTS && (columns & PMD_COLUMN_TOA);
+        katherine_reorder_begin(acq->reorder, ordered ? pixel_size : 0, ordered ? px_toa_offset(acq) : 0);
+    }
+
+    // Pixels are decoded in chunks of the buffer, which must hold one at
+    // least for the decoder to make progress.
+    if (acq->decode_data && acq->pixel_buffer_max_valid == 0) {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/* Takes the data socket for the duration of a read, and prepares the pixel
+   buffer as begin_decode() does. */
+static inline int
+begin_read(katherine_acquisition_t *acq, size_t pixel_size, unsigned columns)
+{
+    if (katherine_udp_mutex_lock(&acq->device->data_socket) != 0) return 1;
+
+    int res = begin_decode(acq, pixel_size, columns);
+    if (res) {
+        (void) katherine_udp_mutex_unlock(&acq->device->data_socket);
+    }
+
+    return res;
+}
+
+/* Runs whenever the stream has been quiet for a receive timeout: flushes a
+   partial pixel buffer once the report timeout has passed, and ends the
+   acquisition when it has run out of time or was aborted. */
+static inline void
+handle_idle(katherine_acquisition_t *acq, uint64_t kill_off_time)
+{
+    const uint64_t now = katherine_clock_ns();
+
+    count_stat(&acq->stats.receive_timeouts, 1);
+
+    // The clusters still open after a report timeout of silence are as
+    // good as closed, and are reported with the pixels.
+    if (acq->report_timeout > 0 && now - acq->last_received_ns > (uint64_t) acq->report_timeout * 1000000ull) {
+        if (acq->clusterer != NULL) {
+            katherine_clusterer_close_all(acq->clusterer);
+            katherine_clusterer_deliver(acq->clusterer);
+        }
+        if (acq->pixel_buffer_valid > 0) {
+            flush_buffer(acq, &acq->stats.flushes_report_timeout);
+        }
+        if (katherine_reorder_active(acq->reorder)) {
+            katherine_reorder_flush(acq->reorder);
+        }
+    }
+
+    if (kill_off_time > 0 && now - acq->acq_start_time_ns > kill_off_time) {
+        acq->state = ACQUISITION_TIMED_OUT;
+    }
+
+    // An abort ends the acquisition as soon as the stream has dried up,
+    // whether or not the data are decoded. The flag is raised by
+    // katherine_acquisition_abort() and by the aborted measurement datum
+    // alike.
+    if (acq->aborted) {
+        acq->state = ACQUISITION_SUCCEEDED;
+    }
+}
+
+/* Translates the state of an acquisition to the result of its read. */
+static inline int
+read_result(const katherine_acquisition_t *acq)
+{
+    switch (acq->state) {
+    case ACQUISITION_SUCCEEDED: return 0;
+    case ACQUISITION_TIMED_OUT: return ETIMEDOUT;
+    default:                    return EAGAIN;
+    }
+}
+
+/* Delivers what the decoder left behind and translates the final state of
+   the acquisition to the result of the read. */
+static inline int
+end_decode(katherine_acquisition_t *acq)
+{
+    if (acq->frame_active) {
+        handle_acquisition_interrupted(acq);
+    } else if (acq->pixel_buffer_valid > 0) {
+        flush_buffer(acq, &acq->stats.flushes_frame_end);
+    }
+
+    drain_reorder(acq);
+
+    if (acq->clusterer != NULL) {
+        katherine_clusterer_close_all(acq->clusterer);
+        katherine_clusterer_deliver(acq->clusterer);
+    }
+
+    return read_result(acq);
+}
+
+/* As end_decode(), and releases the data socket. */
+static inline int
+end_read(katherine_acquisition_t *acq)
+{
+    int res = end_decode(acq);
+    (void) katherine_udp_mutex_unlock(&acq->device->data_socket);
+    return res;
+}
+
+/* Starts the decoding threads for a read of an acquisition which decodes
+   in parallel, and records the parallel decoder can produce. */
+static inline int
+begin_parallel_decode(katherine_acquisition_t *acq)
+{
+    if (acq->decode_pool == NULL || !acq->decode_data || acq->px_layout != KATHERINE_PX_LAYOUT_STRUCTS) {
+        return 0;
+    }
+
+    return katherine_decode_pool_start(acq->decode_pool, acq);
+}
+
+static inline void
+end_parallel_decode(katherine_acquisition_t *acq)
+{
+    if (acq->decode_pool != NULL && acq->decode_pool->running) {
+        katherine_decode_pool_stop(acq->decode_pool);
+    }
+}
+
+/* Starts a step-wise read: as begin_read(), and the data socket stops
+   blocking, so that a pump returns as soon as it has drained it. */
+static inline int
+begin_pump(katherine_acquisition_t *acq, size_t pixel_size, unsigned columns)
+{
+    int res = begin_read(acq, pixel_size, columns);
+    if (res) return res;
+
+    res = katherine_udp_set_blocking(&acq->device->data_socket, false);
+    if (res) {
+        (void) katherine_udp_mutex_unlock(&acq->device->data_socket);
+        return res;
+    }
+
+    acq->pumping = true;
+    return 0;
+}
+
+/* Starts over the state of an acquisition the read keeps, for a new run of
+   the given frames. */
+static inline void
+reset_acquisition(katherine_acquisition_t *acq, int frames, double frame_duration)
+{
+    acq->state = ACQUISITION_RUNNING;
+
+    acq->completed_frames         = 0;
+    acq->requested_frames         = frames;
+    acq->requested_frame_duration = frame_duration;
+    acq->dropped_measurement_data = 0;
+    memset(&acq->stats, 0, sizeof(acq->stats));
+    acq->host_drops_seen = 0;
+
+    acq->pixel_buffer_valid     = 0;
+    acq->pixel_buffer_max_valid = 0;
+    acq->last_toa_offset        = 0;
+    acq->frame_toa_offset       = 0;
+    acq->frame_active           = false;
+}
+
 #ifdef KATHERINE_DEBUG_ACQ
 // clang-format off
 static inline void
@@ -220,7 +714,7 @@ dump_config(const katherine_acquisition_t *acq, const katherine_config_t *config
  * @param acq Acquisition to initialize
  * @param device Katherine device
  * @param ctx User context (may be used to convey useful info)
- * @param md_buffer_size Size of the measurement data buffer in bytes
+ * @param md_buffer_size Size of the measurement data buffer in bytes (split into up to KATHERINE_MD_BATCH_MAX datagram slots)
  * @param pixel_buffer_size Size of the pixel buffer in bytes
  * @param report_timeout Timeout for reporting incomplete pixel buffers (ms). Set zero to disable.
  * @param fail_timeout Timeout for any device communication (ms). Set zero to disable.
@@ -228,14 +722,50 @@ dump_config(const katherine_acquisition_t *acq, const katherine_config_t *config
  */
 int
 katherine_acquisition_init(katherine_acquisition_t *acq, katherine_device_t *device, void *ctx, size_t md_buffer_size, size_t pixel_buffer_size, int report_timeout, int fail_timeout)
+{
+    return katherine_acquisition_init_with_allocator(acq, device, ctx, md_buffer_size, pixel_buffer_size, report_timeout, fail_timeout, NULL);
+}
+
+/**
+ * Initialize acquisition, with its buffers taken from the given allocator.
+ *
+ * A page of a fresh buffer is backed by memory only as it is first written, by a fault that costs
+ * the read loop time it does not have at the start of a stream. The allocator lets the application
+ * take the buffers from arenas of its own, placed near the CPU which reads, say, and the
+ * KATHERINE_ALLOC_PREFAULT flag faults every page in here instead, for any allocator.
+ *
+ * @param acq Acquisition to initialize
+ * @param device Katherine device
+ * @param ctx User context (may be used to convey useful info)
+ * @param md_buffer_size Size of the measurement data buffer in bytes (split into up to KATHERINE_MD_BATCH_MAX datagram slots)
+ * @param pixel_buffer_size Size of the pixel buffer in bytes
+ * @param report_timeout Timeout for reporting incomplete pixel buffers (ms). Set zero to disable.
+ * @param fail_timeout Timeout for any device communication (ms). Set zero to disable.
+ * @param allocator Allocator of the buffers, or NULL for the C heap
+ * @return Error code.
+ */
+int
+katherine_acquisition_init_with_allocator(katherine_acquisition_t *acq, katherine_device_t *device, void *ctx, size_t md_buffer_size, size_t pixel_buffer_size, int report_timeout, int fail_timeout, const katherine_allocator_t *allocator)
 {
     int res = 0;
 
+    if (allocator != NULL && allocator->alloc != NULL && allocator->free == NULL) {
+        return EINVAL;
+    }
+
+    if (allocator != NULL) {
+        acq->allocator = *allocator;
+    } else {
+        memset(&acq->allocator, 0, sizeof(acq->allocator));
+    }
+
     acq->device       = device;
     acq->user_ctx     = ctx;
     acq->state        = ACQUISITION_NOT_STARTED;
     acq->aborted      = false;
     acq->frame_active = false;
+    acq->pumping      = false;
+    acq->replaying    = false;
 
     // Handlers are optional. Clear them so that a caller which registers only
     // some of them does not leave the rest pointing at indeterminate values.
@@ -243,18 +773,36 @@ katherine_acquisition_init(katherine_acquisition_t *acq, katherine_device_t *dev
 
     acq->md_buffer_size = md_buffer_size;
 
+    // Split the buffer into slots of one datagram each, so that the read
+    // loop can receive a whole batch of datagrams per system call. A buffer
+    // too small for two slots stays a single one, as it always was.
+    acq->md_slots = md_buffer_size / KATHERINE_MD_DATAGRAM_MAX_SIZE;
+    if (acq->md_slots > KATHERINE_MD_BATCH_MAX) {
+        acq->md_slots = KATHERINE_MD_BATCH_MAX;
+    } else if (acq->md_slots == 0) {
+        acq->md_slots = 1;
+    }
+    acq->md_slot_size = md_buffer_size / acq->md_slots;
+
     // The read loop accesses 6-byte MD's as uint64_t's, so the last MD of a
-    // full buffer is read up to 2 bytes beyond the received data. Allocate a
-    // whole extra word so that this stays within the allocation for any
-    // requested size, including multiples of 8.
-    acq->md_buffer = (char *) malloc(md_buffer_size + sizeof(uint64_t));
+    // full slot is read up to 2 bytes beyond the received data -- into the
+    // next slot, or beyond the last one. Allocate a whole extra word so that
+    // this stays within the allocation for any requested size, including
+    // multiples of 8.
+    acq->md_buffer = (char *) katherine_buffer_alloc(&acq->allocator, md_buffer_size + sizeof(uint64_t));
     if (acq->md_buffer == NULL) {
         res = ENOMEM;
         goto err_datagram_buffer;
     }
 
+    acq->px_layout = KATHERINE_PX_LAYOUT_STRUCTS;
+    memset(&acq->px_columns, 0, sizeof(acq->px_columns));
+
+    acq->timestamp_unit = KATHERINE_TIMESTAMP_TOA;
+    acq->toa_shift      = 0;
+
     acq->pixel_buffer_size  = pixel_buffer_size;
-    acq->pixel_buffer       = (char *) malloc(acq->pixel_buffer_size);
+    acq->pixel_buffer       = (char *) katherine_buffer_alloc(&acq->allocator, acq->pixel_buffer_size);
     acq->pixel_buffer_valid = 0;
     if (acq->pixel_buffer == NULL) {
         res = ENOMEM;
@@ -263,11 +811,29 @@ katherine_acquisition_init(katherine_acquisition_t *acq, katherine_device_t *dev
 
     acq->report_timeout = report_timeout;
     acq->fail_timeout   = fail_timeout;
+    memset(&acq->stats, 0, sizeof(acq->stats));
+    acq->host_drops_seen = 0;
+
+    acq->pipeline    = NULL;
+    acq->md_pool     = NULL;
+    acq->decode_pool = NULL;
+    acq->clusterer   = NULL;
+    acq->reorder     = NULL;
+    acq->px_filter   = NULL;
+    acq->recorder    = NULL;
+    acq->sink        = NULL;
+
+    acq->frame_maps[0]      = NULL;
+    acq->frame_maps[1]      = NULL;
+    acq->frame_maps_current = 0;
+
+    memset(&acq->realtime, 0, sizeof(acq->realtime));
+    memset(&acq->realtime_status, 0, sizeof(acq->realtime_status));
 
     return res;
 
 err_pixel_buffer:
-    free(acq->md_buffer);
+    katherine_buffer_free(&acq->allocator, acq->md_buffer, md_buffer_size + sizeof(uint64_t));
 err_datagram_buffer:
     return res;
 }
@@ -279,25 +845,113 @@ err_datagram_buffer:
 void
 katherine_acquisition_fini(katherine_acquisition_t *acq)
 {
-    free(acq->md_buffer);
-    free(acq->pixel_buffer);
+    (void) katherine_acquisition_set_pipeline(acq, 0);
+    (void) katherine_acquisition_set_decode_threads(acq, 0);
+    (void) katherine_acquisition_set_frame_maps(acq, false);
+    (void) katherine_acquisition_set_clustering(acq, NULL);
+    (void) katherine_acquisition_set_reordering(acq, NULL);
+    (void) katherine_acquisition_set_px_filter(acq, NULL);
+    katherine_md_pool_free(acq, acq->md_pool);
+    katherine_buffer_free(&acq->allocator, acq->md_buffer, acq->md_buffer_size + sizeof(uint64_t));
+    katherine_buffer_free(&acq->allocator, acq->pixel_buffer, acq->pixel_buffer_size);
 }
 
-#define DEFINE_ACQ_IMPL(SUFFIX) \
+/* Every acquisition mode is implemented for its plain records (SUFFIX) and
+   for the packed ones (P16, P12). The modes without a ToA have no packed
+   records of their own, as their plain ones are not padded around a ToA;
+   they pass the plain records for both. */
+#define DEFINE_ACQ_IMPL(SUFFIX, P16, P12) \
+    static inline size_t \
+    pixel_size_##SUFFIX(const katherine_acquisition_t *acq) \
+    { \
+        switch (acq->px_layout) { \
+        case KATHERINE_PX_LAYOUT_PACKED16: return sizeof(katherine_px_##P16##_t); \
+        case KATHERINE_PX_LAYOUT_PACKED12: return sizeof(katherine_px_##P12##_t); \
+        default:                           return sizeof(katherine_px_##SUFFIX##_t); \
+        } \
+    } \
+\
+    /* Maps a run of pixel MD's in chunks that fit the pixel buffer, flushing \
+       it whenever it fills up, just as one MD at a time would. */ \
     static inline void \
-    handle_measurement_data_##SUFFIX(katherine_acquisition_t *acq, const uint64_t *md) \
+    handle_passed_run_##SUFFIX(katherine_acquisition_t *acq, const char *data, size_t count) \
     { \
-        static const int PIXEL_SIZE = sizeof(katherine_px_##SUFFIX##_t); \
-        char hdr                    = EXTRACT(*md, md, header); \
+        md_simd_level_t level = md_simd_detect(); \
+        size_t valid, chunk; \
 \
-        if (hdr == 0x4) { \
+        if (acq->frame_maps[0] != NULL) { \
+            pmd_##SUFFIX##_accumulate(acq->frame_maps[acq->frame_maps_current], data, count); \
+        } \
+        if (acq->clusterer != NULL) { \
+            pmd_##SUFFIX##_cluster_run(acq->clusterer, data, count, acq); \
+        } \
+\
+        while (count > 0) { \
             if (acq->pixel_buffer_valid == acq->pixel_buffer_max_valid) { \
-                flush_buffer(acq); \
+                flush_buffer(acq, &acq->stats.flushes_full); \
+            } \
+\
+            chunk = acq->pixel_buffer_max_valid - acq->pixel_buffer_valid; \
+            if (chunk > count) chunk = count; \
+\
+            valid = acq->pixel_buffer_valid; \
+            switch (acq->px_layout) { \
+            case KATHERINE_PX_LAYOUT_COLUMNS: \
+                pmd_##SUFFIX##_columns_run(&acq->px_columns, valid, data, chunk, acq); \
+                break; \
+            case KATHERINE_PX_LAYOUT_PACKED16: \
+                pmd_##P16##_run((katherine_px_##P16##_t *) acq->pixel_buffer + valid, data, chunk, acq); \
+                break; \
+            case KATHERINE_PX_LAYOUT_PACKED12: \
+                pmd_##P12##_run((katherine_px_##P12##_t *) acq->pixel_buffer + valid, data, chunk, acq); \
+                break; \
+            default: \
+                pmd_##SUFFIX##_run_at(level, (katherine_px_##SUFFIX##_t *) acq->pixel_buffer + valid, data, chunk, acq); \
+                break; \
+            } \
+            acq->pixel_buffer_valid += chunk; \
+            count_stat(&acq->stats.md_by_header[0x4], chunk); \
+            data += chunk * KATHERINE_MD_SIZE; \
+            count -= chunk; \
+        } \
+    } \
+\
+    /* Maps the pixels of a run of pixel MD's which pass the filter, if any, \
+       and drops the others. */ \
+    static inline void \
+    handle_pixel_run_##SUFFIX(katherine_acquisition_t *acq, const char *data, size_t count) \
+    { \
+        size_t run; \
+\
+        if (acq->px_filter == NULL) { \
+            handle_passed_run_##SUFFIX(acq, data, count); \
+            return; \
+        } \
+\
+        while (count > 0) { \
+            run = md_px_filter_span(acq->px_filter, data, count, true); \
+            if (run > 0) { \
+                handle_passed_run_##SUFFIX(acq, data, run); \
             } \
+            data += run * KATHERINE_MD_SIZE; \
+            count -= run; \
+\
+            run = md_px_filter_span(acq->px_filter, data, count, false); \
+            drop_pixels(acq, run); \
+            data += run * KATHERINE_MD_SIZE; \
+            count -= run; \
+        } \
+    } \
+\
+    static inline void \
+    handle_measurement_data_##SUFFIX(katherine_acquisition_t *acq, const uint64_t *md) \
+    { \
+        char hdr = EXTRACT(*md, md, header); \
 \
-            pmd_##SUFFIX##_map((katherine_px_##SUFFIX##_t *) acq->pixel_buffer + acq->pixel_buffer_valid, md, acq); \
-            ++acq->pixel_buffer_valid; \
+        if (hdr == 0x4) { \
+            handle_pixel_run_##SUFFIX(acq, (const char *) md, 1); \
         } else { \
+            count_stat(&acq->stats.md_by_header[(unsigned char) hdr], 1); \
             switch (hdr) { \
             case 0x2: handle_trigger_info(acq, md); break; \
             case 0x3: handle_trigger_info(acq, md); break; \
@@ -315,87 +969,464 @@ katherine_acquisition_fini(katherine_acquisition_t *acq)
         } \
     } \
 \
-    static int \
-    acquisition_read_##SUFFIX(katherine_acquisition_t *acq) \
+    static inline void \
+    handle_datagram_##SUFFIX(katherine_acquisition_t *acq, const char *data, size_t length) \
     { \
-        static const int PIXEL_SIZE = sizeof(katherine_px_##SUFFIX##_t); \
-\
-        if (katherine_udp_mutex_lock(&acq->device->data_socket) != 0) return 1; \
+        size_t count, run; \
 \
-        time_t last_data_received = time(NULL); \
-        double duration; \
-        double kill_off_time = acq->fail_timeout <= 0 ? -1 : acq->requested_frames * acq->requested_frame_duration + (double) acq->fail_timeout / 1000.0; \
-        int res; \
+        if (acq->decode_data) { \
+            /* Whole data only: the trailing fragment of a datagram cut \
+               short is not a datum, and decoding it would decode the bytes \
+               that happen to follow it in the buffer. */ \
+            for (count = length / KATHERINE_MD_SIZE; count > 0; count -= run, data += run * KATHERINE_MD_SIZE) { \
+                run = md_pixel_run_length(data, count); \
+                if (run > 0) { \
+                    handle_pixel_run_##SUFFIX(acq, data, run); \
+                } else { \
+                    handle_measurement_data_##SUFFIX(acq, (const uint64_t *) data); \
+                    run = 1; \
+                } \
+            } \
+        } else if (acq->handlers.data_received != NULL) { \
+            RUN_HANDLER(acq, data_received, data, length); \
+        } \
+    } \
 \
-        size_t i; \
-        size_t received; \
+    /* Maps the pixels of a datagram with no timestamp offset and notes \
+       where its other data are, for the parallel decoder. */ \
+    static size_t \
+    decode_datagram_##SUFFIX(const katherine_acquisition_t *acq, const char *data, size_t length, void *px, uint32_t *marks) \
+    { \
+        md_simd_level_t level          = md_simd_detect(); \
+        katherine_px_##SUFFIX##_t *out = (katherine_px_##SUFFIX##_t *) px; \
+        size_t count, run; \
+        size_t index = 0, marked = 0; \
 \
-        acq->pixel_buffer_valid     = 0; \
-        acq->pixel_buffer_max_valid = acq->pixel_buffer_size / PIXEL_SIZE; \
+        for (count = length / KATHERINE_MD_SIZE; count > 0; count -= run, index += run, data += run * KATHERINE_MD_SIZE) { \
+            run = md_pixel_run_length(data, count); \
+            if (run > 0) { \
+                pmd_##SUFFIX##_run_at(level, out, data, run, acq); \
+                out += run; \
+            } else { \
+                marks[marked++] = (uint32_t) index; \
+                run = 1; \
+            } \
+        } \
 \
-        while (acq->state == ACQUISITION_RUNNING) { \
-            received = acq->md_buffer_size; \
-            res      = katherine_udp_recv(&acq->device->data_socket, acq->md_buffer, &received); \
+        return marked; \
+    } \
 \
-            if (res) { \
-                duration = 1000 * difftime(time(NULL), last_data_received); \
-                if (acq->report_timeout > 0 && duration > acq->report_timeout && acq->pixel_buffer_valid > 0) { \
-                    flush_buffer(acq); \
+    /* Moves a run of pixels mapped by decode_datagram to the pixel buffer, \
+       adding the timestamp offset in effect, and flushes the buffer \
+       whenever it fills up. */ \
+    static inline void \
+    handle_mapped_run_##SUFFIX(katherine_acquisition_t *acq, const katherine_px_##SUFFIX##_t *px, size_t count) \
+    { \
+        katherine_px_##SUFFIX##_t *dst; \
+        size_t chunk; \
+\
+        while (count > 0) { \
+            if (acq->pixel_buffer_valid == acq->pixel_buffer_max_valid) { \
+                flush_buffer(acq, &acq->stats.flushes_full); \
+            } \
+\
+            chunk = acq->pixel_buffer_max_valid - acq->pixel_buffer_valid; \
+            if (chunk > count) chunk = count; \
+\
+            dst = (katherine_px_##SUFFIX##_t *) acq->pixel_buffer + acq->pixel_buffer_valid; \
+            memcpy(dst, px, chunk * sizeof(*dst)); \
+            if (acq->last_toa_offset != 0) { \
+                pmd_##SUFFIX##_rebase(dst, chunk, acq->last_toa_offset); \
+            } \
+            acq->pixel_buffer_valid += chunk; \
+            count_stat(&acq->stats.md_by_header[0x4], chunk); \
+            px += chunk; \
+            count -= chunk; \
+        } \
+    } \
+\
+    /* Handles a run of pixels mapped by decode_datagram, from the run of \
+       pixel MD's at `data`, as handle_pixel_run does the MD's. */ \
+    static inline void \
+    handle_decoded_run_##SUFFIX(katherine_acquisition_t *acq, const char *data, const katherine_px_##SUFFIX##_t *px, size_t count) \
+    { \
+        size_t run; \
+\
+        while (count > 0) { \
+            run = acq->px_filter != NULL ? md_px_filter_span(acq->px_filter, data, count, true) : count; \
+            if (run > 0) { \
+                if (acq->frame_maps[0] != NULL) { \
+                    pmd_##SUFFIX##_accumulate(acq->frame_maps[acq->frame_maps_current], data, run); \
+                } \
+                if (acq->clusterer != NULL) { \
+                    pmd_##SUFFIX##_cluster_run(acq->clusterer, data, run, acq); \
+                } \
+                handle_mapped_run_##SUFFIX(acq, px, run); \
+            } \
+            data += run * KATHERINE_MD_SIZE; \
+            px += run; \
+            count -= run; \
+\
+            if (count > 0) { \
+                run = md_px_filter_span(acq->px_filter, data, count, false); \
+                drop_pixels(acq, run); \
+                data += run * KATHERINE_MD_SIZE; \
+                px += run; \
+                count -= run; \
+            } \
+        } \
+    } \
+\
+    /* Handles a datagram whose pixels decode_datagram has mapped: the runs \
+       of pixels and the other data in between, as handle_datagram does. */ \
+    static inline void \
+    handle_decoded_datagram_##SUFFIX(katherine_acquisition_t *acq, const char *data, size_t length, const katherine_px_##SUFFIX##_t *px, const uint32_t *marks, size_t marked) \
+    { \
+        const size_t count = length / KATHERINE_MD_SIZE; \
+        size_t next = 0, end; \
+\
+        for (size_t m = 0; m <= marked; ++m, next = end + 1) { \
+            end = m < marked ? marks[m] : count; \
+            if (end > next) { \
+                handle_decoded_run_##SUFFIX(acq, data + next * KATHERINE_MD_SIZE, px, end - next); \
+                px += end - next; \
+            } \
+            if (m < marked) { \
+                handle_measurement_data_##SUFFIX(acq, (const uint64_t *) (data + end * KATHERINE_MD_SIZE)); \
+            } \
+        } \
+    } \
+\
+    /* Handles a batch of datagrams in order, until one of them ends the \
+       acquisition. The datagrams behind it are not handled, just like they \
+       used to stay unread in the socket before the receive was batched. \
+       The time it takes, less that of the handlers, is counted as decoding. */ \
+    static inline void \
+    handle_batch_##SUFFIX(katherine_acquisition_t *acq, const char *const *data, const size_t *lengths, size_t count) \
+    { \
+        struct katherine_decode_pool *pool = acq->decode_pool; \
+        const uint64_t started             = katherine_clock_ns(); \
+        const uint64_t callback_ns         = acq->stats.callback_ns; \
+        size_t s; \
+\
+        count_received(acq, lengths, count); \
+        record_datagrams(acq, data, lengths, count); \
+\
+        if (pool != NULL && pool->running && count > 1) { \
+            katherine_decode_pool_run(pool, data, lengths, count, decode_datagram_##SUFFIX); \
+            for (s = 0; s < count && acq->state == ACQUISITION_RUNNING; ++s) { \
+                if (katherine_decode_pool_fits(pool, lengths[s])) { \
+                    handle_decoded_datagram_##SUFFIX(acq, data[s], lengths[s], \
+                        (const katherine_px_##SUFFIX##_t *) katherine_decode_pool_pixels(pool, s), katherine_decode_pool_marks(pool, s), pool->marked[s]); \
+                } else { \
+                    handle_datagram_##SUFFIX(acq, data[s], lengths[s]); \
                 } \
+            } \
+        } else { \
+            for (s = 0; s < count && acq->state == ACQUISITION_RUNNING; ++s) { \
+                handle_datagram_##SUFFIX(acq, data[s], lengths[s]); \
+            } \
+        } \
+\
+        count_stat(&acq->stats.decode_ns, katherine_clock_ns() - started - (acq->stats.callback_ns - callback_ns)); \
+    } \
+\
+    static int \
+    acquisition_read_pipelined_##SUFFIX(katherine_acquisition_t *acq) \
+    { \
+        struct katherine_acquisition_pipeline *p = acq->pipeline; \
+\
+        int res = begin_read(acq, pixel_size_##SUFFIX(acq), PMD_##SUFFIX##_COLUMNS); \
+        if (res) return res; \
+\
+        uint64_t kill_off      = kill_off_time(acq); \
+        uint64_t timeouts_seen = 0; \
+        uint64_t timeouts; \
+        unsigned rounds = 0; \
+        size_t s, pending, batch; \
+        const char *data[KATHERINE_MD_BATCH_MAX]; \
+        size_t lengths[KATHERINE_MD_BATCH_MAX]; \
+\
+        res = begin_parallel_decode(acq); \
+        if (res) { \
+            (void) katherine_udp_mutex_unlock(&acq->device->data_socket); \
+            return res; \
+        } \
+\
+        res = katherine_pipeline_start(p); \
+        if (res) { \
+            end_parallel_decode(acq); \
+            (void) katherine_udp_mutex_unlock(&acq->device->data_socket); \
+            return res; \
+        } \
+\
+        while (acq->state == ACQUISITION_RUNNING) { \
+            pending = katherine_pipeline_pending(p); \
+            if (pending > 0) { \
+                mark_received(acq, katherine_clock_ns()); \
+                rounds = 0; \
 \
-                duration = difftime(time(NULL), acq->acq_start_time); \
-                if (kill_off_time > 0 && duration > kill_off_time) { \
-                    acq->state = ACQUISITION_TIMED_OUT; \
+                for (; pending > 0 && acq->state == ACQUISITION_RUNNING; pending -= batch) { \
+                    batch = pending < KATHERINE_MD_BATCH_MAX ? pending : KATHERINE_MD_BATCH_MAX; \
+                    for (s = 0; s < batch; ++s) { \
+                        data[s] = katherine_pipeline_at(p, s, &lengths[s]); \
+                    } \
+                    handle_batch_##SUFFIX(acq, data, lengths, batch); \
+                    katherine_pipeline_pop(p, batch); \
                 } \
+                continue; \
+            } \
 \
-                /* An abort ends the acquisition as soon as the stream has \
-                   dried up, whether or not the data are decoded. The flag \
-                   is raised by katherine_acquisition_abort() and by the \
-                   aborted measurement datum alike. */ \
-                if (acq->aborted) { \
-                    acq->state = ACQUISITION_SUCCEEDED; \
+            /* The stream is quiet if the receiver timed out with nothing \
+               queued behind the datagrams already decoded; a timeout that \
+               datagrams have arrived after is stale by now. */ \
+            timeouts = katherine_atomic_load(&p->timeouts); \
+            if (timeouts != timeouts_seen) { \
+                timeouts_seen = timeouts; \
+                if (katherine_atomic_load(&p->idle_head) == p->tail) { \
+                    handle_idle(acq, kill_off); \
                 } \
                 continue; \
             } \
 \
-            last_data_received = time(NULL); \
+            katherine_pipeline_backoff(&rounds); \
+        } \
 \
-            if (acq->decode_data) { \
-                const char *it = acq->md_buffer; \
-                /* Whole data only: the trailing fragment of a datagram cut \
-                   short is not a datum, and decoding it would decode the \
-                   bytes that happen to follow it in the buffer. */ \
-                for (i = 0; i + KATHERINE_MD_SIZE <= received; i += KATHERINE_MD_SIZE, it += KATHERINE_MD_SIZE) { \
-                    handle_measurement_data_##SUFFIX(acq, (const uint64_t *) it); \
-                } \
-            } else if (acq->handlers.data_received != NULL) { \
-                acq->handlers.data_received(acq->user_ctx, acq->md_buffer, received); \
+        katherine_pipeline_stop(p); \
+        end_parallel_decode(acq); \
+        return end_read(acq); \
+    } \
+\
+    static int \
+    acquisition_read_##SUFFIX(katherine_acquisition_t *acq) \
+    { \
+        if (acq->pipeline != NULL) { \
+            return acquisition_read_pipelined_##SUFFIX(acq); \
+        } \
+\
+        int res = begin_read(acq, pixel_size_##SUFFIX(acq), PMD_##SUFFIX##_COLUMNS); \
+        if (res) return res; \
+\
+        uint64_t kill_off = kill_off_time(acq); \
+\
+        size_t s; \
+        size_t batch; \
+        void *slots[KATHERINE_MD_BATCH_MAX]; \
+        const char *data[KATHERINE_MD_BATCH_MAX]; \
+        size_t received[KATHERINE_MD_BATCH_MAX]; \
+\
+        for (s = 0; s < acq->md_slots; ++s) { \
+            slots[s] = acq->md_buffer + s * acq->md_slot_size; \
+            data[s]  = acq->md_buffer + s * acq->md_slot_size; \
+        } \
+\
+        res = begin_parallel_decode(acq); \
+        if (res) { \
+            (void) katherine_udp_mutex_unlock(&acq->device->data_socket); \
+            return res; \
+        } \
+\
+        while (acq->state == ACQUISITION_RUNNING) { \
+            batch = acq->md_slots; \
+            res   = katherine_udp_recv_batch(&acq->device->data_socket, slots, acq->md_slot_size, received, &batch); \
+\
+            if (res) { \
+                handle_idle(acq, kill_off); \
+                continue; \
             } \
+\
+            mark_received(acq, katherine_clock_ns()); \
+            handle_batch_##SUFFIX(acq, data, received, batch); \
+        } \
+\
+        end_parallel_decode(acq); \
+        return end_read(acq); \
+    } \
+\
+    /* One step of a step-wise read: handles the datagrams waiting in the \
+       socket, up to max_datagrams of them, without waiting for any. */ \
+    static int \
+    acquisition_pump_##SUFFIX(katherine_acquisition_t *acq, size_t max_datagrams, size_t *handled) \
+    { \
+        size_t s; \
+        size_t batch; \
+        void *slots[KATHERINE_MD_BATCH_MAX]; \
+        const char *data[KATHERINE_MD_BATCH_MAX]; \
+        size_t received[KATHERINE_MD_BATCH_MAX]; \
+        int res; \
+\
+        *handled = 0; \
+        if (!acq->pumping) { \
+            res = begin_pump(acq, pixel_size_##SUFFIX(acq), PMD_##SUFFIX##_COLUMNS); \
+            if (res) return res; \
+        } \
+\
+        for (s = 0; s < acq->md_slots; ++s) { \
+            slots[s] = acq->md_buffer + s * acq->md_slot_size; \
+            data[s]  = acq->md_buffer + s * acq->md_slot_size; \
         } \
 \
-        if (acq->frame_active) { \
-            handle_acquisition_interrupted(acq); \
-        } else if (acq->pixel_buffer_valid > 0) { \
-            flush_buffer(acq); \
+        while (acq->state == ACQUISITION_RUNNING && *handled < max_datagrams) { \
+            batch = max_datagrams - *handled; \
+            if (batch > acq->md_slots) batch = acq->md_slots; \
+\
+            res = katherine_udp_recv_batch(&acq->device->data_socket, slots, acq->md_slot_size, received, &batch); \
+            if (res == EAGAIN) return 0; \
+            if (res) return res; \
+\
+            mark_received(acq, katherine_clock_ns()); \
+            handle_batch_##SUFFIX(acq, data, received, batch); \
+            *handled += batch; \
         } \
 \
-        (void) katherine_udp_mutex_unlock(&acq->device->data_socket); \
-        switch (acq->state) { \
-        case ACQUISITION_SUCCEEDED: return 0; \
-        case ACQUISITION_TIMED_OUT: return ETIMEDOUT; \
-        default:                    return EAGAIN; \
+        return 0; \
+    } \
+\
+    /* The read of a replay: handles the datagrams of the source back to \
+       back, with no socket and no timeouts, until it runs out. */ \
+    static int \
+    acquisition_replay_##SUFFIX(katherine_acquisition_t *acq, katherine_replay_source_t *source) \
+    { \
+        size_t batch; \
+        const char *data[KATHERINE_MD_BATCH_MAX]; \
+        size_t lengths[KATHERINE_MD_BATCH_MAX]; \
+\
+        int res = begin_decode(acq, pixel_size_##SUFFIX(acq), PMD_##SUFFIX##_COLUMNS); \
+        if (res) return res; \
+\
+        res = begin_parallel_decode(acq); \
+        if (res) return res; \
+\
+        while (acq->state == ACQUISITION_RUNNING) { \
+            batch = KATHERINE_MD_BATCH_MAX; \
+            res   = katherine_replay_source_next(source, acq, data, lengths, &batch); \
+            if (res) break; \
+\
+            if (batch == 0) { \
+                acq->state = ACQUISITION_SUCCEEDED; \
+                break; \
+            } \
+\
+            mark_received(acq, katherine_clock_ns()); \
+            handle_batch_##SUFFIX(acq, data, lengths, batch); \
         } \
+\
+        end_parallel_decode(acq); \
+        const int result = end_decode(acq); \
+        return res ? res : result; \
     }
 
-DEFINE_ACQ_IMPL(f_toa_tot);
-DEFINE_ACQ_IMPL(toa_tot);
-DEFINE_ACQ_IMPL(f_toa_only);
-DEFINE_ACQ_IMPL(toa_only);
-DEFINE_ACQ_IMPL(f_event_itot);
-DEFINE_ACQ_IMPL(event_itot);
+DEFINE_ACQ_IMPL(f_toa_tot, f_toa_tot_p16, f_toa_tot_p12);
+DEFINE_ACQ_IMPL(toa_tot, toa_tot_p16, toa_tot_p12);
+DEFINE_ACQ_IMPL(f_toa_only, f_toa_only_p16, f_toa_only_p12);
+DEFINE_ACQ_IMPL(toa_only, toa_only_p16, toa_only_p12);
+DEFINE_ACQ_IMPL(f_event_itot, f_event_itot, f_event_itot);
+DEFINE_ACQ_IMPL(event_itot, event_itot, event_itot);
 
 #undef DEFINE_ACQ_IMPL
 
+/* The read of an acquisition with a lease pool, which does not decode its
+   data: receives datagrams into the free leases of the pool and hands them
+   to the application. If it holds every lease, the read waits for one to be
+   released, minding the same timeouts as while the stream is quiet. */
+static int
+acquisition_read_leased(katherine_acquisition_t *acq)
+{
+    struct katherine_md_pool *pool = acq->md_pool;
+
+    // Nothing is decoded, so the pixel buffer goes unused.
+    int res = begin_read(acq, 1, 0);
+    if (res) return res;
+
+    uint64_t kill_off = kill_off_time(acq);
+    unsigned rounds   = 0;
+
+    size_t s;
+    size_t taken, batch;
+    katherine_md_lease_t *leases[KATHERINE_MD_BATCH_MAX];
+    void *slots[KATHERINE_MD_BATCH_MAX];
+    size_t received[KATHERINE_MD_BATCH_MAX];
+
+    while (acq->state == ACQUISITION_RUNNING) {
+        for (taken = 0; taken < acq->md_slots; ++taken) {
+            leases[taken] = katherine_md_pool_take(pool);
+            if (leases[taken] == NULL) break;
+            slots[taken] = katherine_md_pool_buffer(pool, leases[taken]);
+        }
+
+        if (taken == 0) {
+            if (rounds == 0) {
+                katherine_atomic_store(&pool->stalls, pool->stalls + 1);
+            }
+            katherine_pipeline_backoff(&rounds);
+            if (rounds >= KATHERINE_PIPELINE_SPINS) {
+                handle_idle(acq, kill_off);
+            }
+            continue;
+        }
+        rounds = 0;
+
+        batch = taken;
+        res   = katherine_udp_recv_batch(&acq->device->data_socket, slots, pool->slot_size, received, &batch);
+        if (res) {
+            batch = 0;
+            handle_idle(acq, kill_off);
+        } else {
+            mark_received(acq, katherine_clock_ns());
+            count_received(acq, received, batch);
+            record_datagrams(acq, (const char *const *) slots, received, batch);
+        }
+
+        for (s = 0; s < batch; ++s) {
+            leases[s]->length = received[s];
+            if (acq->handlers.data_leased != NULL) {
+                (void) katherine_atomic_fetch_add(&pool->leased, 1);
+                RUN_HANDLER(acq, data_leased, leases[s]);
+            } else {
+                katherine_md_pool_untake(pool, leases[s]);
+            }
+        }
+
+        // Leases taken for datagrams which did not arrive.
+        for (s = batch; s < taken; ++s) {
+            katherine_md_pool_untake(pool, leases[s]);
+        }
+    }
+
+    return end_read(acq);
+}
+
+/* The read, the pump and the replay of an acquisition mode. */
+typedef struct acquisition_impl {
+    int (*read)(katherine_acquisition_t *acq);
+    int (*pump)(katherine_acquisition_t *acq, size_t max_datagrams, size_t *handled);
+    int (*replay)(katherine_acquisition_t *acq, katherine_replay_source_t *source);
+} acquisition_impl_t;
+
+#define ACQ_IMPL(SUFFIX) {acquisition_read_##SUFFIX, acquisition_pump_##SUFFIX, acquisition_replay_##SUFFIX}
+
+static const acquisition_impl_t impl_f_toa_tot    = ACQ_IMPL(f_toa_tot);
+static const acquisition_impl_t impl_toa_tot      = ACQ_IMPL(toa_tot);
+static const acquisition_impl_t impl_f_toa_only   = ACQ_IMPL(f_toa_only);
+static const acquisition_impl_t impl_toa_only     = ACQ_IMPL(toa_only);
+static const acquisition_impl_t impl_f_event_itot = ACQ_IMPL(f_event_itot);
+static const acquisition_impl_t impl_event_itot   = ACQ_IMPL(event_itot);
+
+#undef ACQ_IMPL
+
+/* The implementation of the mode of an acquisition, or NULL if the mode is
+   not known. */
+static const acquisition_impl_t *
+find_impl(const katherine_acquisition_t *acq)
+{
+    switch (acq->acq_mode) {
+    case ACQUISITION_MODE_TOA_TOT:    return acq->fast_vco_enabled ? &impl_f_toa_tot : &impl_toa_tot;
+    case ACQUISITION_MODE_ONLY_TOA:   return acq->fast_vco_enabled ? &impl_f_toa_only : &impl_toa_only;
+    case ACQUISITION_MODE_EVENT_ITOT: return acq->fast_vco_enabled ? &impl_f_event_itot : &impl_event_itot;
+    default:                          return NULL;
+    }
+}
+
 /**
  * Read measurement data from acquisition.
  * @param acq Acquisition
@@ -404,31 +1435,177 @@ DEFINE_ACQ_IMPL(event_itot);
 int
 katherine_acquisition_read(katherine_acquisition_t *acq)
 {
-    switch (acq->acq_mode) {
-    case ACQUISITION_MODE_TOA_TOT:
-        if (acq->fast_vco_enabled) {
-            return acquisition_read_f_toa_tot(acq);
-        } else {
-            return acquisition_read_toa_tot(acq);
-        }
+    const bool leased = !acq->decode_data && acq->md_pool != NULL;
 
-    case ACQUISITION_MODE_ONLY_TOA:
-        if (acq->fast_vco_enabled) {
-            return acquisition_read_f_toa_only(acq);
-        } else {
-            return acquisition_read_toa_only(acq);
-        }
+    const acquisition_impl_t *impl = find_impl(acq);
+    if (impl == NULL && !leased) {
+        return EINVAL;
+    }
 
-    case ACQUISITION_MODE_EVENT_ITOT:
-        if (acq->fast_vco_enabled) {
-            return acquisition_read_f_event_itot(acq);
-        } else {
-            return acquisition_read_event_itot(acq);
-        }
+    // A pipeline receives on a thread of its own, which it tunes as it
+    // starts it; the calling thread only decodes then.
+    struct katherine_realtime_saved saved;
+    int res = katherine_realtime_enter(acq, leased || acq->pipeline == NULL, &saved);
+    if (res) return res;
 
-    default:
+    res = leased ? acquisition_read_leased(acq) : impl->read(acq);
+
+    katherine_realtime_leave(acq, &saved);
+    return res;
+}
+
+/**
+ * Decode measurement data of a past acquisition, as if they were being received.
+ *
+ * The replay takes the place of both katherine_acquisition_begin() and katherine_acquisition_read():
+ * it starts the acquisition over in the mode of the source, and hands the datagrams of the source to
+ * the decoder as fast as it takes them, with the handlers, the counters and the stages of the
+ * acquisition as they are set. The acquisition succeeds once the source runs out, and a frame which
+ * has not finished by then is ended as interrupted. The datagrams are handled on the calling thread,
+ * or by the decoding threads of the acquisition; a pipeline is not used.
+ *
+ * Neither the device nor the data socket of the acquisition is used, so it may be initialized with a
+ * device which is not connected, and several acquisitions may replay at once.
+ *
+ * @param acq Acquisition, which is not being read
+ * @param source Source of the measurement data
+ * @return Error code: the result katherine_acquisition_read() would have returned, or the error of the source,
+ *         such as EMSGSIZE for a recorded datagram longer than a slot of the measurement data buffer.
+ */
+int
+katherine_acquisition_replay(katherine_acquisition_t *acq, katherine_replay_source_t *source)
+{
+    const acquisition_impl_t *impl;
+    int res;
+
+    acq->acq_mode         = source->acq_mode;
+    acq->readout_mode     = source->readout_mode;
+    acq->fast_vco_enabled = source->fast_vco_enabled;
+    acq->decode_data      = true;
+    acq->aborted          = false;
+
+    impl = find_impl(acq);
+    if (impl == NULL) {
         return EINVAL;
     }
+
+    // No frame count ends a replay, which runs until the source does.
+    reset_acquisition(acq, 0, 0.0);
+    acq->acq_start_time    = time(NULL);
+    acq->acq_start_time_ns = katherine_clock_ns();
+
+    acq->replaying = true;
+    res            = impl->replay(acq, source);
+    acq->replaying = false;
+    return res;
+}
+
+/**
+ * Get the data socket of an acquisition, for an event loop to wait on.
+ *
+ * The socket becomes readable when measurement data arrive, which is when the loop should call
+ * katherine_acquisition_pump().
+ *
+ * @param acq Acquisition
+ * @return Socket descriptor.
+ */
+katherine_socket_t
+katherine_acquisition_get_fd(const katherine_acquisition_t *acq)
+{
+    return acq->device->data_socket.sock;
+}
+
+/**
+ * Handle the measurement data waiting in the data socket, without waiting for more.
+ *
+ * This is a step of the step-wise read, an alternative to katherine_acquisition_read() for
+ * applications which run an event loop of their own: instead of blocking until the acquisition
+ * ends, the read is driven by the loop, one step at a time. The loop waits for the socket of
+ * katherine_acquisition_get_fd() to become readable and calls this function, which handles up to
+ * max_datagrams datagrams, running the handlers as the blocking read would; meanwhile, a timer of
+ * the loop calls katherine_acquisition_poll_timeouts(). Once the state of the acquisition is no
+ * longer ACQUISITION_RUNNING, the loop ends the read by katherine_acquisition_finish().
+ *
+ * The first step takes the data socket for the acquisition and makes it non-blocking until the
+ * read is finished, so all steps must be made from the same thread. The step-wise read neither
+ * starts the receiver thread of a pipeline nor uses the lease pool.
+ *
+ * @param acq Acquisition
+ * @param max_datagrams Datagrams to handle at most, so that one readout cannot starve the others
+ * @return Error code.
+ */
+int
+katherine_acquisition_pump(katherine_acquisition_t *acq, size_t max_datagrams)
+{
+    const acquisition_impl_t *impl = find_impl(acq);
+    size_t handled;
+
+    if (impl == NULL) {
+        return EINVAL;
+    }
+
+    if (acq->state != ACQUISITION_RUNNING) {
+        return 0;
+    }
+
+    return impl->pump(acq, max_datagrams, &handled);
+}
+
+/**
+ * Check the timeouts of a step-wise read.
+ *
+ * The step-wise counterpart of the receive timeout of katherine_acquisition_read(), to be called
+ * by a timer of the event loop, e.g. as often as the report timeout. If no measurement data are
+ * waiting, the stream is quiet: a partial pixel buffer is delivered once the report timeout has
+ * passed, and the acquisition ends if it has run out of time or was aborted. Data that are waiting
+ * are handled instead, as by katherine_acquisition_pump().
+ *
+ * @param acq Acquisition
+ * @return Error code.
+ */
+int
+katherine_acquisition_poll_timeouts(katherine_acquisition_t *acq)
+{
+    const acquisition_impl_t *impl = find_impl(acq);
+    size_t handled;
+    int res;
+
+    if (impl == NULL) {
+        return EINVAL;
+    }
+
+    if (acq->state != ACQUISITION_RUNNING) {
+        return 0;
+    }
+
+    res = impl->pump(acq, acq->md_slots, &handled);
+    if (res == 0 && handled == 0) {
+        handle_idle(acq, kill_off_time(acq));
+    }
+
+    return res;
+}
+
+/**
+ * End a step-wise read.
+ *
+ * Delivers the pixels still buffered, ends an unfinished frame as interrupted and releases the data
+ * socket, which blocks again. Usually called once the acquisition is no longer running, but may be
+ * called before to give up on it.
+ *
+ * @param acq Acquisition
+ * @return Error code: the result katherine_acquisition_read() would have returned.
+ */
+int
+katherine_acquisition_finish(katherine_acquisition_t *acq)
+{
+    if (!acq->pumping) {
+        return read_result(acq);
+    }
+
+    acq->pumping = false;
+    (void) katherine_udp_set_blocking(&acq->device->data_socket, true);
+    return end_read(acq);
 }
 
 /**
@@ -468,22 +1645,14 @@ katherine_acquisition_begin(katherine_acquisition_t *acq, const katherine_config
     res = katherine_set_acq_mode(acq->device, acq_mode, fast_vco_enabled);
     if (res) goto err;
 
-    acq->state = ACQUISITION_RUNNING;
-
-    acq->completed_frames         = 0;
-    acq->requested_frames         = config->no_frames;
-    acq->requested_frame_duration = config->acq_time / 1e9;
-    acq->dropped_measurement_data = 0;
-
-    acq->pixel_buffer_valid     = 0;
-    acq->pixel_buffer_max_valid = 0;
-    acq->last_toa_offset        = 0;
-    acq->frame_active           = false;
+    reset_acquisition(acq, config->no_frames, config->acq_time / 1e9);
+    acq->host_drops_seen = katherine_udp_dropped(&acq->device->data_socket);
 
     res = katherine_udp_mutex_lock(&acq->device->control_socket);
     if (res) goto err;
 
-    acq->acq_start_time = time(NULL);
+    acq->acq_start_time    = time(NULL);
+    acq->acq_start_time_ns = katherine_clock_ns();
 
     res = katherine_cmd_start_acquisition(&acq->device->control_socket, readout_mode);
     if (res) goto err_cmd;
@@ -550,6 +1719,305 @@ err:
     return res;
 }
 
+/**
+ * Take a snapshot of the performance counters of an acquisition.
+ *
+ * May be called from any thread, including while another one is reading the acquisition; each
+ * figure is read whole, though the figures are not taken at quite the same instant. Comparing the
+ * time spent decoding and in the handlers with the wall-clock time of the read, and the receive
+ * timeouts with the datagrams, tells whether a read is bound by the decoder, by the handlers or by
+ * the stream.
+ *
+ * @param acq Acquisition
+ * @param stats Snapshot to fill in
+ */
+void
+katherine_acquisition_get_stats(const katherine_acquisition_t *acq, katherine_acquisition_stats_t *stats)
+{
+    const katherine_acquisition_stats_t *c = &acq->stats;
+
+    stats->datagrams              = katherine_atomic_load(&c->datagrams);
+    stats->bytes                  = katherine_atomic_load(&c->bytes);
+    stats->max_datagram_size      = katherine_atomic_load(&c->max_datagram_size);
+    stats->mean_datagram_size     = stats->datagrams > 0 ? (double) stats->bytes / (double) stats->datagrams : 0.0;
+    stats->receive_timeouts       = katherine_atomic_load(&c->receive_timeouts);
+    stats->host_dropped_datagrams = katherine_atomic_load(&c->host_dropped_datagrams);
+    stats->decode_ns              = katherine_atomic_load(&c->decode_ns);
+    stats->callback_ns            = katherine_atomic_load(&c->callback_ns);
+    stats->flushes_full           = katherine_atomic_load(&c->flushes_full);
+    stats->flushes_report_timeout = katherine_atomic_load(&c->flushes_report_timeout);
+    stats->flushes_frame_end      = katherine_atomic_load(&c->flushes_frame_end);
+
+    for (size_t i = 0; i < sizeof(c->md_by_header) / sizeof(c->md_by_header[0]); ++i) {
+        stats->md_by_header[i] = katherine_atomic_load(&c->md_by_header[i]);
+    }
+
+    stats->late_pixels   = katherine_atomic_load(&c->late_pixels);
+    stats->forced_pixels = katherine_atomic_load(&c->forced_pixels);
+}
+
+/**
+ * Choose the layout in which the decoded pixels are delivered.
+ *
+ * By default, pixels are delivered to the pixels_received handler as an array of the
+ * katherine_px_*_t records of the acquisition mode. The columnar layout splits the pixel buffer
+ * into one array per field instead, and delivers them to the pixel_columns_received handler, so
+ * that a consumer can stream just the fields it reads. The buffer holds somewhat more pixels that
+ * way, since the records lose their padding.
+ *
+ * The packed layouts deliver the katherine_px_*_p16_t or katherine_px_*_p12_t records of the modes
+ * with a ToA to the pixels_received handler, which are smaller than the plain ones and hold the
+ * same information. The modes without a ToA deliver their plain records in either packed layout.
+ * The 12-byte records hold the time of arrival in ToA ticks only, and are refused (EINVAL) while
+ * the fine timestamp unit is chosen (see katherine_acquisition_set_timestamp_unit()).
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param layout Layout of the pixels
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_px_layout(katherine_acquisition_t *acq, katherine_px_layout_t layout)
+{
+    if (!timestamp_fits_layout(acq->timestamp_unit, (char) layout)) {
+        return EINVAL;
+    }
+
+    switch (layout) {
+    case KATHERINE_PX_LAYOUT_STRUCTS:
+    case KATHERINE_PX_LAYOUT_COLUMNS:
+    case KATHERINE_PX_LAYOUT_PACKED16:
+    case KATHERINE_PX_LAYOUT_PACKED12:
+        acq->px_layout = (char) layout;
+        return 0;
+    default:
+        return EINVAL;
+    }
+}
+
+/**
+ * Enable or disable the accumulation of per-frame maps.
+ *
+ * Imaging in frames often needs no more of a frame than how many hits each pixel saw and how much
+ * ToT it integrated. With the maps enabled, the decoder adds every pixel it decodes to a count map
+ * and an integrated ToT map of the running frame, straight from the measurement data, and hands them
+ * over with the frame info (katherine_frame_info_t.maps) to the frame_ended handler. The pixels are
+ * still delivered as well; an application which only needs the maps can leave pixels_received unset.
+ *
+ * The maps are double-buffered: the next frame accumulates into the other pair, so that the maps
+ * handed over stay valid, and unchanged, until the next frame ends. A consumer may therefore hand
+ * them to another thread, which has the whole of the next frame to process them, without holding up
+ * the decoder.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param enabled Whether to accumulate the maps
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_frame_maps(katherine_acquisition_t *acq, bool enabled)
+{
+    if (acq->frame_maps[0] != NULL) {
+        katherine_buffer_free(&acq->allocator, acq->frame_maps[1], sizeof(katherine_frame_maps_t));
+        katherine_buffer_free(&acq->allocator, acq->frame_maps[0], sizeof(katherine_frame_maps_t));
+        acq->frame_maps[0] = NULL;
+        acq->frame_maps[1] = NULL;
+    }
+
+    if (!enabled) {
+        return 0;
+    }
+
+    katherine_frame_maps_t *first  = (katherine_frame_maps_t *) katherine_buffer_alloc(&acq->allocator, sizeof(katherine_frame_maps_t));
+    katherine_frame_maps_t *second = (katherine_frame_maps_t *) katherine_buffer_alloc(&acq->allocator, sizeof(katherine_frame_maps_t));
+    if (first == NULL || second == NULL) {
+        katherine_buffer_free(&acq->allocator, second, sizeof(katherine_frame_maps_t));
+        katherine_buffer_free(&acq->allocator, first, sizeof(katherine_frame_maps_t));
+        return ENOMEM;
+    }
+
+    memset(first, 0, sizeof(*first));
+    memset(second, 0, sizeof(*second));
+
+    acq->frame_maps[0]      = first;
+    acq->frame_maps[1]      = second;
+    acq->frame_maps_current = 0;
+    return 0;
+}
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Hands closed clusters to the clusters_received handler, if any. */
+static void
+emit_clusters(katherine_acquisition_t *acq, const katherine_cluster_t *clusters, size_t count)
+{
+    if (acq->handlers.clusters_received != NULL) {
+        RUN_HANDLER(acq, clusters_received, clusters, count);
+    }
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Enable or disable the clustering of the decoded pixels.
+ *
+ * With the clustering enabled, the decoder groups the pixels it decodes into clusters as they
+ * arrive: a pixel joins the clusters it neighbours -- one of the eight pixels around it, or the
+ * pixel itself, was hit by the cluster at most toa_window before or after it -- merging them if
+ * there are several, or starts one of its own. A cluster closes once the stream has moved more
+ * than toa_window past its last pixel, or to make room when max_open clusters are open, and at
+ * the end of every frame. Closed clusters are passed to the clusters_received handler in batches,
+ * along with the pixel buffer, or when the stream falls quiet for the report timeout.
+ *
+ * Pixels are clustered in stream order; those arriving so late that their cluster has closed
+ * already start a cluster of their own. The pixels are still delivered as well. Only the modes with
+ * a time of arrival are clustered, in the timestamp unit of the acquisition (see
+ * katherine_acquisition_set_timestamp_unit()).
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param clustering Parameters of the clustering, or NULL to disable it
+ * @return Error code: EINVAL if max_open is zero.
+ */
+int
+katherine_acquisition_set_clustering(katherine_acquisition_t *acq, const katherine_clustering_t *clustering)
+{
+    katherine_clusterer_free(acq->clusterer);
+    acq->clusterer = NULL;
+
+    if (clustering == NULL) {
+        return 0;
+    }
+
+    if (clustering->max_open == 0 || clustering->max_open >= KATHERINE_CLUSTER_NONE) {
+        return EINVAL;
+    }
+
+    acq->clusterer = katherine_clusterer_new(acq, clustering, emit_clusters);
+    if (acq->clusterer == NULL) {
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Hands pixels the time ordering releases to the pixel sink and the
+   pixels_received handler, if any. */
+static void
+emit_pixels(katherine_acquisition_t *acq, const void *px, size_t count)
+{
+    sink_pixels(acq, px, count);
+    if (acq->handlers.pixels_received != NULL) {
+        RUN_HANDLER(acq, pixels_received, px, count);
+    }
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Enable or disable the time ordering of the decoded pixels.
+ *
+ * In the data-driven readout, the chip sends the hits as its columns get to them rather than in the
+ * order of their time of arrival. With the time ordering enabled, the pixels flushed from the pixel
+ * buffer are held back until the latest time of arrival seen has moved more than the window past
+ * theirs, and are then sorted, by a radix sort on the time of arrival, and passed to the
+ * pixels_received handler. Each batch the handler receives is then sorted, and follows the batch
+ * before it in time, for as long as no pixel arrives more than the window late.
+ *
+ * A pixel which does -- whose time of arrival precedes that of a pixel delivered already -- is
+ * delivered right away, in a batch of its own, and counted in
+ * katherine_acquisition_stats_t.late_pixels. Should max_pending pixels be held back at once, all
+ * of them are delivered, and counted in katherine_acquisition_stats_t.forced_pixels. The held-back
+ * pixels are delivered at the end of every frame, before the frame_ended handler runs, at the end of
+ * the read, and when the stream falls quiet for the report timeout.
+ *
+ * Only the records of the default layout of the modes with a time of arrival are ordered, in the
+ * timestamp unit of the acquisition (see katherine_acquisition_set_timestamp_unit()); the others
+ * are delivered as they are decoded.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param reordering Parameters of the ordering, or NULL to disable it
+ * @return Error code: EINVAL if max_pending is zero.
+ */
+int
+katherine_acquisition_set_reordering(katherine_acquisition_t *acq, const katherine_reordering_t *reordering)
+{
+    size_t max_record_size = sizeof(katherine_px_f_toa_tot_t);
+
+    katherine_reorder_free(acq->reorder);
+    acq->reorder = NULL;
+
+    if (reordering == NULL) {
+        return 0;
+    }
+
+    if (reordering->max_pending == 0 || reordering->max_pending > UINT32_MAX) {
+        return EINVAL;
+    }
+
+    if (max_record_size < sizeof(katherine_px_toa_tot_t)) max_record_size = sizeof(katherine_px_toa_tot_t);
+    if (max_record_size < sizeof(katherine_px_f_toa_only_t)) max_record_size = sizeof(katherine_px_f_toa_only_t);
+    if (max_record_size < sizeof(katherine_px_toa_only_t)) max_record_size = sizeof(katherine_px_toa_only_t);
+
+    acq->reorder = katherine_reorder_new(acq, reordering, max_record_size, emit_pixels);
+    if (acq->reorder == NULL) {
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+/**
+ * Choose the unit of the time of arrival of the decoded pixels.
+ *
+ * By default, the toa of a pixel counts ticks of the 40 MHz ToA clock (25 ns) since its frame
+ * started, and the modes with fast VCO leave the fToA in a field of its own, which the application
+ * subtracts from it. In the fine unit, the decoder does that itself: the toa counts ticks of the
+ * 640 MHz fToA clock (1.5625 ns), with the fToA already subtracted in the fast VCO modes, and in
+ * the sequential readout it is moved by the start of its frame as the device reports it
+ * (katherine_frame_info_t.start_time), so that the time of arrival of every pixel of the
+ * acquisition is measured on the same clock. The data-driven readout runs a single frame, whose
+ * time of arrival counts from the start of the acquisition in either unit.
+ *
+ * The time of arrival is computed as the pixels are mapped, by the vectorized decoder where it is
+ * available, and costs a shift and a subtraction per pixel. The fToA field is left in place.
+ *
+ * The fine unit takes four bits more than the 48 of the packed 12-byte records, and is refused
+ * (EINVAL) while that layout is chosen (see katherine_acquisition_set_px_layout()).
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param unit Unit of the time of arrival
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_timestamp_unit(katherine_acquisition_t *acq, katherine_timestamp_unit_t unit)
+{
+    switch (unit) {
+    case KATHERINE_TIMESTAMP_TOA:
+        acq->timestamp_unit = (char) unit;
+        acq->toa_shift      = 0;
+        return 0;
+    case KATHERINE_TIMESTAMP_FINE:
+        if (!timestamp_fits_layout((char) unit, acq->px_layout)) {
+            return EINVAL;
+        }
+        acq->timestamp_unit = (char) unit;
+        acq->toa_shift      = 4;
+        return 0;
+    default:
+        return EINVAL;
+    }
+}
+
 /**
  * Get human-readable description of acquisition status.
  * @param status Status to describe
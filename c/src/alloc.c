@@ -0,0 +1,114 @@
+/**
+ * @file
+ * @brief Implementation of the allocation of the buffers of an acquisition.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <katherine/global.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+
+#ifdef KATHERINE_NIX
+#include <sys/mman.h>
+#endif
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+// Huge pages of the transparent kind are 2 MiB on the common platforms; a
+// mapping is rounded up to whole ones so that none of it is left to small
+// pages at its end.
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+#if defined(KATHERINE_NIX) && defined(MAP_ANONYMOUS)
+#define HAVE_ANONYMOUS_MAPPINGS
+#endif
+
+#ifdef HAVE_ANONYMOUS_MAPPINGS
+
+static size_t
+huge_size(size_t size)
+{
+    return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+/* Maps whole huge pages for the buffer and asks the kernel to back them by
+   huge pages, which it does on a best-effort basis. */
+static void *
+map_huge(size_t size)
+{
+    void *ptr = mmap(NULL, huge_size(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    (void) madvise(ptr, huge_size(size), MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+#endif /* HAVE_ANONYMOUS_MAPPINGS */
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Allocate a buffer of an acquisition.
+ * @param allocator Allocator of the acquisition
+ * @param size Size of the buffer in bytes
+ * @return The buffer, or NULL if it cannot be allocated.
+ */
+KATHERINE_NOT_EXPORTED void *
+katherine_buffer_alloc(const katherine_allocator_t *allocator, size_t size)
+{
+    void *ptr;
+
+    if (allocator->alloc != NULL) {
+        ptr = allocator->alloc(allocator->ctx, size);
+#ifdef HAVE_ANONYMOUS_MAPPINGS
+    } else if (allocator->flags & KATHERINE_ALLOC_HUGEPAGES) {
+        ptr = map_huge(size);
+#endif
+    } else {
+        ptr = malloc(size);
+    }
+
+    // Writing the buffer makes the kernel back every page of it now rather
+    // than on the first receive into it, in the middle of the first frame.
+    if (ptr != NULL && (allocator->flags & KATHERINE_ALLOC_PREFAULT)) {
+        memset(ptr, 0, size);
+    }
+
+    return ptr;
+}
+
+/**
+ * Free a buffer of an acquisition.
+ * @param allocator Allocator of the acquisition, which allocated the buffer
+ * @param ptr Buffer, or NULL
+ * @param size Size the buffer was allocated with
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_buffer_free(const katherine_allocator_t *allocator, void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    if (allocator->alloc != NULL) {
+        allocator->free(allocator->ctx, ptr, size);
+#ifdef HAVE_ANONYMOUS_MAPPINGS
+    } else if (allocator->flags & KATHERINE_ALLOC_HUGEPAGES) {
+        (void) munmap(ptr, huge_size(size));
+#endif
+    } else {
+        free(ptr);
+    }
+}
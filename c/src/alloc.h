@@ -0,0 +1,39 @@
+/**
+ * @file
+ * @brief Internal allocation of the buffers of an acquisition.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <katherine/acquisition.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* The buffers the stream is received into and decoded to -- the measurement
+ * data buffer, the pixel buffer, the ring of a pipeline and the buffers of a
+ * lease pool -- come from the allocator of the acquisition, and go back to it
+ * with the size they were allocated with. Bookkeeping of the read (lease
+ * records, lengths, ...) stays on the heap. */
+
+KATHERINE_NOT_EXPORTED void *
+katherine_buffer_alloc(const katherine_allocator_t *allocator, size_t size);
+
+KATHERINE_NOT_EXPORTED void
+katherine_buffer_free(const katherine_allocator_t *allocator, void *ptr, size_t size);
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @brief Internal portable monotonic clock.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <katherine/global.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#ifdef KATHERINE_WIN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Nanoseconds on a clock which never steps backwards, from an arbitrary
+// origin. The read loop samples it once per batch of datagrams, not once
+// per datagram, so the precise clock is affordable: the coarse one
+// (CLOCK_MONOTONIC_COARSE) would be cheaper still, but ticks only every
+// few milliseconds, which is as long as a short frame.
+static inline uint64_t
+katherine_clock_ns(void)
+{
+#ifdef KATHERINE_WIN
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) {
+        (void) QueryPerformanceFrequency(&freq);
+    }
+    (void) QueryPerformanceCounter(&now);
+
+    const uint64_t ticks = (uint64_t) now.QuadPart;
+    const uint64_t hz    = (uint64_t) freq.QuadPart;
+    return ticks / hz * 1000000000ull + ticks % hz * 1000000000ull / hz;
+#else
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
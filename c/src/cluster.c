@@ -0,0 +1,327 @@
+/**
+ * @file
+ * @brief Implementation of the streaming clustering of pixel hits.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include "cluster.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Unlinks an open root from the list of open roots. */
+static inline void
+unlink_open(struct katherine_clusterer *c, uint32_t s)
+{
+    struct katherine_cluster_slot *slot = &c->slots[s];
+
+    if (slot->prev != KATHERINE_CLUSTER_NONE) c->slots[slot->prev].next = slot->next;
+    else c->oldest = slot->next;
+
+    if (slot->next != KATHERINE_CLUSTER_NONE) c->slots[slot->next].prev = slot->prev;
+    else c->newest = slot->prev;
+}
+
+/* Links an open root at the end of the list of open roots, as the most
+   recently hit one. */
+static inline void
+link_newest(struct katherine_clusterer *c, uint32_t s)
+{
+    struct katherine_cluster_slot *slot = &c->slots[s];
+
+    slot->prev = c->newest;
+    slot->next = KATHERINE_CLUSTER_NONE;
+
+    if (c->newest != KATHERINE_CLUSTER_NONE) c->slots[c->newest].next = s;
+    else c->oldest = s;
+    c->newest = s;
+}
+
+/* Closes an open cluster: notes its record for emit and frees its slot, and
+   those of the clusters merged into it, which makes the pixels naming them
+   stale. */
+static void
+close_cluster(struct katherine_clusterer *c, uint32_t s)
+{
+    struct katherine_cluster_slot *slot = &c->slots[s];
+    katherine_cluster_t *out;
+
+    if (c->out_count == KATHERINE_CLUSTER_OUT) {
+        katherine_clusterer_deliver(c);
+    }
+
+    out            = &c->out[c->out_count++];
+    out->first_toa = slot->first_toa;
+    out->last_toa  = slot->last_toa;
+    out->size      = slot->size;
+    out->sum_tot   = slot->sum_tot;
+    out->min_x     = slot->min_x;
+    out->min_y     = slot->min_y;
+    out->max_x     = slot->max_x;
+    out->max_y     = slot->max_y;
+
+    // Without a ToT to weigh them by, all pixels weigh the same.
+    if (slot->sum_tot > 0) {
+        out->x = (float) ((double) slot->sum_wx / slot->sum_tot);
+        out->y = (float) ((double) slot->sum_wy / slot->sum_tot);
+    } else {
+        out->x = (float) ((double) slot->sum_x / slot->size);
+        out->y = (float) ((double) slot->sum_y / slot->size);
+    }
+
+    unlink_open(c, s);
+
+    for (uint32_t m = slot->merged, next; m != KATHERINE_CLUSTER_NONE; m = next) {
+        next               = c->slots[m].next_merged;
+        c->slots[m].serial = 0;
+        c->slots[m].next   = c->free;
+        c->free            = m;
+    }
+
+    slot->serial = 0;
+    slot->next   = c->free;
+    c->free      = s;
+}
+
+/* Opens an empty cluster, closing the least recently hit one if no slot is
+   free, and returns its slot. */
+static inline uint32_t
+open_cluster(struct katherine_clusterer *c)
+{
+    struct katherine_cluster_slot *slot;
+    uint32_t s;
+
+    if (c->free == KATHERINE_CLUSTER_NONE) {
+        close_cluster(c, c->oldest);
+    }
+
+    s       = c->free;
+    slot    = &c->slots[s];
+    c->free = slot->next;
+
+    if (++c->serial == 0) ++c->serial;
+
+    memset(slot, 0, sizeof(*slot));
+    slot->first_toa   = UINT64_MAX;
+    slot->min_x       = UINT8_MAX;
+    slot->min_y       = UINT8_MAX;
+    slot->serial      = c->serial;
+    slot->root        = s;
+    slot->merged      = KATHERINE_CLUSTER_NONE;
+    slot->next_merged = KATHERINE_CLUSTER_NONE;
+
+    link_newest(c, s);
+    return s;
+}
+
+/* Merges two open clusters, the smaller into the larger, and returns the
+   root of the merged one. */
+static uint32_t
+merge_clusters(struct katherine_clusterer *c, uint32_t a, uint32_t b)
+{
+    if (c->slots[a].size < c->slots[b].size) {
+        const uint32_t t = a;
+        a                = b;
+        b                = t;
+    }
+
+    struct katherine_cluster_slot *keep = &c->slots[a];
+    struct katherine_cluster_slot *gone = &c->slots[b];
+    uint32_t tail                       = b;
+
+    if (gone->first_toa < keep->first_toa) keep->first_toa = gone->first_toa;
+    if (gone->last_toa > keep->last_toa) keep->last_toa = gone->last_toa;
+    if (gone->min_x < keep->min_x) keep->min_x = gone->min_x;
+    if (gone->min_y < keep->min_y) keep->min_y = gone->min_y;
+    if (gone->max_x > keep->max_x) keep->max_x = gone->max_x;
+    if (gone->max_y > keep->max_y) keep->max_y = gone->max_y;
+    keep->sum_x += gone->sum_x;
+    keep->sum_y += gone->sum_y;
+    keep->sum_wx += gone->sum_wx;
+    keep->sum_wy += gone->sum_wy;
+    keep->size += gone->size;
+    keep->sum_tot += gone->sum_tot;
+
+    unlink_open(c, b);
+
+    // The merged cluster and all of those merged into it before forward to
+    // the root they join, ahead of the ones merged into it already.
+    gone->root        = a;
+    gone->next_merged = gone->merged;
+    for (uint32_t m = gone->merged; m != KATHERINE_CLUSTER_NONE; m = c->slots[m].next_merged) {
+        c->slots[m].root = a;
+        tail             = m;
+    }
+    c->slots[tail].next_merged = keep->merged;
+    keep->merged               = b;
+    gone->merged               = KATHERINE_CLUSTER_NONE;
+
+    return a;
+}
+
+/* Adds a hit to the open clusters. */
+static inline void
+add_hit(struct katherine_clusterer *c, const katherine_cluster_hit_t *hit)
+{
+    struct katherine_cluster_slot *slot;
+    struct katherine_cluster_cell *cell;
+    uint32_t root = KATHERINE_CLUSTER_NONE;
+
+    const int x0 = hit->x > 0 ? hit->x - 1 : 0;
+    const int x1 = hit->x < KATHERINE_FRAME_MAP_WIDTH - 1 ? hit->x + 1 : KATHERINE_FRAME_MAP_WIDTH - 1;
+    const int y0 = hit->y > 0 ? hit->y - 1 : 0;
+    const int y1 = hit->y < KATHERINE_FRAME_MAP_WIDTH - 1 ? hit->y + 1 : KATHERINE_FRAME_MAP_WIDTH - 1;
+
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            cell = &c->cells[y * KATHERINE_FRAME_MAP_WIDTH + x];
+            if (cell->serial == 0 || c->slots[cell->slot].serial != cell->serial) continue;
+            if ((hit->toa > cell->toa ? hit->toa - cell->toa : cell->toa - hit->toa) > c->toa_window) continue;
+
+            const uint32_t r = c->slots[cell->slot].root;
+            if (root == KATHERINE_CLUSTER_NONE) root = r;
+            else if (r != root) root = merge_clusters(c, root, r);
+        }
+    }
+
+    if (root == KATHERINE_CLUSTER_NONE) {
+        root = open_cluster(c);
+    } else {
+        unlink_open(c, root);
+        link_newest(c, root);
+    }
+
+    slot = &c->slots[root];
+    if (hit->toa < slot->first_toa) slot->first_toa = hit->toa;
+    if (hit->toa > slot->last_toa) slot->last_toa = hit->toa;
+    if (hit->x < slot->min_x) slot->min_x = hit->x;
+    if (hit->y < slot->min_y) slot->min_y = hit->y;
+    if (hit->x > slot->max_x) slot->max_x = hit->x;
+    if (hit->y > slot->max_y) slot->max_y = hit->y;
+    slot->sum_x += hit->x;
+    slot->sum_y += hit->y;
+    slot->sum_wx += (uint64_t) hit->x * hit->tot;
+    slot->sum_wy += (uint64_t) hit->y * hit->tot;
+    slot->sum_tot += hit->tot;
+    ++slot->size;
+
+    cell         = &c->cells[hit->y * KATHERINE_FRAME_MAP_WIDTH + hit->x];
+    cell->toa    = hit->toa;
+    cell->slot   = root;
+    cell->serial = slot->serial;
+
+    if (hit->toa > c->latest_toa) c->latest_toa = hit->toa;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Allocate a clustering stage.
+ * @param acq Acquisition to cluster the hits of
+ * @param clustering Parameters of the clustering, with max_open positive
+ * @param emit Function the closed clusters are handed to
+ * @return The stage, or NULL if out of memory.
+ */
+KATHERINE_NOT_EXPORTED struct katherine_clusterer *
+katherine_clusterer_new(katherine_acquisition_t *acq, const katherine_clustering_t *clustering, void (*emit)(katherine_acquisition_t *, const katherine_cluster_t *, size_t))
+{
+    struct katherine_clusterer *c = (struct katherine_clusterer *) calloc(1, sizeof(*c));
+    if (c == NULL) {
+        goto err_clusterer;
+    }
+
+    c->acq        = acq;
+    c->emit       = emit;
+    c->toa_window = clustering->toa_window;
+    c->capacity   = (uint32_t) clustering->max_open;
+    c->oldest     = KATHERINE_CLUSTER_NONE;
+    c->newest     = KATHERINE_CLUSTER_NONE;
+
+    c->slots = (struct katherine_cluster_slot *) calloc(c->capacity, sizeof(struct katherine_cluster_slot));
+    if (c->slots == NULL) {
+        goto err_slots;
+    }
+
+    c->cells = (struct katherine_cluster_cell *) calloc(KATHERINE_FRAME_MAP_SIZE, sizeof(struct katherine_cluster_cell));
+    if (c->cells == NULL) {
+        goto err_cells;
+    }
+
+    for (uint32_t s = 0; s < c->capacity; ++s) {
+        c->slots[s].next = s + 1 < c->capacity ? s + 1 : KATHERINE_CLUSTER_NONE;
+    }
+    c->free = 0;
+
+    return c;
+
+err_cells:
+    free(c->slots);
+err_slots:
+    free(c);
+err_clusterer:
+    return NULL;
+}
+
+/**
+ * Free a clustering stage, dropping the clusters it holds.
+ * @param c Stage to free, or NULL
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_clusterer_free(struct katherine_clusterer *c)
+{
+    if (c == NULL) {
+        return;
+    }
+
+    free(c->cells);
+    free(c->slots);
+    free(c);
+}
+
+/**
+ * Add hits to the clustering, in the order they arrived.
+ *
+ * Afterwards, the clusters which the stream has left behind are closed, least recently hit first:
+ * those whose last hit is more than the window before the latest hit seen.
+ *
+ * @param c Clustering stage
+ * @param hits Hits to add
+ * @param count Number of hits
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_clusterer_add(struct katherine_clusterer *c, const katherine_cluster_hit_t *hits, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        add_hit(c, &hits[i]);
+    }
+
+    while (c->oldest != KATHERINE_CLUSTER_NONE && c->slots[c->oldest].last_toa + c->toa_window < c->latest_toa) {
+        close_cluster(c, c->oldest);
+    }
+}
+
+/**
+ * Close all open clusters, as at the end of a frame.
+ *
+ * The closed clusters are handed to emit by the next katherine_clusterer_deliver(), or sooner, when
+ * enough of them pile up. The time of arrival may restart afterwards.
+ *
+ * @param c Clustering stage
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_clusterer_close_all(struct katherine_clusterer *c)
+{
+    while (c->oldest != KATHERINE_CLUSTER_NONE) {
+        close_cluster(c, c->oldest);
+    }
+
+    c->latest_toa = 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file
+ * @brief Internal streaming clustering of pixel hits.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Hits the decoder hands to the clustering at once, at most. */
+#define KATHERINE_CLUSTER_HITS 64
+
+/* Clusters delivered to the clusters_received handler at once, at most. */
+#define KATHERINE_CLUSTER_OUT 256
+
+/* Ends the lists of slots. */
+#define KATHERINE_CLUSTER_NONE UINT32_MAX
+
+/* A pixel hit, as the clustering takes it. */
+typedef struct katherine_cluster_hit {
+    uint64_t toa;
+    uint16_t tot;
+    uint8_t x;
+    uint8_t y;
+} katherine_cluster_hit_t;
+
+/* A cluster being built. Clusters which turn out to touch are merged into
+ * the larger of them, the root; the slot of the other one is kept until the
+ * root closes, and forwards the pixels which still name it to the root. */
+struct katherine_cluster_slot {
+    uint64_t first_toa;
+    uint64_t last_toa;
+    uint64_t sum_x;  // coordinates, summed
+    uint64_t sum_y;
+    uint64_t sum_wx; // coordinates weighted by the ToT, summed
+    uint64_t sum_wy;
+    uint32_t size;
+    uint32_t sum_tot;
+    uint8_t min_x, min_y, max_x, max_y;
+
+    uint32_t serial;      // of the cluster, zero while the slot is free
+    uint32_t root;        // slot the cluster was merged into, or its own
+    uint32_t prev, next;  // open roots by their last hit, or free slots (next only)
+    uint32_t merged;      // first slot merged into the root
+    uint32_t next_merged; // next slot merged into the same root
+};
+
+/* The last hit of a pixel: when, and which cluster it went to. */
+struct katherine_cluster_cell {
+    uint64_t toa;
+    uint32_t slot;
+    uint32_t serial; // of the cluster, which is stale once its slot is freed
+};
+
+/* A hit joins every open cluster it neighbours -- one of the eight pixels
+ * around it, or the pixel itself, was hit by the cluster no more than the
+ * window before or after -- merging them, or opens a cluster of its own.
+ * Clusters close, least recently hit first, once the stream has moved on by
+ * more than the window past their last hit, or to make room for a new one,
+ * and at the end of every frame. Closed clusters are collected and handed
+ * to emit in batches. Memory is bounded by the number of slots and by the
+ * map of the last hit of every pixel. */
+struct katherine_clusterer {
+    katherine_acquisition_t *acq;
+    void (*emit)(katherine_acquisition_t *acq, const katherine_cluster_t *clusters, size_t count);
+
+    uint64_t toa_window;
+    uint64_t latest_toa;
+    uint32_t serial;
+
+    struct katherine_cluster_slot *slots;
+    uint32_t capacity;
+    uint32_t free;   // stack of free slots
+    uint32_t oldest; // open roots, least recently hit first
+    uint32_t newest;
+
+    struct katherine_cluster_cell *cells; // KATHERINE_FRAME_MAP_SIZE of them
+
+    katherine_cluster_t out[KATHERINE_CLUSTER_OUT];
+    size_t out_count;
+};
+
+KATHERINE_NOT_EXPORTED struct katherine_clusterer *
+katherine_clusterer_new(katherine_acquisition_t *acq, const katherine_clustering_t *clustering, void (*emit)(katherine_acquisition_t *, const katherine_cluster_t *, size_t));
+
+KATHERINE_NOT_EXPORTED void
+katherine_clusterer_free(struct katherine_clusterer *c);
+
+KATHERINE_NOT_EXPORTED void
+katherine_clusterer_add(struct katherine_clusterer *c, const katherine_cluster_hit_t *hits, size_t count);
+
+KATHERINE_NOT_EXPORTED void
+katherine_clusterer_close_all(struct katherine_clusterer *c);
+
+/* Hands the clusters closed so far to emit. */
+static inline void
+katherine_clusterer_deliver(struct katherine_clusterer *c)
+{
+    if (c->out_count > 0) {
+        c->emit(c->acq, c->out, c->out_count);
+        c->out_count = 0;
+    }
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
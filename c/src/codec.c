@@ -0,0 +1,324 @@
+/**
+ * @file
+ * @brief Implementation of the compression of raw measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/codec.h>
+#include "md.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#define MD_HDR_PIXEL       0x4
+#define MD_HDR_TIME_OFFSET 0x5
+
+/* Bits of a datum below its header, and those of a pixel below its time of
+   arrival, which all pixel data have in the same place. */
+#define PAYLOAD_BITS 44
+#define LOW_BITS     14
+
+/* Longest encoding of a datum: a varint of the run it starts, and those of
+   a pixel -- three bytes of the change of time of arrival, two of the
+   coordinates and two of the rest. The payloads of the other data take
+   seven bytes at most. */
+#define MAX_ENCODED_MD 8
+
+/* Ways of coding the coordinates of a pixel, in the low bits of the change
+   of its time of arrival. */
+#define PIXEL_SAME_COLUMN 0 // the change of the row follows
+#define PIXEL_MOVED       1 // the column and the row follow, a byte each
+
+/* Longest varint of a 64-bit value. */
+#define MAX_VARINT 10
+
+static inline uint64_t
+load_md(const unsigned char *src)
+{
+    uint64_t md = 0;
+    memcpy(&md, src, KATHERINE_MD_SIZE);
+    return md;
+}
+
+static inline void
+store_md(unsigned char *dst, uint64_t md)
+{
+    memcpy(dst, &md, KATHERINE_MD_SIZE);
+}
+
+static inline uint64_t
+zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t
+unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* The change from `from` to `to` of a field of the given bits, which wraps
+   around, as the shortest signed difference. */
+static inline int64_t
+wrapped_delta(uint64_t to, uint64_t from, unsigned bits)
+{
+    const uint64_t d = (to - from) & MASK(bits);
+    return d >> (bits - 1) ? (int64_t) d - (int64_t) (1ull << bits) : (int64_t) d;
+}
+
+static inline unsigned char *
+put_varint(unsigned char *out, uint64_t v)
+{
+    while (v >= 0x80) {
+        *out++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char) v;
+    return out;
+}
+
+/* Reads a varint, or returns NULL if the input ends before it does. */
+static inline const unsigned char *
+get_varint(const unsigned char *in, const unsigned char *end, uint64_t *v)
+{
+    uint64_t value = 0;
+
+    for (unsigned shift = 0; in < end && shift < 7 * MAX_VARINT; shift += 7) {
+        const unsigned char byte = *in++;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *v = value;
+            return in;
+        }
+    }
+
+    return NULL;
+}
+
+static inline unsigned char *
+encode_pixel(katherine_md_codec_t *codec, unsigned char *out, uint64_t md)
+{
+    const uint8_t x    = (uint8_t) EXTRACT(md, pmd_toa_tot, coord_x);
+    const uint8_t y    = (uint8_t) EXTRACT(md, pmd_toa_tot, coord_y);
+    const uint16_t toa = EXTRACT(md, pmd_toa_tot, toa);
+
+    const uint64_t dt  = zigzag(wrapped_delta(toa, codec->toa, LOW_BITS));
+
+    // Data-driven readout goes down a column before it moves on, and a
+    // pixel near the one before it takes a byte rather than two.
+    if (x == codec->x) {
+        out = put_varint(out, (dt << 1) | PIXEL_SAME_COLUMN);
+        out = put_varint(out, zigzag((int64_t) y - codec->y));
+    } else {
+        out    = put_varint(out, (dt << 1) | PIXEL_MOVED);
+        out[0] = x;
+        out[1] = y;
+        out += 2;
+    }
+    out = put_varint(out, md & MASK(LOW_BITS));
+
+    codec->x   = x;
+    codec->y   = y;
+    codec->toa = toa;
+    return out;
+}
+
+static inline const unsigned char *
+decode_pixel(katherine_md_codec_t *codec, const unsigned char *in, const unsigned char *end, uint64_t *md)
+{
+    uint64_t dt, dy, low, toa;
+
+    if ((in = get_varint(in, end, &dt)) == NULL) return NULL;
+    toa = (uint64_t) (codec->toa + unzigzag(dt >> 1)) & MASK(LOW_BITS);
+
+    if ((dt & 1) == PIXEL_SAME_COLUMN) {
+        if ((in = get_varint(in, end, &dy)) == NULL) return NULL;
+        codec->y = (uint8_t) (codec->y + unzigzag(dy));
+    } else {
+        if (end - in < 2) return NULL;
+        codec->x = in[0];
+        codec->y = in[1];
+        in += 2;
+    }
+    if ((in = get_varint(in, end, &low)) == NULL) return NULL;
+
+    codec->toa = (uint16_t) toa;
+
+    *md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_PIXEL);
+    *md = INSERT(*md, pmd_toa_tot, coord_x, (uint64_t) codec->x);
+    *md = INSERT(*md, pmd_toa_tot, coord_y, (uint64_t) codec->y);
+    *md = INSERT(*md, pmd_toa_tot, toa, toa);
+    *md |= low & MASK(LOW_BITS);
+    return in;
+}
+
+static inline unsigned char *
+encode_other(katherine_md_codec_t *codec, unsigned char *out, uint64_t md, uint8_t header)
+{
+    const uint64_t payload = md & MASK(PAYLOAD_BITS);
+
+    if (header == MD_HDR_TIME_OFFSET) {
+        out           = put_varint(out, zigzag(wrapped_delta(payload, codec->offset, PAYLOAD_BITS)));
+        codec->offset = payload;
+        return out;
+    }
+
+    return put_varint(out, payload);
+}
+
+static inline const unsigned char *
+decode_other(katherine_md_codec_t *codec, const unsigned char *in, const unsigned char *end, uint64_t *md, uint8_t header)
+{
+    uint64_t payload;
+
+    if ((in = get_varint(in, end, &payload)) == NULL) return NULL;
+
+    if (header == MD_HDR_TIME_OFFSET) {
+        payload       = (uint64_t) (codec->offset + unzigzag(payload)) & MASK(PAYLOAD_BITS);
+        codec->offset = payload;
+    }
+
+    *md = INSERT(payload & MASK(PAYLOAD_BITS), md, header, (uint64_t) header);
+    return in;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Start a codec over, for the first block of a stream.
+ * @param codec Codec
+ */
+void
+katherine_md_codec_init(katherine_md_codec_t *codec)
+{
+    memset(codec, 0, sizeof(*codec));
+}
+
+/**
+ * Bytes a block of raw measurement data may take encoded, at most.
+ * @param length Bytes of the block
+ * @return Capacity of the output of katherine_md_encode() which always suffices.
+ */
+size_t
+katherine_md_codec_bound(size_t length)
+{
+    return length / KATHERINE_MD_SIZE * MAX_ENCODED_MD + 1 + KATHERINE_MD_SIZE;
+}
+
+/**
+ * Encode a block of raw measurement data.
+ * @param codec Codec, which carries the state of the stream over to the next block
+ * @param src Block, in wire order
+ * @param length Bytes of the block
+ * @param dst Output
+ * @param capacity Bytes of the output, katherine_md_codec_bound() of the length at least
+ * @param written Bytes of the encoded block
+ * @return Error code: ENOBUFS if the output is too short.
+ */
+int
+katherine_md_encode(katherine_md_codec_t *codec, const void *src, size_t length, void *dst, size_t capacity, size_t *written)
+{
+    const unsigned char *in = (const unsigned char *) src;
+    unsigned char *out      = (unsigned char *) dst;
+    const size_t count      = length / KATHERINE_MD_SIZE;
+    const size_t tail       = length % KATHERINE_MD_SIZE;
+    size_t i                = 0;
+    size_t run;
+
+    *written = 0;
+    if (capacity < katherine_md_codec_bound(length)) {
+        return ENOBUFS;
+    }
+
+    while (i < count) {
+        const uint8_t header = EXTRACT(load_md(in + i * KATHERINE_MD_SIZE), md, header);
+
+        for (run = 1; i + run < count && EXTRACT(load_md(in + (i + run) * KATHERINE_MD_SIZE), md, header) == header; ++run) { }
+        out = put_varint(out, ((uint64_t) run << 4) | header);
+
+        if (header == MD_HDR_PIXEL) {
+            for (; run > 0; --run, ++i) {
+                out = encode_pixel(codec, out, load_md(in + i * KATHERINE_MD_SIZE));
+            }
+        } else {
+            for (; run > 0; --run, ++i) {
+                out = encode_other(codec, out, load_md(in + i * KATHERINE_MD_SIZE), header);
+            }
+        }
+    }
+
+    if (tail > 0) {
+        out = put_varint(out, tail);
+        memcpy(out, in + count * KATHERINE_MD_SIZE, tail);
+        out += tail;
+    }
+
+    *written = (size_t) (out - (unsigned char *) dst);
+    return 0;
+}
+
+/**
+ * Decode a block of raw measurement data.
+ * @param codec Codec, in the state the encoding one was in when it encoded the block
+ * @param src Encoded block
+ * @param length Bytes of the encoded block
+ * @param dst Output
+ * @param capacity Bytes of the output
+ * @param written Bytes of the decoded block
+ * @return Error code: ENOBUFS if the output is too short, EPROTO if the block is malformed.
+ */
+int
+katherine_md_decode(katherine_md_codec_t *codec, const void *src, size_t length, void *dst, size_t capacity, size_t *written)
+{
+    const unsigned char *in  = (const unsigned char *) src;
+    const unsigned char *end = in + length;
+    unsigned char *out       = (unsigned char *) dst;
+    unsigned char *out_end   = out + capacity;
+    uint64_t token, md;
+
+    *written = 0;
+
+    while (in < end) {
+        if ((in = get_varint(in, end, &token)) == NULL) return EPROTO;
+
+        const uint8_t header = (uint8_t) (token & 0xF);
+        const uint64_t run   = token >> 4;
+
+        // A fragment of a datum, which ends the block.
+        if (run == 0) {
+            if (header == 0 || header >= KATHERINE_MD_SIZE || (size_t) (end - in) != header) return EPROTO;
+            if ((size_t) (out_end - out) < header) return ENOBUFS;
+            memcpy(out, in, header);
+            out += header;
+            in += header;
+            break;
+        }
+
+        if (run > (uint64_t) (out_end - out) / KATHERINE_MD_SIZE) return ENOBUFS;
+
+        if (header == MD_HDR_PIXEL) {
+            for (uint64_t k = 0; k < run; ++k, out += KATHERINE_MD_SIZE) {
+                if ((in = decode_pixel(codec, in, end, &md)) == NULL) return EPROTO;
+                store_md(out, md);
+            }
+        } else {
+            for (uint64_t k = 0; k < run; ++k, out += KATHERINE_MD_SIZE) {
+                if ((in = decode_other(codec, in, end, &md, header)) == NULL) return EPROTO;
+                store_md(out, md);
+            }
+        }
+    }
+
+    *written = (size_t) (out - (unsigned char *) dst);
+    return 0;
+}
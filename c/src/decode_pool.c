@@ -0,0 +1,294 @@
+/**
+ * @file
+ * @brief Implementation of the pool of threads decoding measurement data in parallel.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include "decode_pool.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Maps the datagrams of the current batch which fall to the given worker,
+   each of them no further than its slot holds. */
+static void
+decode_share(struct katherine_decode_pool *pool, size_t index)
+{
+    const size_t max_length = pool->slot_mds * KATHERINE_MD_SIZE;
+
+    for (size_t i = index; i < pool->count; i += pool->threads) {
+        char *px            = pool->pixels + i * pool->slot_mds * pool->px_size;
+        uint32_t *marks     = pool->marks + i * pool->slot_mds;
+        const size_t length = pool->lengths[i] < max_length ? pool->lengths[i] : max_length;
+
+        pool->marked[i] = pool->decode(&pool->mapping, pool->data[i], length, px, marks);
+    }
+}
+
+/* Waits for a batch after the generation `seen`, and returns its generation,
+   or `seen` once the reader has raised the stop flag instead. */
+static uint64_t
+await_batch(struct katherine_decode_pool *pool, uint64_t seen)
+{
+    uint64_t generation;
+
+    for (unsigned rounds = 0; rounds < KATHERINE_DECODE_SPINS; ++rounds) {
+        generation = katherine_atomic_load(&pool->generation);
+        if (generation != seen || katherine_atomic_load(&pool->stop)) {
+            return generation;
+        }
+        katherine_thread_yield();
+    }
+
+    katherine_mutex_lock(&pool->lock);
+    while ((generation = katherine_atomic_load(&pool->generation)) == seen && !katherine_atomic_load(&pool->stop)) {
+        katherine_cond_wait(&pool->batch_ready, &pool->lock);
+    }
+    katherine_mutex_unlock(&pool->lock);
+    return generation;
+}
+
+/* Raises the generation or the stop flag, and wakes the workers asleep. */
+static void
+publish(struct katherine_decode_pool *pool, uint64_t *counter, uint64_t value)
+{
+    katherine_mutex_lock(&pool->lock);
+    katherine_atomic_store(counter, value);
+    katherine_cond_broadcast(&pool->batch_ready);
+    katherine_mutex_unlock(&pool->lock);
+}
+
+/* Body of a worker: decodes its share of every batch handed out, until the
+   reader raises the stop flag between two batches. */
+static void
+work(void *arg)
+{
+    struct katherine_decode_worker *w  = (struct katherine_decode_worker *) arg;
+    struct katherine_decode_pool *pool = w->pool;
+    const uint64_t workers             = pool->threads - 1;
+
+    uint64_t seen = 0;
+
+    for (;;) {
+        const uint64_t generation = await_batch(pool, seen);
+        if (generation == seen) {
+            return;
+        }
+        seen = generation;
+
+        decode_share(pool, w->index);
+
+        // The reader may be asleep by now; the lock keeps it from falling
+        // asleep between testing the count and waiting.
+        if (katherine_atomic_fetch_add(&pool->done, 1) + 1 == workers) {
+            katherine_mutex_lock(&pool->lock);
+            katherine_cond_signal(&pool->batch_done);
+            katherine_mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Start the workers of a decoding pool.
+ * @param pool Decoding pool of the acquisition being read
+ * @param acq Acquisition being read
+ * @return Error code.
+ */
+KATHERINE_NOT_EXPORTED int
+katherine_decode_pool_start(struct katherine_decode_pool *pool, const katherine_acquisition_t *acq)
+{
+    int res = 0;
+    size_t i;
+
+    pool->mapping.timestamp_unit = acq->timestamp_unit;
+    pool->mapping.toa_shift      = acq->toa_shift;
+
+    pool->generation = 0;
+    pool->done       = 0;
+    pool->stop       = 0;
+
+    for (i = 1; i < pool->threads; ++i) {
+        res = katherine_thread_create(&pool->workers[i].thread, work, &pool->workers[i]);
+        if (res) break;
+    }
+
+    if (res) {
+        publish(pool, &pool->stop, 1);
+        while (--i > 0) {
+            katherine_thread_join(&pool->workers[i].thread);
+        }
+        return res;
+    }
+
+    pool->running = true;
+    return 0;
+}
+
+/**
+ * Stop the workers of a decoding pool and wait for them to end.
+ * @param pool Decoding pool of the acquisition being read
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_decode_pool_stop(struct katherine_decode_pool *pool)
+{
+    publish(pool, &pool->stop, 1);
+    for (size_t i = 1; i < pool->threads; ++i) {
+        katherine_thread_join(&pool->workers[i].thread);
+    }
+
+    pool->running = false;
+}
+
+/**
+ * Map the pixels of a batch of datagrams in parallel, and wait until they are.
+ *
+ * The calling thread decodes a share of the batch too. Afterwards, the pixels and the marks of each
+ * datagram are found by katherine_decode_pool_pixels() and katherine_decode_pool_marks().
+ *
+ * @param pool Running decoding pool
+ * @param data Datagrams of the batch
+ * @param lengths Lengths of the datagrams
+ * @param count Number of datagrams, at most KATHERINE_MD_BATCH_MAX
+ * @param decode Function decoding one datagram
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_decode_pool_run(struct katherine_decode_pool *pool, const char *const *data, const size_t *lengths, size_t count, katherine_decode_fn decode)
+{
+    const uint64_t workers = pool->threads - 1;
+
+    pool->data    = data;
+    pool->lengths = lengths;
+    pool->count   = count;
+    pool->decode  = decode;
+
+    katherine_atomic_store(&pool->done, 0);
+    publish(pool, &pool->generation, pool->generation + 1);
+
+    decode_share(pool, 0);
+
+    for (unsigned rounds = 0; rounds < KATHERINE_DECODE_SPINS; ++rounds) {
+        if (katherine_atomic_load(&pool->done) == workers) {
+            return;
+        }
+        katherine_thread_yield();
+    }
+
+    katherine_mutex_lock(&pool->lock);
+    while (katherine_atomic_load(&pool->done) < workers) {
+        katherine_cond_wait(&pool->batch_done, &pool->lock);
+    }
+    katherine_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Enable or disable the parallel decoding of an acquisition.
+ *
+ * With parallel decoding, katherine_acquisition_read() starts the given number of threads less one
+ * for the duration of the read, and splits each batch of received datagrams between them and the
+ * calling thread. Each one maps the pixels of its datagrams; the calling thread then resolves the
+ * timestamp offsets and frame boundaries in stream order and runs the handlers, so that they see
+ * exactly what the serial decoder would deliver. The plain and the pipelined read decode in
+ * parallel alike, the step-wise read (katherine_acquisition_pump()) always decodes serially.
+ *
+ * Only the pixel records of the default layout are decoded in parallel; acquisitions delivering the
+ * columnar or the packed layouts (see katherine_acquisition_set_px_layout()) stay serial.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param threads Threads decoding the data, including the one that reads, or zero or one to go back to the serial decoder
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_decode_threads(katherine_acquisition_t *acq, size_t threads)
+{
+    struct katherine_decode_pool *pool = acq->decode_pool;
+
+    if (pool != NULL) {
+        katherine_cond_destroy(&pool->batch_done);
+        katherine_cond_destroy(&pool->batch_ready);
+        katherine_mutex_destroy(&pool->lock);
+        free(pool->marks);
+        free(pool->pixels);
+        free(pool->workers);
+        free(pool);
+        acq->decode_pool = NULL;
+    }
+
+    if (threads <= 1) {
+        return 0;
+    }
+
+    pool = (struct katherine_decode_pool *) calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        goto err_pool;
+    }
+
+    pool->threads  = threads;
+    pool->slot_mds = KATHERINE_MD_DATAGRAM_MAX_SIZE / KATHERINE_MD_SIZE;
+    pool->px_size  = sizeof(katherine_px_f_toa_tot_t);
+    if (pool->px_size < sizeof(katherine_px_toa_tot_t)) pool->px_size = sizeof(katherine_px_toa_tot_t);
+    if (pool->px_size < sizeof(katherine_px_f_toa_only_t)) pool->px_size = sizeof(katherine_px_f_toa_only_t);
+    if (pool->px_size < sizeof(katherine_px_toa_only_t)) pool->px_size = sizeof(katherine_px_toa_only_t);
+    if (pool->px_size < sizeof(katherine_px_f_event_itot_t)) pool->px_size = sizeof(katherine_px_f_event_itot_t);
+    if (pool->px_size < sizeof(katherine_px_event_itot_t)) pool->px_size = sizeof(katherine_px_event_itot_t);
+
+    pool->workers = (struct katherine_decode_worker *) calloc(threads, sizeof(struct katherine_decode_worker));
+    if (pool->workers == NULL) {
+        goto err_workers;
+    }
+
+    for (size_t i = 0; i < threads; ++i) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+    }
+
+    pool->pixels = (char *) malloc(KATHERINE_MD_BATCH_MAX * pool->slot_mds * pool->px_size);
+    if (pool->pixels == NULL) {
+        goto err_pixels;
+    }
+
+    pool->marks = (uint32_t *) malloc(KATHERINE_MD_BATCH_MAX * pool->slot_mds * sizeof(uint32_t));
+    if (pool->marks == NULL) {
+        goto err_marks;
+    }
+
+    if (katherine_mutex_init(&pool->lock) != 0) {
+        goto err_lock;
+    }
+    if (katherine_cond_init(&pool->batch_ready) != 0) {
+        goto err_batch_ready;
+    }
+    if (katherine_cond_init(&pool->batch_done) != 0) {
+        goto err_batch_done;
+    }
+
+    acq->decode_pool = pool;
+    return 0;
+
+err_batch_done:
+    katherine_cond_destroy(&pool->batch_ready);
+err_batch_ready:
+    katherine_mutex_destroy(&pool->lock);
+err_lock:
+    free(pool->marks);
+err_marks:
+    free(pool->pixels);
+err_pixels:
+    free(pool->workers);
+err_workers:
+    free(pool);
+err_pool:
+    return ENOMEM;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file
+ * @brief Internal pool of threads decoding measurement data in parallel.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+#include "pipeline.h"
+#include "thread.h"
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Maps the pixels of one datagram of `length` bytes to consecutive records
+ * at `px`, as `acq` would, and notes the indices of the other data of the
+ * datagram in `marks`. Returns the number of marks. */
+typedef size_t (*katherine_decode_fn)(const katherine_acquisition_t *acq, const char *data, size_t length, void *px, uint32_t *marks);
+
+/* Rounds a side of the pool yields the processor for before it sleeps. */
+#define KATHERINE_DECODE_SPINS 64
+
+struct katherine_decode_pool;
+
+struct katherine_decode_worker {
+    struct katherine_decode_pool *pool;
+    katherine_thread_t thread;
+    size_t index;
+};
+
+/* A parallel decode splits each batch of datagrams between the thread that
+ * reads the acquisition and the workers of the pool, round robin, and each
+ * of them maps the pixels of its datagrams on its own. Only the pixels are
+ * mapped, and with no timestamp offset, which is the one piece of state they
+ * depend on that changes in the course of a read; the reader then walks the batch in order, handles the other
+ * data (offsets, frame boundaries, ...) between the runs of mapped pixels
+ * as the serial decoder does, and adds the offset in effect to each run as
+ * it moves it to the pixel buffer.
+ *
+ * A batch is handed out by raising the generation, and the workers report
+ * back by counting themselves done. Either side waits for the other one
+ * spinning for KATHERINE_DECODE_SPINS rounds, which a batch following close
+ * behind the last one ends, and then on a condition variable, which the
+ * other side wakes the moment it is done: a wait never oversleeps the hand
+ * off, as a sleeping backoff would by up to a whole sleep per batch. */
+struct katherine_decode_pool {
+    struct katherine_decode_worker *workers;
+    size_t threads;  // including the reader, which is worker zero
+    size_t slot_mds; // data of the largest datagram, whatever the slots of the acquisition
+    size_t px_size;  // of the largest pixel record
+    bool running;
+
+    // What the workers map pixels against: the timestamp unit of the
+    // acquisition being read, and a timestamp offset of zero.
+    katherine_acquisition_t mapping;
+
+    char *pixels;    // slot_mds records per datagram of a batch
+    uint32_t *marks; // slot_mds indices per datagram of a batch
+    size_t marked[KATHERINE_MD_BATCH_MAX];
+
+    // The batch being decoded, published by raising the generation.
+    const char *const *data;
+    const size_t *lengths;
+    size_t count;
+    katherine_decode_fn decode;
+
+    uint64_t generation; // written by the reader
+    char pad_generation[KATHERINE_CACHE_LINE - sizeof(uint64_t)];
+
+    uint64_t done; // workers done with the generation
+    char pad_done[KATHERINE_CACHE_LINE - sizeof(uint64_t)];
+
+    uint64_t stop; // raised by the reader to end the workers
+
+    // Wake-ups of the waits which outlast their spin.
+    katherine_mutex_t lock;
+    katherine_cond_t batch_ready; // the generation raised, or the stop flag
+    katherine_cond_t batch_done;  // the last worker done with the generation
+};
+
+KATHERINE_NOT_EXPORTED int
+katherine_decode_pool_start(struct katherine_decode_pool *pool, const katherine_acquisition_t *acq);
+
+KATHERINE_NOT_EXPORTED void
+katherine_decode_pool_stop(struct katherine_decode_pool *pool);
+
+KATHERINE_NOT_EXPORTED void
+katherine_decode_pool_run(struct katherine_decode_pool *pool, const char *const *data, const size_t *lengths, size_t count, katherine_decode_fn decode);
+
+/* Whether the pool maps the whole of a datagram of the given length. A longer
+   one, which no datagram received from the device is, is mapped only as far
+   as its slot reaches, and has to be decoded serially instead. */
+static inline bool
+katherine_decode_pool_fits(const struct katherine_decode_pool *pool, size_t length)
+{
+    return length <= pool->slot_mds * KATHERINE_MD_SIZE;
+}
+
+/* The pixels mapped from a datagram of the last batch. */
+static inline const void *
+katherine_decode_pool_pixels(const struct katherine_decode_pool *pool, size_t datagram)
+{
+    return pool->pixels + datagram * pool->slot_mds * pool->px_size;
+}
+
+/* The indices of the other data of a datagram of the last batch. */
+static inline const uint32_t *
+katherine_decode_pool_marks(const struct katherine_decode_pool *pool, size_t datagram)
+{
+    return pool->marks + datagram * pool->slot_mds;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
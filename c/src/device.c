@@ -32,6 +32,25 @@ static const uint32_t DATA_TIMEOUT    = 100; // ms
  */
 int
 katherine_device_init(katherine_device_t *device, const char *addr)
+{
+    return katherine_device_init_tuned(device, addr, NULL, NULL);
+}
+
+/**
+ * Initialize Katherine device, tuning its data socket for a high-rate readout.
+ *
+ * The data socket is tuned by katherine_udp_tune(), which leaves the options the host refuses as
+ * they were. A timeout of zero in the tuning keeps the default timeout of the data socket. The
+ * ports are not tunable, as the readout streams to a fixed one.
+ *
+ * @param device Katherine device
+ * @param addr IP address
+ * @param data_tuning Tuning of the data socket, or NULL to leave it untuned
+ * @param granted Tuning of the data socket in effect afterwards, or NULL
+ * @return Error code.
+ */
+int
+katherine_device_init_tuned(katherine_device_t *device, const char *addr, const katherine_udp_tuning_t *data_tuning, katherine_udp_tuning_t *granted)
 {
     int res;
 
@@ -55,8 +74,23 @@ katherine_device_init(katherine_device_t *device, const char *addr)
 
     katherine_udp_pin_remote(&device->data_socket);
 
+    // The measurement data are streamed faster than anything else, and a
+    // host that falls behind them loses datagrams in its own network stack.
+    // Counting those is best effort: where the platform cannot, the host
+    // drops simply stay unreported.
+    (void) katherine_udp_track_drops(&device->data_socket);
+
+    if (data_tuning != NULL || granted != NULL) {
+        const katherine_udp_tuning_t untuned = KATHERINE_UDP_TUNING_INIT;
+        if ((res = katherine_udp_tune(&device->data_socket, data_tuning != NULL ? data_tuning : &untuned, granted)) != 0) {
+            goto err_tune;
+        }
+    }
+
     return 0;
 
+err_tune:
+    katherine_udp_fini(&device->data_socket);
 err_data:
     katherine_udp_fini(&device->control_socket);
 err_control:
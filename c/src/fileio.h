@@ -0,0 +1,46 @@
+/**
+ * @file
+ * @brief Internal seeking in files past the range of a long.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <katherine/global.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#ifdef KATHERINE_NIX
+#include <sys/types.h>
+#endif
+
+/* Like fseek(), but with an offset of 64 bits, which a long is not on
+ * Windows nor on 32-bit POSIX systems. There, fseeko() only takes one if
+ * the file including this header defines _FILE_OFFSET_BITS to 64 (and
+ * _POSIX_C_SOURCE, to declare it) before its first include. */
+static inline int
+katherine_fseek(FILE *file, int64_t offset, int whence)
+{
+#ifdef KATHERINE_WIN
+    return _fseeki64(file, (__int64) offset, whence);
+#else
+    return fseeko(file, (off_t) offset, whence);
+#endif
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
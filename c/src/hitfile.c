@@ -0,0 +1,587 @@
+/**
+ * @file
+ * @brief Implementation of columnar files of decoded hits.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// fseeko() is POSIX, and takes offsets of 64 bits on 32-bit systems only with
+// the large file macro, so both must precede the first libc include.
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/hitfile.h>
+#include "fileio.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* The columns of a chunk, in the order they are stored: the widest first,
+   so that each is aligned in a chunk aligned to CHUNK_ALIGNMENT. */
+#define HITFILE_COLUMNS(COLUMN) \
+    COLUMN(toa, KATHERINE_HIT_TOA, uint64_t) \
+    COLUMN(tot, KATHERINE_HIT_TOT, uint16_t) \
+    COLUMN(event_count, KATHERINE_HIT_EVENT_COUNT, uint16_t) \
+    COLUMN(integral_tot, KATHERINE_HIT_INTEGRAL_TOT, uint16_t) \
+    COLUMN(x, KATHERINE_HIT_X, uint8_t) \
+    COLUMN(y, KATHERINE_HIT_Y, uint8_t) \
+    COLUMN(ftoa, KATHERINE_HIT_FTOA, uint8_t) \
+    COLUMN(hit_count, KATHERINE_HIT_HIT_COUNT, uint8_t)
+
+#define CHUNK_ALIGNMENT 8
+
+/* The columns of the pixels of an acquisition mode, as in the columnar
+   layout of the acquisition. */
+static uint32_t
+mode_columns(katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled)
+{
+    const uint32_t coords = KATHERINE_HIT_X | KATHERINE_HIT_Y;
+
+    switch (acq_mode) {
+    case ACQUISITION_MODE_TOA_TOT:    return coords | KATHERINE_HIT_TOA | KATHERINE_HIT_TOT | (fast_vco_enabled ? KATHERINE_HIT_FTOA : KATHERINE_HIT_HIT_COUNT);
+    case ACQUISITION_MODE_ONLY_TOA:   return coords | KATHERINE_HIT_TOA | (fast_vco_enabled ? KATHERINE_HIT_FTOA : KATHERINE_HIT_HIT_COUNT);
+    case ACQUISITION_MODE_EVENT_ITOT: return coords | KATHERINE_HIT_EVENT_COUNT | KATHERINE_HIT_INTEGRAL_TOT | (fast_vco_enabled ? KATHERINE_HIT_HIT_COUNT : 0);
+    default:                          return 0;
+    }
+}
+
+/* Bytes of a hit, over the given columns. */
+static size_t
+hit_size(uint32_t columns)
+{
+    size_t size = 0;
+
+#define SIZE(NAME, FLAG, TYPE) \
+    if (columns & (FLAG)) size += sizeof(TYPE);
+
+    HITFILE_COLUMNS(SIZE)
+
+#undef SIZE
+
+    return size;
+}
+
+/* Bytes of a chunk of the given hits in the file. */
+static inline uint64_t
+chunk_bytes(uint32_t columns, uint32_t count)
+{
+    return ((uint64_t) count * hit_size(columns) + CHUNK_ALIGNMENT - 1) & ~(uint64_t) (CHUNK_ALIGNMENT - 1);
+}
+
+/* Points the arrays of the given columns into a buffer of hits of the given
+   capacity, and the others to NULL. */
+static void
+carve(katherine_px_columns_t *c, char *buffer, uint32_t columns, size_t capacity)
+{
+    char *it = buffer;
+
+    memset(c, 0, sizeof(*c));
+
+#define CARVE(NAME, FLAG, TYPE) \
+    if (columns & (FLAG)) { \
+        c->NAME = (TYPE *) it; \
+        it += capacity * sizeof(TYPE); \
+    }
+
+    HITFILE_COLUMNS(CARVE)
+
+#undef CARVE
+}
+
+/* Writes the chunk being filled, and adds it to the index. */
+static int
+write_chunk(katherine_hitfile_writer_t *w)
+{
+    static const char padding[CHUNK_ALIGNMENT] = { 0 };
+    const katherine_px_columns_t *c            = &w->chunk;
+    const uint32_t columns                     = w->header.columns;
+    const uint32_t count                       = (uint32_t) c->count;
+    const uint64_t bytes                       = chunk_bytes(columns, count);
+    katherine_hitfile_chunk_t entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = w->offset;
+    entry.count  = count;
+    entry.min_x  = entry.min_y = UINT8_MAX;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (c->x[i] < entry.min_x) entry.min_x = c->x[i];
+        if (c->x[i] > entry.max_x) entry.max_x = c->x[i];
+        if (c->y[i] < entry.min_y) entry.min_y = c->y[i];
+        if (c->y[i] > entry.max_y) entry.max_y = c->y[i];
+    }
+    if (columns & KATHERINE_HIT_TOA) {
+        entry.min_toa = UINT64_MAX;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (c->toa[i] < entry.min_toa) entry.min_toa = c->toa[i];
+            if (c->toa[i] > entry.max_toa) entry.max_toa = c->toa[i];
+        }
+    }
+
+#define WRITE(NAME, FLAG, TYPE) \
+    if ((columns & (FLAG)) && fwrite(c->NAME, sizeof(TYPE), count, w->file) != count) { \
+        return EIO; \
+    }
+
+    HITFILE_COLUMNS(WRITE)
+
+#undef WRITE
+
+    const size_t pad = (size_t) (bytes - (uint64_t) count * hit_size(columns));
+    if (pad > 0 && fwrite(padding, 1, pad, w->file) != pad) {
+        return EIO;
+    }
+
+    if (w->chunk_count == w->chunk_capacity) {
+        const size_t capacity              = w->chunk_capacity > 0 ? 2 * w->chunk_capacity : 64;
+        katherine_hitfile_chunk_t *resized = (katherine_hitfile_chunk_t *) realloc(w->chunks, capacity * sizeof(katherine_hitfile_chunk_t));
+        if (resized == NULL) return ENOMEM;
+
+        w->chunks         = resized;
+        w->chunk_capacity = capacity;
+    }
+
+    w->chunks[w->chunk_count++] = entry;
+    w->offset += bytes;
+    w->hits += count;
+    w->chunk.count = 0;
+    return 0;
+}
+
+/* Whether the hit of a chunk read is within the ranges of a query. */
+static inline bool
+hit_matches(const katherine_px_columns_t *c, size_t i, const katherine_hitfile_query_t *q)
+{
+    if (c->x[i] < q->min_x || c->x[i] > q->max_x) return false;
+    if (c->y[i] < q->min_y || c->y[i] > q->max_y) return false;
+    if (c->toa != NULL && (c->toa[i] < q->min_toa || c->toa[i] > q->max_toa)) return false;
+    return true;
+}
+
+/* Whether all hits of a chunk are within the ranges of a query. */
+static inline bool
+chunk_within(const katherine_hitfile_t *f, const katherine_hitfile_chunk_t *chunk, const katherine_hitfile_query_t *q)
+{
+    if (chunk->min_x < q->min_x || chunk->max_x > q->max_x) return false;
+    if (chunk->min_y < q->min_y || chunk->max_y > q->max_y) return false;
+    if ((f->header.columns & KATHERINE_HIT_TOA) && (chunk->min_toa < q->min_toa || chunk->max_toa > q->max_toa)) return false;
+    return true;
+}
+
+/* Moves the hits of the chunk read which are within the ranges of a query
+   to its front. */
+static void
+select_hits(katherine_px_columns_t *c, const katherine_hitfile_query_t *q)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < c->count; ++i) {
+        if (!hit_matches(c, i, q)) continue;
+
+        if (kept != i) {
+#define MOVE(NAME, FLAG, TYPE) \
+    if (c->NAME != NULL) c->NAME[kept] = c->NAME[i];
+
+            HITFILE_COLUMNS(MOVE)
+
+#undef MOVE
+        }
+        ++kept;
+    }
+
+    c->count = kept;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Create a hit file and start writing it.
+ *
+ * The file holds the columns of the pixels of the given mode, as the columnar layout delivers them
+ * (see katherine_acquisition_set_px_layout()), so that the pixel_columns_received handler may pass
+ * them on to katherine_hitfile_write() as they are.
+ *
+ * @param writer Writer to initialize
+ * @param file_path Path of the file, which is overwritten
+ * @param acq_mode Mode of the acquisition the hits are from
+ * @param fast_vco_enabled Whether it runs with the fast VCO
+ * @param timestamp_unit Unit of the times of arrival of the hits
+ * @param chunk_size Hits of a chunk, or zero for KATHERINE_HITFILE_DEFAULT_CHUNK_SIZE
+ * @return Error code: EINVAL if the mode is not known, or the chunks too large.
+ */
+int
+katherine_hitfile_create(katherine_hitfile_writer_t *writer, const char *file_path, katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled, katherine_timestamp_unit_t timestamp_unit, size_t chunk_size)
+{
+    int res                = 0;
+    const uint32_t columns = mode_columns(acq_mode, fast_vco_enabled);
+
+    memset(writer, 0, sizeof(*writer));
+
+    if (chunk_size == 0) {
+        chunk_size = KATHERINE_HITFILE_DEFAULT_CHUNK_SIZE;
+    }
+    if (columns == 0 || chunk_size > UINT32_MAX) {
+        return EINVAL;
+    }
+
+    writer->buffer = (char *) malloc(chunk_size * hit_size(columns));
+    if (writer->buffer == NULL) {
+        res = ENOMEM;
+        goto err_buffer;
+    }
+    carve(&writer->chunk, writer->buffer, columns, chunk_size);
+
+    writer->file = fopen(file_path, "wb");
+    if (writer->file == NULL) {
+        res = errno;
+        goto err_fopen;
+    }
+
+    katherine_hitfile_header_t *h = &writer->header;
+    memcpy(h->magic, KATHERINE_HITFILE_MAGIC, sizeof(KATHERINE_HITFILE_MAGIC));
+    h->byte_order       = 0x01020304;
+    h->format           = KATHERINE_HITFILE_FORMAT;
+    h->header_size      = sizeof(*h);
+    h->columns          = columns;
+    h->chunk_size       = (uint32_t) chunk_size;
+    h->acq_mode         = (char) acq_mode;
+    h->fast_vco_enabled = fast_vco_enabled;
+    h->timestamp_unit   = (char) timestamp_unit;
+
+    if (fwrite(h, sizeof(*h), 1, writer->file) != 1) {
+        res = EIO;
+        goto err_header;
+    }
+    writer->offset = sizeof(*h);
+
+    return 0;
+
+err_header:
+    fclose(writer->file);
+    remove(file_path);
+err_fopen:
+    free(writer->buffer);
+err_buffer:
+    memset(writer, 0, sizeof(*writer));
+    return res;
+}
+
+/**
+ * Write hits to a hit file.
+ *
+ * The hits are copied to the chunk being filled, which is written once full.
+ *
+ * @param writer Open writer
+ * @param hits Columns of the hits, which must have the arrays of the columns of the file
+ * @return Error code: EINVAL if a column of the file is missing.
+ */
+int
+katherine_hitfile_write(katherine_hitfile_writer_t *writer, const katherine_px_columns_t *hits)
+{
+    const uint32_t columns    = writer->header.columns;
+    katherine_px_columns_t *c = &writer->chunk;
+    size_t from               = 0;
+    int res;
+
+#define CHECK(NAME, FLAG, TYPE) \
+    if ((columns & (FLAG)) && hits->NAME == NULL && hits->count > 0) return EINVAL;
+
+    HITFILE_COLUMNS(CHECK)
+
+#undef CHECK
+
+    while (from < hits->count) {
+        size_t n = writer->header.chunk_size - c->count;
+        if (n > hits->count - from) n = hits->count - from;
+
+#define COPY(NAME, FLAG, TYPE) \
+    if (columns & (FLAG)) memcpy(c->NAME + c->count, hits->NAME + from, n * sizeof(TYPE));
+
+        HITFILE_COLUMNS(COPY)
+
+#undef COPY
+
+        c->count += n;
+        from += n;
+
+        if (c->count == writer->header.chunk_size) {
+            res = write_chunk(writer);
+            if (res) return res;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Finish a hit file: write the chunk being filled, the index of the chunks, and close the file.
+ * @param writer Open writer, which is closed even if an error is reported
+ * @return Error code: the first error in writing the file, if any.
+ */
+int
+katherine_hitfile_finish(katherine_hitfile_writer_t *writer)
+{
+    katherine_hitfile_trailer_t trailer;
+    int res = 0;
+
+    if (writer->file == NULL) {
+        return 0;
+    }
+
+    if (writer->chunk.count > 0) {
+        res = write_chunk(writer);
+    }
+
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.index_offset = writer->offset;
+    trailer.chunks       = writer->chunk_count;
+    trailer.hits         = writer->hits;
+    memcpy(trailer.magic, KATHERINE_HITFILE_TRAILER_MAGIC, sizeof(KATHERINE_HITFILE_TRAILER_MAGIC));
+
+    if (res == 0 && writer->chunk_count > 0 && fwrite(writer->chunks, sizeof(katherine_hitfile_chunk_t), writer->chunk_count, writer->file) != writer->chunk_count) {
+        res = EIO;
+    }
+    if (res == 0 && fwrite(&trailer, sizeof(trailer), 1, writer->file) != 1) {
+        res = EIO;
+    }
+    if (fclose(writer->file) != 0 && res == 0) {
+        res = EIO;
+    }
+
+    free(writer->chunks);
+    free(writer->buffer);
+    memset(writer, 0, sizeof(*writer));
+    return res;
+}
+
+/**
+ * Open a hit file for reading, and load its index.
+ * @param file Hit file to initialize
+ * @param file_path Path of the file
+ * @return Error code: EPROTO if the file is not a complete hit file of this library.
+ */
+int
+katherine_hitfile_open(katherine_hitfile_t *file, const char *file_path)
+{
+    int res = 0;
+    katherine_hitfile_trailer_t trailer;
+
+    memset(file, 0, sizeof(*file));
+
+    file->file = fopen(file_path, "rb");
+    if (file->file == NULL) {
+        res = errno;
+        goto err_fopen;
+    }
+
+    if (fread(&file->header, sizeof(file->header), 1, file->file) != 1) {
+        res = EPROTO;
+        goto err_header;
+    }
+
+    const katherine_hitfile_header_t *h = &file->header;
+    if (memcmp(h->magic, KATHERINE_HITFILE_MAGIC, sizeof(KATHERINE_HITFILE_MAGIC)) != 0 || h->byte_order != 0x01020304 || h->format != KATHERINE_HITFILE_FORMAT || h->header_size != sizeof(*h) || (h->columns & ~KATHERINE_HIT_ALL) != 0 || (h->columns & (KATHERINE_HIT_X | KATHERINE_HIT_Y)) != (KATHERINE_HIT_X | KATHERINE_HIT_Y) || h->chunk_size == 0) {
+        res = EPROTO;
+        goto err_header;
+    }
+
+    if (katherine_fseek(file->file, -(int64_t) sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, file->file) != 1 || memcmp(trailer.magic, KATHERINE_HITFILE_TRAILER_MAGIC, sizeof(KATHERINE_HITFILE_TRAILER_MAGIC)) != 0) {
+        res = EPROTO;
+        goto err_header;
+    }
+
+    file->chunk_count = (size_t) trailer.chunks;
+    file->hits        = trailer.hits;
+
+    if (file->chunk_count > 0) {
+        file->chunks = (katherine_hitfile_chunk_t *) malloc(file->chunk_count * sizeof(katherine_hitfile_chunk_t));
+        if (file->chunks == NULL) {
+            res = ENOMEM;
+            goto err_header;
+        }
+
+        if (katherine_fseek(file->file, (int64_t) trailer.index_offset, SEEK_SET) != 0 || fread(file->chunks, sizeof(katherine_hitfile_chunk_t), file->chunk_count, file->file) != file->chunk_count) {
+            res = EPROTO;
+            goto err_index;
+        }
+    }
+
+    // A chunk which does not fit before the index would be read past it.
+    for (size_t i = 0; i < file->chunk_count; ++i) {
+        const katherine_hitfile_chunk_t *chunk = &file->chunks[i];
+        if (chunk->count > h->chunk_size || chunk->offset < h->header_size || chunk->offset + chunk_bytes(h->columns, chunk->count) > trailer.index_offset) {
+            res = EPROTO;
+            goto err_index;
+        }
+    }
+
+    file->buffer = (char *) malloc((size_t) h->chunk_size * hit_size(h->columns));
+    if (file->buffer == NULL) {
+        res = ENOMEM;
+        goto err_index;
+    }
+
+    return 0;
+
+err_index:
+    free(file->chunks);
+err_header:
+    fclose(file->file);
+err_fopen:
+    memset(file, 0, sizeof(*file));
+    return res;
+}
+
+/**
+ * Initialize a query which all hits match.
+ * @param query Query to initialize, whose ranges may then be narrowed
+ */
+void
+katherine_hitfile_query_all(katherine_hitfile_query_t *query)
+{
+    query->min_toa = 0;
+    query->max_toa = UINT64_MAX;
+    query->min_x   = 0;
+    query->max_x   = UINT8_MAX;
+    query->min_y   = 0;
+    query->max_y   = UINT8_MAX;
+}
+
+/**
+ * Tell from the index of a hit file whether a chunk may hold hits matching a query.
+ * @param file Open hit file
+ * @param chunk Index of the chunk
+ * @param query Query
+ * @return Whether the ranges of the chunk overlap those of the query.
+ */
+bool
+katherine_hitfile_chunk_matches(const katherine_hitfile_t *file, size_t chunk, const katherine_hitfile_query_t *query)
+{
+    const katherine_hitfile_chunk_t *c = &file->chunks[chunk];
+
+    if (c->count == 0) return false;
+    if (c->max_x < query->min_x || c->min_x > query->max_x) return false;
+    if (c->max_y < query->min_y || c->min_y > query->max_y) return false;
+    if ((file->header.columns & KATHERINE_HIT_TOA) && (c->max_toa < query->min_toa || c->min_toa > query->max_toa)) return false;
+    return true;
+}
+
+/**
+ * Read columns of a chunk of a hit file to katherine_hitfile_t.columns.
+ *
+ * Only the columns asked for are read from the file; the arrays of the others are NULL. The columns
+ * are valid until the next read.
+ *
+ * @param file Open hit file
+ * @param chunk Index of the chunk
+ * @param columns KATHERINE_HIT_* flags of the columns to read
+ * @return Error code: EINVAL if the file has no such chunk.
+ */
+int
+katherine_hitfile_read_chunk(katherine_hitfile_t *file, size_t chunk, unsigned columns)
+{
+    const uint32_t stored = file->header.columns;
+    const katherine_hitfile_chunk_t *c;
+    uint64_t at;
+
+    if (chunk >= file->chunk_count) {
+        return EINVAL;
+    }
+    c = &file->chunks[chunk];
+
+    carve(&file->columns, file->buffer, stored & columns, file->header.chunk_size);
+    file->columns.count = c->count;
+    at                  = c->offset;
+
+#define READ(NAME, FLAG, TYPE) \
+    if (stored & (FLAG)) { \
+        if (columns & (FLAG)) { \
+            if (katherine_fseek(file->file, (int64_t) at, SEEK_SET) != 0 || fread(file->columns.NAME, sizeof(TYPE), c->count, file->file) != c->count) { \
+                return EIO; \
+            } \
+            file->bytes_read += (uint64_t) c->count * sizeof(TYPE); \
+        } \
+        at += (uint64_t) c->count * sizeof(TYPE); \
+    }
+
+    HITFILE_COLUMNS(READ)
+
+#undef READ
+
+    return 0;
+}
+
+/**
+ * Find the hits of a hit file matching a query.
+ *
+ * The chunks the index tells to miss the query are skipped. Of the others, the columns asked for
+ * are read, along with those of the ranges of the query unless the whole chunk matches it, and the
+ * hits matching the query are passed to the handler, a chunk at a time.
+ *
+ * @param file Open hit file
+ * @param query Query
+ * @param columns KATHERINE_HIT_* flags of the columns to pass to the handler; the arrays of the others are NULL
+ * @param handler Handler of the hits found
+ * @param ctx Context passed to the handler
+ * @return Error code.
+ */
+int
+katherine_hitfile_query(katherine_hitfile_t *file, const katherine_hitfile_query_t *query, unsigned columns, katherine_hitfile_handler_t handler, void *ctx)
+{
+    const unsigned ranges = KATHERINE_HIT_TOA | KATHERINE_HIT_X | KATHERINE_HIT_Y;
+    int res;
+
+    for (size_t i = 0; i < file->chunk_count; ++i) {
+        if (!katherine_hitfile_chunk_matches(file, i, query)) continue;
+
+        const bool within = chunk_within(file, &file->chunks[i], query);
+
+        res = katherine_hitfile_read_chunk(file, i, within ? columns : columns | ranges);
+        if (res) return res;
+
+        if (!within) {
+            katherine_px_columns_t *c = &file->columns;
+
+            select_hits(c, query);
+
+#define HIDE(NAME, FLAG, TYPE) \
+    if (!(columns & (FLAG))) c->NAME = NULL;
+
+            HITFILE_COLUMNS(HIDE)
+
+#undef HIDE
+        }
+
+        if (file->columns.count > 0) {
+            handler(ctx, &file->columns);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Close a hit file open for reading.
+ * @param file Open hit file
+ */
+void
+katherine_hitfile_close(katherine_hitfile_t *file)
+{
+    if (file->file != NULL) {
+        fclose(file->file);
+    }
+    free(file->chunks);
+    free(file->buffer);
+    memset(file, 0, sizeof(*file));
+}
@@ -21,8 +21,11 @@
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 
+#include <string.h>
 #include "bitfields.h"
+#include "cluster.h"
 #include <katherine/px.h>
+#include <katherine/px_filter.h>
 
 /* MD stands for Measurement Data, the 6 byte
  * messages sent during (or after) acquisition.
@@ -81,8 +84,23 @@
 #define DEFINE_PMD_PAIR(NAME, TYPE, BASE_TYPE) \
     dst->NAME = (TYPE) EXTRACT(*src, BASE_TYPE, NAME)
 
+/* The time of arrival of a pixel, in the timestamp unit of the acquisition:
+ * the coarse ToA shifted to the unit, plus the offset in effect (which holds
+ * the frame start too, where it applies). In the fast VCO modes, the fine
+ * ToA counts 1/16ths of a coarse tick back from it; it only shows in the
+ * fine unit, as in ticks of the coarse clock it shifts down to zero. Both
+ * are plain shifts and adds, so that runs of pixels map vectorized. */
+#define PMD_TOA(BASE_TYPE) \
+    (((uint64_t) EXTRACT(*src, BASE_TYPE, toa) << acq->toa_shift) + acq->last_toa_offset)
+
+#define PMD_F_TOA(BASE_TYPE) \
+    (PMD_TOA(BASE_TYPE) - (((uint64_t) EXTRACT(*src, BASE_TYPE, ftoa) << acq->toa_shift) >> 4))
+
 #define DEFINE_PMD_PAIR_TOA(BASE_TYPE) \
-    dst->toa = (uint64_t) EXTRACT(*src, BASE_TYPE, toa) + acq->last_toa_offset
+    dst->toa = PMD_TOA(BASE_TYPE)
+
+#define DEFINE_PMD_PAIR_F_TOA(BASE_TYPE) \
+    dst->toa = PMD_F_TOA(BASE_TYPE)
 
 #define DEFINE_PMD_PAIR_COORD(BASE_TYPE) \
     { \
@@ -113,7 +131,7 @@
 DEFINE_PMD_MAP(f_toa_tot)
 {
     DEFINE_PMD_PAIR_COORD(pmd_f_toa_tot);
-    DEFINE_PMD_PAIR_TOA(pmd_f_toa_tot);
+    DEFINE_PMD_PAIR_F_TOA(pmd_f_toa_tot);
     DEFINE_PMD_PAIR(ftoa, uint8_t, pmd_f_toa_tot);
     DEFINE_PMD_PAIR(tot, uint16_t, pmd_f_toa_tot);
 }
@@ -165,7 +183,7 @@ DEFINE_PMD_MAP(toa_tot)
 DEFINE_PMD_MAP(f_toa_only)
 {
     DEFINE_PMD_PAIR_COORD(pmd_f_toa_only);
-    DEFINE_PMD_PAIR_TOA(pmd_f_toa_only);
+    DEFINE_PMD_PAIR_F_TOA(pmd_f_toa_only);
     DEFINE_PMD_PAIR(ftoa, uint8_t, pmd_f_toa_only);
 }
 
@@ -243,9 +261,400 @@ DEFINE_PMD_MAP(event_itot)
     DEFINE_PMD_PAIR(integral_tot, uint16_t, pmd_event_itot);
 }
 
+/* The packed records of the modes with a ToA (katherine_px_{A}_p16_t and
+ * katherine_px_{A}_p12_t) are mapped from the same bitfields as the plain
+ * ones, by functions named after them:
+ *
+ *   pmd_{A}_p16_map(dst, src, acq)
+ *   pmd_{A}_p12_map(dst, src, acq)
+ */
+
+#define DEFINE_PMD_PAIR_TOA48(TOA) \
+    { \
+        uint64_t toa = (TOA); \
+        dst->toa_lo  = (uint32_t) toa; \
+        dst->toa_hi  = (uint16_t) (toa >> 32); \
+    }
+
+#define DEFINE_PMD_RESERVED() \
+    memset(dst->reserved, 0, sizeof(dst->reserved))
+
+DEFINE_PMD_MAP(f_toa_tot_p16)
+{
+    DEFINE_PMD_PAIR_F_TOA(pmd_f_toa_tot);
+    DEFINE_PMD_PAIR_COORD(pmd_f_toa_tot);
+    DEFINE_PMD_PAIR(tot, uint16_t, pmd_f_toa_tot);
+    DEFINE_PMD_PAIR(ftoa, uint8_t, pmd_f_toa_tot);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(f_toa_tot_p12)
+{
+    DEFINE_PMD_PAIR_TOA48(PMD_F_TOA(pmd_f_toa_tot));
+    DEFINE_PMD_PAIR_COORD(pmd_f_toa_tot);
+    DEFINE_PMD_PAIR(tot, uint16_t, pmd_f_toa_tot);
+    DEFINE_PMD_PAIR(ftoa, uint8_t, pmd_f_toa_tot);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(toa_tot_p16)
+{
+    DEFINE_PMD_PAIR_TOA(pmd_toa_tot);
+    DEFINE_PMD_PAIR_COORD(pmd_toa_tot);
+    DEFINE_PMD_PAIR(tot, uint16_t, pmd_toa_tot);
+    DEFINE_PMD_PAIR(hit_count, uint8_t, pmd_toa_tot);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(toa_tot_p12)
+{
+    DEFINE_PMD_PAIR_TOA48(PMD_TOA(pmd_toa_tot));
+    DEFINE_PMD_PAIR_COORD(pmd_toa_tot);
+    DEFINE_PMD_PAIR(tot, uint16_t, pmd_toa_tot);
+    DEFINE_PMD_PAIR(hit_count, uint8_t, pmd_toa_tot);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(f_toa_only_p16)
+{
+    DEFINE_PMD_PAIR_F_TOA(pmd_f_toa_only);
+    DEFINE_PMD_PAIR_COORD(pmd_f_toa_only);
+    DEFINE_PMD_PAIR(ftoa, uint8_t, pmd_f_toa_only);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(f_toa_only_p12)
+{
+    DEFINE_PMD_PAIR_TOA48(PMD_F_TOA(pmd_f_toa_only));
+    DEFINE_PMD_PAIR_COORD(pmd_f_toa_only);
+    DEFINE_PMD_PAIR(ftoa, uint8_t, pmd_f_toa_only);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(toa_only_p16)
+{
+    DEFINE_PMD_PAIR_TOA(pmd_toa_only);
+    DEFINE_PMD_PAIR_COORD(pmd_toa_only);
+    DEFINE_PMD_PAIR(hit_count, uint8_t, pmd_toa_only);
+    DEFINE_PMD_RESERVED();
+}
+
+DEFINE_PMD_MAP(toa_only_p12)
+{
+    DEFINE_PMD_PAIR_TOA48(PMD_TOA(pmd_toa_only));
+    DEFINE_PMD_PAIR_COORD(pmd_toa_only);
+    DEFINE_PMD_PAIR(hit_count, uint8_t, pmd_toa_only);
+    DEFINE_PMD_RESERVED();
+}
+
+/* A run is a sequence of consecutive pixel MD's, which the decoder maps in
+ * bulk rather than one by one. For every pixel type, we define a function
+ * named by the following template:
+ *
+ *   pmd_{A}_run(dst, src, count, acq)
+ *
+ * This function maps `count` consecutive MD's starting at `src` (packed in
+ * wire order, 6 bytes apart) to as many pixels of type katherine_px_{A}_t
+ * starting at `dst`. These are the portable versions; md_simd.h adds
+ * vectorized ones where the instruction set allows.
+ */
+
+#define _BITS_md_header_byte 5 /* the byte holding the header in wire order */
+
+/* Number of consecutive pixel MD's at the beginning of the `count` MD's
+ * starting at `src`. Only the byte holding the header is inspected, so the
+ * scan is cheap enough to precede every run. */
+static inline size_t
+md_pixel_run_length(const char *src, size_t count)
+{
+    const unsigned char *it = (const unsigned char *) src + _BITS_md_header_byte;
+    size_t n                = 0;
+
+    while (n < count && (*it >> 4) == 0x4) {
+        ++n;
+        it += KATHERINE_MD_SIZE;
+    }
+
+    return n;
+}
+
+#define DEFINE_PMD_RUN(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_run(katherine_px_##SUFFIX##_t *dst, const char *src, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        for (size_t i = 0; i < count; ++i, src += KATHERINE_MD_SIZE) { \
+            pmd_##SUFFIX##_map(dst + i, (const uint64_t *) src, acq); \
+        } \
+    }
+
+DEFINE_PMD_RUN(f_toa_tot)
+DEFINE_PMD_RUN(toa_tot)
+DEFINE_PMD_RUN(f_toa_only)
+DEFINE_PMD_RUN(toa_only)
+DEFINE_PMD_RUN(f_event_itot)
+DEFINE_PMD_RUN(event_itot)
+DEFINE_PMD_RUN(f_toa_tot_p16)
+DEFINE_PMD_RUN(f_toa_tot_p12)
+DEFINE_PMD_RUN(toa_tot_p16)
+DEFINE_PMD_RUN(toa_tot_p12)
+DEFINE_PMD_RUN(f_toa_only_p16)
+DEFINE_PMD_RUN(f_toa_only_p12)
+DEFINE_PMD_RUN(toa_only_p16)
+DEFINE_PMD_RUN(toa_only_p12)
+
+/* The parallel decoder maps pixels before it knows the timestamp offset
+ * which applies to them, and adds it afterwards by the function
+ *
+ *   pmd_{A}_rebase(px, count, offset)
+ *
+ * which adds `offset` to the time of arrival of `count` pixels of type
+ * katherine_px_{A}_t starting at `px`. Pixels without a time of arrival
+ * are left alone.
+ */
+
+#define DEFINE_PMD_REBASE(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_rebase(katherine_px_##SUFFIX##_t *px, size_t count, uint64_t offset) \
+    { \
+        for (size_t i = 0; i < count; ++i) { \
+            px[i].toa += offset; \
+        } \
+    }
+
+#define DEFINE_PMD_REBASE_NONE(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_rebase(katherine_px_##SUFFIX##_t *px, size_t count, uint64_t offset) \
+    { \
+        (void) px; \
+        (void) count; \
+        (void) offset; \
+    }
+
+DEFINE_PMD_REBASE(f_toa_tot)
+DEFINE_PMD_REBASE(toa_tot)
+DEFINE_PMD_REBASE(f_toa_only)
+DEFINE_PMD_REBASE(toa_only)
+DEFINE_PMD_REBASE_NONE(f_event_itot)
+DEFINE_PMD_REBASE_NONE(event_itot)
+
+/* The columnar layout stores every field of a pixel in an array of its own
+ * (see katherine_px_columns_t). For every pixel type, we define a function
+ * named by the template:
+ *
+ *   pmd_{A}_columns_run(dst, first, src, count, acq)
+ *
+ * which maps `count` consecutive MD's starting at `src` to the elements
+ * `first`, `first + 1`, ... of the columns `dst`, and a constant
+ *
+ *   PMD_{A}_COLUMNS
+ *
+ * naming the columns (besides the coordinates) the pixel type fills in. The
+ * fields are mapped by pmd_{A}_map first, so that both layouts share one
+ * definition of them, and scattered to the columns by pmd_{A}_scatter.
+ */
+
+#define PMD_COLUMN_TOA          (1u << 0)
+#define PMD_COLUMN_FTOA         (1u << 1)
+#define PMD_COLUMN_HIT_COUNT    (1u << 2)
+#define PMD_COLUMN_TOT          (1u << 3)
+#define PMD_COLUMN_EVENT_COUNT  (1u << 4)
+#define PMD_COLUMN_INTEGRAL_TOT (1u << 5)
+
+#define DEFINE_PMD_SCATTER(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_scatter(const katherine_px_columns_t *dst, size_t i, const katherine_px_##SUFFIX##_t *px)
+
+#define DEFINE_PMD_SCATTER_FIELD(NAME) \
+    dst->NAME[i] = px->NAME
+
+#define DEFINE_PMD_SCATTER_COORD() \
+    { \
+        dst->x[i] = px->coord.x; \
+        dst->y[i] = px->coord.y; \
+    }
+
+#define PMD_f_toa_tot_COLUMNS (PMD_COLUMN_TOA | PMD_COLUMN_FTOA | PMD_COLUMN_TOT)
+
+DEFINE_PMD_SCATTER(f_toa_tot)
+{
+    DEFINE_PMD_SCATTER_COORD();
+    DEFINE_PMD_SCATTER_FIELD(toa);
+    DEFINE_PMD_SCATTER_FIELD(ftoa);
+    DEFINE_PMD_SCATTER_FIELD(tot);
+}
+
+#define PMD_toa_tot_COLUMNS (PMD_COLUMN_TOA | PMD_COLUMN_HIT_COUNT | PMD_COLUMN_TOT)
+
+DEFINE_PMD_SCATTER(toa_tot)
+{
+    DEFINE_PMD_SCATTER_COORD();
+    DEFINE_PMD_SCATTER_FIELD(toa);
+    DEFINE_PMD_SCATTER_FIELD(hit_count);
+    DEFINE_PMD_SCATTER_FIELD(tot);
+}
+
+#define PMD_f_toa_only_COLUMNS (PMD_COLUMN_TOA | PMD_COLUMN_FTOA)
+
+DEFINE_PMD_SCATTER(f_toa_only)
+{
+    DEFINE_PMD_SCATTER_COORD();
+    DEFINE_PMD_SCATTER_FIELD(toa);
+    DEFINE_PMD_SCATTER_FIELD(ftoa);
+}
+
+#define PMD_toa_only_COLUMNS (PMD_COLUMN_TOA | PMD_COLUMN_HIT_COUNT)
+
+DEFINE_PMD_SCATTER(toa_only)
+{
+    DEFINE_PMD_SCATTER_COORD();
+    DEFINE_PMD_SCATTER_FIELD(toa);
+    DEFINE_PMD_SCATTER_FIELD(hit_count);
+}
+
+#define PMD_f_event_itot_COLUMNS (PMD_COLUMN_HIT_COUNT | PMD_COLUMN_EVENT_COUNT | PMD_COLUMN_INTEGRAL_TOT)
+
+DEFINE_PMD_SCATTER(f_event_itot)
+{
+    DEFINE_PMD_SCATTER_COORD();
+    DEFINE_PMD_SCATTER_FIELD(hit_count);
+    DEFINE_PMD_SCATTER_FIELD(event_count);
+    DEFINE_PMD_SCATTER_FIELD(integral_tot);
+}
+
+#define PMD_event_itot_COLUMNS (PMD_COLUMN_EVENT_COUNT | PMD_COLUMN_INTEGRAL_TOT)
+
+DEFINE_PMD_SCATTER(event_itot)
+{
+    DEFINE_PMD_SCATTER_COORD();
+    DEFINE_PMD_SCATTER_FIELD(event_count);
+    DEFINE_PMD_SCATTER_FIELD(integral_tot);
+}
+
+#define DEFINE_PMD_COLUMNS_RUN(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_columns_run(const katherine_px_columns_t *dst, size_t first, const char *src, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        katherine_px_##SUFFIX##_t px; \
+        for (size_t i = first; i < first + count; ++i, src += KATHERINE_MD_SIZE) { \
+            pmd_##SUFFIX##_map(&px, (const uint64_t *) src, acq); \
+            pmd_##SUFFIX##_scatter(dst, i, &px); \
+        } \
+    }
+
+DEFINE_PMD_COLUMNS_RUN(f_toa_tot)
+DEFINE_PMD_COLUMNS_RUN(toa_tot)
+DEFINE_PMD_COLUMNS_RUN(f_toa_only)
+DEFINE_PMD_COLUMNS_RUN(toa_only)
+DEFINE_PMD_COLUMNS_RUN(f_event_itot)
+DEFINE_PMD_COLUMNS_RUN(event_itot)
+
+/* The maps of a frame (see katherine_frame_maps_t) are accumulated straight
+ * from the MD's, with no pixel records in between, by the function
+ *
+ *   pmd_{A}_accumulate(maps, src, count)
+ *
+ * which adds `count` consecutive MD's starting at `src` to the maps: a hit
+ * and its ToT in the modes which measure one, the events and the integral
+ * ToT in the event modes, and a hit alone in the ToA-only modes. Neither
+ * depends on the timestamp offset, so a run is accumulated once, whichever
+ * layout or decoder maps it.
+ */
+
+#define DEFINE_PMD_ACCUMULATE(SUFFIX, COUNT, TOT) \
+    static inline void \
+    pmd_##SUFFIX##_accumulate(katherine_frame_maps_t *maps, const char *src, size_t count) \
+    { \
+        for (size_t i = 0; i < count; ++i, src += KATHERINE_MD_SIZE) { \
+            const uint64_t md = *(const uint64_t *) src; \
+            const size_t at   = (size_t) EXTRACT(md, pmd_##SUFFIX, coord_y) * KATHERINE_FRAME_MAP_WIDTH + EXTRACT(md, pmd_##SUFFIX, coord_x); \
+            maps->counts[at] += (COUNT); \
+            maps->integrated_tot[at] += (TOT); \
+        } \
+        maps->pixels += count; \
+    }
+
+DEFINE_PMD_ACCUMULATE(f_toa_tot, 1, EXTRACT(md, pmd_f_toa_tot, tot))
+DEFINE_PMD_ACCUMULATE(toa_tot, 1, EXTRACT(md, pmd_toa_tot, tot))
+DEFINE_PMD_ACCUMULATE(f_toa_only, 1, 0)
+DEFINE_PMD_ACCUMULATE(toa_only, 1, 0)
+DEFINE_PMD_ACCUMULATE(f_event_itot, EXTRACT(md, pmd_f_event_itot, event_count), EXTRACT(md, pmd_f_event_itot, integral_tot))
+DEFINE_PMD_ACCUMULATE(event_itot, EXTRACT(md, pmd_event_itot, event_count), EXTRACT(md, pmd_event_itot, integral_tot))
+
+/* The number of pixel MD's at the start of a run which the filter passes,
+ * or drops if `passed` is false. Every pixel MD holds its coordinates in the
+ * same bits, whatever the mode. */
+static inline size_t
+md_px_filter_span(const katherine_px_filter_t *filter, const char *data, size_t count, bool passed)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i, data += KATHERINE_MD_SIZE) {
+        const uint64_t md  = *(const uint64_t *) data;
+        const size_t index = (size_t) EXTRACT(md, pmd_toa_tot, coord_y) * 256 + EXTRACT(md, pmd_toa_tot, coord_x);
+        if ((bool) ((filter->words[index / 64] >> (index % 64)) & 1) != passed) break;
+    }
+
+    return i;
+}
+
+/* Hands a run of pixel MD's to the clustering, in chunks of hits with the
+ * time of arrival the run maps them to. The modes without a ToA are not
+ * clustered. */
+#define DEFINE_PMD_CLUSTER_RUN(SUFFIX, TOA, TOT) \
+    static inline void \
+    pmd_##SUFFIX##_cluster_run(struct katherine_clusterer *c, const char *data, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        katherine_cluster_hit_t hits[KATHERINE_CLUSTER_HITS]; \
+        size_t chunk; \
+\
+        for (; count > 0; count -= chunk) { \
+            chunk = count < KATHERINE_CLUSTER_HITS ? count : KATHERINE_CLUSTER_HITS; \
+            for (size_t i = 0; i < chunk; ++i, data += KATHERINE_MD_SIZE) { \
+                const uint64_t *src = (const uint64_t *) data; \
+                hits[i].toa         = (TOA); \
+                hits[i].tot         = (uint16_t) (TOT); \
+                hits[i].x           = (uint8_t) EXTRACT(*src, pmd_##SUFFIX, coord_x); \
+                hits[i].y           = (uint8_t) EXTRACT(*src, pmd_##SUFFIX, coord_y); \
+            } \
+            katherine_clusterer_add(c, hits, chunk); \
+        } \
+    }
+
+#define DEFINE_PMD_CLUSTER_RUN_NONE(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_cluster_run(struct katherine_clusterer *c, const char *data, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        (void) c; \
+        (void) data; \
+        (void) count; \
+        (void) acq; \
+    }
+
+DEFINE_PMD_CLUSTER_RUN(f_toa_tot, PMD_F_TOA(pmd_f_toa_tot), EXTRACT(*src, pmd_f_toa_tot, tot))
+DEFINE_PMD_CLUSTER_RUN(toa_tot, PMD_TOA(pmd_toa_tot), EXTRACT(*src, pmd_toa_tot, tot))
+DEFINE_PMD_CLUSTER_RUN(f_toa_only, PMD_F_TOA(pmd_f_toa_only), 0)
+DEFINE_PMD_CLUSTER_RUN(toa_only, PMD_TOA(pmd_toa_only), 0)
+DEFINE_PMD_CLUSTER_RUN_NONE(f_event_itot)
+DEFINE_PMD_CLUSTER_RUN_NONE(event_itot)
+
 #undef DEFINE_PMD_MAP
 #undef DEFINE_PMD_PAIR
 #undef DEFINE_PMD_PAIR_COORD
 #undef DEFINE_PMD_PAIR_TOA
+#undef DEFINE_PMD_PAIR_F_TOA
+#undef DEFINE_PMD_PAIR_TOA48
+#undef PMD_TOA
+#undef PMD_F_TOA
+#undef DEFINE_PMD_CLUSTER_RUN
+#undef DEFINE_PMD_CLUSTER_RUN_NONE
+#undef DEFINE_PMD_RESERVED
+#undef DEFINE_PMD_RUN
+#undef DEFINE_PMD_REBASE
+#undef DEFINE_PMD_REBASE_NONE
+#undef DEFINE_PMD_ACCUMULATE
+#undef DEFINE_PMD_SCATTER
+#undef DEFINE_PMD_SCATTER_FIELD
+#undef DEFINE_PMD_SCATTER_COORD
+#undef DEFINE_PMD_COLUMNS_RUN
 
 #endif
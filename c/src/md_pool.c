@@ -0,0 +1,160 @@
+/**
+ * @file
+ * @brief Implementation of the pool of leased measurement data buffers.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include "alloc.h"
+#include "md_pool.h"
+
+/**
+ * Free a pool, whether or not the application still holds leases of it.
+ * @param acq Acquisition owning the pool
+ * @param pool Pool to free, or NULL
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_md_pool_free(katherine_acquisition_t *acq, struct katherine_md_pool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    katherine_buffer_free(&acq->allocator, pool->buffers, pool->capacity * pool->slot_size + sizeof(uint64_t));
+    free(pool->leases);
+    free(pool);
+}
+
+/**
+ * Enable or disable leased reads of raw measurement data.
+ *
+ * An acquisition which does not decode its data normally passes every datagram to the
+ * data_received handler in the measurement data buffer, which the next receive overwrites as soon
+ * as the handler returns. With a pool of leases, katherine_acquisition_read() receives the
+ * datagrams into buffers of the pool instead, and passes each one to the data_leased handler as a
+ * lease, which the application keeps for as long as it needs -- to compress, write or forward the
+ * datagram from another thread, say -- and then gives back by katherine_acquisition_release_lease().
+ * Once the application holds every lease, the read waits for one to be released, leaving the
+ * stream in the socket meanwhile.
+ *
+ * Each lease holds one datagram of the largest size (KATHERINE_MD_DATAGRAM_MAX_SIZE), whatever the
+ * size of the measurement data buffer. The pool takes precedence over a pipeline (see
+ * katherine_acquisition_set_pipeline()) for acquisitions which do not decode their data, and is not
+ * used by those which do. Without a data_leased handler, datagrams are dropped.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param leases Leases of the pool, or zero to go back to the plain read
+ * @return Error code: EBUSY if the application still holds leases of the current pool.
+ */
+int
+katherine_acquisition_set_md_pool(katherine_acquisition_t *acq, size_t leases)
+{
+    struct katherine_md_pool *pool = acq->md_pool;
+
+    if (pool != NULL) {
+        if (katherine_atomic_load(&pool->leased) > 0) {
+            return EBUSY;
+        }
+
+        katherine_md_pool_free(acq, pool);
+        acq->md_pool = NULL;
+    }
+
+    if (leases == 0) {
+        return 0;
+    }
+
+    pool = (struct katherine_md_pool *) calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        goto err_pool;
+    }
+
+    pool->capacity  = leases;
+    pool->slot_size = KATHERINE_MD_DATAGRAM_MAX_SIZE;
+
+    pool->leases = (katherine_md_lease_t *) calloc(leases, sizeof(katherine_md_lease_t));
+    if (pool->leases == NULL) {
+        goto err_leases;
+    }
+
+    // The same extra word at the end as in the measurement data buffer, so
+    // that a consumer reading the last datum as a whole word stays within.
+    pool->buffers = (char *) katherine_buffer_alloc(&acq->allocator, leases * pool->slot_size + sizeof(uint64_t));
+    if (pool->buffers == NULL) {
+        goto err_buffers;
+    }
+
+    for (size_t i = 0; i < leases; ++i) {
+        pool->leases[i].data = katherine_md_pool_buffer(pool, &pool->leases[i]);
+        pool->leases[i].next = i + 2 <= leases ? i + 2 : 0;
+    }
+    pool->free = 1;
+
+    acq->md_pool = pool;
+    return 0;
+
+err_buffers:
+    free(pool->leases);
+err_leases:
+    free(pool);
+err_pool:
+    return ENOMEM;
+}
+
+/**
+ * Give a lease back to the pool of its acquisition.
+ *
+ * May be called from any thread, including while another one is reading the acquisition, and
+ * after the read has returned, as long as the acquisition has not been finalized. Every lease
+ * must be released exactly once; its datagram must not be accessed afterwards.
+ *
+ * @param acq Acquisition
+ * @param lease Lease passed to the data_leased handler
+ */
+void
+katherine_acquisition_release_lease(katherine_acquisition_t *acq, katherine_md_lease_t *lease)
+{
+    struct katherine_md_pool *pool = acq->md_pool;
+    uint64_t self                  = (uint64_t) (lease - pool->leases) + 1;
+    uint64_t top                   = katherine_atomic_load(&pool->released);
+
+    do {
+        lease->next = top;
+    } while (!katherine_atomic_compare_exchange(&pool->released, &top, self));
+
+    (void) katherine_atomic_fetch_add(&pool->leased, (uint64_t) -1);
+}
+
+/**
+ * Take a snapshot of the lease pool of an acquisition.
+ *
+ * May be called from any thread. For an acquisition without a pool, the figures are all zero.
+ *
+ * @param acq Acquisition
+ * @param stats Snapshot to fill in
+ */
+void
+katherine_acquisition_get_md_pool_stats(const katherine_acquisition_t *acq, katherine_md_pool_stats_t *stats)
+{
+    const struct katherine_md_pool *pool = acq->md_pool;
+
+    memset(stats, 0, sizeof(*stats));
+    if (pool == NULL) {
+        return;
+    }
+
+    stats->capacity = pool->capacity;
+    stats->leased   = (size_t) katherine_atomic_load(&pool->leased);
+    stats->stalls   = katherine_atomic_load(&pool->stalls);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file
+ * @brief Internal pool of leased measurement data buffers.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+#include "thread.h"
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* A leased read receives raw datagrams straight into the buffers of a pool
+ * and hands each one to the application as a lease, which it gives back
+ * whenever it is done with it, from whichever thread. Only the read loop
+ * takes leases out of the pool, whereas any thread may put them back; hence
+ * two lists of free leases:
+ *
+ *  - `free`, private to the read loop, from which it takes leases and to
+ *    which it returns those it did not need, and
+ *  - `released`, a lock-free stack onto which the application pushes the
+ *    leases it releases. The read loop only ever takes it whole, with an
+ *    exchange, so a lease cannot be popped from under a concurrent push.
+ *
+ * Lists are linked through the `next` member of the leases and name them
+ * by their index plus one, so that zero ends a list. */
+struct katherine_md_pool {
+    katherine_md_lease_t *leases;
+    char *buffers;
+    size_t capacity;
+    size_t slot_size;
+
+    uint64_t free;     // private to the read loop
+    uint64_t released; // pushed by any thread, taken whole by the read loop
+    uint64_t leased;   // leases held by the application
+    uint64_t stalls;   // waits of the read loop on an empty pool
+};
+
+KATHERINE_NOT_EXPORTED void
+katherine_md_pool_free(katherine_acquisition_t *acq, struct katherine_md_pool *pool);
+
+/* The buffer of a lease, which the read loop receives into. */
+static inline char *
+katherine_md_pool_buffer(const struct katherine_md_pool *pool, const katherine_md_lease_t *lease)
+{
+    return pool->buffers + (size_t) (lease - pool->leases) * pool->slot_size;
+}
+
+/* Takes a free lease out of the pool, or returns NULL if the application
+ * holds all of them. Read loop only. */
+static inline katherine_md_lease_t *
+katherine_md_pool_take(struct katherine_md_pool *pool)
+{
+    katherine_md_lease_t *lease;
+
+    if (pool->free == 0) {
+        pool->free = katherine_atomic_exchange(&pool->released, 0);
+        if (pool->free == 0) return NULL;
+    }
+
+    lease      = &pool->leases[pool->free - 1];
+    pool->free = lease->next;
+    return lease;
+}
+
+/* Returns a lease the read loop took but did not hand out. Read loop only. */
+static inline void
+katherine_md_pool_untake(struct katherine_md_pool *pool, katherine_md_lease_t *lease)
+{
+    lease->next = pool->free;
+    pool->free  = (uint64_t) (lease - pool->leases) + 1;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,273 @@
+/**
+ * @file
+ * @brief Internal vectorized mapping of runs of pixel measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#include <stddef.h>
+#include "md.h"
+
+/* The decoder spends most of its time in runs of pixel MD's, which md.h
+ * maps one field at a time. Here the same mapping is done for several MD's
+ * at once: a shuffle widens packed MD's to one per 64-bit lane, shifts and
+ * masks cut the fields out of all lanes together (adding the ToA offset on
+ * the way), and interleaving stores write the lanes out as pixel records.
+ *
+ * There are two kernels, one on 128-bit vectors (2 MD's per instruction,
+ * SSE4.1) and one on 256-bit vectors (4 MD's per instruction, AVX2). The
+ * library is built for the baseline of its target, so the kernels are
+ * compiled for their instruction sets individually and chosen at run time
+ * by md_simd_detect(). Elsewhere (other architectures, MSVC), and for the
+ * modes without a ToA, every level falls back to pmd_{A}_run of md.h.
+ *
+ * For every pixel type, we define a function named by the template:
+ *
+ *   pmd_{A}_run_at(level, dst, src, count, acq)
+ *
+ * which does what pmd_{A}_run does, using the kernel of the given level. */
+
+typedef enum md_simd_level {
+    MD_SIMD_SCALAR,
+    MD_SIMD_SSE41,
+    MD_SIMD_AVX2,
+} md_simd_level_t;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KATHERINE_MD_SIMD
+#endif
+
+/* Best level the processor we are running on supports. Cheap enough to be
+ * asked once per run: the answer is a bit test in a table the runtime fills
+ * in before main(). */
+static inline md_simd_level_t
+md_simd_detect(void)
+{
+#ifdef KATHERINE_MD_SIMD
+    if (__builtin_cpu_supports("avx2")) return MD_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return MD_SIMD_SSE41;
+#endif
+    return MD_SIMD_SCALAR;
+}
+
+#ifdef KATHERINE_MD_SIMD
+
+#include <immintrin.h>
+
+#define MD_SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define MD_SIMD_TARGET_AVX2  __attribute__((target("avx2")))
+
+/* The stores write pixel records as whole 64-bit words, one per lane, so
+ * they rely on the records laying their fields out in words like so (the
+ * padding in between is written as zeros). */
+_Static_assert(offsetof(katherine_px_f_toa_tot_t, ftoa) == 2 && offsetof(katherine_px_f_toa_tot_t, toa) == 8 &&
+                   offsetof(katherine_px_f_toa_tot_t, tot) == 16 && sizeof(katherine_px_f_toa_tot_t) == 24,
+               "unexpected layout of katherine_px_f_toa_tot_t");
+_Static_assert(offsetof(katherine_px_toa_tot_t, toa) == 8 && offsetof(katherine_px_toa_tot_t, hit_count) == 16 &&
+                   offsetof(katherine_px_toa_tot_t, tot) == 18 && sizeof(katherine_px_toa_tot_t) == 24,
+               "unexpected layout of katherine_px_toa_tot_t");
+_Static_assert(offsetof(katherine_px_f_toa_only_t, ftoa) == 2 && offsetof(katherine_px_f_toa_only_t, toa) == 8 &&
+                   sizeof(katherine_px_f_toa_only_t) == 16,
+               "unexpected layout of katherine_px_f_toa_only_t");
+_Static_assert(offsetof(katherine_px_toa_only_t, toa) == 8 && offsetof(katherine_px_toa_only_t, hit_count) == 16 &&
+                   sizeof(katherine_px_toa_only_t) == 24,
+               "unexpected layout of katherine_px_toa_only_t");
+
+/* The fields of two MD's, one per lane. The four pixel types with a ToA
+ * share the positions of their fields, so those of pmd_f_toa_tot stand for
+ * all of them; `low` is the 4-bit field at the bottom (fToA or hit count),
+ * and `coord` holds x and y side by side, as katherine_coord_t does. The
+ * time of arrival comes as PMD_TOA of md.h computes it (`toa`), and as
+ * PMD_F_TOA does, with the bottom field taken for the fToA (`f_toa`). */
+typedef struct md_simd_fields {
+    __m128i coord;
+    __m128i low;
+    __m128i toa;
+    __m128i f_toa;
+    __m128i tot;
+} md_simd_fields_t;
+
+static inline MD_SIMD_TARGET_SSE41 void
+md_simd_fields_sse41(md_simd_fields_t *f, __m128i md, __m128i toa_offset, __m128i toa_shift)
+{
+    f->coord = _mm_and_si128(_mm_srli_epi64(md, _BITS_pmd_f_toa_tot_coord_x_start), _mm_set1_epi64x(MASK(16)));
+    f->low   = _mm_and_si128(md, _mm_set1_epi64x(_BITS_pmd_f_toa_tot_ftoa_mask));
+    f->toa   = _mm_and_si128(_mm_srli_epi64(md, _BITS_pmd_f_toa_tot_toa_start), _mm_set1_epi64x(_BITS_pmd_f_toa_tot_toa_mask));
+    f->toa   = _mm_add_epi64(_mm_sll_epi64(f->toa, toa_shift), toa_offset);
+    f->f_toa = _mm_sub_epi64(f->toa, _mm_srli_epi64(_mm_sll_epi64(f->low, toa_shift), 4));
+    f->tot   = _mm_and_si128(_mm_srli_epi64(md, _BITS_pmd_f_toa_tot_tot_start), _mm_set1_epi64x(_BITS_pmd_f_toa_tot_tot_mask));
+}
+
+/* Same as above for four MD's, split into two halves for the stores. */
+static inline MD_SIMD_TARGET_AVX2 void
+md_simd_fields_avx2(md_simd_fields_t *lo, md_simd_fields_t *hi, __m256i md, __m256i toa_offset, __m128i toa_shift)
+{
+    __m256i coord = _mm256_and_si256(_mm256_srli_epi64(md, _BITS_pmd_f_toa_tot_coord_x_start), _mm256_set1_epi64x(MASK(16)));
+    __m256i low   = _mm256_and_si256(md, _mm256_set1_epi64x(_BITS_pmd_f_toa_tot_ftoa_mask));
+    __m256i toa   = _mm256_and_si256(_mm256_srli_epi64(md, _BITS_pmd_f_toa_tot_toa_start), _mm256_set1_epi64x(_BITS_pmd_f_toa_tot_toa_mask));
+    __m256i tot   = _mm256_and_si256(_mm256_srli_epi64(md, _BITS_pmd_f_toa_tot_tot_start), _mm256_set1_epi64x(_BITS_pmd_f_toa_tot_tot_mask));
+
+    toa = _mm256_add_epi64(_mm256_sll_epi64(toa, toa_shift), toa_offset);
+
+    __m256i f_toa = _mm256_sub_epi64(toa, _mm256_srli_epi64(_mm256_sll_epi64(low, toa_shift), 4));
+
+    lo->coord = _mm256_castsi256_si128(coord);
+    lo->low   = _mm256_castsi256_si128(low);
+    lo->toa   = _mm256_castsi256_si128(toa);
+    lo->f_toa = _mm256_castsi256_si128(f_toa);
+    lo->tot   = _mm256_castsi256_si128(tot);
+    hi->coord = _mm256_extracti128_si256(coord, 1);
+    hi->low   = _mm256_extracti128_si256(low, 1);
+    hi->toa   = _mm256_extracti128_si256(toa, 1);
+    hi->f_toa = _mm256_extracti128_si256(f_toa, 1);
+    hi->tot   = _mm256_extracti128_si256(tot, 1);
+}
+
+/* Two records of two words each, from the words of both lanes. */
+static inline MD_SIMD_TARGET_SSE41 void
+md_simd_store2(void *dst, __m128i w0, __m128i w1)
+{
+    __m128i *out = (__m128i *) dst;
+
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi64(w0, w1));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi64(w0, w1));
+}
+
+/* Two records of three words each, from the words of both lanes. */
+static inline MD_SIMD_TARGET_SSE41 void
+md_simd_store3(void *dst, __m128i w0, __m128i w1, __m128i w2)
+{
+    __m128i *out = (__m128i *) dst;
+
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi64(w0, w1));
+    _mm_storeu_si128(out + 1, _mm_blend_epi16(w2, w0, 0xF0));
+    _mm_storeu_si128(out + 2, _mm_unpackhi_epi64(w1, w2));
+}
+
+#define DEFINE_PMD_STORE(SUFFIX) \
+    static inline MD_SIMD_TARGET_SSE41 void \
+    pmd_##SUFFIX##_store(katherine_px_##SUFFIX##_t *dst, const md_simd_fields_t *f)
+
+DEFINE_PMD_STORE(f_toa_tot)
+{
+    md_simd_store3(dst, _mm_or_si128(f->coord, _mm_slli_epi64(f->low, 16)), f->f_toa, f->tot);
+}
+
+DEFINE_PMD_STORE(toa_tot)
+{
+    md_simd_store3(dst, f->coord, f->toa, _mm_or_si128(f->low, _mm_slli_epi64(f->tot, 16)));
+}
+
+DEFINE_PMD_STORE(f_toa_only)
+{
+    md_simd_store2(dst, _mm_or_si128(f->coord, _mm_slli_epi64(f->low, 16)), f->f_toa);
+}
+
+DEFINE_PMD_STORE(toa_only)
+{
+    md_simd_store3(dst, f->coord, f->toa, f->low);
+}
+
+/* Widens the 6-byte MD's at offsets 0 and 6 of a 16-byte load to a lane
+ * each, zero-extended. */
+#define MD_SIMD_WIDEN_2 0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1
+
+/* Loads never reach past the run: the 128-bit kernel loads 16 bytes for the
+ * 12 of two MD's and the 256-bit one another 16 bytes from the third MD on,
+ * so each stops while at least one more MD than it maps remains, and leaves
+ * the last few to the scalar loop. */
+#define DEFINE_PMD_RUN_SIMD(SUFFIX) \
+    static inline MD_SIMD_TARGET_SSE41 void \
+    pmd_##SUFFIX##_run_sse41(katherine_px_##SUFFIX##_t *dst, const char *src, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        const __m128i widen      = _mm_setr_epi8(MD_SIMD_WIDEN_2); \
+        const __m128i toa_offset = _mm_set1_epi64x((long long) acq->last_toa_offset); \
+        const __m128i toa_shift  = _mm_cvtsi32_si128(acq->toa_shift); \
+        md_simd_fields_t f; \
+        size_t i = 0; \
+\
+        for (; i + 3 <= count; i += 2, src += 2 * KATHERINE_MD_SIZE) { \
+            __m128i md = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), widen); \
+            md_simd_fields_sse41(&f, md, toa_offset, toa_shift); \
+            pmd_##SUFFIX##_store(dst + i, &f); \
+        } \
+\
+        pmd_##SUFFIX##_run(dst + i, src, count - i, acq); \
+    } \
+\
+    static inline MD_SIMD_TARGET_AVX2 void \
+    pmd_##SUFFIX##_run_avx2(katherine_px_##SUFFIX##_t *dst, const char *src, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        const __m256i widen      = _mm256_setr_epi8(MD_SIMD_WIDEN_2, MD_SIMD_WIDEN_2); \
+        const __m256i toa_offset = _mm256_set1_epi64x((long long) acq->last_toa_offset); \
+        const __m128i toa_shift  = _mm_cvtsi32_si128(acq->toa_shift); \
+        md_simd_fields_t lo, hi; \
+        size_t i = 0; \
+\
+        for (; i + 5 <= count; i += 4, src += 4 * KATHERINE_MD_SIZE) { \
+            __m128i first  = _mm_loadu_si128((const __m128i *) src); \
+            __m128i second = _mm_loadu_si128((const __m128i *) (src + 2 * KATHERINE_MD_SIZE)); \
+            __m256i md     = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1); \
+            md_simd_fields_avx2(&lo, &hi, _mm256_shuffle_epi8(md, widen), toa_offset, toa_shift); \
+            pmd_##SUFFIX##_store(dst + i, &lo); \
+            pmd_##SUFFIX##_store(dst + i + 2, &hi); \
+        } \
+\
+        pmd_##SUFFIX##_run(dst + i, src, count - i, acq); \
+    } \
+\
+    static inline void \
+    pmd_##SUFFIX##_run_at(md_simd_level_t level, katherine_px_##SUFFIX##_t *dst, const char *src, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        switch (level) { \
+        case MD_SIMD_AVX2:  pmd_##SUFFIX##_run_avx2(dst, src, count, acq); break; \
+        case MD_SIMD_SSE41: pmd_##SUFFIX##_run_sse41(dst, src, count, acq); break; \
+        default:            pmd_##SUFFIX##_run(dst, src, count, acq); break; \
+        } \
+    }
+
+#endif /* KATHERINE_MD_SIMD */
+
+#define DEFINE_PMD_RUN_SCALAR(SUFFIX) \
+    static inline void \
+    pmd_##SUFFIX##_run_at(md_simd_level_t level, katherine_px_##SUFFIX##_t *dst, const char *src, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        (void) level; \
+        pmd_##SUFFIX##_run(dst, src, count, acq); \
+    }
+
+#ifdef KATHERINE_MD_SIMD
+DEFINE_PMD_RUN_SIMD(f_toa_tot)
+DEFINE_PMD_RUN_SIMD(toa_tot)
+DEFINE_PMD_RUN_SIMD(f_toa_only)
+DEFINE_PMD_RUN_SIMD(toa_only)
+#else
+DEFINE_PMD_RUN_SCALAR(f_toa_tot)
+DEFINE_PMD_RUN_SCALAR(toa_tot)
+DEFINE_PMD_RUN_SCALAR(f_toa_only)
+DEFINE_PMD_RUN_SCALAR(toa_only)
+#endif
+DEFINE_PMD_RUN_SCALAR(f_event_itot)
+DEFINE_PMD_RUN_SCALAR(event_itot)
+
+#undef DEFINE_PMD_STORE
+#undef DEFINE_PMD_RUN_SIMD
+#undef DEFINE_PMD_RUN_SCALAR
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
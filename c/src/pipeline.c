@@ -0,0 +1,212 @@
+/**
+ * @file
+ * @brief Implementation of the receiver thread of pipelined acquisitions.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/udp.h>
+#include "alloc.h"
+#include "pipeline.h"
+#include "realtime.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Body of the receiver thread: receives batches of datagrams into the free
+   slots of the ring and publishes them to the decoder, until the decoder
+   raises the stop flag. The flag is checked between receives, so the
+   thread ends within one receive timeout of the data socket. */
+static void
+receive(void *arg)
+{
+    struct katherine_acquisition_pipeline *p = (struct katherine_acquisition_pipeline *) arg;
+    katherine_udp_t *data_socket             = &p->acq->device->data_socket;
+
+    void *slots[KATHERINE_MD_BATCH_MAX];
+    size_t received[KATHERINE_MD_BATCH_MAX];
+    unsigned rounds = 0;
+
+    while (!katherine_atomic_load(&p->stop)) {
+        const uint64_t head = p->head;
+        const size_t room   = p->capacity - (size_t) (head - katherine_atomic_load(&p->tail));
+
+        // A full ring is left to drain. The kernel keeps buffering the
+        // stream meanwhile, so waiting here costs no data until the socket
+        // buffer fills as well.
+        if (room == 0) {
+            if (rounds == 0) {
+                katherine_atomic_store(&p->stalls, p->stalls + 1);
+            }
+            katherine_pipeline_backoff(&rounds);
+            continue;
+        }
+        rounds = 0;
+
+        size_t batch = room < KATHERINE_MD_BATCH_MAX ? room : KATHERINE_MD_BATCH_MAX;
+        for (size_t i = 0; i < batch; ++i) {
+            slots[i] = p->slots + (size_t) ((head + i) % p->capacity) * p->slot_size;
+        }
+
+        if (katherine_udp_recv_batch(data_socket, slots, p->slot_size, received, &batch) != 0) {
+            katherine_atomic_store(&p->idle_head, head);
+            katherine_atomic_store(&p->timeouts, p->timeouts + 1);
+            continue;
+        }
+
+        for (size_t i = 0; i < batch; ++i) {
+            p->lengths[(head + i) % p->capacity] = received[i];
+        }
+        katherine_atomic_store(&p->head, head + batch);
+
+        const uint64_t depth = head + batch - katherine_atomic_load(&p->tail);
+        if (depth > p->high_water) {
+            katherine_atomic_store(&p->high_water, depth);
+        }
+    }
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Empty the ring and start the receiver thread, tuned as the reads of the acquisition are.
+ * @param p Pipeline of the acquisition being read
+ * @return Error code.
+ */
+KATHERINE_NOT_EXPORTED int
+katherine_pipeline_start(struct katherine_acquisition_pipeline *p)
+{
+    p->head       = 0;
+    p->tail       = 0;
+    p->timeouts   = 0;
+    p->idle_head  = 0;
+    p->stalls     = 0;
+    p->high_water = 0;
+    p->stop       = 0;
+
+    int res = katherine_thread_create(&p->receiver, receive, p);
+    if (res) return res;
+
+    res = katherine_realtime_tune_thread(p->acq, &p->receiver);
+    if (res) {
+        katherine_pipeline_stop(p);
+        return res;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the receiver thread and wait for it to end. Datagrams still queued
+ * in the ring are discarded.
+ * @param p Pipeline of the acquisition being read
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_pipeline_stop(struct katherine_acquisition_pipeline *p)
+{
+    katherine_atomic_store(&p->stop, 1);
+    katherine_thread_join(&p->receiver);
+}
+
+/**
+ * Enable or disable the pipelined read of an acquisition.
+ *
+ * A pipelined acquisition dedicates a receiver thread to the data socket. The thread receives
+ * datagrams into a lock-free ring of the given depth, and katherine_acquisition_read() decodes them
+ * from the ring on the calling thread, running the handlers there just like the plain read does. A
+ * slow handler then delays the decoder only, while the receiver keeps draining the socket for as
+ * long as the ring has room. The ring replaces the measurement data buffer for the purpose, and each
+ * of its slots holds one datagram of the largest size (KATHERINE_MD_DATAGRAM_MAX_SIZE), whatever the
+ * size of that buffer.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param depth Datagram slots of the ring, or zero to go back to the plain read
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_pipeline(katherine_acquisition_t *acq, size_t depth)
+{
+    struct katherine_acquisition_pipeline *p = acq->pipeline;
+
+    if (p != NULL) {
+        katherine_buffer_free(&acq->allocator, p->slots, p->capacity * p->slot_size + sizeof(uint64_t));
+        free(p->lengths);
+        free(p);
+        acq->pipeline = NULL;
+    }
+
+    if (depth == 0) {
+        return 0;
+    }
+
+    p = (struct katherine_acquisition_pipeline *) calloc(1, sizeof(*p));
+    if (p == NULL) {
+        goto err_pipeline;
+    }
+
+    p->acq       = acq;
+    p->capacity  = depth;
+    p->slot_size = KATHERINE_MD_DATAGRAM_MAX_SIZE;
+
+    // The decoder reads the last datum of a slot as a whole word, as it does
+    // in the measurement data buffer, hence the same extra word at the end.
+    p->slots = (char *) katherine_buffer_alloc(&acq->allocator, depth * p->slot_size + sizeof(uint64_t));
+    if (p->slots == NULL) {
+        goto err_slots;
+    }
+
+    p->lengths = (size_t *) calloc(depth, sizeof(size_t));
+    if (p->lengths == NULL) {
+        goto err_lengths;
+    }
+
+    acq->pipeline = p;
+    return 0;
+
+err_lengths:
+    katherine_buffer_free(&acq->allocator, p->slots, depth * p->slot_size + sizeof(uint64_t));
+err_slots:
+    free(p);
+err_pipeline:
+    return ENOMEM;
+}
+
+/**
+ * Take a snapshot of the ring of a pipelined acquisition.
+ *
+ * May be called from any thread, including while another one is reading the acquisition. The
+ * figures describe the current or the last read; for an acquisition which is not pipelined, they
+ * are all zero.
+ *
+ * @param acq Acquisition
+ * @param stats Snapshot to fill in
+ */
+void
+katherine_acquisition_get_pipeline_stats(const katherine_acquisition_t *acq, katherine_pipeline_stats_t *stats)
+{
+    const struct katherine_acquisition_pipeline *p = acq->pipeline;
+
+    memset(stats, 0, sizeof(*stats));
+    if (p == NULL) {
+        return;
+    }
+
+    const uint64_t tail = katherine_atomic_load(&p->tail);
+    const uint64_t head = katherine_atomic_load(&p->head);
+
+    stats->capacity   = p->capacity;
+    stats->depth      = (size_t) (head - tail);
+    stats->high_water = (size_t) katherine_atomic_load(&p->high_water);
+    stats->datagrams  = head;
+    stats->stalls     = katherine_atomic_load(&p->stalls);
+}
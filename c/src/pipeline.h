@@ -0,0 +1,116 @@
+/**
+ * @file
+ * @brief Internal receiver thread and datagram ring of pipelined acquisitions.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+#include "msleep.h"
+#include "thread.h"
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Assumed size of a cache line, by which the positions written by the two
+ * threads are kept apart so that neither invalidates the line the other
+ * one keeps reading. */
+#define KATHERINE_CACHE_LINE 64
+
+/* A pipelined acquisition splits the read loop between two threads. The
+ * receiver owns the data socket and receives datagrams straight into the
+ * free slots of a single-producer/single-consumer ring; the decoder, on the
+ * thread that called katherine_acquisition_read(), drains the ring in
+ * order. Either side only ever advances its own position (head for the
+ * receiver, tail for the decoder), which is what makes the ring lock-free.
+ *
+ * Positions count datagrams since the acquisition began and are reduced
+ * modulo the capacity to name a slot, so that a full ring (head - tail ==
+ * capacity) and an empty one (head == tail) stay distinguishable. */
+struct katherine_acquisition_pipeline {
+    katherine_acquisition_t *acq;
+    katherine_thread_t receiver;
+
+    char *slots;
+    size_t *lengths;
+    size_t slot_size;
+    size_t capacity;
+
+    uint64_t head; // written by the receiver
+    char pad_head[KATHERINE_CACHE_LINE - sizeof(uint64_t)];
+
+    uint64_t tail; // written by the decoder
+    char pad_tail[KATHERINE_CACHE_LINE - sizeof(uint64_t)];
+
+    uint64_t timeouts;   // receives that expired or failed, written by the receiver
+    uint64_t idle_head;  // head at the last of them, published before the count
+    uint64_t stalls;     // waits of the receiver on a full ring
+    uint64_t high_water; // deepest the ring has been, written by the receiver
+    uint64_t stop;       // raised by the decoder to end the receiver
+};
+
+KATHERINE_NOT_EXPORTED int
+katherine_pipeline_start(struct katherine_acquisition_pipeline *p);
+
+KATHERINE_NOT_EXPORTED void
+katherine_pipeline_stop(struct katherine_acquisition_pipeline *p);
+
+/* Rounds of yielding the processor before a waiting side of the ring starts
+ * to sleep instead. */
+#define KATHERINE_PIPELINE_SPINS 64
+
+/* Waits a little for the other side of the ring: yields the processor for
+ * the first KATHERINE_PIPELINE_SPINS rounds of a wait, so that a short one
+ * stays short, and sleeps a millisecond per round afterwards, so that a
+ * long one does not keep a core busy. */
+static inline void
+katherine_pipeline_backoff(unsigned *rounds)
+{
+    if (*rounds < KATHERINE_PIPELINE_SPINS) {
+        ++*rounds;
+        katherine_thread_yield();
+    } else {
+        katherine_msleep(1);
+    }
+}
+
+/* Number of datagrams queued for the decoder. */
+static inline size_t
+katherine_pipeline_pending(const struct katherine_acquisition_pipeline *p)
+{
+    return (size_t) (katherine_atomic_load(&p->head) - p->tail);
+}
+
+/* The datagram `i` places behind the tail of the ring; the one at the tail
+   is the one the decoder handles next. */
+static inline const char *
+katherine_pipeline_at(const struct katherine_acquisition_pipeline *p, size_t i, size_t *length)
+{
+    size_t slot = (size_t) ((p->tail + i) % p->capacity);
+    *length     = p->lengths[slot];
+    return p->slots + slot * p->slot_size;
+}
+
+/* Hands the `count` slots at the tail of the ring back to the receiver. */
+static inline void
+katherine_pipeline_pop(struct katherine_acquisition_pipeline *p, size_t count)
+{
+    katherine_atomic_store(&p->tail, p->tail + count);
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
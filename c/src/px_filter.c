@@ -0,0 +1,147 @@
+/**
+ * @file
+ * @brief Implementation of the filtering of decoded pixels by their coordinates.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/px_filter.h>
+
+/* Pixels are ordered by rows in the filter, as in the frame maps. */
+static inline size_t
+_px_filter_index(katherine_coord_t coord)
+{
+    return (size_t) coord.y * 256 + coord.x;
+}
+
+/**
+ * Let all pixels pass a filter, or none.
+ * @param filter Filter to modify.
+ * @param passed Whether the pixels pass.
+ */
+void
+katherine_px_filter_fill(katherine_px_filter_t *filter, bool passed)
+{
+    memset(filter->words, passed ? 0xFF : 0x00, sizeof(filter->words));
+}
+
+/**
+ * Let a single pixel pass a filter, or not.
+ * @param filter Filter to modify.
+ * @param coord Pixel coordinates.
+ * @param passed Whether the pixel passes.
+ */
+void
+katherine_px_filter_set(katherine_px_filter_t *filter, katherine_coord_t coord, bool passed)
+{
+    const size_t index = _px_filter_index(coord);
+    const uint64_t bit = (uint64_t) 1 << (index % 64);
+
+    if (passed) {
+        filter->words[index / 64] |= bit;
+    } else {
+        filter->words[index / 64] &= ~bit;
+    }
+}
+
+/**
+ * Get whether a single pixel passes a filter.
+ * @param filter Filter to read.
+ * @param coord Pixel coordinates.
+ * @return True if the pixel passes.
+ */
+bool
+katherine_px_filter_get(const katherine_px_filter_t *filter, katherine_coord_t coord)
+{
+    const size_t index = _px_filter_index(coord);
+    return (filter->words[index / 64] >> (index % 64)) & 1;
+}
+
+/**
+ * Let a rectangle of pixels pass a filter, or not, such as a region of interest.
+ * @param filter Filter to modify.
+ * @param from Corner of the rectangle, inclusive.
+ * @param to Opposite corner of the rectangle, inclusive.
+ * @param passed Whether the pixels pass.
+ */
+void
+katherine_px_filter_set_rect(katherine_px_filter_t *filter, katherine_coord_t from, katherine_coord_t to, bool passed)
+{
+    const unsigned x0 = from.x < to.x ? from.x : to.x;
+    const unsigned x1 = from.x < to.x ? to.x : from.x;
+    const unsigned y0 = from.y < to.y ? from.y : to.y;
+    const unsigned y1 = from.y < to.y ? to.y : from.y;
+    katherine_coord_t coord;
+
+    for (unsigned y = y0; y <= y1; ++y) {
+        for (unsigned x = x0; x <= x1; ++x) {
+            coord.x = (uint8_t) x;
+            coord.y = (uint8_t) y;
+            katherine_px_filter_set(filter, coord, passed);
+        }
+    }
+}
+
+/**
+ * Let the pixels of a configuration matrix pass a filter unless they are masked.
+ * @param filter Filter to overwrite.
+ * @param px_config Configuration matrix to read the mask bits from.
+ */
+void
+katherine_px_filter_load_mask(katherine_px_filter_t *filter, const katherine_px_config_t *px_config)
+{
+    katherine_coord_t coord;
+
+    for (unsigned y = 0; y < 256; ++y) {
+        for (unsigned x = 0; x < 256; ++x) {
+            coord.x = (uint8_t) x;
+            coord.y = (uint8_t) y;
+            katherine_px_filter_set(filter, coord, !katherine_px_config_get_mask_bit(px_config, coord));
+        }
+    }
+}
+
+/**
+ * Enable or disable the filtering of the decoded pixels by their coordinates.
+ *
+ * With a filter, the decoder drops the pixels which do not pass it straight from the measurement
+ * data, before they are mapped to the pixel buffer, so that masked or hot pixels, or those outside
+ * of a region of interest, cost neither the memory traffic of the buffer nor the handlers. Dropped
+ * pixels are not added to the frame maps or the clusters either (see
+ * katherine_acquisition_set_frame_maps() and katherine_acquisition_set_clustering()), and are
+ * counted in katherine_frame_info_t.filtered_pixels instead of received_pixels.
+ *
+ * The filter is copied; it applies to every acquisition mode and layout. Must not be called while
+ * the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param filter Pixels to pass, or NULL to pass all of them
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_px_filter(katherine_acquisition_t *acq, const katherine_px_filter_t *filter)
+{
+    free(acq->px_filter);
+    acq->px_filter = NULL;
+
+    if (filter == NULL) {
+        return 0;
+    }
+
+    acq->px_filter = (katherine_px_filter_t *) malloc(sizeof(katherine_px_filter_t));
+    if (acq->px_filter == NULL) {
+        return ENOMEM;
+    }
+
+    memcpy(acq->px_filter, filter, sizeof(katherine_px_filter_t));
+    return 0;
+}
@@ -0,0 +1,361 @@
+/**
+ * @file
+ * @brief Implementation of the real-time tuning of the threads receiving measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// cpu_set_t and pthread_setaffinity_np() are GNU extensions of the C library,
+// so the feature macro must precede the first libc include to take effect.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <katherine/global.h>
+
+#include <errno.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include "md_pool.h"
+#include "pipeline.h"
+#include "realtime.h"
+
+#ifdef KATHERINE_NIX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#ifdef KATHERINE_WIN
+typedef HANDLE native_thread_t;
+#define current_thread() GetCurrentThread()
+#else
+typedef pthread_t native_thread_t;
+#define current_thread() pthread_self()
+#endif
+
+static bool
+any_cpu(const uint64_t *cpus)
+{
+    for (size_t i = 0; i < KATHERINE_CPU_SET_WORDS; ++i) {
+        if (cpus[i] != 0) return true;
+    }
+    return false;
+}
+
+/* The first of the errors of a tuning, or zero if every part of it was
+   applied. */
+static int
+first_error(const katherine_realtime_status_t *status)
+{
+    if (status->affinity != 0) return status->affinity;
+    if (status->priority != 0) return status->priority;
+    return status->lock_memory;
+}
+
+#ifdef KATHERINE_NIX
+
+#ifdef __linux__
+
+static int
+get_affinity(native_thread_t thread, uint64_t *cpus)
+{
+    cpu_set_t set;
+    int res = pthread_getaffinity_np(thread, sizeof(set), &set);
+    if (res) return res;
+
+    memset(cpus, 0, KATHERINE_CPU_SET_WORDS * sizeof(uint64_t));
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpu < 64 * KATHERINE_CPU_SET_WORDS; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus[cpu / 64] |= 1ull << (cpu % 64);
+    }
+    return 0;
+}
+
+static int
+set_affinity(native_thread_t thread, const uint64_t *cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int cpu = 0; cpu < 64 * KATHERINE_CPU_SET_WORDS; ++cpu) {
+        if ((cpus[cpu / 64] >> (cpu % 64)) & 1) {
+            if (cpu >= CPU_SETSIZE) return EINVAL;
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+#else
+
+static int
+get_affinity(native_thread_t thread, uint64_t *cpus)
+{
+    (void) thread;
+    (void) cpus;
+    return ENOTSUP;
+}
+
+static int
+set_affinity(native_thread_t thread, const uint64_t *cpus)
+{
+    (void) thread;
+    (void) cpus;
+    return ENOTSUP;
+}
+
+#endif /* __linux__ */
+
+/* Pins the thread to the CPUs of the tuning and raises it to its priority,
+   noting in the status of the acquisition why either part failed. When
+   `saved` is given, what the thread had before is kept there, so that
+   katherine_realtime_leave() can put it back. */
+static void
+tune(katherine_acquisition_t *acq, native_thread_t thread, struct katherine_realtime_saved *saved)
+{
+    const katherine_realtime_t *rt      = &acq->realtime;
+    katherine_realtime_status_t *status = &acq->realtime_status;
+
+    if (any_cpu(rt->cpus)) {
+        status->affinity = saved != NULL ? get_affinity(thread, saved->cpus) : 0;
+        if (status->affinity == 0) {
+            status->affinity = set_affinity(thread, rt->cpus);
+        }
+        if (status->affinity == 0 && saved != NULL) {
+            saved->affinity = true;
+        }
+    }
+
+    if (rt->priority != 0) {
+        struct sched_param param;
+        int policy;
+
+        status->priority = pthread_getschedparam(thread, &policy, &param);
+        if (status->priority == 0 && saved != NULL) {
+            saved->policy   = policy;
+            saved->priority = param.sched_priority;
+        }
+
+        if (status->priority == 0) {
+            param.sched_priority = rt->priority;
+            status->priority     = pthread_setschedparam(thread, SCHED_FIFO, &param);
+        }
+        if (status->priority == 0 && saved != NULL) {
+            saved->scheduling = true;
+        }
+    }
+}
+
+static void
+untune(native_thread_t thread, struct katherine_realtime_saved *saved)
+{
+    if (saved->scheduling) {
+        struct sched_param param;
+        param.sched_priority = saved->priority;
+        (void) pthread_setschedparam(thread, saved->policy, &param);
+    }
+
+    if (saved->affinity) {
+        (void) set_affinity(thread, saved->cpus);
+    }
+}
+
+static int
+lock_region(struct katherine_realtime_saved *saved, const void *addr, size_t length)
+{
+    if (mlock(addr, length) == -1) {
+        return errno;
+    }
+
+    saved->locked[saved->locked_count].addr   = addr;
+    saved->locked[saved->locked_count].length = length;
+    ++saved->locked_count;
+    return 0;
+}
+
+static void
+unlock_regions(struct katherine_realtime_saved *saved)
+{
+    for (size_t i = 0; i < saved->locked_count; ++i) {
+        (void) munlock(saved->locked[i].addr, saved->locked[i].length);
+    }
+    saved->locked_count = 0;
+}
+
+#else /* KATHERINE_WIN */
+
+static void
+tune(katherine_acquisition_t *acq, native_thread_t thread, struct katherine_realtime_saved *saved)
+{
+    (void) thread;
+    (void) saved;
+
+    if (any_cpu(acq->realtime.cpus)) acq->realtime_status.affinity = ENOTSUP;
+    if (acq->realtime.priority != 0) acq->realtime_status.priority = ENOTSUP;
+}
+
+static void
+untune(native_thread_t thread, struct katherine_realtime_saved *saved)
+{
+    (void) thread;
+    (void) saved;
+}
+
+static int
+lock_region(struct katherine_realtime_saved *saved, const void *addr, size_t length)
+{
+    (void) saved;
+    (void) addr;
+    (void) length;
+    return ENOTSUP;
+}
+
+static void
+unlock_regions(struct katherine_realtime_saved *saved)
+{
+    (void) saved;
+}
+
+#endif /* KATHERINE_NIX */
+
+/* Locks the buffers the read receives into and decodes from, noting the
+   first error in the status of the acquisition. */
+static void
+lock_buffers(katherine_acquisition_t *acq, struct katherine_realtime_saved *saved)
+{
+    int res = lock_region(saved, acq->md_buffer, acq->md_buffer_size + sizeof(uint64_t));
+
+    if (res == 0) {
+        res = lock_region(saved, acq->pixel_buffer, acq->pixel_buffer_size);
+    }
+    if (res == 0 && acq->pipeline != NULL) {
+        res = lock_region(saved, acq->pipeline->slots, acq->pipeline->capacity * acq->pipeline->slot_size + sizeof(uint64_t));
+    }
+    if (res == 0 && acq->md_pool != NULL) {
+        res = lock_region(saved, acq->md_pool->buffers, acq->md_pool->capacity * acq->md_pool->slot_size + sizeof(uint64_t));
+    }
+
+    acq->realtime_status.lock_memory = res;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Apply the real-time tuning of an acquisition at the beginning of a read.
+ * @param acq Acquisition being read
+ * @param tune_caller Whether the calling thread receives the data, rather than the receiver thread of a pipeline
+ * @param saved What the tuning changed, to be undone by katherine_realtime_leave()
+ * @return Error code: the first part of the tuning which failed, if the tuning is required.
+ */
+KATHERINE_NOT_EXPORTED int
+katherine_realtime_enter(katherine_acquisition_t *acq, bool tune_caller, struct katherine_realtime_saved *saved)
+{
+    memset(saved, 0, sizeof(*saved));
+    memset(&acq->realtime_status, 0, sizeof(acq->realtime_status));
+
+    if (acq->realtime.lock_memory) {
+        lock_buffers(acq, saved);
+    }
+
+    if (tune_caller) {
+        tune(acq, current_thread(), saved);
+    }
+
+    int res = first_error(&acq->realtime_status);
+    if (res && acq->realtime.required) {
+        katherine_realtime_leave(acq, saved);
+        return res;
+    }
+
+    return 0;
+}
+
+/**
+ * Apply the real-time tuning of an acquisition to a thread which receives its data.
+ * @param acq Acquisition being read
+ * @param t Thread receiving the data, which ends with the read
+ * @return Error code: the first part of the tuning which failed, if the tuning is required.
+ */
+KATHERINE_NOT_EXPORTED int
+katherine_realtime_tune_thread(katherine_acquisition_t *acq, katherine_thread_t *t)
+{
+    tune(acq, t->handle, NULL);
+
+    int res = first_error(&acq->realtime_status);
+    return acq->realtime.required ? res : 0;
+}
+
+/**
+ * Undo the real-time tuning of the calling thread and unlock the buffers at the end of a read.
+ * @param acq Acquisition being read
+ * @param saved What katherine_realtime_enter() changed
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_realtime_leave(katherine_acquisition_t *acq, struct katherine_realtime_saved *saved)
+{
+    (void) acq;
+
+    untune(current_thread(), saved);
+    unlock_regions(saved);
+}
+
+/**
+ * Run the reads of an acquisition in real time.
+ *
+ * A read at full rate must keep up with the stream: a thread preempted for a few milliseconds lets
+ * the socket buffer overflow. With a tuning, katherine_acquisition_read() pins the thread receiving
+ * the measurement data to the given CPUs, raises it to the given SCHED_FIFO priority and locks the
+ * buffers of the acquisition in memory, for the duration of the read. The receiving thread is the
+ * one that called the read, or the receiver thread of a pipelined acquisition (see
+ * katherine_acquisition_set_pipeline()); the affinity and the scheduling of the calling thread are
+ * put back as they were when the read returns. The step-wise read (katherine_acquisition_pump())
+ * runs on the thread of the event loop, which the application tunes itself.
+ *
+ * Each part of the tuning needs the host to allow it: a real-time priority needs CAP_SYS_NICE or a
+ * sufficient RLIMIT_RTPRIO, and locking memory CAP_IPC_LOCK or a sufficient RLIMIT_MEMLOCK. A part
+ * which the host refuses is skipped, and the reason is kept for katherine_acquisition_get_realtime_status()
+ * -- EPERM for a missing privilege, say -- unless the tuning is required, in which case the read fails
+ * with it instead. Only Linux pins threads; elsewhere the affinity fails with ENOTSUP.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param rt Tuning, or NULL to read without one
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_realtime(katherine_acquisition_t *acq, const katherine_realtime_t *rt)
+{
+    if (rt == NULL) {
+        memset(&acq->realtime, 0, sizeof(acq->realtime));
+        return 0;
+    }
+
+    if (rt->priority < 0) {
+        return EINVAL;
+    }
+
+    acq->realtime = *rt;
+    return 0;
+}
+
+/**
+ * Find out which parts of the real-time tuning of an acquisition the last read applied.
+ *
+ * May be called from a handler, or once the read has returned.
+ *
+ * @param acq Acquisition
+ * @param status Error code of each part of the tuning, zero where it was applied or not requested
+ */
+void
+katherine_acquisition_get_realtime_status(const katherine_acquisition_t *acq, katherine_realtime_status_t *status)
+{
+    *status = acq->realtime_status;
+}
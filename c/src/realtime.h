@@ -0,0 +1,63 @@
+/**
+ * @file
+ * @brief Internal real-time tuning of the threads receiving measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+#include "thread.h"
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Buffers of an acquisition which a read locks in memory, at most: the
+ * measurement data buffer, the pixel buffer, the ring of a pipeline and the
+ * buffers of a lease pool. */
+#define KATHERINE_REALTIME_REGIONS 4
+
+/* What a read changed to run in real time, and undoes when it ends. The
+ * affinity and the scheduling of the thread that called the read are kept
+ * as they were, in the same form as requested; the receiver thread of a
+ * pipeline is tuned too, but ends with the read and needs no undoing. */
+struct katherine_realtime_saved {
+    bool affinity;
+    uint64_t cpus[KATHERINE_CPU_SET_WORDS];
+
+    bool scheduling;
+    int policy;
+    int priority;
+
+    struct {
+        const void *addr;
+        size_t length;
+    } locked[KATHERINE_REALTIME_REGIONS];
+    size_t locked_count;
+};
+
+KATHERINE_NOT_EXPORTED int
+katherine_realtime_enter(katherine_acquisition_t *acq, bool tune_caller, struct katherine_realtime_saved *saved);
+
+KATHERINE_NOT_EXPORTED int
+katherine_realtime_tune_thread(katherine_acquisition_t *acq, katherine_thread_t *t);
+
+KATHERINE_NOT_EXPORTED void
+katherine_realtime_leave(katherine_acquisition_t *acq, struct katherine_realtime_saved *saved);
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,594 @@
+/**
+ * @file
+ * @brief Implementation of recordings of raw measurement data.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// fseeko() is POSIX, and takes offsets of 64 bits on 32-bit systems only with
+// the large file macro, so both must precede the first libc include.
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/recording.h>
+#include <katherine/version.h>
+#include "fileio.h"
+#include "md.h"
+#include "pipeline.h"
+#include "thread.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Length of the entry of the buffer which sends the writer back to its
+   start, as the datagram behind it did not fit before the end. */
+#define RECORDER_WRAP UINT32_MAX
+
+/* Entries of the buffer are 8-byte aligned: a header of the length, padded
+   to a word, and the datagram, padded likewise. */
+#define RECORDER_ENTRY(LENGTH) (sizeof(uint64_t) + (((LENGTH) + 7) & ~(size_t) 7))
+
+/* The thread which hands the datagrams to the recorder copies each one into
+ * a ring buffer, and the writer, a thread of the recorder, writes them to the
+ * file, indexing the frames as it goes. Either side counts the bytes it has
+ * been through, so that the buffer holds `head - tail` bytes; the side that
+ * finds it full or empty waits by katherine_pipeline_backoff(). */
+struct katherine_recorder_writer {
+    FILE *file;
+    katherine_thread_t thread;
+
+    char *ring;
+    size_t capacity;
+
+    uint64_t head; // written by the thread handing the datagrams
+    char pad_head[KATHERINE_CACHE_LINE - sizeof(uint64_t)];
+
+    uint64_t tail; // written by the writer
+    char pad_tail[KATHERINE_CACHE_LINE - sizeof(uint64_t)];
+
+    uint64_t stop;   // raised to end the writer once it has drained the ring
+    uint64_t error;  // first error of the writer
+    uint64_t stalls; // waits for room in the ring
+
+    // Private to the writer until it ends.
+    uint64_t offset; // of the next record in the file
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t indexed; // frame_count, for the stats
+    katherine_recording_frame_t *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    bool frame_open;
+};
+
+/* Notes a failure of the writer, unless one has been noted already. */
+static void
+fail(struct katherine_recorder_writer *w, int error)
+{
+    uint64_t none = 0;
+    (void) katherine_atomic_compare_exchange(&w->error, &none, (uint64_t) error);
+}
+
+/* Adds a frame to the index, growing it as needed. */
+static katherine_recording_frame_t *
+new_frame(struct katherine_recorder_writer *w)
+{
+    if (w->frame_count == w->frame_capacity) {
+        const size_t capacity                = w->frame_capacity > 0 ? 2 * w->frame_capacity : 64;
+        katherine_recording_frame_t *resized = (katherine_recording_frame_t *) realloc(w->frames, capacity * sizeof(katherine_recording_frame_t));
+        if (resized == NULL) return NULL;
+
+        w->frames         = resized;
+        w->frame_capacity = capacity;
+    }
+
+    katherine_recording_frame_t *frame = &w->frames[w->frame_count++];
+    memset(frame, 0, sizeof(*frame));
+    katherine_atomic_store(&w->indexed, w->frame_count);
+    return frame;
+}
+
+/* Indexes the frame data of a datagram whose record starts at `offset`. */
+static void
+index_datagram(struct katherine_recorder_writer *w, const char *data, size_t length, uint64_t offset)
+{
+    const uint64_t end                 = offset + sizeof(uint32_t) + length;
+    katherine_recording_frame_t *frame = w->frame_open ? &w->frames[w->frame_count - 1] : NULL;
+
+    for (size_t count = length / KATHERINE_MD_SIZE; count > 0; --count, data += KATHERINE_MD_SIZE) {
+        const uint64_t md = *(const uint64_t *) data;
+
+        switch (EXTRACT(md, md, header)) {
+        case 0x7:
+            frame = new_frame(w);
+            if (frame == NULL) {
+                fail(w, ENOMEM);
+                return;
+            }
+            frame->start_offset = offset;
+            frame->end_offset   = end;
+            w->frame_open       = true;
+            break;
+        case 0x8:
+            if (frame != NULL) frame->start_time.b.lsb = EXTRACT(md, md_time_lsb, lsb);
+            break;
+        case 0x9:
+            if (frame != NULL) frame->start_time.b.msb = EXTRACT(md, md_time_msb, msb);
+            break;
+        case 0xA:
+            if (frame != NULL) frame->end_time.b.lsb = EXTRACT(md, md_time_lsb, lsb);
+            break;
+        case 0xB:
+            if (frame != NULL) frame->end_time.b.msb = EXTRACT(md, md_time_msb, msb);
+            break;
+        case 0xC:
+            if (frame != NULL) {
+                frame->sent_pixels = EXTRACT(md, md_frame_finished, n_sent);
+                frame->completed   = 1;
+                frame->end_offset  = end;
+            }
+            frame         = NULL;
+            w->frame_open = false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // A frame still running spans the datagram.
+    if (frame != NULL) {
+        frame->end_offset = end;
+    }
+}
+
+/* Writes a datagram to the file as a record. */
+static void
+write_record(struct katherine_recorder_writer *w, const char *data, uint32_t length)
+{
+    if (katherine_atomic_load(&w->error) != 0) {
+        return;
+    }
+
+    if (fwrite(&length, sizeof(length), 1, w->file) != 1 || fwrite(data, 1, length, w->file) != length) {
+        fail(w, EIO);
+        return;
+    }
+
+    index_datagram(w, data, length, w->offset);
+    w->offset += sizeof(length) + length;
+    katherine_atomic_store(&w->datagrams, w->datagrams + 1);
+    katherine_atomic_store(&w->bytes, w->bytes + sizeof(length) + length);
+}
+
+/* Body of the writer: writes the datagrams of the ring to the file, until
+   the ring is empty and the stop flag raised. */
+static void
+drain(void *arg)
+{
+    struct katherine_recorder_writer *w = (struct katherine_recorder_writer *) arg;
+    unsigned rounds                     = 0;
+    uint64_t tail                       = w->tail;
+
+    for (;;) {
+        if (tail == katherine_atomic_load(&w->head)) {
+            // The flag is raised after the last datagram, so a ring still
+            // empty after seeing it stays empty.
+            if (katherine_atomic_load(&w->stop) && tail == katherine_atomic_load(&w->head)) {
+                return;
+            }
+            katherine_pipeline_backoff(&rounds);
+            continue;
+        }
+        rounds = 0;
+
+        const size_t at = (size_t) (tail % w->capacity);
+        uint32_t length;
+        memcpy(&length, w->ring + at, sizeof(length));
+
+        if (length == RECORDER_WRAP) {
+            tail += w->capacity - at;
+        } else {
+            write_record(w, w->ring + at + sizeof(uint64_t), length);
+            tail += RECORDER_ENTRY(length);
+        }
+        katherine_atomic_store(&w->tail, tail);
+    }
+}
+
+/* Writes the index and the trailer behind the records. */
+static int
+write_index(struct katherine_recorder_writer *w)
+{
+    katherine_recording_trailer_t trailer;
+
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.index_offset = w->offset;
+    trailer.frames       = w->frame_count;
+    trailer.datagrams    = w->datagrams;
+    memcpy(trailer.magic, KATHERINE_RECORDING_TRAILER_MAGIC, sizeof(KATHERINE_RECORDING_TRAILER_MAGIC));
+
+    if (w->frame_count > 0 && fwrite(w->frames, sizeof(katherine_recording_frame_t), w->frame_count, w->file) != w->frame_count) {
+        return EIO;
+    }
+    if (fwrite(&trailer, sizeof(trailer), 1, w->file) != 1) {
+        return EIO;
+    }
+
+    return 0;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Create a recording and start the thread writing it.
+ *
+ * The recording describes the acquisition by the given parameters, which should be those it is
+ * begun with (see katherine_acquisition_begin()).
+ *
+ * @param recorder Recorder to initialize
+ * @param file_path Path of the recording, which is overwritten
+ * @param config Configuration of the acquisition
+ * @param readout_mode Readout mode of the acquisition
+ * @param acq_mode Acquisition mode
+ * @param fast_vco_enabled Whether the acquisition runs with the fast VCO
+ * @param buffer_size Size of the buffer between the recorder and its thread, in bytes
+ * @return Error code: EINVAL if the buffer cannot hold two datagrams of the largest size.
+ */
+int
+katherine_recorder_open(katherine_recorder_t *recorder, const char *file_path, const katherine_config_t *config, char readout_mode, katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled, size_t buffer_size)
+{
+    int res = 0;
+    struct katherine_recorder_writer *w;
+    katherine_recording_header_t header;
+
+    recorder->writer = NULL;
+
+    // A datagram which does not fit before the end of the ring takes the
+    // room left there as well as its own entry, so only twice the largest
+    // entry is room enough for any datagram wherever the ring stands.
+    buffer_size &= ~(size_t) 7;
+    if (buffer_size < 2 * RECORDER_ENTRY(KATHERINE_MD_DATAGRAM_MAX_SIZE)) {
+        return EINVAL;
+    }
+
+    w = (struct katherine_recorder_writer *) calloc(1, sizeof(*w));
+    if (w == NULL) {
+        res = ENOMEM;
+        goto err_writer;
+    }
+
+    // An extra word, so that indexing reads the last datum of a datagram at
+    // the end of the ring as a whole word within the allocation.
+    w->capacity = buffer_size;
+    w->ring     = (char *) malloc(buffer_size + sizeof(uint64_t));
+    if (w->ring == NULL) {
+        res = ENOMEM;
+        goto err_ring;
+    }
+
+    w->file = fopen(file_path, "wb");
+    if (w->file == NULL) {
+        res = errno;
+        goto err_fopen;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KATHERINE_RECORDING_MAGIC, sizeof(KATHERINE_RECORDING_MAGIC));
+    header.byte_order      = 0x01020304;
+    header.format          = KATHERINE_RECORDING_FORMAT;
+    header.header_size     = sizeof(header);
+    header.config_size     = sizeof(header.config);
+    header.library_version = katherine_version();
+    strncpy(header.library_version_string, katherine_version_string(), sizeof(header.library_version_string) - 1);
+    header.readout_mode     = readout_mode;
+    header.acq_mode         = (char) acq_mode;
+    header.fast_vco_enabled = fast_vco_enabled;
+    header.config           = *config;
+
+    if (fwrite(&header, sizeof(header), 1, w->file) != 1) {
+        res = EIO;
+        goto err_header;
+    }
+    w->offset = sizeof(header);
+
+    res = katherine_thread_create(&w->thread, drain, w);
+    if (res) {
+        goto err_thread;
+    }
+
+    recorder->writer = w;
+    return 0;
+
+err_thread:
+err_header:
+    fclose(w->file);
+    remove(file_path);
+err_fopen:
+    free(w->ring);
+err_ring:
+    free(w);
+err_writer:
+    return res;
+}
+
+/**
+ * Hand a datagram of raw measurement data to a recorder.
+ *
+ * The datagram is copied to the buffer of the recorder, and written by its thread. Should the buffer
+ * be full, the call waits for room. Must not be called from more than one thread at once.
+ *
+ * @param recorder Open recorder
+ * @param data Datagram
+ * @param length Length of the datagram, at most KATHERINE_MD_DATAGRAM_MAX_SIZE
+ * @return Error code: the first error of the thread writing the file, if any.
+ */
+int
+katherine_recorder_write(katherine_recorder_t *recorder, const char *data, size_t length)
+{
+    struct katherine_recorder_writer *w = recorder->writer;
+    const size_t entry                  = RECORDER_ENTRY(length);
+    const uint64_t error                = katherine_atomic_load(&w->error);
+    unsigned rounds                     = 0;
+
+    if (error != 0) {
+        return (int) error;
+    }
+    if (length > KATHERINE_MD_DATAGRAM_MAX_SIZE) {
+        return EINVAL;
+    }
+
+    const uint64_t head = w->head;
+    const size_t at     = (size_t) (head % w->capacity);
+    const size_t room   = w->capacity - at;
+    const size_t needed = room < entry ? room + entry : entry;
+
+    while (w->capacity - (head - katherine_atomic_load(&w->tail)) < needed) {
+        if (rounds == 0) {
+            katherine_atomic_store(&w->stalls, w->stalls + 1);
+        }
+        katherine_pipeline_backoff(&rounds);
+    }
+
+    char *dst       = w->ring + at;
+    uint32_t header = (uint32_t) length;
+
+    if (room < entry) {
+        const uint32_t wrap = RECORDER_WRAP;
+        memcpy(dst, &wrap, sizeof(wrap));
+        dst = w->ring;
+    }
+
+    memcpy(dst, &header, sizeof(header));
+    memcpy(dst + sizeof(uint64_t), data, length);
+    katherine_atomic_store(&w->head, head + needed);
+    return 0;
+}
+
+/**
+ * Take a snapshot of the counters of a recorder.
+ *
+ * May be called from any thread while the recorder is open.
+ *
+ * @param recorder Open recorder
+ * @param stats Snapshot to fill in
+ */
+void
+katherine_recorder_get_stats(const katherine_recorder_t *recorder, katherine_recorder_stats_t *stats)
+{
+    struct katherine_recorder_writer *w = recorder->writer;
+
+    stats->datagrams = katherine_atomic_load(&w->datagrams);
+    stats->bytes     = katherine_atomic_load(&w->bytes);
+    stats->frames    = katherine_atomic_load(&w->indexed);
+    stats->stalls    = katherine_atomic_load(&w->stalls);
+}
+
+/**
+ * Finish a recording: wait for the thread to write the datagrams handed to the recorder, write the
+ * index of the frames, and close the file.
+ * @param recorder Open recorder, which is closed even if an error is reported
+ * @return Error code: the first error in writing the recording, if any.
+ */
+int
+katherine_recorder_close(katherine_recorder_t *recorder)
+{
+    struct katherine_recorder_writer *w = recorder->writer;
+    int res;
+
+    if (w == NULL) {
+        return 0;
+    }
+
+    katherine_atomic_store(&w->stop, 1);
+    katherine_thread_join(&w->thread);
+
+    res = (int) katherine_atomic_load(&w->error);
+    if (res == 0) {
+        res = write_index(w);
+    }
+    if (fclose(w->file) != 0 && res == 0) {
+        res = EIO;
+    }
+
+    free(w->frames);
+    free(w->ring);
+    free(w);
+    recorder->writer = NULL;
+    return res;
+}
+
+/**
+ * Record the raw measurement data an acquisition receives.
+ *
+ * With a recorder, katherine_acquisition_read() and katherine_acquisition_pump() hand every
+ * datagram they receive to it, before it is decoded or passed to the data_received or data_leased
+ * handler, so that the stream can be archived whether or not the acquisition decodes it. The
+ * recorder is not owned by the acquisition; it must stay open for as long as it is set.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param recorder Open recorder, or NULL to stop recording
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_recorder(katherine_acquisition_t *acq, katherine_recorder_t *recorder)
+{
+    acq->recorder = recorder;
+    return 0;
+}
+
+/**
+ * Open a recording for reading, and load its index.
+ *
+ * Afterwards, katherine_recording_next() reads the records from the first one.
+ *
+ * @param recording Recording to initialize
+ * @param file_path Path of the recording
+ * @return Error code: EPROTO if the file is not a complete recording of this library.
+ */
+int
+katherine_recording_open(katherine_recording_t *recording, const char *file_path)
+{
+    int res = 0;
+    katherine_recording_trailer_t trailer;
+
+    memset(recording, 0, sizeof(*recording));
+
+    recording->file = fopen(file_path, "rb");
+    if (recording->file == NULL) {
+        res = errno;
+        goto err_fopen;
+    }
+
+    if (fread(&recording->header, sizeof(recording->header), 1, recording->file) != 1) {
+        res = EPROTO;
+        goto err_header;
+    }
+
+    // Recordings of other hosts and of other builds of the library, whose
+    // configuration differs in layout, are not read.
+    const katherine_recording_header_t *h = &recording->header;
+    if (memcmp(h->magic, KATHERINE_RECORDING_MAGIC, sizeof(KATHERINE_RECORDING_MAGIC)) != 0 || h->byte_order != 0x01020304 || h->format != KATHERINE_RECORDING_FORMAT || h->header_size != sizeof(*h) || h->config_size != sizeof(h->config)) {
+        res = EPROTO;
+        goto err_header;
+    }
+
+    if (katherine_fseek(recording->file, -(int64_t) sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, recording->file) != 1 || memcmp(trailer.magic, KATHERINE_RECORDING_TRAILER_MAGIC, sizeof(KATHERINE_RECORDING_TRAILER_MAGIC)) != 0) {
+        res = EPROTO;
+        goto err_header;
+    }
+
+    recording->frame_count  = (size_t) trailer.frames;
+    recording->datagrams    = trailer.datagrams;
+    recording->index_offset = trailer.index_offset;
+
+    if (recording->frame_count > 0) {
+        recording->frames = (katherine_recording_frame_t *) malloc(recording->frame_count * sizeof(katherine_recording_frame_t));
+        if (recording->frames == NULL) {
+            res = ENOMEM;
+            goto err_header;
+        }
+
+        if (katherine_fseek(recording->file, (int64_t) trailer.index_offset, SEEK_SET) != 0 || fread(recording->frames, sizeof(katherine_recording_frame_t), recording->frame_count, recording->file) != recording->frame_count) {
+            res = EPROTO;
+            goto err_index;
+        }
+    }
+
+    recording->position = h->header_size;
+    if (katherine_fseek(recording->file, (int64_t) recording->position, SEEK_SET) != 0) {
+        res = EIO;
+        goto err_index;
+    }
+
+    return 0;
+
+err_index:
+    free(recording->frames);
+err_header:
+    fclose(recording->file);
+err_fopen:
+    memset(recording, 0, sizeof(*recording));
+    return res;
+}
+
+/**
+ * Move the reading of a recording to the first record of a frame.
+ * @param recording Open recording
+ * @param frame Index of the frame
+ * @return Error code: EINVAL if the recording has no such frame.
+ */
+int
+katherine_recording_seek_frame(katherine_recording_t *recording, size_t frame)
+{
+    if (frame >= recording->frame_count) {
+        return EINVAL;
+    }
+
+    if (katherine_fseek(recording->file, (int64_t) recording->frames[frame].start_offset, SEEK_SET) != 0) {
+        return EIO;
+    }
+
+    recording->position = recording->frames[frame].start_offset;
+    return 0;
+}
+
+/**
+ * Read the next record of a recording.
+ * @param recording Open recording
+ * @param buffer Buffer to read the datagram to
+ * @param buffer_size Size of the buffer, in bytes
+ * @param length Length of the datagram read, or zero past the last record
+ * @return Error code: EMSGSIZE if the datagram does not fit the buffer.
+ */
+int
+katherine_recording_next(katherine_recording_t *recording, char *buffer, size_t buffer_size, size_t *length)
+{
+    uint32_t header;
+
+    *length = 0;
+    if (recording->position >= recording->index_offset) {
+        return 0;
+    }
+
+    if (fread(&header, sizeof(header), 1, recording->file) != 1) {
+        return EIO;
+    }
+    if (header > buffer_size) {
+        return EMSGSIZE;
+    }
+    if (fread(buffer, 1, header, recording->file) != header) {
+        return EIO;
+    }
+
+    recording->position += sizeof(header) + header;
+    *length = header;
+    return 0;
+}
+
+/**
+ * Close a recording open for reading.
+ * @param recording Open recording
+ */
+void
+katherine_recording_close(katherine_recording_t *recording)
+{
+    free(recording->frames);
+    if (recording->file != NULL) {
+        fclose(recording->file);
+    }
+    memset(recording, 0, sizeof(*recording));
+}
@@ -0,0 +1,307 @@
+/**
+ * @file
+ * @brief Implementation of the time ordering of decoded pixels.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include "reorder.h"
+#include "thread.h"
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+static inline uint64_t
+record_toa(const struct katherine_reorder *r, const char *record)
+{
+    uint64_t toa;
+    memcpy(&toa, record + r->toa_offset, sizeof(toa));
+    return toa;
+}
+
+/* Adds to a performance counter of the acquisition, as the read does. */
+static inline void
+count_pixels(uint64_t *counter, uint64_t n)
+{
+    katherine_atomic_store(counter, *counter + n);
+}
+
+/* Hands out the late records collected so far. */
+static inline void
+emit_late(struct katherine_reorder *r)
+{
+    if (r->late_count > 0) {
+        r->emit(r->acq, r->out, r->late_count);
+        r->late_count = 0;
+    }
+}
+
+/* Sorts the first `count` keys, and the indices along with them, by a least
+   significant digit first radix sort on a byte at a time, which takes as
+   many passes as the keys span bytes above the smallest one. Returns where
+   the sorted indices ended up. */
+static uint32_t *
+radix_sort(struct katherine_reorder *r, size_t count)
+{
+    uint64_t *keys   = r->keys;
+    uint64_t *keys2  = r->keys + r->capacity;
+    uint32_t *order  = r->order;
+    uint32_t *order2 = r->order + r->capacity;
+    uint64_t min     = UINT64_MAX;
+    uint64_t span    = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (keys[i] < min) min = keys[i];
+    }
+    for (i = 0; i < count; ++i) {
+        keys[i] -= min;
+        span |= keys[i];
+    }
+
+    for (unsigned shift = 0; shift < 64 && (span >> shift) != 0; shift += 8) {
+        size_t offsets[256] = {0};
+
+        for (i = 0; i < count; ++i) {
+            ++offsets[(keys[i] >> shift) & 0xFF];
+        }
+        for (size_t digit = 0, sum = 0; digit < 256; ++digit) {
+            const size_t n  = offsets[digit];
+            offsets[digit]  = sum;
+            sum            += n;
+        }
+        for (i = 0; i < count; ++i) {
+            const size_t at = offsets[(keys[i] >> shift) & 0xFF]++;
+            keys2[at]       = keys[i];
+            order2[at]      = order[i];
+        }
+
+        uint64_t *k = keys;
+        uint32_t *o = order;
+        keys        = keys2;
+        order       = order2;
+        keys2       = k;
+        order2      = o;
+    }
+
+    return order;
+}
+
+/* Hands out, in order, the records held back whose time of arrival is at
+   most `limit`, and keeps the others. */
+static void
+release(struct katherine_reorder *r, uint64_t limit)
+{
+    const size_t rs = r->record_size;
+    size_t count    = 0;
+    size_t kept     = 0;
+    uint32_t *order;
+    uint64_t toa;
+
+    emit_late(r);
+
+    for (size_t i = 0; i < r->pending_count; ++i) {
+        toa = record_toa(r, r->pending + i * rs);
+        if (toa <= limit) {
+            r->keys[count]  = toa;
+            r->order[count] = (uint32_t) i;
+            ++count;
+            if (toa > r->emitted_toa) r->emitted_toa = toa;
+        }
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    order = radix_sort(r, count);
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(r->out + i * rs, r->pending + (size_t) order[i] * rs, rs);
+    }
+
+    // The records kept move forward, in arrival order still, so that equal
+    // times of arrival go out as they came.
+    for (size_t i = 0; i < r->pending_count; ++i) {
+        const char *record = r->pending + i * rs;
+        if (record_toa(r, record) > limit) {
+            if (kept != i) memcpy(r->pending + kept * rs, record, rs);
+            ++kept;
+        }
+    }
+    r->pending_count = kept;
+
+    r->emit(r->acq, r->out, count);
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Allocate a time ordering stage.
+ * @param acq Acquisition to order the pixels of
+ * @param reordering Parameters of the ordering, with max_pending positive
+ * @param max_record_size Largest pixel record it may be given
+ * @param emit Function the ordered pixels are handed to
+ * @return The stage, or NULL if out of memory.
+ */
+KATHERINE_NOT_EXPORTED struct katherine_reorder *
+katherine_reorder_new(katherine_acquisition_t *acq, const katherine_reordering_t *reordering, size_t max_record_size, void (*emit)(katherine_acquisition_t *, const void *, size_t))
+{
+    struct katherine_reorder *r = (struct katherine_reorder *) calloc(1, sizeof(*r));
+    if (r == NULL) {
+        goto err_reorder;
+    }
+
+    r->acq      = acq;
+    r->emit     = emit;
+    r->window   = reordering->window;
+    r->capacity = reordering->max_pending;
+
+    r->pending = (char *) malloc(r->capacity * max_record_size);
+    if (r->pending == NULL) {
+        goto err_pending;
+    }
+
+    r->out = (char *) malloc(r->capacity * max_record_size);
+    if (r->out == NULL) {
+        goto err_out;
+    }
+
+    r->keys = (uint64_t *) malloc(2 * r->capacity * sizeof(uint64_t));
+    if (r->keys == NULL) {
+        goto err_keys;
+    }
+
+    r->order = (uint32_t *) malloc(2 * r->capacity * sizeof(uint32_t));
+    if (r->order == NULL) {
+        goto err_order;
+    }
+
+    return r;
+
+err_order:
+    free(r->keys);
+err_keys:
+    free(r->out);
+err_out:
+    free(r->pending);
+err_pending:
+    free(r);
+err_reorder:
+    return NULL;
+}
+
+/**
+ * Free a time ordering stage, dropping the pixels it holds back.
+ * @param r Stage to free, or NULL
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_free(struct katherine_reorder *r)
+{
+    if (r == NULL) {
+        return;
+    }
+
+    free(r->order);
+    free(r->keys);
+    free(r->out);
+    free(r->pending);
+    free(r);
+}
+
+/**
+ * Prepare a time ordering stage for a read.
+ * @param r Stage
+ * @param record_size Size of the pixel records of the read, or zero if they are not to be ordered
+ * @param toa_offset Offset of the 64-bit time of arrival in the records
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_begin(struct katherine_reorder *r, size_t record_size, size_t toa_offset)
+{
+    r->record_size   = record_size;
+    r->toa_offset    = toa_offset;
+    r->pending_count = 0;
+    r->late_count    = 0;
+    katherine_reorder_restart(r);
+}
+
+/**
+ * Pass pixel records through a time ordering stage.
+ *
+ * The records which arrived late are handed out right away, on their own. The others are held back,
+ * and those which the window has passed are then handed out in order. Should the records held back
+ * fill the stage up, all of them are handed out first, as a flush would.
+ *
+ * @param r Stage of a read which orders its pixels
+ * @param px Records
+ * @param count Number of records
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_push(struct katherine_reorder *r, const void *px, size_t count)
+{
+    const size_t rs    = r->record_size;
+    const char *record = (const char *) px;
+    uint64_t late      = 0;
+    uint64_t forced    = 0;
+    uint64_t toa;
+
+    for (size_t i = 0; i < count; ++i, record += rs) {
+        toa = record_toa(r, record);
+
+        if (toa < r->emitted_toa) {
+            if (r->late_count == r->capacity) emit_late(r);
+            memcpy(r->out + r->late_count * rs, record, rs);
+            ++r->late_count;
+            ++late;
+            continue;
+        }
+
+        if (r->pending_count == r->capacity) {
+            forced += r->pending_count;
+            release(r, UINT64_MAX);
+        }
+
+        memcpy(r->pending + r->pending_count * rs, record, rs);
+        ++r->pending_count;
+        if (toa > r->latest_toa) r->latest_toa = toa;
+    }
+
+    if (late > 0) count_pixels(&r->acq->stats.late_pixels, late);
+    if (forced > 0) count_pixels(&r->acq->stats.forced_pixels, forced);
+
+    emit_late(r);
+    if (r->latest_toa >= r->window) {
+        release(r, r->latest_toa - r->window);
+    }
+}
+
+/**
+ * Hand out all pixel records a time ordering stage holds back, in order.
+ *
+ * The pixels passed afterwards still have to follow those handed out, or count as late.
+ *
+ * @param r Stage of a read which orders its pixels
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_flush(struct katherine_reorder *r)
+{
+    release(r, UINT64_MAX);
+}
+
+/**
+ * Let the time of arrival of the pixels passed to a time ordering stage start over, as with a new
+ * frame. The stage must hold nothing back.
+ * @param r Stage
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_restart(struct katherine_reorder *r)
+{
+    r->latest_toa  = 0;
+    r->emitted_toa = 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file
+ * @brief Internal time ordering of decoded pixels.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Pixel records pass through the stage as they are flushed from the pixel
+ * buffer, and wait in it until the latest time of arrival seen has moved on
+ * by the window past theirs: no pixel arriving in time can precede them any
+ * more. They are then sorted by a radix sort on their time of arrival,
+ * which is stable, and handed to emit in order. Each batch the stage hands
+ * out follows the one before it in time, save for the late pixels -- those
+ * arriving behind a pixel handed out already -- which are handed out on
+ * their own, as soon as they arrive.
+ *
+ * Records are moved as opaque bytes, with the time of arrival read at an
+ * offset; the stage only orders the plain records of the modes with one. */
+struct katherine_reorder {
+    katherine_acquisition_t *acq;
+    void (*emit)(katherine_acquisition_t *acq, const void *px, size_t count);
+
+    uint64_t window;
+    size_t capacity;    // records, of the largest size
+    size_t record_size; // of the read, zero if the read is not reordered
+    size_t toa_offset;
+
+    char *pending; // records held back, in arrival order
+    size_t pending_count;
+    char *out; // records handed out, late or sorted
+    size_t late_count;
+
+    uint64_t *keys; // sort of the records released, two halves each
+    uint32_t *order;
+
+    uint64_t latest_toa;  // of the pixels seen
+    uint64_t emitted_toa; // of the last pixel handed out in order
+};
+
+KATHERINE_NOT_EXPORTED struct katherine_reorder *
+katherine_reorder_new(katherine_acquisition_t *acq, const katherine_reordering_t *reordering, size_t max_record_size, void (*emit)(katherine_acquisition_t *, const void *, size_t));
+
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_free(struct katherine_reorder *r);
+
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_begin(struct katherine_reorder *r, size_t record_size, size_t toa_offset);
+
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_push(struct katherine_reorder *r, const void *px, size_t count);
+
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_flush(struct katherine_reorder *r);
+
+KATHERINE_NOT_EXPORTED void
+katherine_reorder_restart(struct katherine_reorder *r);
+
+/* Whether the read under way passes its pixels through the stage. */
+static inline bool
+katherine_reorder_active(const struct katherine_reorder *r)
+{
+    return r != NULL && r->record_size > 0;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
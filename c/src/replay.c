@@ -0,0 +1,301 @@
+/**
+ * @file
+ * @brief Implementation of the sources of measurement data replayed.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/recording.h>
+#include <katherine/replay.h>
+#include "replay.h"
+
+#ifdef KATHERINE_NIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Bytes the decoder reads past the last whole datum of a datagram, which it
+   accesses as a word. */
+#define OVERREAD (sizeof(uint64_t) - KATHERINE_MD_SIZE)
+
+/* Takes datagrams of a raw stream in memory. They are decoded in place,
+   save for a last one which ends too close to the end of the stream to be
+   read as words: it is copied to the measurement data buffer, on its own.
+   As a received datagram, none is longer than a slot of that buffer: the
+   stream is cut into whole data which fit one, should its datagrams not. */
+static int
+next_memory(katherine_replay_source_t *source, katherine_acquisition_t *acq, const char **data, size_t *lengths, size_t *count)
+{
+    const size_t slot = acq->md_slot_size - acq->md_slot_size % KATHERINE_MD_SIZE;
+    const size_t max  = *count;
+    size_t got        = 0;
+    size_t n;
+
+    if (slot == 0) {
+        return EMSGSIZE;
+    }
+
+    while (got < max && source->position < source->length) {
+        n = source->length - source->position;
+        if (n > source->datagram_size) n = source->datagram_size;
+        if (n > slot) n = slot;
+
+        if (source->position + n + OVERREAD > source->length) {
+            if (got > 0) break;
+
+            memcpy(acq->md_buffer, source->data + source->position, n);
+            data[got]    = acq->md_buffer;
+            lengths[got] = n;
+            ++got;
+            source->position += n;
+            break;
+        }
+
+        data[got]    = source->data + source->position;
+        lengths[got] = n;
+        ++got;
+        source->position += n;
+    }
+
+    *count = got;
+    return 0;
+}
+
+/* Takes the records of a mapped recording, which are decoded in place: the
+   index and the trailer follow the last of them in the mapping. A record
+   longer than a slot of the measurement data buffer is refused, as reading
+   the recording to the slots refuses it. */
+static int
+next_records(katherine_replay_source_t *source, katherine_acquisition_t *acq, const char **data, size_t *lengths, size_t *count)
+{
+    const size_t max = *count;
+    size_t got       = 0;
+    uint32_t length;
+
+    while (got < max && source->position < source->length) {
+        if (source->length - source->position < sizeof(length)) return EPROTO;
+        memcpy(&length, source->data + source->position, sizeof(length));
+        if (source->length - source->position - sizeof(length) < length) return EPROTO;
+        if (length > acq->md_slot_size) return EMSGSIZE;
+
+        data[got]    = source->data + source->position + sizeof(length);
+        lengths[got] = length;
+        ++got;
+        source->position += sizeof(length) + length;
+    }
+
+    *count = got;
+    return 0;
+}
+
+/* Reads the records of a recording to the slots of the measurement data
+   buffer, as the read receives datagrams to them. */
+static int
+next_recorded(katherine_replay_source_t *source, katherine_acquisition_t *acq, const char **data, size_t *lengths, size_t *count)
+{
+    const size_t max = *count < acq->md_slots ? *count : acq->md_slots;
+    size_t got       = 0;
+    int res          = 0;
+
+    while (got < max) {
+        char *slot = acq->md_buffer + got * acq->md_slot_size;
+
+        res = katherine_recording_next(source->recording, slot, acq->md_slot_size, &lengths[got]);
+        if (res || lengths[got] == 0) break;
+
+        data[got] = slot;
+        ++got;
+    }
+
+    *count = got;
+    return res;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Take the next datagrams of a replayed source.
+ * @param source Source
+ * @param acq Acquisition replaying it, whose measurement data buffer may receive the datagrams
+ * @param data Datagrams taken, valid until the next call
+ * @param lengths Their lengths
+ * @param count Datagrams to take at most; the number taken, zero at the end of the source
+ * @return Error code.
+ */
+KATHERINE_NOT_EXPORTED int
+katherine_replay_source_next(katherine_replay_source_t *source, katherine_acquisition_t *acq, const char **data, size_t *lengths, size_t *count)
+{
+    switch (source->kind) {
+    case KATHERINE_REPLAY_MEMORY:    return next_memory(source, acq, data, lengths, count);
+    case KATHERINE_REPLAY_RECORDS:   return next_records(source, acq, data, lengths, count);
+    case KATHERINE_REPLAY_RECORDING: return next_recorded(source, acq, data, lengths, count);
+    default:                         return EINVAL;
+    }
+}
+
+/**
+ * Replay a raw stream of measurement data in memory, such as one received by the data_received
+ * handler and stored.
+ * @param source Source to initialize
+ * @param data Stream, which must outlive the source
+ * @param length Bytes of the stream
+ * @param datagram_size Bytes of the datagrams the stream is cut into, at most KATHERINE_MD_DATAGRAM_MAX_SIZE, or zero for that many;
+ *        the replaying acquisition cuts them further to whole data which fit a slot of its measurement data buffer
+ * @param acq_mode Mode of the acquisition the stream was measured in
+ * @param fast_vco_enabled Whether it ran with the fast VCO
+ * @return Error code.
+ */
+int
+katherine_replay_source_memory(katherine_replay_source_t *source, const void *data, size_t length, size_t datagram_size, katherine_acquisition_mode_t acq_mode, bool fast_vco_enabled)
+{
+    if (datagram_size == 0) {
+        datagram_size = KATHERINE_MD_DATAGRAM_MAX_SIZE;
+    }
+    if (datagram_size > KATHERINE_MD_DATAGRAM_MAX_SIZE) {
+        return EINVAL;
+    }
+
+    memset(source, 0, sizeof(*source));
+    source->kind             = KATHERINE_REPLAY_MEMORY;
+    source->readout_mode     = READOUT_DATA_DRIVEN;
+    source->acq_mode         = acq_mode;
+    source->fast_vco_enabled = fast_vco_enabled;
+    source->data             = (const char *) data;
+    source->length           = length;
+    source->datagram_size    = datagram_size;
+    return 0;
+}
+
+/**
+ * Replay the records of a recording open for reading, from its position on.
+ *
+ * The records are read as they are replayed; katherine_recording_seek_frame() beforehand replays
+ * from a frame on.
+ *
+ * @param source Source to initialize
+ * @param recording Open recording, which must outlive the source
+ * @return Error code.
+ */
+int
+katherine_replay_source_recording(katherine_replay_source_t *source, katherine_recording_t *recording)
+{
+    memset(source, 0, sizeof(*source));
+    source->kind             = KATHERINE_REPLAY_RECORDING;
+    source->readout_mode     = recording->header.readout_mode;
+    source->acq_mode         = (katherine_acquisition_mode_t) recording->header.acq_mode;
+    source->fast_vco_enabled = recording->header.fast_vco_enabled;
+    source->recording        = recording;
+    return 0;
+}
+
+/**
+ * Map a recording file to memory and replay a range of its frames in place.
+ *
+ * Since a mapped file is shared, several acquisitions may replay distinct frames of it at once, each
+ * mapping it on its own.
+ *
+ * @param source Source to initialize, which is to be unmapped by katherine_replay_source_unmap()
+ * @param file_path Path of the recording
+ * @param first_frame Index of the first frame to replay
+ * @param frame_count Frames to replay, or zero for all from the first on
+ * @return Error code: EINVAL if the recording has no such frames, ENOTSUP on platforms without mapping.
+ */
+int
+katherine_replay_source_map(katherine_replay_source_t *source, const char *file_path, size_t first_frame, size_t frame_count)
+{
+    katherine_recording_t recording;
+    uint64_t start, end;
+    int res;
+
+    memset(source, 0, sizeof(*source));
+
+    // The index tells where the frames are, and opening the recording
+    // checks that it can be replayed.
+    res = katherine_recording_open(&recording, file_path);
+    if (res) return res;
+
+    if (first_frame == 0 && frame_count == 0) {
+        start = recording.header.header_size;
+        end   = recording.index_offset;
+    } else if (first_frame < recording.frame_count && frame_count <= recording.frame_count - first_frame) {
+        start = recording.frames[first_frame].start_offset;
+        end   = frame_count > 0 ? recording.frames[first_frame + frame_count - 1].end_offset : recording.index_offset;
+    } else {
+        katherine_recording_close(&recording);
+        return EINVAL;
+    }
+
+    source->kind             = KATHERINE_REPLAY_RECORDS;
+    source->readout_mode     = recording.header.readout_mode;
+    source->acq_mode         = (katherine_acquisition_mode_t) recording.header.acq_mode;
+    source->fast_vco_enabled = recording.header.fast_vco_enabled;
+    katherine_recording_close(&recording);
+
+#ifdef KATHERINE_NIX
+    struct stat st;
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        res = errno;
+        goto err_open;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        res = errno;
+        goto err_map;
+    }
+
+    source->mapping_size = (size_t) st.st_size;
+    source->mapping      = mmap(NULL, source->mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (source->mapping == MAP_FAILED) {
+        res             = errno;
+        source->mapping = NULL;
+        goto err_map;
+    }
+
+    // The records are read once, front to back.
+    (void) madvise(source->mapping, source->mapping_size, MADV_SEQUENTIAL);
+    close(fd);
+
+    source->data   = (const char *) source->mapping + start;
+    source->length = (size_t) (end - start);
+    return 0;
+
+err_map:
+    close(fd);
+err_open:
+    memset(source, 0, sizeof(*source));
+    return res;
+#else
+    (void) start;
+    (void) end;
+    memset(source, 0, sizeof(*source));
+    return ENOTSUP;
+#endif
+}
+
+/**
+ * Unmap a recording file mapped by katherine_replay_source_map().
+ * @param source Source
+ */
+void
+katherine_replay_source_unmap(katherine_replay_source_t *source)
+{
+#ifdef KATHERINE_NIX
+    if (source->mapping != NULL) {
+        (void) munmap(source->mapping, source->mapping_size);
+    }
+#endif
+    memset(source, 0, sizeof(*source));
+}
@@ -0,0 +1,31 @@
+/**
+ * @file
+ * @brief Internal reading of the sources of measurement data replayed.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <katherine/acquisition.h>
+#include <katherine/replay.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+KATHERINE_NOT_EXPORTED int
+katherine_replay_source_next(katherine_replay_source_t *source, katherine_acquisition_t *acq, const char **data, size_t *lengths, size_t *count);
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,833 @@
+/**
+ * @file
+ * @brief Implementation of the asynchronous writing of acquired data to files.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// O_DIRECT is a GNU extension of the C library, so the feature macro must
+// precede the first libc include to take effect.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <katherine/global.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <katherine/acquisition.h>
+#include <katherine/sink.h>
+#include "clock.h"
+#include "pipeline.h"
+#include "sink.h"
+#include "thread.h"
+
+#ifdef KATHERINE_NIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+// The ring is driven by the system calls themselves, so that the library
+// needs no liburing to build or to run.
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define SINK_URING
+#endif
+#endif
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#ifdef SINK_URING
+
+/* The rings shared with the kernel, mapped from the file of the ring. */
+struct sink_ring {
+    int fd;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct iovec *iovs; // one per buffer, what is left of it to write
+};
+
+#endif /* SINK_URING */
+
+/* The thread handing the data to the sink fills its buffers in turns, and
+ * submits each full one to be written at the next offset of the file. A
+ * buffer is pending while its write is in flight, and is filled again once
+ * the write has completed; the thread which finds the next buffer pending
+ * waits for it.
+ *
+ * With io_uring, the submitting thread reaps the completions too, whenever it
+ * submits or waits. With the writer thread, the writer takes the buffers in
+ * the order they were submitted and writes each by pwrite(). */
+struct katherine_sink_writer {
+    int fd;
+    char content;
+    char backend;
+    bool direct;
+
+    char *memory; // the buffers, back to back
+    size_t buffer_size;
+    size_t buffers;
+
+    // Private to the thread handing the data.
+    size_t current;   // buffer being filled
+    size_t fill;      // bytes of it
+    uint64_t offset;  // of the file, where the current buffer goes
+    uint64_t size;    // bytes handed to the sink
+
+    uint64_t *pending; // per buffer, bytes in flight, zero if free
+    uint64_t *offsets; // per buffer, of the file, where it goes
+
+    uint64_t in_flight;
+    uint64_t max_in_flight;
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t stalls;
+    uint64_t error; // first error of a write
+    uint64_t opened_ns;
+
+    katherine_thread_t thread;
+    uint64_t stop; // raised to end the writer once it has written all buffers
+
+    // Of a pixel sink, told by the acquisition writing to it.
+    katherine_sink_trailer_t trailer;
+    katherine_sink_frame_t *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    uint64_t frame_end; // bytes handed to the sink when the last frame ended
+
+#ifdef SINK_URING
+    struct sink_ring ring;
+#endif
+};
+
+static inline char *
+buffer_at(const struct katherine_sink_writer *w, size_t index)
+{
+    return w->memory + index * w->buffer_size;
+}
+
+/* Notes a failure of a write, unless one has been noted already. */
+static void
+fail(struct katherine_sink_writer *w, int error)
+{
+    uint64_t none = 0;
+    (void) katherine_atomic_compare_exchange(&w->error, &none, (uint64_t) error);
+}
+
+/* Counts a write of the given bytes. Only one thread completes the writes,
+   the submitting one or the writer, so the counters have a single writer. */
+static inline void
+count_write(struct katherine_sink_writer *w, uint64_t bytes)
+{
+    katherine_atomic_store(&w->bytes, w->bytes + bytes);
+    katherine_atomic_store(&w->writes, w->writes + 1);
+}
+
+/* Frees a buffer whose write has completed, or failed. */
+static inline void
+release(struct katherine_sink_writer *w, size_t index)
+{
+    katherine_atomic_store(&w->pending[index], 0);
+    (void) katherine_atomic_fetch_add(&w->in_flight, (uint64_t) -1);
+}
+
+static int
+write_at(int fd, const char *data, size_t length, uint64_t offset)
+{
+#ifdef KATHERINE_NIX
+    while (length > 0) {
+        const ssize_t n = pwrite(fd, data, length, (off_t) offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) {
+            return EIO;
+        }
+
+        data += n;
+        length -= (size_t) n;
+        offset += (uint64_t) n;
+    }
+    return 0;
+#else
+    (void) fd;
+    (void) data;
+    (void) length;
+    (void) offset;
+    return ENOTSUP;
+#endif
+}
+
+/* Body of the writer: writes the buffers in the order they were submitted,
+   until the next one is free and the stop flag raised. */
+static void
+write_buffers(void *arg)
+{
+    struct katherine_sink_writer *w = (struct katherine_sink_writer *) arg;
+    unsigned rounds                 = 0;
+    size_t next                     = 0;
+
+    for (;;) {
+        const uint64_t length = katherine_atomic_load(&w->pending[next]);
+
+        if (length == 0) {
+            // The flag is raised after the last submission, so a buffer
+            // still free after seeing it stays free.
+            if (katherine_atomic_load(&w->stop) && katherine_atomic_load(&w->pending[next]) == 0) {
+                return;
+            }
+            katherine_pipeline_backoff(&rounds);
+            continue;
+        }
+        rounds = 0;
+
+        const int res = write_at(w->fd, buffer_at(w, next), (size_t) length, w->offsets[next]);
+        if (res) {
+            fail(w, res);
+        } else {
+            count_write(w, length);
+        }
+
+        release(w, next);
+        next = (next + 1) % w->buffers;
+    }
+}
+
+#ifdef SINK_URING
+
+static int
+ring_enter(struct sink_ring *r, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    for (;;) {
+        if (syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, NULL, 0) >= 0) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return errno;
+        }
+    }
+}
+
+static void
+ring_close(struct sink_ring *r)
+{
+    if (r->sqes != NULL) (void) munmap(r->sqes, r->sqes_size);
+    if (r->cq_map != NULL && r->cq_map != r->sq_map) (void) munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map != NULL) (void) munmap(r->sq_map, r->sq_map_size);
+    if (r->fd >= 0) (void) close(r->fd);
+    free(r->iovs);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* Sets up a ring with an entry per buffer, which never runs out, as there
+   are never more writes in flight. */
+static int
+ring_open(struct katherine_sink_writer *w)
+{
+    struct sink_ring *r = &w->ring;
+    struct io_uring_params params;
+    int res;
+
+    memset(r, 0, sizeof(*r));
+    memset(&params, 0, sizeof(params));
+
+    r->fd = (int) syscall(__NR_io_uring_setup, (unsigned) w->buffers, &params);
+    if (r->fd < 0) {
+        res   = errno;
+        r->fd = -1;
+        return res;
+    }
+
+    r->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_size > r->sq_map_size) r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = r->sq_map_size;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        goto err_map;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            goto err_map;
+        }
+    }
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes      = (struct io_uring_sqe *) mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto err_map;
+    }
+
+    r->sq_tail  = (unsigned *) ((char *) r->sq_map + params.sq_off.tail);
+    r->sq_mask  = (unsigned *) ((char *) r->sq_map + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *) ((char *) r->sq_map + params.sq_off.array);
+    r->cq_head  = (unsigned *) ((char *) r->cq_map + params.cq_off.head);
+    r->cq_tail  = (unsigned *) ((char *) r->cq_map + params.cq_off.tail);
+    r->cq_mask  = (unsigned *) ((char *) r->cq_map + params.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *) ((char *) r->cq_map + params.cq_off.cqes);
+
+    r->iovs = (struct iovec *) calloc(w->buffers, sizeof(struct iovec));
+    if (r->iovs == NULL) {
+        ring_close(r);
+        return ENOMEM;
+    }
+
+    return 0;
+
+err_map:
+    res = errno;
+    ring_close(r);
+    return res;
+}
+
+/* Queues the write of what is left of a buffer, and hands it to the kernel. */
+static int
+ring_submit(struct katherine_sink_writer *w, size_t index)
+{
+    struct sink_ring *r      = &w->ring;
+    const unsigned tail      = *r->sq_tail;
+    const unsigned at        = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[at];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_WRITEV;
+    sqe->fd        = w->fd;
+    sqe->addr      = (uint64_t) (uintptr_t) &r->iovs[index];
+    sqe->len       = 1;
+    sqe->off       = w->offsets[index];
+    sqe->user_data = index;
+
+    r->sq_array[at] = at;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return ring_enter(r, 1, 0, 0);
+}
+
+/* Takes the completions the kernel has posted. A write cut short goes on
+   from where it stopped. */
+static void
+ring_reap(struct katherine_sink_writer *w)
+{
+    struct sink_ring *r = &w->ring;
+    unsigned head       = *r->cq_head;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        const size_t index             = (size_t) cqe->user_data;
+        const int32_t res              = cqe->res;
+        struct iovec *iov              = &r->iovs[index];
+        ++head;
+
+        if (res <= 0) {
+            fail(w, res < 0 ? -res : EIO);
+            release(w, index);
+        } else if ((size_t) res < iov->iov_len) {
+            iov->iov_base = (char *) iov->iov_base + res;
+            iov->iov_len -= (size_t) res;
+            w->offsets[index] += (uint64_t) res;
+            katherine_atomic_store(&w->bytes, w->bytes + (uint64_t) res);
+
+            const int again = ring_submit(w, index);
+            if (again) {
+                fail(w, again);
+                release(w, index);
+            }
+        } else {
+            count_write(w, (uint64_t) res);
+            release(w, index);
+        }
+    }
+
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif /* SINK_URING */
+
+/* Waits until a buffer is free. The writer thread frees it by itself; the
+   completions of the ring are waited for and reaped here. */
+static int
+wait_free(struct katherine_sink_writer *w, size_t index)
+{
+    unsigned rounds = 0;
+
+    if (katherine_atomic_load(&w->pending[index]) == 0) {
+        return 0;
+    }
+    katherine_atomic_store(&w->stalls, w->stalls + 1);
+
+    while (katherine_atomic_load(&w->pending[index]) != 0) {
+#ifdef SINK_URING
+        if (w->backend == KATHERINE_SINK_IO_URING) {
+            const int res = ring_enter(&w->ring, 0, 1, IORING_ENTER_GETEVENTS);
+            if (res) return res;
+            ring_reap(w);
+            continue;
+        }
+#endif
+        katherine_pipeline_backoff(&rounds);
+    }
+
+    return 0;
+}
+
+/* Submits the current buffer, of the given bytes, and moves on to the next
+   one, which is waited for to be free. */
+static int
+submit(struct katherine_sink_writer *w, size_t length)
+{
+    const size_t index   = w->current;
+    const uint64_t depth = katherine_atomic_fetch_add(&w->in_flight, 1) + 1;
+
+    if (depth > w->max_in_flight) {
+        katherine_atomic_store(&w->max_in_flight, depth);
+    }
+
+    w->offsets[index] = w->offset;
+    w->offset += length;
+    w->current = (index + 1) % w->buffers;
+    w->fill    = 0;
+
+#ifdef SINK_URING
+    if (w->backend == KATHERINE_SINK_IO_URING) {
+        w->ring.iovs[index].iov_base = buffer_at(w, index);
+        w->ring.iovs[index].iov_len  = length;
+        w->pending[index]            = length;
+
+        const int res = ring_submit(w, index);
+        if (res) {
+            release(w, index);
+            return res;
+        }
+        ring_reap(w);
+        return wait_free(w, w->current);
+    }
+#endif
+
+    katherine_atomic_store(&w->pending[index], length);
+    return wait_free(w, w->current);
+}
+
+/* Waits for all writes in flight to complete. */
+static int
+drain(struct katherine_sink_writer *w)
+{
+#ifdef SINK_URING
+    if (w->backend == KATHERINE_SINK_IO_URING) {
+        while (katherine_atomic_load(&w->in_flight) > 0) {
+            const int res = ring_enter(&w->ring, 0, 1, IORING_ENTER_GETEVENTS);
+            if (res) return res;
+            ring_reap(w);
+        }
+        return 0;
+    }
+#endif
+
+    katherine_atomic_store(&w->stop, 1);
+    katherine_thread_join(&w->thread);
+    return 0;
+}
+
+/* Copies data to the buffers, submitting each one filled. */
+static int
+put(struct katherine_sink_writer *w, const void *data, size_t length)
+{
+    const char *src = (const char *) data;
+    int res;
+
+    w->size += length;
+    while (length > 0) {
+        size_t n = w->buffer_size - w->fill;
+        if (n > length) n = length;
+
+        memcpy(buffer_at(w, w->current) + w->fill, src, n);
+        w->fill += n;
+        src += n;
+        length -= n;
+
+        if (w->fill == w->buffer_size) {
+            res = submit(w, w->buffer_size);
+            if (res) {
+                fail(w, res);
+                return res;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Ends the file of a pixel sink: pads the records to a word, and writes the
+   index of the frames and the trailer behind them. */
+static int
+put_index(struct katherine_sink_writer *w)
+{
+    static const char padding[sizeof(uint64_t)] = { 0 };
+    katherine_sink_trailer_t *t                 = &w->trailer;
+    const size_t pad                            = (size_t) (-w->size & (sizeof(uint64_t) - 1));
+    int res;
+
+    t->pixels       = t->record_size > 0 ? w->size / t->record_size : 0;
+    t->index_offset = w->size + pad;
+    t->frames       = w->frame_count;
+    t->byte_order   = 0x01020304;
+    memcpy(t->magic, KATHERINE_SINK_TRAILER_MAGIC, sizeof(KATHERINE_SINK_TRAILER_MAGIC));
+
+    res = put(w, padding, pad);
+    if (res) return res;
+
+    res = put(w, w->frames, w->frame_count * sizeof(katherine_sink_frame_t));
+    if (res) return res;
+
+    return put(w, t, sizeof(*t));
+}
+
+static void
+free_writer(struct katherine_sink_writer *w)
+{
+#ifdef SINK_URING
+    ring_close(&w->ring);
+#endif
+    free(w->frames);
+    free(w->pending);
+    free(w->memory);
+    free(w);
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Create a file and open a sink writing to it.
+ *
+ * The data handed to the sink are copied to its buffers, and each buffer is written as a whole once
+ * full, while the next ones are filled. By default, the writes are submitted to an io_uring, set up
+ * by the system calls of the kernel; where the kernel has none, or forbids it, they are issued by a
+ * thread of the sink by pwrite().
+ *
+ * The buffers are aligned to KATHERINE_SINK_ALIGNMENT, and so are their sizes, so that the file may
+ * be opened for direct I/O. Its last buffer, which may be partial, is then written padded to the
+ * alignment, and the file truncated back to the bytes handed to the sink when it is closed.
+ *
+ * @param sink Sink to initialize
+ * @param file_path Path of the file, which is overwritten
+ * @param content What the sink writes when attached to an acquisition (see katherine_acquisition_set_sink())
+ * @param params Parameters of the sink, or NULL for the defaults
+ * @return Error code: EINVAL if the parameters are invalid, ENOTSUP if the backend requested or direct I/O is not available.
+ */
+int
+katherine_sink_open(katherine_sink_t *sink, const char *file_path, katherine_sink_content_t content, const katherine_sink_params_t *params)
+{
+    static const katherine_sink_params_t defaults = { 0, 0, false, KATHERINE_SINK_AUTO };
+    int res                                       = 0;
+    struct katherine_sink_writer *w;
+
+    sink->writer  = NULL;
+    sink->content = (char) content;
+
+    if (params == NULL) {
+        params = &defaults;
+    }
+    if (params->backend < KATHERINE_SINK_AUTO || params->backend > KATHERINE_SINK_THREAD || (params->buffers != 0 && params->buffers < 2)) {
+        return EINVAL;
+    }
+
+#ifndef KATHERINE_NIX
+    (void) file_path;
+    (void) res;
+    return ENOTSUP;
+#else
+    w = (struct katherine_sink_writer *) calloc(1, sizeof(*w));
+    if (w == NULL) {
+        res = ENOMEM;
+        goto err_writer;
+    }
+#ifdef SINK_URING
+    w->ring.fd = -1;
+#endif
+
+    w->content     = (char) content;
+    w->direct      = params->direct;
+    w->buffers     = params->buffers > 0 ? params->buffers : 2;
+    w->buffer_size = params->buffer_size > 0 ? params->buffer_size : KATHERINE_SINK_DEFAULT_BUFFER_SIZE;
+    w->buffer_size = (w->buffer_size + KATHERINE_SINK_ALIGNMENT - 1) & ~(size_t) (KATHERINE_SINK_ALIGNMENT - 1);
+
+    if (posix_memalign((void **) &w->memory, KATHERINE_SINK_ALIGNMENT, w->buffers * w->buffer_size) != 0) {
+        w->memory = NULL;
+        res       = ENOMEM;
+        goto err_memory;
+    }
+
+    w->pending = (uint64_t *) calloc(2 * w->buffers, sizeof(uint64_t));
+    if (w->pending == NULL) {
+        res = ENOMEM;
+        goto err_memory;
+    }
+    w->offsets = w->pending + w->buffers;
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (w->direct) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        res = ENOTSUP;
+        goto err_memory;
+#endif
+    }
+
+    w->fd = open(file_path, flags, 0644);
+    if (w->fd < 0) {
+        res = errno;
+        goto err_memory;
+    }
+
+    w->backend = params->backend;
+    if (w->backend != KATHERINE_SINK_THREAD) {
+#ifdef SINK_URING
+        res = ring_open(w);
+#else
+        res = ENOTSUP;
+#endif
+        if (res == 0) {
+            w->backend = KATHERINE_SINK_IO_URING;
+        } else if (w->backend == KATHERINE_SINK_IO_URING) {
+            goto err_backend;
+        } else {
+            w->backend = KATHERINE_SINK_THREAD;
+        }
+    }
+
+    if (w->backend == KATHERINE_SINK_THREAD) {
+        res = katherine_thread_create(&w->thread, write_buffers, w);
+        if (res) {
+            goto err_backend;
+        }
+    }
+
+    w->opened_ns = katherine_clock_ns();
+    sink->writer = w;
+    return 0;
+
+err_backend:
+    close(w->fd);
+    remove(file_path);
+err_memory:
+    free_writer(w);
+err_writer:
+    return res;
+#endif
+}
+
+/**
+ * Hand data to a sink.
+ *
+ * The data are copied to the buffers of the sink, and written when a buffer fills up. Should the
+ * next buffer still be written, the call waits for the write to complete. Must not be called from
+ * more than one thread at once.
+ *
+ * @param sink Open sink
+ * @param data Data
+ * @param length Bytes of the data
+ * @return Error code: the first error of a write of the sink, if any.
+ */
+int
+katherine_sink_write(katherine_sink_t *sink, const void *data, size_t length)
+{
+    struct katherine_sink_writer *w = sink->writer;
+    const uint64_t error            = katherine_atomic_load(&w->error);
+
+    if (error != 0) {
+        return (int) error;
+    }
+
+    return put(w, data, length);
+}
+
+/**
+ * Take a snapshot of the counters of a sink.
+ *
+ * May be called from any thread while the sink is open.
+ *
+ * @param sink Open sink
+ * @param stats Snapshot to fill in
+ */
+void
+katherine_sink_get_stats(const katherine_sink_t *sink, katherine_sink_stats_t *stats)
+{
+    struct katherine_sink_writer *w = sink->writer;
+
+    stats->bytes           = katherine_atomic_load(&w->bytes);
+    stats->writes          = katherine_atomic_load(&w->writes);
+    stats->stalls          = katherine_atomic_load(&w->stalls);
+    stats->queue_depth     = katherine_atomic_load(&w->in_flight);
+    stats->max_queue_depth = katherine_atomic_load(&w->max_in_flight);
+    stats->elapsed_ns      = katherine_clock_ns() - w->opened_ns;
+    stats->throughput      = stats->elapsed_ns > 0 ? (double) stats->bytes * 1e9 / (double) stats->elapsed_ns : 0.0;
+    stats->backend         = w->backend;
+}
+
+/**
+ * Close a sink: write the data left in its buffers, and of a pixel sink, the index of the frames
+ * and the trailer, wait for all writes to complete, and close the file.
+ * @param sink Open sink, which is closed even if an error is reported
+ * @return Error code: the first error in writing the file, if any.
+ */
+int
+katherine_sink_close(katherine_sink_t *sink)
+{
+    struct katherine_sink_writer *w = sink->writer;
+    int res                         = 0;
+
+    if (w == NULL) {
+        return 0;
+    }
+
+#ifdef KATHERINE_NIX
+    if (w->content == KATHERINE_SINK_PIXELS && katherine_atomic_load(&w->error) == 0) {
+        (void) put_index(w);
+    }
+
+    if (w->fill > 0 && katherine_atomic_load(&w->error) == 0) {
+        size_t length = w->fill;
+
+        // Direct I/O writes whole blocks, so the tail is padded, and cut
+        // off the file below.
+        if (w->direct) {
+            length = (length + KATHERINE_SINK_ALIGNMENT - 1) & ~(size_t) (KATHERINE_SINK_ALIGNMENT - 1);
+            memset(buffer_at(w, w->current) + w->fill, 0, length - w->fill);
+        }
+
+        res = submit(w, length);
+        if (res) fail(w, res);
+    }
+
+    res = drain(w);
+    if (res) fail(w, res);
+
+    res = (int) katherine_atomic_load(&w->error);
+    if (res == 0 && w->direct && w->offset != w->size && ftruncate(w->fd, (off_t) w->size) != 0) {
+        res = errno;
+    }
+    if (close(w->fd) != 0 && res == 0) {
+        res = EIO;
+    }
+#endif
+
+    free_writer(w);
+    sink->writer = NULL;
+    return res;
+}
+
+/**
+ * Describe the pixel records an acquisition is about to write to a sink, in its trailer.
+ * @param sink Open sink
+ * @param acq Acquisition beginning a read
+ */
+KATHERINE_NOT_EXPORTED void
+katherine_sink_describe(katherine_sink_t *sink, const katherine_acquisition_t *acq)
+{
+    katherine_sink_trailer_t *t = &sink->writer->trailer;
+
+    t->record_size      = (uint32_t) acq->pixel_size;
+    t->acq_mode         = acq->acq_mode;
+    t->fast_vco_enabled = acq->fast_vco_enabled;
+    t->px_layout        = acq->px_layout;
+    t->timestamp_unit   = acq->timestamp_unit;
+}
+
+/**
+ * Index a frame which has ended: the records handed to a sink since the frame before it ended.
+ * @param sink Open sink
+ * @param info Info of the frame
+ * @return Error code.
+ */
+KATHERINE_NOT_EXPORTED int
+katherine_sink_end_frame(katherine_sink_t *sink, const katherine_frame_info_t *info)
+{
+    struct katherine_sink_writer *w = sink->writer;
+    const uint64_t record_size      = w->trailer.record_size;
+
+    if (record_size == 0) {
+        return EINVAL;
+    }
+
+    if (w->frame_count == w->frame_capacity) {
+        const size_t capacity           = w->frame_capacity > 0 ? 2 * w->frame_capacity : 64;
+        katherine_sink_frame_t *resized = (katherine_sink_frame_t *) realloc(w->frames, capacity * sizeof(katherine_sink_frame_t));
+        if (resized == NULL) return ENOMEM;
+
+        w->frames         = resized;
+        w->frame_capacity = capacity;
+    }
+
+    katherine_sink_frame_t *frame = &w->frames[w->frame_count++];
+    memset(frame, 0, sizeof(*frame));
+    frame->first_pixel = w->frame_end / record_size;
+    frame->pixels      = (w->size - w->frame_end) / record_size;
+    frame->start_time  = info->start_time;
+    frame->end_time    = info->end_time;
+    frame->sent_pixels = info->sent_pixels;
+    frame->completed   = info->completed;
+
+    w->frame_end = w->size;
+    return 0;
+}
+
+/**
+ * Write the data of an acquisition to a sink.
+ *
+ * A sink of KATHERINE_SINK_RAW receives every datagram the acquisition receives, as a recorder does
+ * (see katherine_acquisition_set_recorder()). A sink of KATHERINE_SINK_PIXELS receives the pixel
+ * records of the default and the packed layouts as they are passed to the pixels_received handler,
+ * in the same order, whether or not the handler is set, and indexes the frames as they end; it
+ * receives nothing in the columnar layout. The sink is not owned by the acquisition; it must stay
+ * open for as long as it is set.
+ *
+ * Must not be called while the acquisition is being read.
+ *
+ * @param acq Acquisition
+ * @param sink Open sink, or NULL to stop writing
+ * @return Error code.
+ */
+int
+katherine_acquisition_set_sink(katherine_acquisition_t *acq, katherine_sink_t *sink)
+{
+    acq->sink = sink;
+    return 0;
+}
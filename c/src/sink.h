@@ -0,0 +1,34 @@
+/**
+ * @file
+ * @brief Internal description of the pixels written by a sink.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <katherine/acquisition.h>
+#include <katherine/sink.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+KATHERINE_NOT_EXPORTED void
+katherine_sink_describe(katherine_sink_t *sink, const katherine_acquisition_t *acq);
+
+KATHERINE_NOT_EXPORTED int
+katherine_sink_end_frame(katherine_sink_t *sink, const katherine_frame_info_t *info);
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,314 @@
+/**
+ * @file
+ * @brief Internal portable threads, wake-ups and atomic counters.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <katherine/global.h>
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+#ifdef KATHERINE_WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* A thread running fn(arg). The function and its argument are kept in the
+ * handle itself, so that the native entry points of either platform can
+ * reach them through the one pointer they pass along; the handle must
+ * therefore stay where it is until katherine_thread_join() returns. */
+typedef struct katherine_thread {
+#ifdef KATHERINE_WIN
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    void (*fn)(void *);
+    void *arg;
+} katherine_thread_t;
+
+/* A mutex, and a condition variable waited on with it, for the waits that
+ * may be long but must end as soon as the other side is done: unlike a
+ * sleeping backoff, a wake-up reaches the waiting thread at once. */
+#ifdef KATHERINE_WIN
+typedef SRWLOCK katherine_mutex_t;
+typedef CONDITION_VARIABLE katherine_cond_t;
+#else
+typedef pthread_mutex_t katherine_mutex_t;
+typedef pthread_cond_t katherine_cond_t;
+#endif
+
+#ifdef KATHERINE_WIN
+
+static inline DWORD WINAPI
+katherine_thread_entry(LPVOID self)
+{
+    katherine_thread_t *t = (katherine_thread_t *) self;
+    t->fn(t->arg);
+    return 0;
+}
+
+static inline int
+katherine_thread_create(katherine_thread_t *t, void (*fn)(void *), void *arg)
+{
+    t->fn     = fn;
+    t->arg    = arg;
+    t->handle = CreateThread(NULL, 0, katherine_thread_entry, t, 0, NULL);
+    return t->handle == NULL ? (int) GetLastError() : 0;
+}
+
+static inline void
+katherine_thread_join(katherine_thread_t *t)
+{
+    (void) WaitForSingleObject(t->handle, INFINITE);
+    (void) CloseHandle(t->handle);
+}
+
+static inline void
+katherine_thread_yield(void)
+{
+    (void) SwitchToThread();
+}
+
+static inline int
+katherine_mutex_init(katherine_mutex_t *m)
+{
+    InitializeSRWLock(m);
+    return 0;
+}
+
+static inline void
+katherine_mutex_destroy(katherine_mutex_t *m)
+{
+    (void) m;
+}
+
+static inline void
+katherine_mutex_lock(katherine_mutex_t *m)
+{
+    AcquireSRWLockExclusive(m);
+}
+
+static inline void
+katherine_mutex_unlock(katherine_mutex_t *m)
+{
+    ReleaseSRWLockExclusive(m);
+}
+
+static inline int
+katherine_cond_init(katherine_cond_t *c)
+{
+    InitializeConditionVariable(c);
+    return 0;
+}
+
+static inline void
+katherine_cond_destroy(katherine_cond_t *c)
+{
+    (void) c;
+}
+
+/* Waits for a wake-up, or a spurious one: the caller tests its condition
+   again, holding the mutex. */
+static inline void
+katherine_cond_wait(katherine_cond_t *c, katherine_mutex_t *m)
+{
+    (void) SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+
+static inline void
+katherine_cond_signal(katherine_cond_t *c)
+{
+    WakeConditionVariable(c);
+}
+
+static inline void
+katherine_cond_broadcast(katherine_cond_t *c)
+{
+    WakeAllConditionVariable(c);
+}
+
+#else /* KATHERINE_NIX */
+
+static inline void *
+katherine_thread_entry(void *self)
+{
+    katherine_thread_t *t = (katherine_thread_t *) self;
+    t->fn(t->arg);
+    return NULL;
+}
+
+static inline int
+katherine_thread_create(katherine_thread_t *t, void (*fn)(void *), void *arg)
+{
+    t->fn  = fn;
+    t->arg = arg;
+    return pthread_create(&t->handle, NULL, katherine_thread_entry, t);
+}
+
+static inline void
+katherine_thread_join(katherine_thread_t *t)
+{
+    (void) pthread_join(t->handle, NULL);
+}
+
+static inline void
+katherine_thread_yield(void)
+{
+    (void) sched_yield();
+}
+
+static inline int
+katherine_mutex_init(katherine_mutex_t *m)
+{
+    return pthread_mutex_init(m, NULL);
+}
+
+static inline void
+katherine_mutex_destroy(katherine_mutex_t *m)
+{
+    (void) pthread_mutex_destroy(m);
+}
+
+static inline void
+katherine_mutex_lock(katherine_mutex_t *m)
+{
+    (void) pthread_mutex_lock(m);
+}
+
+static inline void
+katherine_mutex_unlock(katherine_mutex_t *m)
+{
+    (void) pthread_mutex_unlock(m);
+}
+
+static inline int
+katherine_cond_init(katherine_cond_t *c)
+{
+    return pthread_cond_init(c, NULL);
+}
+
+static inline void
+katherine_cond_destroy(katherine_cond_t *c)
+{
+    (void) pthread_cond_destroy(c);
+}
+
+/* Waits for a wake-up, or a spurious one: the caller tests its condition
+   again, holding the mutex. */
+static inline void
+katherine_cond_wait(katherine_cond_t *c, katherine_mutex_t *m)
+{
+    (void) pthread_cond_wait(c, m);
+}
+
+static inline void
+katherine_cond_signal(katherine_cond_t *c)
+{
+    (void) pthread_cond_signal(c);
+}
+
+static inline void
+katherine_cond_broadcast(katherine_cond_t *c)
+{
+    (void) pthread_cond_broadcast(c);
+}
+
+#endif /* KATHERINE_WIN */
+
+/* Atomic access to plain 64-bit counters. The counters are shared between
+ * one writer and any number of readers, so a load pairs with the store that
+ * published a value (acquire/release) and nothing stronger is needed. They
+ * stay plain uint64_t's rather than C11 _Atomic objects, which lets them
+ * live in the public structures the C99 headers declare; MSVC reaches them
+ * through its interlocked intrinsics instead of the GNU builtins. */
+#if defined(_MSC_VER) && !defined(__clang__)
+
+static inline uint64_t
+katherine_atomic_load(const uint64_t *p)
+{
+    return (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) p, 0, 0);
+}
+
+static inline void
+katherine_atomic_store(uint64_t *p, uint64_t v)
+{
+    (void) InterlockedExchange64((volatile LONG64 *) p, (LONG64) v);
+}
+
+static inline uint64_t
+katherine_atomic_fetch_add(uint64_t *p, uint64_t v)
+{
+    return (uint64_t) InterlockedExchangeAdd64((volatile LONG64 *) p, (LONG64) v);
+}
+
+static inline uint64_t
+katherine_atomic_exchange(uint64_t *p, uint64_t v)
+{
+    return (uint64_t) InterlockedExchange64((volatile LONG64 *) p, (LONG64) v);
+}
+
+static inline int
+katherine_atomic_compare_exchange(uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+    uint64_t seen = (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) p, (LONG64) desired, (LONG64) *expected);
+    if (seen == *expected) return 1;
+    *expected = seen;
+    return 0;
+}
+
+#else
+
+static inline uint64_t
+katherine_atomic_load(const uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+katherine_atomic_store(uint64_t *p, uint64_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+katherine_atomic_fetch_add(uint64_t *p, uint64_t v)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+}
+
+static inline uint64_t
+katherine_atomic_exchange(uint64_t *p, uint64_t v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+/* Stores `desired` if the counter still holds `*expected`, and returns
+ * nonzero; otherwise loads the value it does hold into `*expected`. */
+static inline int
+katherine_atomic_compare_exchange(uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#endif /* _MSC_VER */
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -10,11 +10,18 @@
  * SPDX-License-Identifier: MIT
  */
 
+// recvmmsg() and struct mmsghdr are GNU extensions of the C library, so the
+// feature macro must precede the first libc include to take effect.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <katherine/global.h>
 
 #ifdef KATHERINE_NIX
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -22,6 +29,14 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <katherine/udp.h>
+#include "thread.h"
+
+// Linux receives a whole batch of datagrams in one system call. Elsewhere,
+// katherine_udp_recv_batch() falls back to receiving one datagram per call,
+// which its contract allows.
+#ifdef __linux__
+#define KATHERINE_HAVE_RECVMMSG
+#endif
 
 #ifdef KATHERINE_DEBUG_UDP
 static inline void
@@ -111,6 +126,134 @@ recv_datagram(katherine_udp_t *u, void *data, size_t count, size_t *received)
     return 0;
 }
 
+#ifdef KATHERINE_HAVE_RECVMMSG
+/* Control message space for what the kernel attaches to a datagram: the
+   drop counter of the socket and the receive time. */
+typedef union datagram_cmsg {
+    char buf[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+} datagram_cmsg_t;
+
+/* Accounts the control messages a datagram came with. The kernel stamps
+   every datagram with the number of datagrams the socket had dropped when it
+   queued it (SO_RXQ_OVFL), as a 32-bit counter which wraps around, and with
+   the time it was received, if asked to (SO_TIMESTAMPNS). Only the receiving
+   thread writes the total of drops, another one may read it. */
+static void
+note_cmsgs(katherine_udp_t *u, struct msghdr *msg)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+
+#ifdef SO_RXQ_OVFL
+        if (c->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t counter;
+            memcpy(&counter, CMSG_DATA(c), sizeof(counter));
+            if (counter != u->drops_seen) {
+                katherine_atomic_store(&u->dropped, u->dropped + (uint32_t) (counter - u->drops_seen));
+                u->drops_seen = counter;
+            }
+        }
+#endif
+
+#ifdef SO_TIMESTAMPNS
+        if (c->cmsg_type == SO_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            u->rx_time_ns = (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+        }
+#endif
+    }
+}
+
+/* Receives up to *count datagrams into the buffers of data, blocking for the
+   first one only. The pin is enforced per datagram, as recv_pinned() does
+   it: the datagrams of foreign hosts are dropped from the batch and the
+   accepted ones moved up to fill the gaps, so that the caller sees its own
+   datagrams in consecutive buffers, in arrival order. A batch that carried
+   nothing but strays is received again, for as long as the discard budget
+   of the call lasts. The control messages are read off every datagram, the
+   strays' included, as the drop counter counts the drops of the socket. */
+static int
+recv_batch(katherine_udp_t *u, void *const *data, size_t size, size_t *received, size_t *count)
+{
+    struct mmsghdr msgs[KATHERINE_UDP_BATCH_MAX];
+    struct iovec iovs[KATHERINE_UDP_BATCH_MAX];
+    struct sockaddr_in addrs[KATHERINE_UDP_BATCH_MAX];
+    datagram_cmsg_t cmsgs[KATHERINE_UDP_BATCH_MAX];
+    const bool control = u->track_drops || u->timestamps;
+
+    const size_t wanted = *count < KATHERINE_UDP_BATCH_MAX ? *count : KATHERINE_UDP_BATCH_MAX;
+    uint32_t discarded  = 0;
+    size_t kept         = 0;
+
+    while (kept == 0) {
+        for (size_t i = 0; i < wanted; ++i) {
+            iovs[i].iov_base = data[i];
+            iovs[i].iov_len  = size;
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name    = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+            if (control) {
+                msgs[i].msg_hdr.msg_control    = cmsgs[i].buf;
+                msgs[i].msg_hdr.msg_controllen = sizeof(cmsgs[i].buf);
+            }
+        }
+
+        int res = recvmmsg(u->sock, msgs, (unsigned int) wanted, MSG_WAITFORONE, NULL);
+        if (res == -1) {
+            return errno;
+        }
+
+        for (size_t i = 0; i < (size_t) res; ++i) {
+            if (control) {
+                note_cmsgs(u, &msgs[i].msg_hdr);
+            }
+
+            if (u->remote_pinned && !from_pinned_remote(u, &addrs[i])) {
+                ++discarded;
+                continue;
+            }
+
+            if (!u->remote_pinned) {
+                u->addr_remote = addrs[i];
+            }
+
+            if (kept != i) {
+                memcpy(data[kept], data[i], msgs[i].msg_len);
+            }
+            received[kept++] = msgs[i].msg_len;
+        }
+
+        if (kept == 0 && discarded >= KATHERINE_UDP_PIN_MAX_DISCARDS) {
+            return EAGAIN;
+        }
+    }
+
+    *count = kept;
+    return 0;
+}
+#else
+/* Receives one datagram into the first buffer of data: the batch this
+   platform can offer without a batched receive of its own. */
+static int
+recv_batch(katherine_udp_t *u, void *const *data, size_t size, size_t *received, size_t *count)
+{
+    int res = recv_datagram(u, data[0], size, &received[0]);
+    if (res != 0) {
+        return res;
+    }
+
+    *count = 1;
+    return 0;
+}
+#endif /* KATHERINE_HAVE_RECVMMSG */
+
 /**
  * Initialize new UDP session.
  * @param u UDP session to initialize
@@ -152,6 +295,11 @@ katherine_udp_init_bound(katherine_udp_t *u, const char *local_addr, uint16_t lo
     // uninitialized storage, so the default cannot be left to the
     // allocation.
     u->remote_pinned = false;
+    u->track_drops   = false;
+    u->drops_seen    = 0;
+    u->dropped       = 0;
+    u->timestamps    = false;
+    u->rx_time_ns    = 0;
 
     // Create socket.
     if ((u->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
@@ -317,6 +465,46 @@ katherine_udp_recv(katherine_udp_t *u, void *data, size_t *count)
     return 0;
 }
 
+/**
+ * Receive a batch of messages (unreliable).
+ *
+ * Waits for the first datagram just like katherine_udp_recv() does, and then takes every datagram
+ * already queued behind it, up to the number of buffers given. Each datagram is received whole into
+ * a buffer of its own, so a batch is never split across buffers the way katherine_udp_recv_exact()
+ * splits a message. Where the platform has no batched receive, every batch holds a single datagram.
+ *
+ * A pinned session (see katherine_udp_pin_remote()) drops the datagrams of other hosts from the
+ * batch, and the discard budget of KATHERINE_UDP_PIN_MAX_DISCARDS is spent per call, as it is by
+ * katherine_udp_recv().
+ *
+ * @param u UDP session
+ * @param data Inbound buffers, each of them size bytes long
+ * @param size Size of every inbound buffer in bytes
+ * @param received Array of *count lengths, receiving the size of each datagram in bytes
+ * @param count In: the number of buffers, at least one. Out: the number of datagrams received.
+ * @return Error code.
+ */
+int
+katherine_udp_recv_batch(katherine_udp_t *u, void *const *data, size_t size, size_t *received, size_t *count)
+{
+    if (*count == 0) {
+        return EINVAL;
+    }
+
+    int res = recv_batch(u, data, size, received, count);
+    if (res != 0) {
+        return res;
+    }
+
+#ifdef KATHERINE_DEBUG_UDP
+    for (size_t i = 0; i < *count; ++i) {
+        dump_buffer("Received:", data[i], received[i]);
+    }
+#endif /* KATHERINE_DEBUG_UDP */
+
+    return 0;
+}
+
 /**
  * Repoint the remote address of a UDP session.
  *
@@ -370,6 +558,188 @@ katherine_udp_pin_remote(katherine_udp_t *u)
     u->remote_pinned = true;
 }
 
+/**
+ * Switch a UDP session between blocking and non-blocking receives.
+ *
+ * A session starts out blocking, where a receive waits for a datagram for up to the timeout given
+ * to katherine_udp_init(). A non-blocking receive returns EAGAIN at once if none is waiting, which
+ * is what a caller polling the socket from an event loop wants.
+ *
+ * @param u UDP session
+ * @param blocking True to block, false not to
+ * @return Error code.
+ */
+int
+katherine_udp_set_blocking(katherine_udp_t *u, bool blocking)
+{
+    int flags = fcntl(u->sock, F_GETFL, 0);
+    if (flags == -1) {
+        return errno;
+    }
+
+    flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+    if (fcntl(u->sock, F_SETFL, flags) == -1) {
+        return errno;
+    }
+
+    return 0;
+}
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Reads an integer option of the socket of u, or returns the fallback if the
+   platform or the kernel does not know it. */
+static int
+get_int_option(const katherine_udp_t *u, int name, int fallback)
+{
+    int value;
+    socklen_t len = sizeof(value);
+
+    if (getsockopt(u->sock, SOL_SOCKET, name, &value, &len) == -1) {
+        return fallback;
+    }
+
+    return value;
+}
+
+static int
+set_int_option(katherine_udp_t *u, int name, int value)
+{
+    return setsockopt(u->sock, SOL_SOCKET, name, &value, sizeof(value)) == -1 ? errno : 0;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ * Tune the socket of a UDP session for a high-rate stream.
+ *
+ * Every option requested is tried, and those the kernel refuses -- for lack of privilege, of
+ * support, or beyond a system limit -- are left as they were rather than failing the call, so that
+ * the same tuning serves hosts configured differently. What the kernel granted in the end is read
+ * back into `granted`: the receive buffer as the kernel accounts it (Linux doubles the size
+ * requested, for its bookkeeping), the busy polling time, whether datagrams are timestamped, the
+ * CPU the socket is served by (-1 if none yet), and the receive timeout.
+ *
+ * The receive buffer is first requested by SO_RCVBUFFORCE, which may exceed the system limit
+ * (net.core.rmem_max) and needs CAP_NET_ADMIN, and then by SO_RCVBUF, which is capped at the limit.
+ * A raised busy polling time likewise needs CAP_NET_ADMIN. Timestamps are kept in the rx_time_ns
+ * member of the session by katherine_udp_recv_batch().
+ *
+ * @param u UDP session
+ * @param requested Tuning requested
+ * @param granted Tuning in effect afterwards, or NULL
+ * @return Error code.
+ */
+int
+katherine_udp_tune(katherine_udp_t *u, const katherine_udp_tuning_t *requested, katherine_udp_tuning_t *granted)
+{
+    if (requested->rcvbuf > (size_t) INT32_MAX) {
+        return EINVAL;
+    }
+
+    if (requested->rcvbuf > 0) {
+#ifdef SO_RCVBUFFORCE
+        if (set_int_option(u, SO_RCVBUFFORCE, (int) requested->rcvbuf) != 0)
+#endif
+            (void) set_int_option(u, SO_RCVBUF, (int) requested->rcvbuf);
+    }
+
+#ifdef SO_BUSY_POLL
+    if (requested->busy_poll_us > 0) {
+        (void) set_int_option(u, SO_BUSY_POLL, (int) requested->busy_poll_us);
+    }
+#endif
+
+#if defined(KATHERINE_HAVE_RECVMMSG) && defined(SO_TIMESTAMPNS)
+    if (requested->timestamps && set_int_option(u, SO_TIMESTAMPNS, 1) == 0) {
+        u->timestamps = true;
+    }
+#endif
+
+#ifdef SO_INCOMING_CPU
+    if (requested->incoming_cpu >= 0) {
+        (void) set_int_option(u, SO_INCOMING_CPU, requested->incoming_cpu);
+    }
+#endif
+
+    if (requested->timeout_ms > 0) {
+        struct timeval timeout;
+        timeout.tv_sec  = requested->timeout_ms / 1000;
+        timeout.tv_usec = 1000 * (requested->timeout_ms % 1000);
+        if (setsockopt(u->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+            return errno;
+        }
+    }
+
+    if (granted == NULL) {
+        return 0;
+    }
+
+    struct timeval timeout;
+    socklen_t timeout_len = sizeof(timeout);
+    if (getsockopt(u->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, &timeout_len) == -1) {
+        return errno;
+    }
+
+    granted->rcvbuf       = (size_t) get_int_option(u, SO_RCVBUF, 0);
+    granted->busy_poll_us = 0;
+    granted->timestamps   = u->timestamps;
+    granted->incoming_cpu = -1;
+    granted->timeout_ms   = (uint32_t) (timeout.tv_sec * 1000 + timeout.tv_usec / 1000);
+#ifdef SO_BUSY_POLL
+    granted->busy_poll_us = (uint32_t) get_int_option(u, SO_BUSY_POLL, 0);
+#endif
+#ifdef SO_INCOMING_CPU
+    granted->incoming_cpu = get_int_option(u, SO_INCOMING_CPU, -1);
+#endif
+
+    return 0;
+}
+
+/**
+ * Count the datagrams the socket of a UDP session drops.
+ *
+ * A host which falls behind a stream loses datagrams in its own network stack, once the receive
+ * queue of the socket overflows, and nothing tells the application so otherwise. With tracking, the
+ * batched receive (katherine_udp_recv_batch()) notes the drop counter of the socket, which the
+ * kernel attaches to every datagram (SO_RXQ_OVFL), and katherine_udp_dropped() reports the total.
+ * Drops are only noticed by the next datagram queued after them.
+ *
+ * @param u UDP session
+ * @return Error code: ENOTSUP where the platform does not report drops, or where datagrams are not
+ * received in batches.
+ */
+int
+katherine_udp_track_drops(katherine_udp_t *u)
+{
+#if defined(KATHERINE_HAVE_RECVMMSG) && defined(SO_RXQ_OVFL)
+    int on = 1;
+    if (setsockopt(u->sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1) {
+        return errno;
+    }
+
+    u->track_drops = true;
+    return 0;
+#else
+    (void) u;
+    return ENOTSUP;
+#endif
+}
+
+/**
+ * Get the number of datagrams the socket of a UDP session has dropped.
+ *
+ * May be called from any thread, including while another one is receiving.
+ *
+ * @param u UDP session
+ * @return Datagrams the socket has dropped, as far as noticed yet, or zero if drops are not tracked.
+ */
+uint64_t
+katherine_udp_dropped(const katherine_udp_t *u)
+{
+    return katherine_atomic_load(&u->dropped);
+}
+
 /**
  * Lock mutual exclusion synchronization primitive.
  * @param u UDP session
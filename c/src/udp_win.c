@@ -140,6 +140,20 @@ recv_datagram(katherine_udp_t *u, void *data, size_t count, size_t *received)
     return 0;
 }
 
+/* Receives one datagram into the first buffer of data: Winsock offers no
+   batched receive, so every batch holds a single datagram. */
+static int
+recv_batch(katherine_udp_t *u, void *const *data, size_t size, size_t *received, size_t *count)
+{
+    int res = recv_datagram(u, data[0], size, &received[0]);
+    if (res != 0) {
+        return res;
+    }
+
+    *count = 1;
+    return 0;
+}
+
 /**
  * Initialize new UDP session.
  * @param u UDP session to initialize
@@ -344,6 +358,46 @@ katherine_udp_recv(katherine_udp_t *u, void *data, size_t *count)
     return 0;
 }
 
+/**
+ * Receive a batch of messages (unreliable).
+ *
+ * Waits for the first datagram just like katherine_udp_recv() does, and then takes every datagram
+ * already queued behind it, up to the number of buffers given. Each datagram is received whole into
+ * a buffer of its own, so a batch is never split across buffers the way katherine_udp_recv_exact()
+ * splits a message. Where the platform has no batched receive, every batch holds a single datagram.
+ *
+ * A pinned session (see katherine_udp_pin_remote()) drops the datagrams of other hosts from the
+ * batch, and the discard budget of KATHERINE_UDP_PIN_MAX_DISCARDS is spent per call, as it is by
+ * katherine_udp_recv().
+ *
+ * @param u UDP session
+ * @param data Inbound buffers, each of them size bytes long
+ * @param size Size of every inbound buffer in bytes
+ * @param received Array of *count lengths, receiving the size of each datagram in bytes
+ * @param count In: the number of buffers, at least one. Out: the number of datagrams received.
+ * @return Error code.
+ */
+int
+katherine_udp_recv_batch(katherine_udp_t *u, void *const *data, size_t size, size_t *received, size_t *count)
+{
+    if (*count == 0) {
+        return EINVAL;
+    }
+
+    int res = recv_batch(u, data, size, received, count);
+    if (res != 0) {
+        return res;
+    }
+
+#ifdef KATHERINE_DEBUG_UDP
+    for (size_t i = 0; i < *count; ++i) {
+        dump_buffer("Received:", data[i], received[i]);
+    }
+#endif /* KATHERINE_DEBUG_UDP */
+
+    return 0;
+}
+
 /**
  * Repoint the remote address of a UDP session.
  *
@@ -397,6 +451,104 @@ katherine_udp_pin_remote(katherine_udp_t *u)
     u->remote_pinned = true;
 }
 
+/**
+ * Switch a UDP session between blocking and non-blocking receives.
+ *
+ * A session starts out blocking, where a receive waits for a datagram for up to the timeout given
+ * to katherine_udp_init(). A non-blocking receive returns EAGAIN at once if none is waiting, which
+ * is what a caller polling the socket from an event loop wants.
+ *
+ * @param u UDP session
+ * @param blocking True to block, false not to
+ * @return Error code.
+ */
+int
+katherine_udp_set_blocking(katherine_udp_t *u, bool blocking)
+{
+    u_long nonblocking = blocking ? 0 : 1;
+    if (ioctlsocket(u->sock, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+        return WSAGetLastError();
+    }
+
+    return 0;
+}
+
+/**
+ * Count the datagrams the socket of a UDP session drops.
+ *
+ * Windows does not report the datagrams a socket drops, so this always fails.
+ *
+ * @param u UDP session
+ * @return Error code: ENOTSUP.
+ */
+int
+katherine_udp_track_drops(katherine_udp_t *u)
+{
+    (void) u;
+    return ENOTSUP;
+}
+
+/**
+ * Tune the socket of a UDP session for a high-rate stream.
+ *
+ * On Windows, only the receive buffer and the receive timeout are tuned; the other options of the
+ * tuning are ignored and granted as left.
+ *
+ * @param u UDP session
+ * @param requested Tuning requested
+ * @param granted Tuning in effect afterwards, or NULL
+ * @return Error code.
+ */
+int
+katherine_udp_tune(katherine_udp_t *u, const katherine_udp_tuning_t *requested, katherine_udp_tuning_t *granted)
+{
+    if (requested->rcvbuf > (size_t) INT32_MAX) {
+        return EINVAL;
+    }
+
+    if (requested->rcvbuf > 0) {
+        int rcvbuf = (int) requested->rcvbuf;
+        (void) setsockopt(u->sock, SOL_SOCKET, SO_RCVBUF, (char *) &rcvbuf, sizeof(rcvbuf));
+    }
+
+    if (requested->timeout_ms > 0) {
+        DWORD timeout = requested->timeout_ms;
+        if (setsockopt(u->sock, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, sizeof(timeout)) == SOCKET_ERROR) {
+            return WSAGetLastError();
+        }
+    }
+
+    if (granted == NULL) {
+        return 0;
+    }
+
+    int rcvbuf = 0;
+    DWORD timeout = 0;
+    int rcvbuf_len = sizeof(rcvbuf);
+    int timeout_len = sizeof(timeout);
+    (void) getsockopt(u->sock, SOL_SOCKET, SO_RCVBUF, (char *) &rcvbuf, &rcvbuf_len);
+    (void) getsockopt(u->sock, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, &timeout_len);
+
+    granted->rcvbuf       = (size_t) rcvbuf;
+    granted->busy_poll_us = 0;
+    granted->timestamps   = false;
+    granted->incoming_cpu = -1;
+    granted->timeout_ms   = (uint32_t) timeout;
+    return 0;
+}
+
+/**
+ * Get the number of datagrams the socket of a UDP session has dropped.
+ * @param u UDP session
+ * @return Zero, as drops are not tracked on Windows.
+ */
+uint64_t
+katherine_udp_dropped(const katherine_udp_t *u)
+{
+    (void) u;
+    return 0;
+}
+
 /**
  * Lock mutual exclusion synchronization primitive.
  * @param u UDP session
@@ -0,0 +1,398 @@
+/**
+ * @file
+ * @brief Internal fixture running acquisitions over synthetic measurement data.
+ *
+ * The fixture drives the real read loop of c/src/acquisition.c over a
+ * crafted measurement data stream, with no readout and no emulator involved:
+ * the datagrams are queued in the receive buffer of a localhost UDP socket
+ * before the loop starts, exactly as test_issue16.c does it, and the loop
+ * reads them in order. The socket is the only way in -- the loop calls
+ * katherine_udp_recv() itself -- so the tests using this header talk POSIX
+ * sockets directly and are registered inside the same platform guard as
+ * test_issue16.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/device.h>
+#include <katherine/replay.h>
+#include <katherine/sink.h>
+#include <katherine/udp.h>
+
+#include "clock.h"
+#include "ktest.h"
+#include "md_stream.h"
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Recv timeout of the acquisition's data socket. Reached once per run, after
+   the last datagram, so it also bounds how long a run lingers. */
+#define RECV_TIMEOUT_MS       100
+
+/* Only reached if the stream fails to end the acquisition, which every case
+   below asserts against; it keeps a broken read loop from hanging. */
+#define FAIL_TIMEOUT_MS       2000
+
+/* Buffers of the acquisition under test: the measurement data buffer is far
+   larger than any datagram sent here, and the pixel buffer holds every hit
+   of a run, so hits reach the handler only when a frame ends. The former is
+   too small to be split into datagram slots, so every datagram lands at its
+   start; the batched variant has room for a few slots instead. */
+#define MD_BUFFER_MDS         256
+#define MD_BUFFER_BATCHED     (4 * KATHERINE_MD_DATAGRAM_MAX_SIZE)
+#define PIXEL_BUFFER_HITS     64
+
+/* The acquisition mode under test, and the pixel records it delivers in
+   the plain and in the packed layouts. */
+typedef katherine_px_toa_tot_t px_t;
+typedef katherine_px_toa_tot_p16_t px_p16_t;
+typedef katherine_px_toa_tot_p12_t px_p12_t;
+
+typedef struct decode_probe {
+    uint32_t frames_started;
+    uint32_t frames_ended;
+
+    size_t hits; /* summed over every pixels_received call */
+    uint64_t toa[PIXEL_BUFFER_HITS];
+    uint8_t x[PIXEL_BUFFER_HITS];
+
+    katherine_px_layout_t layout; /* of the records delivered to pixels_received */
+    katherine_frame_info_t info;  /* of the last frame ended */
+
+    /* Copied out of the acquisition once the read loop has returned. */
+    char state;
+    int completed_frames;
+    size_t dropped;
+    katherine_pipeline_stats_t pipeline;
+    katherine_acquisition_stats_t stats;
+} decode_probe_t;
+
+static inline void
+on_frame_started(void *ctx, int frame_idx)
+{
+    decode_probe_t *probe = (decode_probe_t *) ctx;
+
+    KT_CHECK_EQ(frame_idx, probe->frames_started);
+    ++probe->frames_started;
+}
+
+static inline void
+on_frame_ended(void *ctx, int frame_idx, bool completed, const katherine_frame_info_t *info)
+{
+    decode_probe_t *probe = (decode_probe_t *) ctx;
+
+    (void) completed;
+
+    KT_CHECK_EQ(frame_idx, probe->frames_ended);
+    ++probe->frames_ended;
+    probe->info = *info;
+}
+
+static inline void
+on_pixels_received(void *ctx, const void *px, size_t count)
+{
+    decode_probe_t *probe = (decode_probe_t *) ctx;
+
+    for (size_t i = 0; i < count && probe->hits + i < PIXEL_BUFFER_HITS; ++i) {
+        switch (probe->layout) {
+        case KATHERINE_PX_LAYOUT_PACKED16: {
+            const px_p16_t *hit         = (const px_p16_t *) px + i;
+            probe->toa[probe->hits + i] = hit->toa;
+            probe->x[probe->hits + i]   = hit->coord.x;
+            KT_CHECK_EQ(hit->reserved[0] | hit->reserved[1] | hit->reserved[2], 0);
+            break;
+        }
+        case KATHERINE_PX_LAYOUT_PACKED12: {
+            const px_p12_t *hit         = (const px_p12_t *) px + i;
+            probe->toa[probe->hits + i] = KATHERINE_PX_TOA48(hit);
+            probe->x[probe->hits + i]   = hit->coord.x;
+            KT_CHECK_EQ(hit->reserved[0], 0);
+            break;
+        }
+        default: {
+            const px_t *hit             = (const px_t *) px + i;
+            probe->toa[probe->hits + i] = hit->toa;
+            probe->x[probe->hits + i]   = hit->coord.x;
+            break;
+        }
+        }
+    }
+
+    probe->hits += count;
+}
+
+static inline void
+on_pixel_columns_received(void *ctx, const katherine_px_columns_t *columns)
+{
+    decode_probe_t *probe = (decode_probe_t *) ctx;
+
+    /* The columns of the mode under test, and none other. */
+    KT_CHECK(columns->toa != NULL && columns->hit_count != NULL && columns->tot != NULL);
+    KT_CHECK(columns->ftoa == NULL && columns->event_count == NULL && columns->integral_tot == NULL);
+
+    for (size_t i = 0; i < columns->count && probe->hits + i < PIXEL_BUFFER_HITS; ++i) {
+        probe->toa[probe->hits + i] = columns->toa[i];
+        probe->x[probe->hits + i]   = columns->x[i];
+    }
+
+    probe->hits += columns->count;
+}
+
+/* Opens the data socket of the device on an ephemeral port, which is the
+   only socket the read loop uses, and tells where a stream sent to it has
+   to go. */
+static inline int
+open_data_socket(katherine_device_t *dev, struct sockaddr_in *bound)
+{
+    int res = katherine_udp_init(&dev->data_socket, 0, "127.0.0.1", 1, RECV_TIMEOUT_MS);
+    KT_CHECK(res == 0);
+    if (res != 0) {
+        return res;
+    }
+
+    socklen_t bound_len = sizeof(*bound);
+    res                 = getsockname(dev->data_socket.sock, (struct sockaddr *) bound, &bound_len);
+    KT_CHECK(res == 0);
+    if (res != 0) {
+        katherine_udp_fini(&dev->data_socket);
+        return -1;
+    }
+    bound->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return 0;
+}
+
+/* Sends the stream, cut into `datagrams` consecutive datagrams of the given
+   lengths, ahead of the read, which finds them queued in the socket. */
+static inline void
+send_stream(const struct sockaddr_in *bound, const unsigned char *stream, const size_t *datagram_len, size_t datagrams)
+{
+    int sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    KT_CHECK(sender >= 0);
+    size_t offset = 0;
+    for (size_t i = 0; i < datagrams; ++i) {
+        ssize_t sent = sendto(sender, stream + offset, datagram_len[i], 0,
+            (const struct sockaddr *) bound, sizeof(*bound));
+        KT_CHECK(sent == (ssize_t) datagram_len[i]);
+        offset += datagram_len[i];
+    }
+    close(sender);
+}
+
+/* Runs one acquisition over the given stream, which is cut into `datagrams`
+   consecutive datagrams of the given lengths, and returns what
+   katherine_acquisition_read() returned. The datagrams are all sent before
+   the loop starts, so the loop reads them back to back and the run ends on
+   the frame-finished datum of the last frame the stream carries. The read
+   is made by the given function, a stand-in for katherine_acquisition_read()
+   or the function itself. */
+static inline int
+run_stream_read(const unsigned char *stream, const size_t *datagram_len, size_t datagrams, int frames,
+    size_t md_buffer_size, size_t pipeline_depth, katherine_px_layout_t layout,
+    int (*read)(katherine_acquisition_t *), decode_probe_t *probe)
+{
+    katherine_device_t dev;
+    memset(&dev, 0, sizeof(dev));
+    memset(probe, 0, sizeof(*probe));
+    probe->layout = layout;
+
+    struct sockaddr_in bound;
+    int res = open_data_socket(&dev, &bound);
+    if (res != 0) {
+        return res;
+    }
+
+    katherine_acquisition_t acq;
+    memset(&acq, 0, sizeof(acq));
+    res = katherine_acquisition_init(&acq, &dev, probe, md_buffer_size,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0 /* report_timeout disabled */, FAIL_TIMEOUT_MS);
+    KT_CHECK(res == 0);
+    if (res != 0) {
+        katherine_udp_fini(&dev.data_socket);
+        return -1;
+    }
+
+    acq.handlers.frame_started          = on_frame_started;
+    acq.handlers.frame_ended            = on_frame_ended;
+    acq.handlers.pixels_received        = on_pixels_received;
+    acq.handlers.pixel_columns_received = on_pixel_columns_received;
+
+    res = katherine_acquisition_set_pipeline(&acq, pipeline_depth);
+    KT_CHECK(res == 0);
+    res = katherine_acquisition_set_px_layout(&acq, layout);
+    KT_CHECK(res == 0);
+
+    /* Stand in for katherine_acquisition_begin (which needs hardware). The
+       memset above leaves the decoding state it initializes -- the pixel
+       buffer counters and the timestamp offset -- zeroed, as it does. */
+    acq.state                    = ACQUISITION_RUNNING;
+    acq.acq_mode                 = ACQUISITION_MODE_TOA_TOT;
+    acq.fast_vco_enabled         = false;
+    acq.decode_data              = true;
+    acq.requested_frames         = frames;
+    acq.requested_frame_duration = 0.0;
+    acq.acq_start_time           = time(NULL);
+    acq.acq_start_time_ns        = katherine_clock_ns();
+
+    send_stream(&bound, stream, datagram_len, datagrams);
+    res = read(&acq);
+
+    probe->state            = acq.state;
+    probe->completed_frames = acq.completed_frames;
+    probe->dropped          = acq.dropped_measurement_data;
+    katherine_acquisition_get_pipeline_stats(&acq, &probe->pipeline);
+    katherine_acquisition_get_stats(&acq, &probe->stats);
+
+    katherine_acquisition_fini(&acq);
+    katherine_udp_fini(&dev.data_socket);
+    return res;
+}
+
+/* As run_stream_read(), with the blocking read. */
+static inline int
+run_stream_buffered(const unsigned char *stream, const size_t *datagram_len, size_t datagrams, int frames,
+    size_t md_buffer_size, size_t pipeline_depth, katherine_px_layout_t layout, decode_probe_t *probe)
+{
+    return run_stream_read(stream, datagram_len, datagrams, frames, md_buffer_size, pipeline_depth, layout, katherine_acquisition_read, probe);
+}
+
+/* As run_stream_buffered(), with the single-slot measurement data buffer,
+   the plain read and pixel records. */
+static inline int
+run_stream(const unsigned char *stream, const size_t *datagram_len, size_t datagrams, int frames,
+    decode_probe_t *probe)
+{
+    return run_stream_buffered(stream, datagram_len, datagrams, frames, MD_BUFFER_MDS * KATHERINE_MD_SIZE, 0, KATHERINE_PX_LAYOUT_STRUCTS, probe);
+}
+
+/* Slots of the ring of a pipelined read: fewer than the datagrams of the
+   batched stream below, so that the receiver fills the ring and has to wait
+   for the decoder to drain it. */
+#define PIPELINE_DEPTH 3
+
+/* Datagrams the batched stream is cut into, hits per datagram, and the coarse
+   arrival time of the i-th hit. More datagrams than the buffer has slots,
+   so the loop needs several batches to read them. */
+#define BATCH_DATAGRAMS   12
+#define BATCH_HITS        4
+#define BATCH_TOA(i)      (0x0100 + 3 * (i))
+
+/* Timestamp offset halfway through the hits, in coarse windows. */
+#define BATCH_OFFSET      3u
+
+/* Builds the stream of the batched cases and returns the number of
+   datagrams it is cut into. One frame: the new-frame datum in a datagram of
+   its own, then the hits, a timestamp offset halfway through them, then the
+   frame finished. A last datagram carries a hit that follows the final
+   frame and must not be decoded, whether it is received behind the datum
+   that ends the acquisition or left in the socket. */
+static inline size_t
+make_batched_stream(unsigned char *stream, size_t *datagram_len)
+{
+    size_t n = 0, d = 0;
+
+    store_md(stream, n++, make_new_frame());
+    datagram_len[d++] = KATHERINE_MD_SIZE;
+
+    for (size_t g = 0; g < BATCH_DATAGRAMS; ++g) {
+        size_t first = n;
+        if (g == BATCH_DATAGRAMS / 2) {
+            store_md(stream, n++, make_time_offset(BATCH_OFFSET));
+        }
+        for (size_t h = 0; h < BATCH_HITS; ++h) {
+            size_t hit = g * BATCH_HITS + h;
+            store_md(stream, n++, make_pixel((uint8_t) hit, (uint8_t) g, BATCH_TOA(hit)));
+        }
+        datagram_len[d++] = (n - first) * KATHERINE_MD_SIZE;
+    }
+
+    store_md(stream, n++, make_frame_finished(BATCH_DATAGRAMS * BATCH_HITS));
+    datagram_len[d++] = KATHERINE_MD_SIZE;
+    store_md(stream, n++, make_pixel(0, 0, 0));
+    datagram_len[d++] = KATHERINE_MD_SIZE;
+
+    return d;
+}
+
+/* Requires the outcome of a run over the stream of make_batched_stream(). */
+static inline void
+check_batched_probe(const decode_probe_t *probe)
+{
+    KT_CHECK_EQ(probe->state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe->completed_frames, 1);
+    KT_CHECK_EQ(probe->dropped, 0);
+    KT_CHECK_EQ(probe->frames_started, 1);
+    KT_CHECK_EQ(probe->frames_ended, 1);
+
+    /* The frame waited for its data no longer than it ran. */
+    KT_CHECK(probe->info.start_time_observed_ns <= probe->info.end_time_observed_ns);
+    KT_CHECK(probe->info.max_receive_gap_ns <= probe->info.end_time_observed_ns - probe->info.start_time_observed_ns);
+
+    KT_REQUIRE(probe->hits == BATCH_DATAGRAMS * BATCH_HITS);
+    for (size_t i = 0; i < probe->hits; ++i) {
+        uint64_t offset = i < (BATCH_DATAGRAMS / 2) * BATCH_HITS ? 0 : BATCH_OFFSET * TOA_WINDOW;
+        KT_CHECK_EQ(probe->toa[i], BATCH_TOA(i) + offset);
+        KT_CHECK_EQ(probe->x[i], (uint8_t) i);
+    }
+}
+
+/* Replays a source into an acquisition of a device which is not connected,
+   decoded by as many threads (none for the calling one) and written to the
+   sink, if any, and copies out what the probe needs. */
+static inline int
+run_replay(katherine_replay_source_t *source, size_t md_buffer_size, size_t decode_threads, katherine_sink_t *sink, decode_probe_t *probe)
+{
+    katherine_device_t dev;
+    katherine_acquisition_t acq;
+    memset(&dev, 0, sizeof(dev));
+    memset(probe, 0, sizeof(*probe));
+    probe->layout = KATHERINE_PX_LAYOUT_STRUCTS;
+
+    int res = katherine_acquisition_init(&acq, &dev, probe, md_buffer_size, PIXEL_BUFFER_HITS * sizeof(px_t), 0, FAIL_TIMEOUT_MS);
+    KT_CHECK_EQ(res, 0);
+    if (res != 0) return res;
+
+    acq.handlers.frame_started   = on_frame_started;
+    acq.handlers.frame_ended     = on_frame_ended;
+    acq.handlers.pixels_received = on_pixels_received;
+    KT_CHECK_EQ(katherine_acquisition_set_sink(&acq, sink), 0);
+    if (decode_threads > 0) {
+        KT_CHECK_EQ(katherine_acquisition_set_decode_threads(&acq, decode_threads), 0);
+    }
+
+    res = katherine_acquisition_replay(&acq, source);
+
+    probe->state            = acq.state;
+    probe->completed_frames = acq.completed_frames;
+    katherine_acquisition_get_stats(&acq, &probe->stats);
+
+    katherine_acquisition_fini(&acq);
+    return res;
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,109 @@
+/**
+ * @file
+ * @brief Internal construction of synthetic measurement data for the test suite.
+ *
+ * Every datum is built with the field declarations of c/src/md.h, the ones
+ * the decoder reads them back with, so that the two can never disagree.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <katherine/acquisition.h>
+
+/* The pixel mapping functions of md.h are written against the acquisition,
+   so its declaration has to precede them. */
+#include "md.h"
+
+/*
+ * IMPORTANT NOTICE:
+ *
+ * The following interface is internal.
+ * It is not intended for user application access.
+ */
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/* Measurement data headers, as dispatched by the read loop. */
+#define MD_HDR_PIXEL          0x4
+#define MD_HDR_TIME_OFFSET    0x5
+#define MD_HDR_NEW_FRAME      0x7
+#define MD_HDR_START_TIME_LSB 0x8
+#define MD_HDR_START_TIME_MSB 0x9
+#define MD_HDR_FRAME_FINISHED 0xC
+
+/* The timestamp offset counts whole coarse time-of-arrival windows, i.e.
+   multiples of the 1 << 14 ticks the coarse field holds. */
+#define TOA_WINDOW            (1ull << 14)
+
+static inline uint64_t
+make_new_frame(void)
+{
+    return INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_NEW_FRAME);
+}
+
+static inline uint64_t
+make_time_offset(uint32_t offset)
+{
+    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_TIME_OFFSET);
+    return INSERT(md, md_time_offset, offset, (uint64_t) offset);
+}
+
+static inline uint64_t
+make_start_time_lsb(uint32_t lsb)
+{
+    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_START_TIME_LSB);
+    return INSERT(md, md_time_lsb, lsb, (uint64_t) lsb);
+}
+
+static inline uint64_t
+make_start_time_msb(uint16_t msb)
+{
+    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_START_TIME_MSB);
+    return INSERT(md, md_time_msb, msb, (uint64_t) msb);
+}
+
+static inline uint64_t
+make_frame_finished(uint64_t n_sent)
+{
+    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_FRAME_FINISHED);
+    return INSERT(md, md_frame_finished, n_sent, n_sent);
+}
+
+static inline uint64_t
+make_pixel_tot(uint8_t x, uint8_t y, uint16_t toa, uint16_t tot)
+{
+    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_PIXEL);
+    md          = INSERT(md, pmd_toa_tot, coord_x, (uint64_t) x);
+    md          = INSERT(md, pmd_toa_tot, coord_y, (uint64_t) y);
+    md          = INSERT(md, pmd_toa_tot, toa, (uint64_t) toa);
+    md          = INSERT(md, pmd_toa_tot, hit_count, (uint64_t) 1);
+    return INSERT(md, pmd_toa_tot, tot, (uint64_t) tot);
+}
+
+static inline uint64_t
+make_pixel(uint8_t x, uint8_t y, uint16_t toa)
+{
+    return make_pixel_tot(x, y, toa, 100);
+}
+
+/* Appends one datum in wire order (little endian) at the given index. */
+static inline void
+store_md(unsigned char *stream, size_t index, uint64_t md)
+{
+    unsigned char *dst = stream + index * KATHERINE_MD_SIZE;
+    for (size_t i = 0; i < KATHERINE_MD_SIZE; ++i) {
+        dst[i] = (unsigned char) (md >> (8 * i));
+    }
+}
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @brief Allocation of the buffers of an acquisition.
+ *
+ * An acquisition is only initialized and configured here, never read, so
+ * this program needs no sockets and builds everywhere.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/device.h>
+
+#include "ktest.h"
+
+/* Buffers of the acquisition under test: room for a few datagram slots, and
+   for the records of a few hits. */
+#define MD_BUFFER_BATCHED (4 * KATHERINE_MD_DATAGRAM_MAX_SIZE)
+#define PIXEL_BUFFER_HITS 64
+#define FAIL_TIMEOUT_MS   2000
+
+/* A measurement data buffer whose slots are each four datagrams long. */
+#define MD_BUFFER_LARGE   (4 * KATHERINE_MD_BATCH_MAX * KATHERINE_MD_DATAGRAM_MAX_SIZE)
+
+/* Slots of the ring and leases of the pool, each replaced once by one
+   more. */
+#define PIPELINE_DEPTH 3
+#define LEASE_POOL     2
+
+typedef katherine_px_toa_tot_t px_t;
+
+typedef struct counting_allocator {
+    size_t allocs;
+    size_t frees;
+    size_t live_bytes;
+} counting_allocator_t;
+
+static void *
+counting_alloc(void *ctx, size_t size)
+{
+    counting_allocator_t *counts = (counting_allocator_t *) ctx;
+    ++counts->allocs;
+    counts->live_bytes += size;
+    return malloc(size);
+}
+
+static void
+counting_free(void *ctx, void *ptr, size_t size)
+{
+    counting_allocator_t *counts = (counting_allocator_t *) ctx;
+    ++counts->frees;
+    counts->live_bytes -= size;
+    free(ptr);
+}
+
+static void
+test_buffer_allocator(void)
+{
+    katherine_device_t dev;
+    memset(&dev, 0, sizeof(dev));
+
+    /* The measurement data and pixel buffers, the ring and the lease pool,
+       the latter two replaced once. */
+    counting_allocator_t counts = {0, 0, 0};
+    katherine_allocator_t counting = {counting_alloc, counting_free, &counts, KATHERINE_ALLOC_PREFAULT};
+
+    katherine_acquisition_t acq;
+    memset(&acq, 0, sizeof(acq));
+    KT_REQUIRE(katherine_acquisition_init_with_allocator(&acq, &dev, NULL, MD_BUFFER_BATCHED,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0, FAIL_TIMEOUT_MS, &counting) == 0);
+    KT_CHECK_EQ(counts.allocs, 2);
+    KT_CHECK_EQ(counts.live_bytes, MD_BUFFER_BATCHED + sizeof(uint64_t) + PIXEL_BUFFER_HITS * sizeof(px_t));
+    KT_CHECK_EQ(acq.pixel_buffer[PIXEL_BUFFER_HITS * sizeof(px_t) - 1], 0);
+
+    KT_CHECK_EQ(katherine_acquisition_set_pipeline(&acq, PIPELINE_DEPTH), 0);
+    KT_CHECK_EQ(katherine_acquisition_set_pipeline(&acq, PIPELINE_DEPTH + 1), 0);
+    KT_CHECK_EQ(katherine_acquisition_set_md_pool(&acq, LEASE_POOL), 0);
+    KT_CHECK_EQ(katherine_acquisition_set_md_pool(&acq, LEASE_POOL + 1), 0);
+    KT_CHECK_EQ(counts.allocs, 6);
+    KT_CHECK_EQ(counts.frees, 2);
+
+    katherine_acquisition_fini(&acq);
+    KT_CHECK_EQ(counts.frees, counts.allocs);
+    KT_CHECK_EQ(counts.live_bytes, 0);
+
+    /* Leases hold a datagram of the largest size each, however large the
+       slots of the measurement data buffer are. */
+    KT_REQUIRE(katherine_acquisition_init_with_allocator(&acq, &dev, NULL, MD_BUFFER_LARGE,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0, FAIL_TIMEOUT_MS, &counting) == 0);
+    const size_t buffers = counts.live_bytes;
+    KT_CHECK_EQ(katherine_acquisition_set_md_pool(&acq, LEASE_POOL), 0);
+    KT_CHECK_EQ(counts.live_bytes - buffers, LEASE_POOL * KATHERINE_MD_DATAGRAM_MAX_SIZE + sizeof(uint64_t));
+    katherine_acquisition_fini(&acq);
+    KT_CHECK_EQ(counts.live_bytes, 0);
+
+    /* An allocator which cannot give back what it allocates is refused. */
+    katherine_allocator_t leaking = {counting_alloc, NULL, &counts, 0};
+    KT_CHECK_EQ(katherine_acquisition_init_with_allocator(&acq, &dev, NULL, MD_BUFFER_BATCHED,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0, FAIL_TIMEOUT_MS, &leaking), EINVAL);
+
+    /* The default allocator maps huge pages instead, faulted in and so
+       zeroed, and unmaps them again. */
+    katherine_allocator_t huge = {NULL, NULL, NULL, KATHERINE_ALLOC_HUGEPAGES | KATHERINE_ALLOC_PREFAULT};
+    KT_REQUIRE(katherine_acquisition_init_with_allocator(&acq, &dev, NULL, MD_BUFFER_BATCHED,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0, FAIL_TIMEOUT_MS, &huge) == 0);
+    KT_CHECK_EQ(acq.md_buffer[MD_BUFFER_BATCHED], 0);
+    memset(acq.md_buffer, 0xa5, MD_BUFFER_BATCHED + sizeof(uint64_t));
+    KT_CHECK_EQ(katherine_acquisition_set_pipeline(&acq, PIPELINE_DEPTH), 0);
+    katherine_acquisition_fini(&acq);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_buffer_allocator);
+    return kt_summary();
+}
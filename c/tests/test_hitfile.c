@@ -0,0 +1,157 @@
+/**
+ * @file
+ * @brief Columnar files of decoded hits, written and queried.
+ *
+ * The file is written to a temporary path by mkstemp(), so this program is
+ * registered inside the same platform guard as test_md_decode.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/hitfile.h>
+
+#include "ktest.h"
+
+static char hitfile_path[] = "/tmp/katherine-hitfile-XXXXXX";
+
+/* Hits a query has found, in the order the handler received them. */
+typedef struct hits_found {
+    size_t count;
+    size_t batches;
+    uint8_t x[128];
+    uint16_t tot[128];
+    bool toa_passed;
+} hits_found_t;
+
+static void
+on_hits_found(void *ctx, const katherine_px_columns_t *hits)
+{
+    hits_found_t *found = (hits_found_t *) ctx;
+
+    ++found->batches;
+    found->toa_passed |= hits->toa != NULL;
+    for (size_t i = 0; i < hits->count && found->count < 128; ++i, ++found->count) {
+        found->x[found->count]   = hits->x != NULL ? hits->x[i] : 0;
+        found->tot[found->count] = hits->tot != NULL ? hits->tot[i] : 0;
+    }
+}
+
+static void
+test_hitfile(void)
+{
+    enum { HITS = 100, CHUNK = 16 };
+    uint8_t x[HITS], y[HITS], hit_count[HITS];
+    uint64_t toa[HITS];
+    uint16_t tot[HITS];
+
+    /* Hits ten ticks apart, sweeping the columns twice, written in uneven
+       batches across the chunks. */
+    for (size_t i = 0; i < HITS; ++i) {
+        x[i]         = (uint8_t) (i % 50);
+        y[i]         = (uint8_t) (i / 2);
+        toa[i]       = 10 * i;
+        tot[i]       = (uint16_t) (1000 + i);
+        hit_count[i] = 1;
+    }
+
+    int fd = mkstemp(hitfile_path);
+    KT_REQUIRE(fd >= 0);
+    close(fd);
+
+    katherine_hitfile_writer_t writer;
+    KT_CHECK_EQ(katherine_hitfile_create(&writer, hitfile_path, (katherine_acquisition_mode_t) 7, false, KATHERINE_TIMESTAMP_TOA, CHUNK), EINVAL);
+    KT_REQUIRE(katherine_hitfile_create(&writer, hitfile_path, ACQUISITION_MODE_TOA_TOT, false, KATHERINE_TIMESTAMP_TOA, CHUNK) == 0);
+
+    katherine_px_columns_t batch;
+    memset(&batch, 0, sizeof(batch));
+    KT_CHECK_EQ((batch.count = 1, katherine_hitfile_write(&writer, &batch)), EINVAL);
+
+    for (size_t at = 0, n = 7; at < HITS; at += n, n = n * 5 % 61 + 1) {
+        if (n > HITS - at) n = HITS - at;
+        batch.count     = n;
+        batch.x         = x + at;
+        batch.y         = y + at;
+        batch.toa       = toa + at;
+        batch.tot       = tot + at;
+        batch.hit_count = hit_count + at;
+        KT_CHECK_EQ(katherine_hitfile_write(&writer, &batch), 0);
+    }
+    KT_CHECK_EQ(katherine_hitfile_finish(&writer), 0);
+
+    katherine_hitfile_t file;
+    KT_REQUIRE(katherine_hitfile_open(&file, hitfile_path) == 0);
+    KT_CHECK_EQ(file.hits, HITS);
+    KT_CHECK_EQ(file.header.columns, KATHERINE_HIT_X | KATHERINE_HIT_Y | KATHERINE_HIT_TOA | KATHERINE_HIT_TOT | KATHERINE_HIT_HIT_COUNT);
+    KT_REQUIRE(file.chunk_count == (HITS + CHUNK - 1) / CHUNK);
+    KT_CHECK_EQ(file.chunks[1].count, CHUNK);
+    KT_CHECK_EQ(file.chunks[1].min_toa, 160);
+    KT_CHECK_EQ(file.chunks[1].max_toa, 310);
+    KT_CHECK_EQ(file.chunks[1].min_y, 8);
+    KT_CHECK_EQ(file.chunks[1].max_y, 15);
+    KT_CHECK_EQ(file.chunks[file.chunk_count - 1].count, HITS % CHUNK);
+
+    /* A time window within the second chunk reads its columns alone: those
+       asked for, and those the window is told by. */
+    katherine_hitfile_query_t query;
+    hits_found_t found;
+    katherine_hitfile_query_all(&query);
+    query.min_toa = 200;
+    query.max_toa = 260;
+    memset(&found, 0, sizeof(found));
+    KT_CHECK_EQ(katherine_hitfile_query(&file, &query, KATHERINE_HIT_X | KATHERINE_HIT_TOT, on_hits_found, &found), 0);
+    KT_REQUIRE(found.count == 7);
+    KT_CHECK_EQ(found.batches, 1);
+    KT_CHECK(found.x[0] == 20 && found.x[6] == 26);
+    KT_CHECK(found.tot[0] == 1020 && found.tot[6] == 1026);
+    KT_CHECK(!found.toa_passed);
+    KT_CHECK_EQ(file.bytes_read, CHUNK * (sizeof(uint64_t) + sizeof(uint16_t) + 2 * sizeof(uint8_t)));
+
+    /* A region of the matrix, across the chunks. */
+    katherine_hitfile_query_all(&query);
+    query.max_x = 1;
+    query.min_y = 20;
+    memset(&found, 0, sizeof(found));
+    KT_CHECK_EQ(katherine_hitfile_query(&file, &query, KATHERINE_HIT_X, on_hits_found, &found), 0);
+    KT_REQUIRE(found.count == 2);
+    KT_CHECK(found.x[0] == 0 && found.x[1] == 1);
+
+    /* All hits: every chunk matches as a whole, and only the column asked
+       for is read. */
+    katherine_hitfile_query_all(&query);
+    memset(&found, 0, sizeof(found));
+    file.bytes_read = 0;
+    KT_CHECK_EQ(katherine_hitfile_query(&file, &query, KATHERINE_HIT_TOT, on_hits_found, &found), 0);
+    KT_CHECK_EQ(found.count, HITS);
+    KT_CHECK_EQ(found.batches, file.chunk_count);
+    KT_CHECK_EQ(found.tot[HITS - 1], 1000 + HITS - 1);
+    KT_CHECK_EQ(file.bytes_read, HITS * sizeof(uint16_t));
+
+    KT_CHECK_EQ(katherine_hitfile_read_chunk(&file, file.chunk_count, KATHERINE_HIT_ALL), EINVAL);
+    katherine_hitfile_close(&file);
+    remove(hitfile_path);
+
+    KT_CHECK_EQ(katherine_hitfile_open(&file, hitfile_path), ENOENT);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_hitfile);
+    return kt_summary();
+}
@@ -17,6 +17,7 @@
 #include <katherine/device.h>
 #include <katherine/udp.h>
 
+#include "clock.h"
 #include "ktest.h"
 
 #define MD_SIZE 6
@@ -117,6 +118,7 @@ run_case(bool send_frame_finished, struct stats *s)
     acq.requested_frames         = 1;
     acq.requested_frame_duration = 0.0;
     acq.acq_start_time           = time(NULL);
+    acq.acq_start_time_ns        = katherine_clock_ns();
 
     /* Craft the stream: frame start, 5 pixels, optionally frame finished. */
     unsigned char packet[7 * MD_SIZE];
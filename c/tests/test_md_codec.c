@@ -0,0 +1,82 @@
+/**
+ * @file
+ * @brief Compression of raw measurement data streams.
+ *
+ * The stream is built in memory by md_stream.h and goes through no socket
+ * and no thread, so this program builds everywhere.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <katherine/codec.h>
+
+#include "ktest.h"
+#include "md_stream.h"
+
+static void
+test_md_codec(void)
+{
+    /* A frame of pixels going down two columns, with a timestamp offset
+       every few of them, and a fragment of a datum at the end. */
+    enum { PIXELS = 64, MDS = PIXELS + PIXELS / 16 + 3 };
+    unsigned char stream[MDS * KATHERINE_MD_SIZE + 3];
+    size_t n = 0;
+
+    store_md(stream, n++, make_new_frame());
+    for (size_t i = 0; i < PIXELS; ++i) {
+        if (i % 16 == 0) store_md(stream, n++, make_time_offset((uint32_t) (100 + i / 16)));
+        store_md(stream, n++, make_pixel_tot((uint8_t) (10 + i / 32), (uint8_t) (i % 32 * 3), (uint16_t) (0x3FF0 + 2 * i), (uint16_t) (50 + i % 7)));
+    }
+    store_md(stream, n++, make_start_time_lsb(0xDEADBEEF));
+    store_md(stream, n++, make_frame_finished(PIXELS));
+    KT_REQUIRE(n == MDS);
+    memcpy(stream + n * KATHERINE_MD_SIZE, "\x01\x02\x03", 3);
+
+    /* Two blocks, the second carrying on from the state of the first. */
+    const size_t split  = 20 * KATHERINE_MD_SIZE;
+    const size_t length = sizeof(stream);
+    unsigned char encoded[2 * MDS * KATHERINE_MD_SIZE + 64];
+    unsigned char decoded[sizeof(stream)];
+    size_t first, second, out1, out2;
+    katherine_md_codec_t enc, dec;
+
+    KT_REQUIRE(katherine_md_codec_bound(length) <= sizeof(encoded));
+    katherine_md_codec_init(&enc);
+    KT_CHECK_EQ(katherine_md_encode(&enc, stream, split, encoded, 1, &first), ENOBUFS);
+    KT_CHECK_EQ(katherine_md_encode(&enc, stream, split, encoded, sizeof(encoded), &first), 0);
+    KT_CHECK_EQ(katherine_md_encode(&enc, stream + split, length - split, encoded + first, sizeof(encoded) - first, &second), 0);
+
+    /* Within a column, a pixel takes four bytes or less. */
+    KT_CHECK(first + second < length * 3 / 4);
+
+    katherine_md_codec_init(&dec);
+    KT_CHECK_EQ(katherine_md_decode(&dec, encoded, first, decoded, sizeof(decoded), &out1), 0);
+    KT_CHECK_EQ(katherine_md_decode(&dec, encoded + first, second, decoded + out1, sizeof(decoded) - out1, &out2), 0);
+    KT_CHECK_EQ(out1, split);
+    KT_CHECK_EQ(out1 + out2, length);
+    KT_CHECK(memcmp(decoded, stream, length) == 0);
+
+    /* A block cut short, or decoded to too short an output. */
+    katherine_md_codec_init(&dec);
+    KT_CHECK_EQ(katherine_md_decode(&dec, encoded, first - 1, decoded, sizeof(decoded), &out1), EPROTO);
+    katherine_md_codec_init(&dec);
+    KT_CHECK_EQ(katherine_md_decode(&dec, encoded, first, decoded, split - 1, &out1), ENOBUFS);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_md_codec);
+    return kt_summary();
+}
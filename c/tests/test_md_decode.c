@@ -2,17 +2,11 @@
  * @file
  * @brief Decoding tests over synthetic measurement data.
  *
- * These tests drive the real read loop of c/src/acquisition.c over a crafted
- * measurement data stream, with no readout and no emulator involved: the
+ * These tests drive the real read loop of c/src/acquisition.c over crafted
+ * measurement data streams, through the fixture of decode_fixture.h: the
  * datagrams are queued in the receive buffer of a localhost UDP socket
- * before the loop starts, exactly as test_issue16.c does it, and the loop
- * reads them in order. The socket is the only way in -- the loop calls
- * katherine_udp_recv() itself -- so this program uses POSIX sockets
- * directly and is registered inside the same platform guard as
- * test_issue16.
- *
- * Every datum is built with the field declarations of c/src/md.h, the ones
- * the decoder reads them back with, so that the two can never disagree.
+ * before the loop starts, so this program is registered inside the same
+ * platform guard as test_issue16.
  *
  * @author Petr Mánek
  * @date 21.8.26
@@ -23,12 +17,16 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
@@ -39,206 +37,12 @@
 /* The pixel mapping functions of md.h are written against the acquisition,
    so its declaration has to precede them. */
 #include "md.h"
+#include "md_simd.h"
 
+#include "clock.h"
+#include "decode_fixture.h"
 #include "ktest.h"
-
-/* Measurement data headers, as dispatched by the read loop. */
-#define MD_HDR_PIXEL          0x4
-#define MD_HDR_TIME_OFFSET    0x5
-#define MD_HDR_NEW_FRAME      0x7
-#define MD_HDR_FRAME_FINISHED 0xC
-
-/* The timestamp offset counts whole coarse time-of-arrival windows, i.e.
-   multiples of the 1 << 14 ticks the coarse field holds. */
-#define TOA_WINDOW            (1ull << 14)
-
-/* Recv timeout of the acquisition's data socket. Reached once per run, after
-   the last datagram, so it also bounds how long a run lingers. */
-#define RECV_TIMEOUT_MS       100
-
-/* Only reached if the stream fails to end the acquisition, which every case
-   below asserts against; it keeps a broken read loop from hanging. */
-#define FAIL_TIMEOUT_MS       2000
-
-/* Buffers of the acquisition under test: the measurement data buffer is far
-   larger than any datagram sent here, and the pixel buffer holds every hit
-   of a run, so hits reach the handler only when a frame ends. */
-#define MD_BUFFER_MDS         256
-#define PIXEL_BUFFER_HITS     64
-
-/* The acquisition mode under test, and the pixel layout it delivers. */
-typedef katherine_px_toa_tot_t px_t;
-
-/* ------------------------------------------------------------------ */
-/* Stream construction.                                                */
-
-static uint64_t
-make_new_frame(void)
-{
-    return INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_NEW_FRAME);
-}
-
-static uint64_t
-make_time_offset(uint32_t offset)
-{
-    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_TIME_OFFSET);
-    return INSERT(md, md_time_offset, offset, (uint64_t) offset);
-}
-
-static uint64_t
-make_frame_finished(uint64_t n_sent)
-{
-    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_FRAME_FINISHED);
-    return INSERT(md, md_frame_finished, n_sent, n_sent);
-}
-
-static uint64_t
-make_pixel(uint8_t x, uint8_t y, uint16_t toa)
-{
-    uint64_t md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_PIXEL);
-    md          = INSERT(md, pmd_toa_tot, coord_x, (uint64_t) x);
-    md          = INSERT(md, pmd_toa_tot, coord_y, (uint64_t) y);
-    md          = INSERT(md, pmd_toa_tot, toa, (uint64_t) toa);
-    md          = INSERT(md, pmd_toa_tot, hit_count, (uint64_t) 1);
-    return INSERT(md, pmd_toa_tot, tot, (uint64_t) 100);
-}
-
-/* Appends one datum in wire order (little endian) at the given index. */
-static void
-store_md(unsigned char *stream, size_t index, uint64_t md)
-{
-    unsigned char *dst = stream + index * KATHERINE_MD_SIZE;
-    for (size_t i = 0; i < KATHERINE_MD_SIZE; ++i) {
-        dst[i] = (unsigned char) (md >> (8 * i));
-    }
-}
-
-/* ------------------------------------------------------------------ */
-/* Fixture.                                                            */
-
-typedef struct decode_probe {
-    uint32_t frames_started;
-    uint32_t frames_ended;
-
-    size_t hits; /* summed over every pixels_received call */
-    uint64_t toa[PIXEL_BUFFER_HITS];
-
-    /* Copied out of the acquisition once the read loop has returned. */
-    char state;
-    int completed_frames;
-    size_t dropped;
-} decode_probe_t;
-
-static void
-on_frame_started(void *ctx, int frame_idx)
-{
-    decode_probe_t *probe = (decode_probe_t *) ctx;
-
-    KT_CHECK_EQ(frame_idx, probe->frames_started);
-    ++probe->frames_started;
-}
-
-static void
-on_frame_ended(void *ctx, int frame_idx, bool completed, const katherine_frame_info_t *info)
-{
-    decode_probe_t *probe = (decode_probe_t *) ctx;
-
-    (void) completed;
-    (void) info;
-
-    KT_CHECK_EQ(frame_idx, probe->frames_ended);
-    ++probe->frames_ended;
-}
-
-static void
-on_pixels_received(void *ctx, const void *px, size_t count)
-{
-    decode_probe_t *probe = (decode_probe_t *) ctx;
-    const px_t *hits      = (const px_t *) px;
-
-    for (size_t i = 0; i < count; ++i) {
-        if (probe->hits + i < PIXEL_BUFFER_HITS) probe->toa[probe->hits + i] = hits[i].toa;
-    }
-
-    probe->hits += count;
-}
-
-/* Runs one acquisition over the given stream, which is cut into `datagrams`
-   consecutive datagrams of the given lengths, and returns what
-   katherine_acquisition_read() returned. The datagrams are all sent before
-   the loop starts, so the loop reads them back to back and the run ends on
-   the frame-finished datum of the last frame the stream carries. */
-static int
-run_stream(const unsigned char *stream, const size_t *datagram_len, size_t datagrams, int frames,
-    decode_probe_t *probe)
-{
-    katherine_device_t dev;
-    memset(&dev, 0, sizeof(dev));
-    memset(probe, 0, sizeof(*probe));
-
-    /* Only the data socket is used by the read loop. */
-    int res = katherine_udp_init(&dev.data_socket, 0, "127.0.0.1", 1, RECV_TIMEOUT_MS);
-    KT_CHECK(res == 0);
-    if (res != 0) {
-        return res;
-    }
-
-    struct sockaddr_in bound;
-    socklen_t bound_len = sizeof(bound);
-    int gs_res          = getsockname(dev.data_socket.sock, (struct sockaddr *) &bound, &bound_len);
-    KT_CHECK(gs_res == 0);
-    if (gs_res != 0) {
-        katherine_udp_fini(&dev.data_socket);
-        return -1;
-    }
-    bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-
-    katherine_acquisition_t acq;
-    memset(&acq, 0, sizeof(acq));
-    res = katherine_acquisition_init(&acq, &dev, probe, MD_BUFFER_MDS * KATHERINE_MD_SIZE,
-        PIXEL_BUFFER_HITS * sizeof(px_t), 0 /* report_timeout disabled */, FAIL_TIMEOUT_MS);
-    KT_CHECK(res == 0);
-    if (res != 0) {
-        katherine_udp_fini(&dev.data_socket);
-        return -1;
-    }
-
-    acq.handlers.frame_started   = on_frame_started;
-    acq.handlers.frame_ended     = on_frame_ended;
-    acq.handlers.pixels_received = on_pixels_received;
-
-    /* Stand in for katherine_acquisition_begin (which needs hardware). The
-       memset above leaves the decoding state it initializes -- the pixel
-       buffer counters and the timestamp offset -- zeroed, as it does. */
-    acq.state                    = ACQUISITION_RUNNING;
-    acq.acq_mode                 = ACQUISITION_MODE_TOA_TOT;
-    acq.fast_vco_enabled         = false;
-    acq.decode_data              = true;
-    acq.requested_frames         = frames;
-    acq.requested_frame_duration = 0.0;
-    acq.acq_start_time           = time(NULL);
-
-    int sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    KT_CHECK(sender >= 0);
-    size_t offset = 0;
-    for (size_t i = 0; i < datagrams; ++i) {
-        ssize_t sent = sendto(sender, stream + offset, datagram_len[i], 0,
-            (struct sockaddr *) &bound, sizeof(bound));
-        KT_CHECK(sent == (ssize_t) datagram_len[i]);
-        offset += datagram_len[i];
-    }
-    close(sender);
-
-    res = katherine_acquisition_read(&acq);
-
-    probe->state            = acq.state;
-    probe->completed_frames = acq.completed_frames;
-    probe->dropped          = acq.dropped_measurement_data;
-
-    katherine_acquisition_fini(&acq);
-    katherine_udp_fini(&dev.data_socket);
-    return res;
-}
+#include "md_stream.h"
 
 /* ------------------------------------------------------------------ */
 /* a) The timestamp offset belongs to the frame that delivered it.     */
@@ -340,11 +144,956 @@ test_partial_datum_ignored(void)
 }
 
 /* ------------------------------------------------------------------ */
+/* c) Datagrams received in batches are decoded in arrival order.      */
+
+/* The batched stream of decode_fixture.h has more datagrams than the buffer
+   has slots, so the loop needs several batches to read them. */
+static void
+test_batched_datagrams(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_buffered(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, &probe), 0);
+    check_batched_probe(&probe);
+}
+
+/* ------------------------------------------------------------------ */
+/* d) A pipelined read decodes exactly what the plain read does.       */
+
+static void
+test_pipelined_datagrams(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_buffered(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, PIPELINE_DEPTH, KATHERINE_PX_LAYOUT_STRUCTS, &probe), 0);
+    check_batched_probe(&probe);
+
+    /* Every datagram up to the one that ended the acquisition went through
+       the ring, which never held more than it has room for. */
+    KT_CHECK_EQ(probe.pipeline.capacity, PIPELINE_DEPTH);
+    KT_CHECK(probe.pipeline.datagrams >= datagrams - 1);
+    KT_CHECK(probe.pipeline.high_water >= 1);
+    KT_CHECK(probe.pipeline.high_water <= PIPELINE_DEPTH);
+
+    /* A ring slot holds a datagram of the largest size, even when a slot
+       of the measurement data buffer would not. */
+    unsigned char whole[KATHERINE_MD_DATAGRAM_MAX_SIZE];
+    const size_t whole_mds = sizeof(whole) / KATHERINE_MD_SIZE;
+    size_t whole_len[1]    = {sizeof(whole)};
+
+    store_md(whole, 0, make_new_frame());
+    for (size_t i = 1; i < whole_mds - 1; ++i) {
+        store_md(whole, i, make_pixel((uint8_t) i, 0, (uint16_t) i));
+    }
+    store_md(whole, whole_mds - 1, make_frame_finished(whole_mds - 2));
+
+    KT_CHECK_EQ(run_stream_buffered(whole, whole_len, 1, 1, 100 * KATHERINE_MD_SIZE, PIPELINE_DEPTH, KATHERINE_PX_LAYOUT_STRUCTS, &probe), 0);
+    KT_CHECK_EQ(probe.state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe.completed_frames, 1);
+    KT_CHECK_EQ(probe.hits, whole_mds - 2);
+}
+
+/* ------------------------------------------------------------------ */
+/* e) The columnar layout delivers the same pixels as the records do.  */
+
+static void
+test_columnar_layout(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_buffered(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_COLUMNS, &probe), 0);
+    check_batched_probe(&probe);
+}
+
+/* ------------------------------------------------------------------ */
+/* f) The packed layouts deliver the same pixels in smaller records.   */
+
+static void
+test_packed_layouts(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+    decode_probe_t probe;
+
+    KT_CHECK_EQ(sizeof(katherine_px_f_toa_tot_p16_t), 16);
+    KT_CHECK_EQ(sizeof(katherine_px_toa_tot_p16_t), 16);
+    KT_CHECK_EQ(sizeof(katherine_px_f_toa_only_p16_t), 16);
+    KT_CHECK_EQ(sizeof(katherine_px_toa_only_p16_t), 16);
+    KT_CHECK_EQ(sizeof(katherine_px_f_toa_tot_p12_t), 12);
+    KT_CHECK_EQ(sizeof(katherine_px_toa_tot_p12_t), 12);
+    KT_CHECK_EQ(sizeof(katherine_px_f_toa_only_p12_t), 12);
+    KT_CHECK_EQ(sizeof(katherine_px_toa_only_p12_t), 12);
+
+    KT_CHECK_EQ(run_stream_buffered(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_PACKED16, &probe), 0);
+    check_batched_probe(&probe);
+
+    KT_CHECK_EQ(run_stream_buffered(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_PACKED12, &probe), 0);
+    check_batched_probe(&probe);
+}
+
+/* ------------------------------------------------------------------ */
+/* g) Every kernel maps a run of pixels exactly as the scalar one does. */
+
+/* Longer than a few iterations of either vector loop, and every length up
+   to it is tried, so that each kernel ends with each possible scalar tail. */
+#define RUN_MAX 19
+
+/* Fills a run with pixels whose fields are all varied, including the bits
+   around the fields, which the kernels must mask off. */
+static void
+make_random_run(unsigned char *stream, size_t count, uint32_t *seed)
+{
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t md = 0;
+        for (int b = 0; b < 4; ++b) {
+            *seed = *seed * 1103515245u + 12345u;
+            md    = (md << 16) | (*seed >> 16);
+        }
+        store_md(stream, i, INSERT(md, md, header, (uint64_t) MD_HDR_PIXEL));
+    }
+}
+
+#define DEFINE_RUN_CHECK(SUFFIX, EQUAL) \
+    static void \
+    check_run_##SUFFIX(md_simd_level_t level, const unsigned char *stream, size_t count, const katherine_acquisition_t *acq) \
+    { \
+        katherine_px_##SUFFIX##_t expected[RUN_MAX], actual[RUN_MAX]; \
+        pmd_##SUFFIX##_run(expected, (const char *) stream, count, acq); \
+        pmd_##SUFFIX##_run_at(level, actual, (const char *) stream, count, acq); \
+        for (size_t i = 0; i < count; ++i) { \
+            const katherine_px_##SUFFIX##_t *e = expected + i, *a = actual + i; \
+            KT_CHECK(e->coord.x == a->coord.x && e->coord.y == a->coord.y && e->toa == a->toa && (EQUAL)); \
+        } \
+    }
+
+DEFINE_RUN_CHECK(f_toa_tot, e->ftoa == a->ftoa && e->tot == a->tot)
+DEFINE_RUN_CHECK(toa_tot, e->hit_count == a->hit_count && e->tot == a->tot)
+DEFINE_RUN_CHECK(f_toa_only, e->ftoa == a->ftoa)
+DEFINE_RUN_CHECK(toa_only, e->hit_count == a->hit_count)
+
+static void
+test_vectorized_runs(void)
+{
+    /* The kernels read the acquisition for the ToA offset and the shift of
+       the timestamp unit only; both units are tried. */
+    katherine_acquisition_t acq;
+    memset(&acq, 0, sizeof(acq));
+    acq.last_toa_offset = 12345 * TOA_WINDOW;
+
+    /* Runs are placed at the end of the stream, which leaves only the slack
+       the scalar mapping needs (it reads the last datum as a whole word), so
+       that a vector load past the run would be caught by a sanitizer. */
+    unsigned char stream[RUN_MAX * KATHERINE_MD_SIZE + sizeof(uint64_t) - KATHERINE_MD_SIZE];
+    uint32_t seed = 42;
+
+    for (int unit = KATHERINE_TIMESTAMP_TOA; unit <= KATHERINE_TIMESTAMP_FINE; ++unit) {
+        KT_CHECK_EQ(katherine_acquisition_set_timestamp_unit(&acq, (katherine_timestamp_unit_t) unit), 0);
+
+        for (int level = MD_SIMD_SCALAR; level <= (int) md_simd_detect(); ++level) {
+            for (size_t count = 0; count <= RUN_MAX; ++count) {
+                make_random_run(stream + (RUN_MAX - count) * KATHERINE_MD_SIZE, count, &seed);
+                const unsigned char *run = stream + (RUN_MAX - count) * KATHERINE_MD_SIZE;
+
+                check_run_f_toa_tot((md_simd_level_t) level, run, count, &acq);
+                check_run_toa_tot((md_simd_level_t) level, run, count, &acq);
+                check_run_f_toa_only((md_simd_level_t) level, run, count, &acq);
+                check_run_toa_only((md_simd_level_t) level, run, count, &acq);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* h) A leased read hands out every datagram, and waits for leases.    */
+
+/* Leases of the pool: fewer than the datagrams of the stream, so that the
+   read runs out of them and has to wait for the releaser below, which holds
+   on to every lease for a while first. */
+#define LEASE_POOL    2
+#define LEASE_HOLD_US 2000
+
+typedef struct lease_probe {
+    katherine_acquisition_t *acq;
+    const unsigned char *stream;
+    const size_t *datagram_len;
+    size_t datagrams;
+
+    size_t received; /* datagrams passed to data_leased */
+    size_t offset;   /* of the next one in the stream */
+
+    /* Leases yet to be released, oldest first, shared with the releaser. */
+    pthread_mutex_t mutex;
+    katherine_md_lease_t *held[LEASE_POOL];
+    size_t held_count;
+    bool done;
+} lease_probe_t;
+
+static void
+on_data_leased(void *ctx, katherine_md_lease_t *lease)
+{
+    lease_probe_t *probe = (lease_probe_t *) ctx;
+
+    KT_REQUIRE(probe->received < probe->datagrams);
+    KT_CHECK_EQ(lease->length, probe->datagram_len[probe->received]);
+    KT_CHECK_MEM_EQ(lease->data, probe->stream + probe->offset, lease->length);
+    probe->offset += probe->datagram_len[probe->received];
+
+    pthread_mutex_lock(&probe->mutex);
+    KT_REQUIRE(probe->held_count < LEASE_POOL);
+    probe->held[probe->held_count++] = lease;
+    pthread_mutex_unlock(&probe->mutex);
+
+    /* Raw data are not parsed, so the stream is ended as an abort would. */
+    if (++probe->received == probe->datagrams) {
+        probe->acq->aborted = true;
+    }
+}
+
+static void *
+release_leases(void *arg)
+{
+    lease_probe_t *probe = (lease_probe_t *) arg;
+
+    for (;;) {
+        katherine_md_lease_t *lease = NULL;
+        bool done;
+
+        pthread_mutex_lock(&probe->mutex);
+        if (probe->held_count > 0) {
+            lease = probe->held[0];
+            memmove(probe->held, probe->held + 1, --probe->held_count * sizeof(probe->held[0]));
+        }
+        done = probe->done;
+        pthread_mutex_unlock(&probe->mutex);
+
+        if (lease != NULL) {
+            usleep(LEASE_HOLD_US);
+            katherine_acquisition_release_lease(probe->acq, lease);
+        } else if (done) {
+            return NULL;
+        } else {
+            usleep(LEASE_HOLD_US / 10);
+        }
+    }
+}
+
+static void
+test_leased_datagrams(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+
+    katherine_device_t dev;
+    memset(&dev, 0, sizeof(dev));
+
+    struct sockaddr_in bound;
+    KT_REQUIRE(open_data_socket(&dev, &bound) == 0);
+
+    lease_probe_t probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.stream       = stream;
+    probe.datagram_len = datagram_len;
+    probe.datagrams    = datagrams;
+    pthread_mutex_init(&probe.mutex, NULL);
+
+    katherine_acquisition_t acq;
+    memset(&acq, 0, sizeof(acq));
+    KT_REQUIRE(katherine_acquisition_init(&acq, &dev, &probe, MD_BUFFER_BATCHED,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0, FAIL_TIMEOUT_MS) == 0);
+    probe.acq = &acq;
+
+    acq.handlers.data_leased = on_data_leased;
+    KT_CHECK_EQ(katherine_acquisition_set_md_pool(&acq, LEASE_POOL), 0);
+
+    /* As in run_stream_buffered(), but the data are passed on raw. */
+    acq.state             = ACQUISITION_RUNNING;
+    acq.acq_mode          = ACQUISITION_MODE_TOA_TOT;
+    acq.decode_data       = false;
+    acq.requested_frames  = 1;
+    acq.acq_start_time    = time(NULL);
+    acq.acq_start_time_ns = katherine_clock_ns();
+
+    pthread_t releaser;
+    KT_REQUIRE(pthread_create(&releaser, NULL, release_leases, &probe) == 0);
+
+    send_stream(&bound, stream, datagram_len, datagrams);
+    KT_CHECK_EQ(katherine_acquisition_read(&acq), 0);
+
+    /* The releaser gives back what the application still holds. */
+    pthread_mutex_lock(&probe.mutex);
+    probe.done = true;
+    pthread_mutex_unlock(&probe.mutex);
+    KT_CHECK(pthread_join(releaser, NULL) == 0);
+
+    KT_CHECK_EQ(acq.state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe.received, datagrams);
+
+    katherine_md_pool_stats_t stats;
+    katherine_acquisition_get_md_pool_stats(&acq, &stats);
+    KT_CHECK_EQ(stats.capacity, LEASE_POOL);
+    KT_CHECK_EQ(stats.leased, 0);
+    KT_CHECK(stats.stalls >= 1);
+
+    /* With every lease back, the pool can go. */
+    KT_CHECK_EQ(katherine_acquisition_set_md_pool(&acq, 0), 0);
+
+    katherine_acquisition_fini(&acq);
+    katherine_udp_fini(&dev.data_socket);
+    pthread_mutex_destroy(&probe.mutex);
+}
+
+/* ------------------------------------------------------------------ */
+/* i) A step-wise read decodes exactly what the blocking read does.    */
+
+/* Datagrams per step: fewer than the stream holds, so that it takes
+   several steps to drain the socket. */
+#define PUMP_DATAGRAMS 3
+
+/* Reads an acquisition step by step, as an event loop would: pumps the data
+   socket whenever it is readable, and polls the timeouts whenever it has
+   been quiet for as long as the blocking read waits before it does. */
+static int
+read_pumped(katherine_acquisition_t *acq)
+{
+    struct pollfd pfd = {.fd = katherine_acquisition_get_fd(acq), .events = POLLIN};
+    int steps         = 0;
+
+    while (acq->state == ACQUISITION_RUNNING) {
+        int ready = poll(&pfd, 1, RECV_TIMEOUT_MS);
+        KT_CHECK(ready >= 0);
+        if (ready < 0) break;
+
+        int res = ready > 0 ? katherine_acquisition_pump(acq, PUMP_DATAGRAMS) : katherine_acquisition_poll_timeouts(acq);
+        KT_CHECK_EQ(res, 0);
+        if (res != 0) break;
+        ++steps;
+    }
+
+    KT_CHECK(steps > 1);
+    return katherine_acquisition_finish(acq);
+}
+
+static void
+test_pumped_datagrams(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, read_pumped, &probe), 0);
+    check_batched_probe(&probe);
+}
+
+/* ------------------------------------------------------------------ */
+/* j) A parallel decode delivers exactly what the serial one does.     */
+
+/* Threads decoding the stream: fewer than the datagrams of a batch, so that
+   every thread decodes several of them, the reader included. */
+#define DECODE_THREADS 3
+
+static int
+read_parallel(katherine_acquisition_t *acq)
+{
+    int res = katherine_acquisition_set_decode_threads(acq, DECODE_THREADS);
+    KT_CHECK_EQ(res, 0);
+    if (res != 0) return res;
+
+    return katherine_acquisition_read(acq);
+}
+
+static void
+test_parallel_decode(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+    decode_probe_t probe;
+
+    KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, read_parallel, &probe), 0);
+    check_batched_probe(&probe);
+
+    KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, PIPELINE_DEPTH, KATHERINE_PX_LAYOUT_STRUCTS, read_parallel, &probe), 0);
+    check_batched_probe(&probe);
+
+    /* The layouts the workers do not produce fall back to the serial decoder. */
+    KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_PACKED12, read_parallel, &probe), 0);
+    check_batched_probe(&probe);
+}
+
+/* The cases below run every feature both ways: each one prepares an
+   acquisition for the read (enables the feature, sets its handlers, clears
+   its own probe), and checks what a read delivered. */
+typedef int (*read_setup_fn)(katherine_acquisition_t *acq);
+typedef void (*read_check_fn)(const decode_probe_t *probe);
+
+static read_setup_fn read_setup;
+
+static int
+read_serial_set_up(katherine_acquisition_t *acq)
+{
+    int res = read_setup(acq);
+    KT_CHECK_EQ(res, 0);
+    if (res != 0) return res;
+
+    return katherine_acquisition_read(acq);
+}
+
+static int
+read_parallel_set_up(katherine_acquisition_t *acq)
+{
+    int res = katherine_acquisition_set_decode_threads(acq, DECODE_THREADS);
+    KT_CHECK_EQ(res, 0);
+    if (res != 0) return res;
+
+    return read_serial_set_up(acq);
+}
+
+/* Runs an acquisition over the stream twice, decoded serially and by
+   DECODE_THREADS threads, each read prepared by `setup` and checked by
+   `check`. */
+static void
+run_serial_and_parallel(const unsigned char *stream, const size_t *datagram_len, size_t datagrams, int frames,
+    read_setup_fn setup, read_check_fn check)
+{
+    int (*reads[])(katherine_acquisition_t *) = {read_serial_set_up, read_parallel_set_up};
+
+    read_setup = setup;
+    for (size_t r = 0; r < sizeof(reads) / sizeof(reads[0]); ++r) {
+        decode_probe_t probe;
+        KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, frames, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, reads[r], &probe), 0);
+        check(&probe);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* k) Fine timestamps count from the frame start the device reports.   */
+
+/* Frame starts in ToA ticks, the second beyond 32 bits, and the hits. */
+#define FINE_START1 0x00000000DEADBEEFull
+#define FINE_START2 0x0000000123456789ull
+#define FINE_HITS   3
+
+/* Fine ticks per coarse tick. */
+#define FINE_PER_TOA 16u
+
+static int
+setup_fine(katherine_acquisition_t *acq)
+{
+    return katherine_acquisition_set_timestamp_unit(acq, KATHERINE_TIMESTAMP_FINE);
+}
+
+/* Reads with the fine unit forced past the setters, which refuse it in the
+   packed 12-byte layout of the read. */
+static int
+read_fine_forced(katherine_acquisition_t *acq)
+{
+    acq->timestamp_unit = KATHERINE_TIMESTAMP_FINE;
+    acq->toa_shift      = 4;
+    return katherine_acquisition_read(acq);
+}
+
+static void
+check_fine(const decode_probe_t *probe)
+{
+    const uint64_t expected[FINE_HITS] = {
+        (FINE_START1 + FRAME1_TOA) * FINE_PER_TOA,
+        (FINE_START1 + FRAME1_OFFSET * TOA_WINDOW + FRAME1_TOA) * FINE_PER_TOA,
+        (FINE_START2 + FRAME2_TOA) * FINE_PER_TOA,
+    };
+
+    KT_CHECK_EQ(probe->state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe->completed_frames, 2);
+    KT_REQUIRE(probe->hits == FINE_HITS);
+    for (size_t i = 0; i < FINE_HITS; ++i) {
+        KT_CHECK_EQ(probe->toa[i], expected[i]);
+    }
+}
+
+static void
+test_fine_timestamps(void)
+{
+    /* Two frames of the sequential readout, each reporting its start in two
+       halves (the lower one last in the second frame, which has to come out
+       the same), and an offset in the first one. One datum per datagram, so
+       that the parallel decoder gets batches of several. */
+    unsigned char stream[14 * KATHERINE_MD_SIZE];
+    size_t datagram_len[14];
+    size_t n = 0;
+    store_md(stream, n++, make_new_frame());
+    store_md(stream, n++, make_start_time_lsb((uint32_t) FINE_START1));
+    store_md(stream, n++, make_start_time_msb((uint16_t) (FINE_START1 >> 32)));
+    store_md(stream, n++, make_pixel(0, 0, FRAME1_TOA));
+    store_md(stream, n++, make_time_offset(FRAME1_OFFSET));
+    store_md(stream, n++, make_pixel(1, 0, FRAME1_TOA));
+    store_md(stream, n++, make_frame_finished(2));
+    store_md(stream, n++, make_new_frame());
+    store_md(stream, n++, make_start_time_msb((uint16_t) (FINE_START2 >> 32)));
+    store_md(stream, n++, make_start_time_lsb((uint32_t) FINE_START2));
+    store_md(stream, n++, make_pixel(2, 0, FRAME2_TOA));
+    store_md(stream, n++, make_frame_finished(1));
+    for (size_t i = 0; i < n; ++i) {
+        datagram_len[i] = KATHERINE_MD_SIZE;
+    }
+
+    run_serial_and_parallel(stream, datagram_len, n, 2, setup_fine, check_fine);
+
+    /* The fast VCO modes subtract the fToA, in sixteenths of a coarse tick. */
+    katherine_acquisition_t acq;
+    memset(&acq, 0, sizeof(acq));
+    KT_CHECK_EQ(katherine_acquisition_set_timestamp_unit(&acq, KATHERINE_TIMESTAMP_FINE), 0);
+    acq.last_toa_offset = FINE_START1 * FINE_PER_TOA;
+
+    uint64_t md = make_pixel(5, 6, FRAME1_TOA);
+    md          = INSERT(md, pmd_f_toa_tot, ftoa, (uint64_t) 7);
+    katherine_px_f_toa_tot_t px;
+    pmd_f_toa_tot_map(&px, &md, &acq);
+    KT_CHECK_EQ(px.toa, (FINE_START1 + FRAME1_TOA) * FINE_PER_TOA - 7);
+    KT_CHECK_EQ(px.ftoa, 7);
+
+    KT_CHECK_EQ(katherine_acquisition_set_timestamp_unit(&acq, (katherine_timestamp_unit_t) 2), EINVAL);
+
+    /* The fine unit does not fit the 48 bits of the packed 12-byte records,
+       whichever is chosen first. */
+    KT_CHECK_EQ(katherine_acquisition_set_px_layout(&acq, KATHERINE_PX_LAYOUT_PACKED12), EINVAL);
+    KT_CHECK_EQ(katherine_acquisition_set_px_layout(&acq, KATHERINE_PX_LAYOUT_PACKED16), 0);
+    KT_CHECK_EQ(katherine_acquisition_set_timestamp_unit(&acq, KATHERINE_TIMESTAMP_TOA), 0);
+    KT_CHECK_EQ(katherine_acquisition_set_px_layout(&acq, KATHERINE_PX_LAYOUT_PACKED12), 0);
+    KT_CHECK_EQ(katherine_acquisition_set_timestamp_unit(&acq, KATHERINE_TIMESTAMP_FINE), EINVAL);
+    KT_CHECK_EQ(acq.px_layout, KATHERINE_PX_LAYOUT_PACKED12);
+    KT_CHECK_EQ(acq.timestamp_unit, KATHERINE_TIMESTAMP_TOA);
+
+    /* Nor does a read decode them with the pair set behind their back. */
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_read(stream, datagram_len, n, 2, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_PACKED12, read_fine_forced, &probe), EINVAL);
+    KT_CHECK_EQ(probe.hits, 0);
+}
+
+/* ------------------------------------------------------------------ */
+/* l) The performance counters add up to the stream.                   */
+
+static void
+test_acquisition_stats(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+    decode_probe_t probe;
+
+    KT_CHECK_EQ(run_stream_buffered(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, &probe), 0);
+    check_batched_probe(&probe);
+
+    /* The datagram behind the frame finished may or may not be received. */
+    const katherine_acquisition_stats_t *stats = &probe.stats;
+    size_t bytes = 0, max = 0;
+    for (size_t i = 0; i < datagrams - 1; ++i) {
+        bytes += datagram_len[i];
+        if (datagram_len[i] > max) max = datagram_len[i];
+    }
+
+    KT_CHECK(stats->datagrams == datagrams - 1 || stats->datagrams == datagrams);
+    KT_CHECK(stats->bytes == bytes || stats->bytes == bytes + datagram_len[datagrams - 1]);
+    KT_CHECK_EQ(stats->max_datagram_size, max);
+    KT_CHECK(stats->mean_datagram_size == (double) stats->bytes / (double) stats->datagrams);
+
+    KT_CHECK_EQ(stats->md_by_header[MD_HDR_PIXEL], BATCH_DATAGRAMS * BATCH_HITS);
+    KT_CHECK_EQ(stats->md_by_header[MD_HDR_NEW_FRAME], 1);
+    KT_CHECK_EQ(stats->md_by_header[MD_HDR_TIME_OFFSET], 1);
+    KT_CHECK_EQ(stats->md_by_header[MD_HDR_FRAME_FINISHED], 1);
+
+    /* The pixel buffer holds every hit, so it is delivered once, at the end
+       of the frame; the handlers ran, and so did the decoder. */
+    KT_CHECK_EQ(stats->flushes_full, 0);
+    KT_CHECK_EQ(stats->flushes_report_timeout, 0);
+    KT_CHECK_EQ(stats->flushes_frame_end, 1);
+    KT_CHECK(stats->callback_ns > 0);
+    KT_CHECK(stats->decode_ns > 0);
+}
+
+/* ------------------------------------------------------------------ */
+/* m) The maps of a frame add up its hits, and outlive the next one.   */
+
+#define MAPS_AT(x, y) ((size_t) (y) * KATHERINE_FRAME_MAP_WIDTH + (x))
+
+/* What the frame_ended handler saw of the maps of each frame. */
+typedef struct maps_probe {
+    const katherine_frame_maps_t *maps[2];
+    uint32_t counts_12[2];
+    uint32_t counts_56[2];
+    uint32_t tot_12[2];
+    uint64_t pixels[2];
+    bool first_kept; /* the maps of the first frame, unchanged at the end of the second */
+} maps_probe_t;
+
+static maps_probe_t maps_probe;
+
+static void
+on_frame_mapped(void *ctx, int frame_idx, bool completed, const katherine_frame_info_t *info)
+{
+    on_frame_ended(ctx, frame_idx, completed, info);
+
+    KT_REQUIRE(frame_idx < 2 && info->maps != NULL);
+    maps_probe.maps[frame_idx]      = info->maps;
+    maps_probe.counts_12[frame_idx] = info->maps->counts[MAPS_AT(1, 2)];
+    maps_probe.counts_56[frame_idx] = info->maps->counts[MAPS_AT(5, 6)];
+    maps_probe.tot_12[frame_idx]    = info->maps->integrated_tot[MAPS_AT(1, 2)];
+    maps_probe.pixels[frame_idx]    = info->maps->pixels;
+
+    if (frame_idx == 1) {
+        maps_probe.first_kept = maps_probe.maps[0] != info->maps && maps_probe.maps[0]->counts[MAPS_AT(1, 2)] == maps_probe.counts_12[0] && maps_probe.maps[0]->pixels == maps_probe.pixels[0];
+    }
+}
+
+static int
+setup_mapped(katherine_acquisition_t *acq)
+{
+    memset(&maps_probe, 0, sizeof(maps_probe));
+    acq->handlers.frame_ended = on_frame_mapped;
+    return katherine_acquisition_set_frame_maps(acq, true);
+}
+
+static void
+check_mapped(const decode_probe_t *probe)
+{
+    KT_CHECK_EQ(probe->completed_frames, 2);
+
+    /* make_pixel() gives every hit a ToT of 100. */
+    KT_CHECK_EQ(maps_probe.pixels[0], 4);
+    KT_CHECK_EQ(maps_probe.counts_12[0], 3);
+    KT_CHECK_EQ(maps_probe.counts_56[0], 1);
+    KT_CHECK_EQ(maps_probe.tot_12[0], 300);
+
+    /* The second frame starts from clear maps of its own. */
+    KT_CHECK_EQ(maps_probe.pixels[1], 1);
+    KT_CHECK_EQ(maps_probe.counts_12[1], 1);
+    KT_CHECK_EQ(maps_probe.counts_56[1], 0);
+    KT_CHECK_EQ(maps_probe.tot_12[1], 100);
+    KT_CHECK(maps_probe.first_kept);
+}
+
+static void
+test_frame_maps(void)
+{
+    /* Three hits at (1, 2) and one at (5, 6) in the first frame, one at
+       (1, 2) in the second; one datum per datagram, so that the parallel
+       decoder gets batches of several. */
+    const uint64_t mds[] = {
+        make_new_frame(),
+        make_pixel(1, 2, 0x10),
+        make_pixel(5, 6, 0x11),
+        make_pixel(1, 2, 0x12),
+        make_pixel(1, 2, 0x13),
+        make_frame_finished(4),
+        make_new_frame(),
+        make_pixel(1, 2, 0x20),
+        make_frame_finished(1),
+    };
+    const size_t n = sizeof(mds) / sizeof(mds[0]);
+
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    size_t datagram_len[sizeof(mds) / sizeof(mds[0])];
+    for (size_t i = 0; i < n; ++i) {
+        store_md(stream, i, mds[i]);
+        datagram_len[i] = KATHERINE_MD_SIZE;
+    }
+
+    run_serial_and_parallel(stream, datagram_len, n, 2, setup_mapped, check_mapped);
+}
+
+/* ------------------------------------------------------------------ */
+/* n) Clusters close as their hits fall behind, or as the frame ends.  */
+
+#define CLUSTERS_MAX 8
+
+typedef struct clusters_probe {
+    katherine_cluster_t clusters[CLUSTERS_MAX];
+    size_t count;
+    size_t before_frame_end; /* clusters received before the frame ended */
+} clusters_probe_t;
+
+static clusters_probe_t clusters_probe;
+
+static void
+on_clusters_received(void *ctx, const katherine_cluster_t *clusters, size_t count)
+{
+    (void) ctx;
+    for (size_t i = 0; i < count && clusters_probe.count < CLUSTERS_MAX; ++i) {
+        clusters_probe.clusters[clusters_probe.count++] = clusters[i];
+    }
+}
+
+static void
+on_frame_clustered(void *ctx, int frame_idx, bool completed, const katherine_frame_info_t *info)
+{
+    on_frame_ended(ctx, frame_idx, completed, info);
+    clusters_probe.before_frame_end = clusters_probe.count;
+}
+
+static int
+setup_clustered(katherine_acquisition_t *acq)
+{
+    const katherine_clustering_t clustering = {10, 4};
+
+    memset(&clusters_probe, 0, sizeof(clusters_probe));
+    acq->handlers.clusters_received = on_clusters_received;
+    acq->handlers.frame_ended       = on_frame_clustered;
+    return katherine_acquisition_set_clustering(acq, &clustering);
+}
+
+static const katherine_cluster_t *
+find_cluster(uint64_t first_toa)
+{
+    for (size_t i = 0; i < clusters_probe.count; ++i) {
+        if (clusters_probe.clusters[i].first_toa == first_toa) return &clusters_probe.clusters[i];
+    }
+    return NULL;
+}
+
+static void
+check_clustered(const decode_probe_t *probe)
+{
+    KT_CHECK_EQ(probe->completed_frames, 1);
+    KT_CHECK_EQ(probe->hits, 6);
+
+    /* All of them before the frame ends, the last one closed by it. */
+    KT_REQUIRE(clusters_probe.count == 3);
+    KT_CHECK_EQ(clusters_probe.before_frame_end, 3);
+
+    const katherine_cluster_t *track = find_cluster(100);
+    KT_REQUIRE(track != NULL);
+    KT_CHECK_EQ(track->size, 4);
+    KT_CHECK_EQ(track->sum_tot, 600);
+    KT_CHECK_EQ(track->last_toa, 104);
+    KT_CHECK(track->min_x == 10 && track->max_x == 13 && track->min_y == 10 && track->max_y == 10);
+    KT_CHECK(track->x > 11.33f && track->x < 11.34f); /* (1000 + 3300 + 1300 + 1200) / 600 */
+    KT_CHECK(track->y == 10.0f);
+
+    const katherine_cluster_t *lone = find_cluster(101);
+    KT_REQUIRE(lone != NULL);
+    KT_CHECK_EQ(lone->size, 1);
+    KT_CHECK_EQ(lone->sum_tot, 50);
+    KT_CHECK(lone->x == 40.0f && lone->y == 40.0f);
+
+    const katherine_cluster_t *late = find_cluster(500);
+    KT_REQUIRE(late != NULL);
+    KT_CHECK_EQ(late->size, 1);
+    KT_CHECK(late->min_x == 10 && late->min_y == 11);
+}
+
+static void
+test_clustering(void)
+{
+    /* A track along y = 10 which starts as two clusters, merged by the
+       pixel between them; a lone hit at (40, 40) meanwhile; and a hit long
+       after, which closes both and starts a cluster of its own even though
+       it neighbours the track. */
+    const uint64_t mds[] = {
+        make_new_frame(),
+        make_pixel_tot(10, 10, 100, 100),
+        make_pixel_tot(11, 10, 102, 300),
+        make_pixel_tot(13, 10, 103, 100),
+        make_pixel_tot(40, 40, 101, 50),
+        make_pixel_tot(12, 10, 104, 100),
+        make_pixel_tot(10, 11, 500, 100),
+        make_frame_finished(6),
+    };
+    const size_t n = sizeof(mds) / sizeof(mds[0]);
+
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    size_t datagram_len[sizeof(mds) / sizeof(mds[0])];
+    for (size_t i = 0; i < n; ++i) {
+        store_md(stream, i, mds[i]);
+        datagram_len[i] = KATHERINE_MD_SIZE;
+    }
+
+    run_serial_and_parallel(stream, datagram_len, n, 1, setup_clustered, check_clustered);
+}
+
+/* ------------------------------------------------------------------ */
+/* o) The hits are delivered in time order, but for the late ones.     */
+
+#define ORDERED_HITS 72
+
+typedef struct order_probe {
+    uint64_t toa[ORDERED_HITS];
+    size_t hits;
+    size_t batches;
+} order_probe_t;
+
+static order_probe_t order_probe;
+
+static void
+on_pixels_ordered(void *ctx, const void *px, size_t count)
+{
+    (void) ctx;
+    ++order_probe.batches;
+    for (size_t i = 0; i < count && order_probe.hits < ORDERED_HITS; ++i) {
+        order_probe.toa[order_probe.hits++] = ((const px_t *) px)[i].toa;
+    }
+}
+
+static int
+setup_reordered(katherine_acquisition_t *acq)
+{
+    const katherine_reordering_t reordering = {20, 128};
+
+    memset(&order_probe, 0, sizeof(order_probe));
+    acq->handlers.pixels_received = on_pixels_ordered;
+    return katherine_acquisition_set_reordering(acq, &reordering);
+}
+
+static void
+check_reordered(const decode_probe_t *probe)
+{
+    KT_CHECK_EQ(probe->completed_frames, 1);
+    KT_REQUIRE(order_probe.hits == PIXEL_BUFFER_HITS + 4);
+
+    /* The first batch up to the window behind its latest hit (252 - 20),
+       in order; the late hit on its own; then, at the frame end, the
+       rest up to the window behind 300, and the last one. */
+    const size_t released = 232 / 4 + 1;
+    bool ordered          = true;
+    for (size_t i = 0; i < released; ++i) {
+        ordered = ordered && order_probe.toa[i] == i * 4;
+    }
+    KT_CHECK(ordered);
+    KT_CHECK_EQ(order_probe.toa[released], 100);
+
+    const uint64_t rest[] = {236, 240, 244, 248, 252, 256, 280, 300};
+    for (size_t i = 0; i < sizeof(rest) / sizeof(rest[0]); ++i) {
+        KT_CHECK_EQ(order_probe.toa[released + 1 + i], rest[i]);
+    }
+
+    KT_CHECK_EQ(order_probe.batches, 4);
+    KT_CHECK_EQ(probe->stats.late_pixels, 1);
+    KT_CHECK_EQ(probe->stats.forced_pixels, 0);
+}
+
+static void
+test_time_ordering(void)
+{
+    /* A pixel buffer of hits swapped pairwise in time, which goes to the
+       ordering as one batch as the next hit arrives; then a hit far behind
+       the ones delivered by then, and three more out of order. */
+    uint64_t mds[1 + PIXEL_BUFFER_HITS + 4 + 1];
+    size_t n = 0;
+
+    mds[n++] = make_new_frame();
+    for (uint16_t i = 0; i < PIXEL_BUFFER_HITS; ++i) {
+        mds[n++] = make_pixel(1, 1, (uint16_t) ((i ^ 1) * 4));
+    }
+    mds[n++] = make_pixel(1, 1, 100);
+    mds[n++] = make_pixel(1, 1, 300);
+    mds[n++] = make_pixel(1, 1, 256);
+    mds[n++] = make_pixel(1, 1, 280);
+    mds[n++] = make_frame_finished(PIXEL_BUFFER_HITS + 4);
+
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    size_t datagram_len[sizeof(mds) / sizeof(mds[0])];
+    for (size_t i = 0; i < n; ++i) {
+        store_md(stream, i, mds[i]);
+        datagram_len[i] = KATHERINE_MD_SIZE;
+    }
+
+    run_serial_and_parallel(stream, datagram_len, n, 1, setup_reordered, check_reordered);
+}
+
+/* ------------------------------------------------------------------ */
+/* p) The filter drops the hits of the pixels it does not pass.        */
+
+static katherine_px_filter_t filter_under_test;
+
+static int
+setup_filtered(katherine_acquisition_t *acq)
+{
+    return katherine_acquisition_set_px_filter(acq, &filter_under_test);
+}
+
+static void
+check_filtered(const decode_probe_t *probe)
+{
+    KT_CHECK_EQ(probe->completed_frames, 1);
+
+    KT_REQUIRE(probe->hits == 3);
+    KT_CHECK(probe->x[0] == 1 && probe->x[1] == 2 && probe->x[2] == 0);
+    KT_CHECK_EQ(probe->toa[1], 0x13);
+    KT_CHECK_EQ(probe->info.received_pixels, 3);
+    KT_CHECK_EQ(probe->info.filtered_pixels, 3);
+    KT_CHECK_EQ(probe->stats.md_by_header[MD_HDR_PIXEL], 6);
+}
+
+static void
+test_px_filter(void)
+{
+    /* The mask bits of a configuration seed the filter. */
+    static katherine_px_config_t px_config;
+    const katherine_coord_t masked = {2, 2}, unmasked = {2, 3};
+    memset(&px_config, 0, sizeof(px_config));
+    katherine_px_config_set_mask_bit(&px_config, masked, true);
+    katherine_px_filter_load_mask(&filter_under_test, &px_config);
+    KT_CHECK(!katherine_px_filter_get(&filter_under_test, masked));
+    KT_CHECK(katherine_px_filter_get(&filter_under_test, unmasked));
+
+    /* Pass a region of interest of columns 0 to 3, save a hot pixel. */
+    const katherine_coord_t from = {0, 0}, to = {3, 255}, hot = {3, 3};
+    katherine_px_filter_fill(&filter_under_test, false);
+    katherine_px_filter_set_rect(&filter_under_test, to, from, true);
+    katherine_px_filter_set(&filter_under_test, hot, false);
+
+    const uint64_t mds[] = {
+        make_new_frame(),
+        make_pixel(1, 1, 0x10),
+        make_pixel(5, 1, 0x11),
+        make_pixel(3, 3, 0x12),
+        make_pixel(2, 9, 0x13),
+        make_pixel(200, 9, 0x14),
+        make_pixel(0, 255, 0x15),
+        make_frame_finished(6),
+    };
+    const size_t n = sizeof(mds) / sizeof(mds[0]);
+
+    /* Whole in one datagram, and one datum per datagram. */
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    size_t whole[1]  = {n * KATHERINE_MD_SIZE};
+    size_t split[sizeof(mds) / sizeof(mds[0])];
+    for (size_t i = 0; i < n; ++i) {
+        store_md(stream, i, mds[i]);
+        split[i] = KATHERINE_MD_SIZE;
+    }
+
+    run_serial_and_parallel(stream, whole, 1, 1, setup_filtered, check_filtered);
+    run_serial_and_parallel(stream, split, n, 1, setup_filtered, check_filtered);
+}
 
 int
 main(void)
 {
     KT_RUN(test_toa_offset_reset);
     KT_RUN(test_partial_datum_ignored);
+    KT_RUN(test_batched_datagrams);
+    KT_RUN(test_pipelined_datagrams);
+    KT_RUN(test_columnar_layout);
+    KT_RUN(test_packed_layouts);
+    KT_RUN(test_vectorized_runs);
+    KT_RUN(test_leased_datagrams);
+    KT_RUN(test_pumped_datagrams);
+    KT_RUN(test_parallel_decode);
+    KT_RUN(test_fine_timestamps);
+    KT_RUN(test_acquisition_stats);
+    KT_RUN(test_frame_maps);
+    KT_RUN(test_clustering);
+    KT_RUN(test_time_ordering);
+    KT_RUN(test_px_filter);
     return kt_summary();
 }
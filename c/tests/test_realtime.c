@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief Real-time tuning of the thread reading an acquisition.
+ *
+ * The read runs over the batched stream of decode_fixture.h, queued in a
+ * loopback socket, so this program is registered inside the same platform
+ * guard as test_md_decode.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <katherine/acquisition.h>
+
+#include "decode_fixture.h"
+#include "ktest.h"
+
+/* ------------------------------------------------------------------ */
+/* a) A real-time read tunes the receiving thread, and puts it back.   */
+
+static katherine_realtime_t realtime_tuning;
+static katherine_realtime_status_t realtime_status;
+
+static int
+read_realtime(katherine_acquisition_t *acq)
+{
+    int res = katherine_acquisition_set_realtime(acq, &realtime_tuning);
+    KT_CHECK_EQ(res, 0);
+    if (res != 0) return res;
+
+    res = katherine_acquisition_read(acq);
+    katherine_acquisition_get_realtime_status(acq, &realtime_status);
+    return res;
+}
+
+static void
+test_realtime_read(void)
+{
+    unsigned char stream[(BATCH_DATAGRAMS * BATCH_HITS + 5) * KATHERINE_MD_SIZE];
+    size_t datagram_len[BATCH_DATAGRAMS + 4];
+    size_t datagrams = make_batched_stream(stream, datagram_len);
+
+    int policy_before, policy_after;
+    struct sched_param param_before, param_after;
+    KT_REQUIRE(pthread_getschedparam(pthread_self(), &policy_before, &param_before) == 0);
+
+    /* Every CPU, which the kernel narrows down to those the test may run
+       on; the priority and the locks may be refused to an unprivileged
+       user, which the status tells apart. */
+    memset(&realtime_tuning, 0, sizeof(realtime_tuning));
+    memset(realtime_tuning.cpus, 0xff, sizeof(realtime_tuning.cpus));
+    realtime_tuning.priority    = 1;
+    realtime_tuning.lock_memory = true;
+
+    size_t depths[] = {0, PIPELINE_DEPTH};
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+        decode_probe_t probe;
+        KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, depths[d], KATHERINE_PX_LAYOUT_STRUCTS, read_realtime, &probe), 0);
+        check_batched_probe(&probe);
+
+#ifdef __linux__
+        KT_CHECK_EQ(realtime_status.affinity, 0);
+#endif
+        KT_CHECK(realtime_status.priority == 0 || realtime_status.priority == EPERM);
+        KT_CHECK(realtime_status.lock_memory == 0 || realtime_status.lock_memory == EPERM || realtime_status.lock_memory == ENOMEM);
+
+        KT_REQUIRE(pthread_getschedparam(pthread_self(), &policy_after, &param_after) == 0);
+        KT_CHECK_EQ(policy_after, policy_before);
+        KT_CHECK_EQ(param_after.sched_priority, param_before.sched_priority);
+    }
+
+#ifdef __linux__
+    /* A required tuning the host cannot apply fails the read before it
+       starts. */
+    memset(&realtime_tuning, 0, sizeof(realtime_tuning));
+    realtime_tuning.cpus[KATHERINE_CPU_SET_WORDS - 1] = 1ull << 63;
+    realtime_tuning.required                          = true;
+
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_read(stream, datagram_len, datagrams, 1, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, read_realtime, &probe), EINVAL);
+    KT_CHECK_EQ(realtime_status.affinity, EINVAL);
+    KT_CHECK_EQ(probe.state, ACQUISITION_RUNNING);
+#endif
+}
+
+int
+main(void)
+{
+    KT_RUN(test_realtime_read);
+    return kt_summary();
+}
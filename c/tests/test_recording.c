@@ -0,0 +1,221 @@
+/**
+ * @file
+ * @brief Recordings of the raw measurement data of an acquisition.
+ *
+ * The recorded read runs over a stream queued in a loopback socket, through
+ * the fixture of decode_fixture.h, so this program is registered inside the
+ * same platform guard as test_md_decode.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/recording.h>
+#include <katherine/version.h>
+
+#include "decode_fixture.h"
+#include "ktest.h"
+#include "md_stream.h"
+
+/* ------------------------------------------------------------------ */
+/* a) The recording of a read indexes its frames.                      */
+
+static char recording_path[] = "/tmp/katherine-recording-XXXXXX";
+static char mixed_path[] = "/tmp/katherine-mixed-XXXXXX";
+static katherine_recorder_stats_t recorder_stats;
+
+/* The least ring the recorder takes: twice the entry of the largest
+   datagram, its 8-byte header and the datagram padded to a word. */
+#define RECORDER_ENTRY_MAX   (8 + ((KATHERINE_MD_DATAGRAM_MAX_SIZE + 7) & ~7))
+#define RECORDER_BUFFER_SIZE (2 * RECORDER_ENTRY_MAX)
+
+static int
+read_recorded(katherine_acquisition_t *acq)
+{
+    static katherine_config_t config;
+    katherine_recorder_t recorder;
+
+    memset(&config, 0, sizeof(config));
+    config.bias = 42.0f;
+
+    int res = katherine_recorder_open(&recorder, recording_path, &config, READOUT_DATA_DRIVEN, ACQUISITION_MODE_TOA_TOT, false, RECORDER_BUFFER_SIZE);
+    KT_CHECK_EQ(res, 0);
+    if (res != 0) return res;
+
+    res = katherine_acquisition_set_recorder(acq, &recorder);
+    KT_CHECK_EQ(res, 0);
+    res = katherine_acquisition_read(acq);
+
+    /* The thread of the recorder writes behind the read. */
+    for (int waited = 0; waited < 1000; ++waited) {
+        katherine_recorder_get_stats(&recorder, &recorder_stats);
+        if (recorder_stats.datagrams == acq->stats.datagrams) break;
+        usleep(1000);
+    }
+    KT_CHECK_EQ(katherine_recorder_close(&recorder), 0);
+    return res;
+}
+
+static void
+test_recording(void)
+{
+    const uint64_t mds[] = {
+        make_new_frame(),
+        make_start_time_lsb(0x1234),
+        make_pixel(1, 1, 0x10),
+        make_frame_finished(1),
+        make_new_frame(),
+        make_pixel(2, 2, 0x20),
+        make_pixel(3, 3, 0x21),
+        make_frame_finished(2),
+    };
+    const size_t n = sizeof(mds) / sizeof(mds[0]);
+
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    size_t split[sizeof(mds) / sizeof(mds[0])];
+    for (size_t i = 0; i < n; ++i) {
+        store_md(stream, i, mds[i]);
+        split[i] = KATHERINE_MD_SIZE;
+    }
+
+    int fd = mkstemp(recording_path);
+    KT_REQUIRE(fd >= 0);
+    close(fd);
+
+    decode_probe_t probe;
+    KT_CHECK_EQ(run_stream_read(stream, split, n, 2, MD_BUFFER_BATCHED, 0, KATHERINE_PX_LAYOUT_STRUCTS, read_recorded, &probe), 0);
+    KT_CHECK_EQ(probe.completed_frames, 2);
+    KT_CHECK_EQ(probe.hits, 3);
+    KT_CHECK_EQ(recorder_stats.datagrams, n);
+    KT_CHECK_EQ(recorder_stats.frames, 2);
+
+    katherine_recording_t recording;
+    KT_REQUIRE(katherine_recording_open(&recording, recording_path) == 0);
+    KT_CHECK_EQ(recording.header.readout_mode, READOUT_DATA_DRIVEN);
+    KT_CHECK_EQ(recording.header.acq_mode, ACQUISITION_MODE_TOA_TOT);
+    KT_CHECK_EQ(recording.header.library_version, katherine_version());
+    KT_CHECK(recording.header.config.bias == 42.0f);
+    KT_CHECK_EQ(recording.datagrams, n);
+
+    /* Each frame spans its records, back to back. */
+    KT_REQUIRE(recording.frame_count == 2);
+    KT_CHECK_EQ(recording.frames[0].start_offset, recording.header.header_size);
+    KT_CHECK_EQ(recording.frames[0].end_offset, recording.frames[1].start_offset);
+    KT_CHECK_EQ(recording.frames[1].end_offset, recording.index_offset);
+    KT_CHECK_EQ(recording.frames[0].start_time.b.lsb, 0x1234);
+    KT_CHECK(recording.frames[0].completed && recording.frames[1].completed);
+    KT_CHECK_EQ(recording.frames[1].sent_pixels, 2);
+
+    /* The second frame reads from its new frame datum to the end. */
+    char datagram[KATHERINE_MD_DATAGRAM_MAX_SIZE];
+    size_t length, records = 0;
+    uint64_t md = 0;
+    KT_CHECK_EQ(katherine_recording_seek_frame(&recording, 2), EINVAL);
+    KT_CHECK_EQ(katherine_recording_seek_frame(&recording, 1), 0);
+    KT_CHECK_EQ(katherine_recording_next(&recording, datagram, sizeof(datagram), &length), 0);
+    KT_CHECK_EQ(length, KATHERINE_MD_SIZE);
+    memcpy(&md, datagram, KATHERINE_MD_SIZE);
+    KT_CHECK_EQ(EXTRACT(md, md, header), MD_HDR_NEW_FRAME);
+    KT_CHECK_EQ(katherine_recording_next(&recording, datagram, 1, &length), EMSGSIZE);
+
+    KT_CHECK_EQ(katherine_recording_seek_frame(&recording, 1), 0);
+    while (katherine_recording_next(&recording, datagram, sizeof(datagram), &length) == 0 && length > 0) {
+        ++records;
+    }
+    KT_CHECK_EQ(records, 4);
+
+    katherine_recording_close(&recording);
+    remove(recording_path);
+}
+
+/* ------------------------------------------------------------------ */
+/* b) Datagrams of mixed sizes wrap the ring wherever it stands.       */
+
+/* A datagram of the largest size, and one of about half, which leaves the
+   ring where the next large one does not fit before its end. */
+#define MIXED_SMALL     608
+#define MIXED_DATAGRAMS 24
+
+static size_t
+mixed_length(size_t i)
+{
+    return i % 2 == 0 ? MIXED_SMALL : KATHERINE_MD_DATAGRAM_MAX_SIZE;
+}
+
+/* Fills a datagram with hits, each telling the datagram in its ToT, and
+   pads the rest with zeros. */
+static void
+make_mixed(unsigned char *datagram, size_t i)
+{
+    const size_t length = mixed_length(i);
+
+    memset(datagram, 0, length);
+    for (size_t j = 0; j < length / KATHERINE_MD_SIZE; ++j) {
+        store_md(datagram, j, make_pixel_tot((uint8_t) j, 0, 0, (uint16_t) i));
+    }
+}
+
+static void
+test_mixed_datagrams(void)
+{
+    static katherine_config_t config;
+    katherine_recorder_t recorder;
+    unsigned char sent[KATHERINE_MD_DATAGRAM_MAX_SIZE];
+    char read[KATHERINE_MD_DATAGRAM_MAX_SIZE];
+
+    int fd = mkstemp(mixed_path);
+    KT_REQUIRE(fd >= 0);
+    close(fd);
+    memset(&config, 0, sizeof(config));
+
+    /* A ring short of two of the largest entries could wait for room it
+       never has. */
+    KT_CHECK_EQ(katherine_recorder_open(&recorder, mixed_path, &config, READOUT_DATA_DRIVEN, ACQUISITION_MODE_TOA_TOT, false, RECORDER_ENTRY_MAX), EINVAL);
+    KT_CHECK_EQ(katherine_recorder_open(&recorder, mixed_path, &config, READOUT_DATA_DRIVEN, ACQUISITION_MODE_TOA_TOT, false, RECORDER_BUFFER_SIZE - 8), EINVAL);
+
+    KT_REQUIRE(katherine_recorder_open(&recorder, mixed_path, &config, READOUT_DATA_DRIVEN, ACQUISITION_MODE_TOA_TOT, false, RECORDER_BUFFER_SIZE) == 0);
+    for (size_t i = 0; i < MIXED_DATAGRAMS; ++i) {
+        make_mixed(sent, i);
+        KT_CHECK_EQ(katherine_recorder_write(&recorder, (const char *) sent, mixed_length(i)), 0);
+    }
+    KT_CHECK_EQ(katherine_recorder_close(&recorder), 0);
+
+    katherine_recording_t recording;
+    KT_REQUIRE(katherine_recording_open(&recording, mixed_path) == 0);
+    KT_CHECK_EQ(recording.datagrams, MIXED_DATAGRAMS);
+
+    size_t length;
+    for (size_t i = 0; i < MIXED_DATAGRAMS; ++i) {
+        KT_REQUIRE(katherine_recording_next(&recording, read, sizeof(read), &length) == 0);
+        KT_CHECK_EQ(length, mixed_length(i));
+        make_mixed(sent, i);
+        KT_CHECK(memcmp(read, sent, mixed_length(i)) == 0);
+    }
+    KT_CHECK_EQ(katherine_recording_next(&recording, read, sizeof(read), &length), 0);
+    KT_CHECK_EQ(length, 0);
+
+    katherine_recording_close(&recording);
+    remove(mixed_path);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_recording);
+    KT_RUN(test_mixed_datagrams);
+    return kt_summary();
+}
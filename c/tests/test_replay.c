@@ -0,0 +1,178 @@
+/**
+ * @file
+ * @brief Replays of measurement data from memory and from recordings.
+ *
+ * The replays need no socket, but share the probe of decode_fixture.h with
+ * the reads over a loopback socket, so this program is registered inside
+ * the same platform guard as test_md_decode.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/recording.h>
+#include <katherine/replay.h>
+
+#include "decode_fixture.h"
+#include "ktest.h"
+#include "md_stream.h"
+
+/* ------------------------------------------------------------------ */
+/* a) A stream replays alike from memory, recorded, and mapped.        */
+
+static char replay_path[] = "/tmp/katherine-replay-XXXXXX";
+
+/* The least ring the recorder takes: twice the entry of the largest
+   datagram, its 8-byte header and the datagram padded to a word. */
+#define RECORDER_BUFFER_SIZE (2 * (8 + ((KATHERINE_MD_DATAGRAM_MAX_SIZE + 7) & ~7)))
+
+static void
+test_replay(void)
+{
+    const uint64_t mds[] = {
+        make_new_frame(),
+        make_pixel(1, 1, 0x10),
+        make_frame_finished(1),
+        make_new_frame(),
+        make_pixel(2, 2, 0x20),
+        make_pixel(3, 3, 0x21),
+        make_frame_finished(2),
+    };
+    const size_t n = sizeof(mds) / sizeof(mds[0]);
+
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    for (size_t i = 0; i < n; ++i) {
+        store_md(stream, i, mds[i]);
+    }
+
+    /* A raw stream in memory, cut into datagrams of two data. */
+    katherine_replay_source_t source;
+    decode_probe_t probe;
+    KT_REQUIRE(katherine_replay_source_memory(&source, stream, sizeof(stream), 2 * KATHERINE_MD_SIZE, ACQUISITION_MODE_TOA_TOT, false) == 0);
+    KT_CHECK_EQ(run_replay(&source, MD_BUFFER_BATCHED, 0, NULL, &probe), 0);
+    KT_CHECK_EQ(probe.state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe.completed_frames, 2);
+    KT_REQUIRE(probe.hits == 3);
+    KT_CHECK(probe.x[0] == 1 && probe.x[1] == 2 && probe.x[2] == 3);
+    KT_CHECK_EQ(probe.stats.datagrams, 4);
+
+    /* The same stream recorded one datum per datagram. */
+    static katherine_config_t config;
+    katherine_recorder_t recorder;
+    int fd = mkstemp(replay_path);
+    KT_REQUIRE(fd >= 0);
+    close(fd);
+    memset(&config, 0, sizeof(config));
+    KT_REQUIRE(katherine_recorder_open(&recorder, replay_path, &config, READOUT_DATA_DRIVEN, ACQUISITION_MODE_TOA_TOT, false, RECORDER_BUFFER_SIZE) == 0);
+    for (size_t i = 0; i < n; ++i) {
+        KT_CHECK_EQ(katherine_recorder_write(&recorder, (const char *) stream + i * KATHERINE_MD_SIZE, KATHERINE_MD_SIZE), 0);
+    }
+    KT_REQUIRE(katherine_recorder_close(&recorder) == 0);
+
+    /* Read from the second frame on. */
+    katherine_recording_t recording;
+    KT_REQUIRE(katherine_recording_open(&recording, replay_path) == 0);
+    KT_CHECK_EQ(katherine_recording_seek_frame(&recording, 1), 0);
+    KT_REQUIRE(katherine_replay_source_recording(&source, &recording) == 0);
+    KT_CHECK_EQ(run_replay(&source, MD_BUFFER_BATCHED, 0, NULL, &probe), 0);
+    KT_CHECK_EQ(probe.completed_frames, 1);
+    KT_CHECK_EQ(probe.hits, 2);
+    KT_CHECK_EQ(probe.stats.datagrams, 4);
+    katherine_recording_close(&recording);
+
+    /* Mapped, the first frame alone, and all of them. */
+    KT_REQUIRE(katherine_replay_source_map(&source, replay_path, 0, 1) == 0);
+    KT_CHECK_EQ(run_replay(&source, MD_BUFFER_BATCHED, 0, NULL, &probe), 0);
+    KT_CHECK_EQ(probe.completed_frames, 1);
+    KT_CHECK_EQ(probe.hits, 1);
+    katherine_replay_source_unmap(&source);
+
+    KT_REQUIRE(katherine_replay_source_map(&source, replay_path, 0, 0) == 0);
+    KT_CHECK_EQ(run_replay(&source, MD_BUFFER_BATCHED, 0, NULL, &probe), 0);
+    KT_CHECK_EQ(probe.completed_frames, 2);
+    KT_CHECK_EQ(probe.hits, 3);
+    katherine_replay_source_unmap(&source);
+
+    KT_CHECK_EQ(katherine_replay_source_map(&source, replay_path, 1, 2), EINVAL);
+    remove(replay_path);
+}
+
+/* ------------------------------------------------------------------ */
+/* b) Datagrams longer than the slots of a small buffer are cut.       */
+
+/* A buffer of one slot of 100 data, well short of a whole datagram, and
+   a stream of whole datagrams: one frame, its hits in between. */
+#define SMALL_MD_BUFFER     600
+#define SMALL_THREADS       2
+#define SMALL_DATAGRAMS     70
+#define SMALL_MDS           (SMALL_DATAGRAMS * KATHERINE_MD_DATAGRAM_MAX_SIZE / KATHERINE_MD_SIZE)
+
+static char small_path[] = "/tmp/katherine-small-XXXXXX";
+
+static void
+test_small_buffer(void)
+{
+    static unsigned char stream[SMALL_MDS * KATHERINE_MD_SIZE];
+
+    store_md(stream, 0, make_new_frame());
+    for (size_t i = 1; i < SMALL_MDS - 1; ++i) {
+        store_md(stream, i, make_pixel((uint8_t) i, (uint8_t) (i >> 8), (uint16_t) i));
+    }
+    store_md(stream, SMALL_MDS - 1, make_frame_finished(SMALL_MDS - 2));
+
+    /* Decoded by threads, which take no datagram longer than a slot. */
+    katherine_replay_source_t source;
+    decode_probe_t probe;
+    KT_REQUIRE(katherine_replay_source_memory(&source, stream, sizeof(stream), 0, ACQUISITION_MODE_TOA_TOT, false) == 0);
+    KT_CHECK_EQ(run_replay(&source, SMALL_MD_BUFFER, SMALL_THREADS, NULL, &probe), 0);
+    KT_CHECK_EQ(probe.state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe.completed_frames, 1);
+    KT_CHECK_EQ(probe.hits, SMALL_MDS - 2);
+    KT_CHECK_EQ(probe.stats.datagrams, (sizeof(stream) + SMALL_MD_BUFFER - 1) / SMALL_MD_BUFFER);
+    KT_CHECK_EQ(probe.info.received_pixels, SMALL_MDS - 2);
+
+    /* A recorded datagram is not cut, but refused. */
+    static katherine_config_t config;
+    katherine_recorder_t recorder;
+    int fd = mkstemp(small_path);
+    KT_REQUIRE(fd >= 0);
+    close(fd);
+    memset(&config, 0, sizeof(config));
+    KT_REQUIRE(katherine_recorder_open(&recorder, small_path, &config, READOUT_DATA_DRIVEN, ACQUISITION_MODE_TOA_TOT, false, RECORDER_BUFFER_SIZE) == 0);
+    KT_CHECK_EQ(katherine_recorder_write(&recorder, (const char *) stream, KATHERINE_MD_DATAGRAM_MAX_SIZE), 0);
+    KT_REQUIRE(katherine_recorder_close(&recorder) == 0);
+
+    katherine_recording_t recording;
+    KT_REQUIRE(katherine_recording_open(&recording, small_path) == 0);
+    KT_REQUIRE(katherine_replay_source_recording(&source, &recording) == 0);
+    KT_CHECK_EQ(run_replay(&source, SMALL_MD_BUFFER, SMALL_THREADS, NULL, &probe), EMSGSIZE);
+    katherine_recording_close(&recording);
+
+    KT_REQUIRE(katherine_replay_source_map(&source, small_path, 0, 0) == 0);
+    KT_CHECK_EQ(run_replay(&source, SMALL_MD_BUFFER, SMALL_THREADS, NULL, &probe), EMSGSIZE);
+    katherine_replay_source_unmap(&source);
+
+    remove(small_path);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_replay);
+    KT_RUN(test_small_buffer);
+    return kt_summary();
+}
@@ -0,0 +1,189 @@
+/**
+ * @file
+ * @brief Sinks writing the data of an acquisition to a file.
+ *
+ * The files are written to temporary paths, and the pixels sunk are those
+ * of replays probed by decode_fixture.h, so this program is registered
+ * inside the same platform guard as test_md_decode.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/replay.h>
+#include <katherine/sink.h>
+
+#include "decode_fixture.h"
+#include "ktest.h"
+#include "md_stream.h"
+
+/* ------------------------------------------------------------------ */
+/* a) A sink writes what it is given whole, raw or as indexed pixels.  */
+
+static char sink_path[] = "/tmp/katherine-sink-XXXXXX";
+
+/* Writes a pattern through a sink in uneven pieces, and checks that the
+   file holds it whole. Returns the error of opening the sink, so that a
+   backend or direct I/O the host lacks can be told apart. */
+static int
+run_sink(const katherine_sink_params_t *params, size_t length)
+{
+    katherine_sink_t sink;
+    katherine_sink_stats_t stats;
+    unsigned char *pattern = (unsigned char *) malloc(length);
+    unsigned char *read    = (unsigned char *) malloc(length + 1);
+    KT_CHECK(pattern != NULL && read != NULL);
+    if (pattern == NULL || read == NULL) return ENOMEM;
+
+    for (size_t i = 0; i < length; ++i) {
+        pattern[i] = (unsigned char) (i * 7 + i / 251);
+    }
+
+    int res = katherine_sink_open(&sink, sink_path, KATHERINE_SINK_RAW, params);
+    if (res == 0) {
+        for (size_t at = 0, piece = 1; at < length; at += piece, piece = piece * 3 % 1499 + 1) {
+            if (piece > length - at) piece = length - at;
+            KT_CHECK_EQ(katherine_sink_write(&sink, pattern + at, piece), 0);
+        }
+
+        katherine_sink_get_stats(&sink, &stats);
+        KT_CHECK(stats.max_queue_depth >= 1);
+        KT_CHECK(stats.max_queue_depth <= (params->buffers > 0 ? params->buffers : 2));
+        KT_CHECK(stats.backend == KATHERINE_SINK_IO_URING || stats.backend == KATHERINE_SINK_THREAD);
+        KT_CHECK(params->backend == KATHERINE_SINK_AUTO || stats.backend == params->backend);
+        KT_CHECK_EQ(katherine_sink_close(&sink), 0);
+
+        FILE *file = fopen(sink_path, "rb");
+        KT_CHECK(file != NULL);
+        if (file != NULL) {
+            KT_CHECK_EQ(fread(read, 1, length + 1, file), length);
+            KT_CHECK(memcmp(read, pattern, length) == 0);
+            fclose(file);
+        }
+    }
+
+    free(read);
+    free(pattern);
+    return res;
+}
+
+static void
+test_sink(void)
+{
+    int fd = mkstemp(sink_path);
+    KT_REQUIRE(fd >= 0);
+    close(fd);
+
+    /* Many buffers' worth, through either backend, and with a deeper
+       queue. */
+    katherine_sink_params_t params = { KATHERINE_SINK_ALIGNMENT, 2, false, KATHERINE_SINK_THREAD };
+    KT_CHECK_EQ(run_sink(&params, 10 * KATHERINE_SINK_ALIGNMENT + 123), 0);
+    params.backend = KATHERINE_SINK_AUTO;
+    params.buffers = 4;
+    KT_CHECK_EQ(run_sink(&params, 10 * KATHERINE_SINK_ALIGNMENT + 123), 0);
+
+    /* The kernel may lack io_uring, or the host forbid it. */
+    params.backend = KATHERINE_SINK_IO_URING;
+    int res        = run_sink(&params, 3 * KATHERINE_SINK_ALIGNMENT + 5);
+    KT_CHECK(res == 0 || res == ENOSYS || res == EPERM || res == ENOTSUP);
+
+    /* Direct I/O pads the last buffer, and cuts the file back, where the
+       file system supports it. */
+    params.backend = KATHERINE_SINK_AUTO;
+    params.direct  = true;
+    res            = run_sink(&params, 3 * KATHERINE_SINK_ALIGNMENT + 5);
+    KT_CHECK(res == 0 || res == EINVAL || res == ENOTSUP);
+
+    params.direct  = false;
+    params.buffers = 1;
+    KT_CHECK_EQ(run_sink(&params, 1), EINVAL);
+
+    /* The pixels of a replay, as the handler receives them. */
+    const uint64_t mds[] = {
+        make_new_frame(),
+        make_pixel(1, 1, 0x10),
+        make_pixel(2, 2, 0x20),
+        make_pixel(3, 3, 0x21),
+        make_frame_finished(3),
+    };
+    unsigned char stream[sizeof(mds) / sizeof(mds[0]) * KATHERINE_MD_SIZE];
+    for (size_t i = 0; i < sizeof(mds) / sizeof(mds[0]); ++i) {
+        store_md(stream, i, mds[i]);
+    }
+
+    katherine_sink_t sink;
+    katherine_sink_stats_t stats;
+    katherine_replay_source_t source;
+    decode_probe_t probe;
+    KT_REQUIRE(katherine_sink_open(&sink, sink_path, KATHERINE_SINK_PIXELS, NULL) == 0);
+    KT_REQUIRE(katherine_replay_source_memory(&source, stream, sizeof(stream), 0, ACQUISITION_MODE_TOA_TOT, false) == 0);
+    KT_CHECK_EQ(run_replay(&source, MD_BUFFER_BATCHED, 0, &sink, &probe), 0);
+    KT_CHECK_EQ(probe.hits, 3);
+    KT_CHECK_EQ(katherine_sink_close(&sink), 0);
+
+    /* The records, padded to a word, the index of the frame and the trailer. */
+    uint64_t recorded[64];
+    FILE *file = fopen(sink_path, "rb");
+    KT_REQUIRE(file != NULL);
+    const size_t padded = (3 * sizeof(px_t) + 7) & ~(size_t) 7;
+    const size_t length = fread(recorded, 1, sizeof(recorded), file);
+    fclose(file);
+    KT_REQUIRE(length == padded + sizeof(katherine_sink_frame_t) + sizeof(katherine_sink_trailer_t));
+
+    const px_t *px = (const px_t *) recorded;
+    KT_CHECK(px[0].coord.x == 1 && px[1].coord.x == 2 && px[2].coord.x == 3);
+    KT_CHECK_EQ(px[2].toa, 0x21);
+
+    katherine_sink_frame_t frame;
+    katherine_sink_trailer_t trailer;
+    memcpy(&frame, (const char *) recorded + padded, sizeof(frame));
+    memcpy(&trailer, (const char *) recorded + padded + sizeof(frame), sizeof(trailer));
+    KT_CHECK(memcmp(trailer.magic, KATHERINE_SINK_TRAILER_MAGIC, sizeof(trailer.magic)) == 0);
+    KT_CHECK_EQ(trailer.index_offset, padded);
+    KT_CHECK_EQ(trailer.pixels, 3);
+    KT_CHECK_EQ(trailer.frames, 1);
+    KT_CHECK_EQ(trailer.record_size, sizeof(px_t));
+    KT_CHECK_EQ(trailer.acq_mode, ACQUISITION_MODE_TOA_TOT);
+    KT_CHECK_EQ(frame.first_pixel, 0);
+    KT_CHECK_EQ(frame.pixels, 3);
+    KT_CHECK_EQ(frame.sent_pixels, 3);
+    KT_CHECK_EQ(frame.completed, 1);
+
+    /* The raw datagrams of the same replay. */
+    KT_REQUIRE(katherine_sink_open(&sink, sink_path, KATHERINE_SINK_RAW, NULL) == 0);
+    KT_REQUIRE(katherine_replay_source_memory(&source, stream, sizeof(stream), 0, ACQUISITION_MODE_TOA_TOT, false) == 0);
+    KT_CHECK_EQ(run_replay(&source, MD_BUFFER_BATCHED, 0, &sink, &probe), 0);
+    katherine_sink_get_stats(&sink, &stats);
+    KT_CHECK_EQ(stats.bytes, 0);
+    KT_CHECK_EQ(katherine_sink_close(&sink), 0);
+
+    unsigned char raw[sizeof(stream) + 1];
+    file = fopen(sink_path, "rb");
+    KT_REQUIRE(file != NULL);
+    KT_CHECK_EQ(fread(raw, 1, sizeof(raw), file), sizeof(stream));
+    KT_CHECK(memcmp(raw, stream, sizeof(stream)) == 0);
+    fclose(file);
+
+    remove(sink_path);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_sink);
+    return kt_summary();
+}
@@ -357,6 +357,49 @@ test_set_remote_moves_pin(void)
     endpoints_fini(&e);
 }
 
+/* h) A batched receive applies the pin to every datagram of the batch: the
+      stray queued between the peer's datagrams is dropped, and the peer's
+      come out in consecutive buffers, in the order they were sent. A
+      platform without a batched receive hands them over one per call, so
+      the batches are collected until the peer's datagrams are all in.     */
+
+static void
+test_pinned_batch_skips_stray(void)
+{
+    endpoints_t e;
+    KT_REQUIRE(endpoints_init(&e, HOST_OTHER, true, TIMEOUT_MS) == 0);
+
+    static const char *const sent[] = {TEXT_HALF, TEXT_WANTED, TEXT_REST};
+
+    send_text(&e.b, sent[0]);
+    send_text(&e.c, TEXT_STRAY);
+    send_text(&e.b, sent[1]);
+    send_text(&e.c, TEXT_STRAY);
+    send_text(&e.b, sent[2]);
+
+    char bufs[4][64];
+    void *const data[4] = {bufs[0], bufs[1], bufs[2], bufs[3]};
+    size_t received[4];
+    size_t got = 0;
+
+    while (got < 3) {
+        size_t count = 4;
+        int res      = katherine_udp_recv_batch(&e.a, data, sizeof(bufs[0]), received, &count);
+
+        KT_CHECK_EQ(res, 0);
+        if (res != 0) break;
+
+        for (size_t i = 0; i < count && got < 3; ++i, ++got) {
+            KT_CHECK_EQ(received[i], strlen(sent[got]));
+            KT_CHECK_MEM_EQ(bufs[i], sent[got], strlen(sent[got]));
+        }
+    }
+
+    expect_timeout(&e.a);
+
+    endpoints_fini(&e);
+}
+
 /* ------------------------------------------------------------------ */
 
 int
@@ -375,6 +418,7 @@ main(void)
         KT_RUN(test_pinned_recv_exact_skips_stray);
         KT_RUN(test_pinned_discard_bound);
         KT_RUN(test_set_remote_moves_pin);
+        KT_RUN(test_pinned_batch_skips_stray);
     } else {
         printf("# SKIP the foreign-host cases: " HOST_OTHER " cannot be bound on this host\n");
     }
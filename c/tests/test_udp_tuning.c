@@ -0,0 +1,222 @@
+/**
+ * @file
+ * @brief Tuning of the data socket, and the datagrams the host drops from it.
+ *
+ * The UDP layer counterpart of test_udp_pinning.c, for the cases that need
+ * more than its public API: the data socket of an acquisition is opened on
+ * loopback by the fixture of decode_fixture.h, and tuned or flooded with
+ * POSIX sockets and threads directly, so this program is registered inside
+ * the same platform guard as test_md_decode.
+ *
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/device.h>
+#include <katherine/udp.h>
+
+#include "clock.h"
+#include "decode_fixture.h"
+#include "ktest.h"
+#include "md_stream.h"
+
+/* ------------------------------------------------------------------ */
+/* a) Datagrams the host drops are counted, apart from lost pixels.    */
+
+/* Datagrams sent ahead of the read, which the socket, shrunk to its
+   smallest receive buffer, cannot all queue; and how long the datagram that
+   ends the frame follows them, by which time the read has drained the
+   queue, so that it is queued and carries the drop counter. */
+#define FLOOD_DATAGRAMS 64
+#define FLOOD_LATE_US   50000
+
+typedef struct flood_sender {
+    const struct sockaddr_in *bound;
+    const unsigned char *datum;
+} flood_sender_t;
+
+static void *
+send_late(void *arg)
+{
+    const flood_sender_t *sender = (const flood_sender_t *) arg;
+    size_t length                = KATHERINE_MD_SIZE;
+
+    usleep(FLOOD_LATE_US);
+    send_stream(sender->bound, sender->datum, &length, 1);
+    return NULL;
+}
+
+static void
+test_host_drops(void)
+{
+    katherine_device_t dev;
+    memset(&dev, 0, sizeof(dev));
+
+    struct sockaddr_in bound;
+    if (open_data_socket(&dev, &bound) != 0) {
+        return;
+    }
+
+    int res = katherine_udp_track_drops(&dev.data_socket);
+    if (res == ENOTSUP) {
+        printf("# SKIP host drops are not reported on this platform\n");
+        katherine_udp_fini(&dev.data_socket);
+        return;
+    }
+    KT_CHECK_EQ(res, 0);
+
+    int rcvbuf = 1; /* raised to the smallest the kernel allows */
+    KT_CHECK_EQ(setsockopt(dev.data_socket.sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)), 0);
+
+    /* A new frame, then a hit per datagram. */
+    unsigned char stream[FLOOD_DATAGRAMS * KATHERINE_MD_SIZE];
+    size_t datagram_len[FLOOD_DATAGRAMS];
+    store_md(stream, 0, make_new_frame());
+    datagram_len[0] = KATHERINE_MD_SIZE;
+    for (size_t i = 1; i < FLOOD_DATAGRAMS; ++i) {
+        store_md(stream, i, make_pixel((uint8_t) i, 0, (uint16_t) i));
+        datagram_len[i] = KATHERINE_MD_SIZE;
+    }
+
+    unsigned char finished[KATHERINE_MD_SIZE + sizeof(uint64_t)];
+    store_md(finished, 0, make_frame_finished(FLOOD_DATAGRAMS - 1));
+
+    decode_probe_t probe;
+    memset(&probe, 0, sizeof(probe));
+
+    katherine_acquisition_t acq;
+    memset(&acq, 0, sizeof(acq));
+    res = katherine_acquisition_init(&acq, &dev, &probe, MD_BUFFER_BATCHED,
+        PIXEL_BUFFER_HITS * sizeof(px_t), 0 /* report_timeout disabled */, FAIL_TIMEOUT_MS);
+    KT_REQUIRE(res == 0);
+
+    acq.handlers.frame_started   = on_frame_started;
+    acq.handlers.frame_ended     = on_frame_ended;
+    acq.handlers.pixels_received = on_pixels_received;
+
+    /* As in run_stream_read() of decode_fixture.h. */
+    acq.state             = ACQUISITION_RUNNING;
+    acq.acq_mode          = ACQUISITION_MODE_TOA_TOT;
+    acq.decode_data       = true;
+    acq.requested_frames  = 1;
+    acq.acq_start_time    = time(NULL);
+    acq.acq_start_time_ns = katherine_clock_ns();
+
+    send_stream(&bound, stream, datagram_len, FLOOD_DATAGRAMS);
+
+    pthread_t sender;
+    flood_sender_t late = {&bound, finished};
+    KT_REQUIRE(pthread_create(&sender, NULL, send_late, &late) == 0);
+    res = katherine_acquisition_read(&acq);
+    pthread_join(sender, NULL);
+
+    katherine_acquisition_stats_t stats;
+    katherine_acquisition_get_stats(&acq, &stats);
+
+    KT_CHECK_EQ(res, 0);
+    KT_CHECK_EQ(acq.state, ACQUISITION_SUCCEEDED);
+    KT_CHECK_EQ(probe.frames_ended, 1);
+
+    /* Every datagram was either received or dropped by the host, and the
+       frame owns the drops, none of which the device reported lost. */
+    KT_CHECK(stats.host_dropped_datagrams > 0);
+    KT_CHECK_EQ(stats.datagrams + stats.host_dropped_datagrams, FLOOD_DATAGRAMS + 1);
+    KT_CHECK_EQ(katherine_udp_dropped(&dev.data_socket), stats.host_dropped_datagrams);
+    KT_CHECK_EQ(probe.info.host_dropped_datagrams, stats.host_dropped_datagrams);
+    KT_CHECK_EQ(probe.info.lost_pixels, 0);
+    KT_CHECK_EQ(probe.info.received_pixels + stats.host_dropped_datagrams, FLOOD_DATAGRAMS - 1);
+
+    katherine_acquisition_fini(&acq);
+    katherine_udp_fini(&dev.data_socket);
+}
+
+/* ------------------------------------------------------------------ */
+/* b) Tuning the data socket grants what the host allows.              */
+
+/* Receive buffer requested: small enough for any system limit, so that it
+   is granted even without the privilege to exceed the limit. */
+#define TUNED_RCVBUF     (64 * 1024)
+#define TUNED_TIMEOUT_MS 200
+
+static void
+test_socket_tuning(void)
+{
+    katherine_device_t dev;
+    memset(&dev, 0, sizeof(dev));
+
+    struct sockaddr_in bound;
+    if (open_data_socket(&dev, &bound) != 0) {
+        return;
+    }
+
+    katherine_udp_tuning_t requested = KATHERINE_UDP_TUNING_INIT;
+    katherine_udp_tuning_t granted;
+    requested.rcvbuf     = TUNED_RCVBUF;
+    requested.timestamps = true;
+    requested.timeout_ms = TUNED_TIMEOUT_MS;
+    KT_REQUIRE(katherine_udp_tune(&dev.data_socket, &requested, &granted) == 0);
+
+    /* Linux accounts twice the size requested. */
+    KT_CHECK(granted.rcvbuf >= TUNED_RCVBUF);
+    /* The kernel rounds the timeout up to whole ticks of its clock. */
+    KT_CHECK(granted.timeout_ms >= TUNED_TIMEOUT_MS && granted.timeout_ms < TUNED_TIMEOUT_MS + 10);
+
+    /* Options left as they were stay so. */
+    katherine_udp_tuning_t untouched = KATHERINE_UDP_TUNING_INIT;
+    katherine_udp_tuning_t regranted;
+    KT_CHECK_EQ(katherine_udp_tune(&dev.data_socket, &untouched, &regranted), 0);
+    KT_CHECK_EQ(regranted.rcvbuf, granted.rcvbuf);
+    KT_CHECK_EQ(regranted.timeout_ms, granted.timeout_ms);
+    KT_CHECK_EQ(regranted.timestamps, granted.timestamps);
+
+    if (!granted.timestamps) {
+        printf("# SKIP receive timestamps are not supported on this platform\n");
+        katherine_udp_fini(&dev.data_socket);
+        return;
+    }
+
+    unsigned char datum[KATHERINE_MD_SIZE];
+    size_t length = KATHERINE_MD_SIZE;
+    store_md(datum, 0, make_new_frame());
+
+    const uint64_t before = (uint64_t) time(NULL) * 1000000000ull;
+    send_stream(&bound, datum, &length, 1);
+
+    char buffer[KATHERINE_MD_SIZE + sizeof(uint64_t)];
+    void *data[1] = {buffer};
+    size_t received, count = 1;
+    KT_CHECK_EQ(katherine_udp_recv_batch(&dev.data_socket, data, sizeof(buffer), &received, &count), 0);
+    KT_CHECK_EQ(count, 1);
+    KT_CHECK_EQ(received, KATHERINE_MD_SIZE);
+
+    /* The receive time is on the wall clock, which time() truncates. */
+    KT_CHECK(dev.data_socket.rx_time_ns >= before);
+    KT_CHECK(dev.data_socket.rx_time_ns < before + 10 * 1000000000ull);
+
+    katherine_udp_fini(&dev.data_socket);
+}
+
+int
+main(void)
+{
+    KT_RUN(test_host_drops);
+    KT_RUN(test_socket_tuning);
+    return kt_summary();
+}
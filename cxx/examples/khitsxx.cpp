@@ -0,0 +1,71 @@
+/**
+ * @file
+ * @brief Example: summarize the hits of a file recorded by a pixel sink.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <numeric>
+
+#ifdef KHITSXX_PARALLEL
+#include <execution>
+#endif
+
+#include <katherinexx/katherinexx.hpp>
+
+using mode = katherine::acq::f_toa_tot;
+
+/* Sums the ToT of hits in the mapping, in parallel where the standard library can. */
+static std::uint64_t
+sum_tot(katherine::span<const mode::pixel_type> hits)
+{
+    auto tot = [](const mode::pixel_type& px) { return static_cast<std::uint64_t>(px.tot); };
+
+#if defined(KHITSXX_PARALLEL) && defined(__cpp_lib_parallel_algorithm)
+    return std::transform_reduce(std::execution::par, hits.begin(), hits.end(), std::uint64_t{0}, std::plus<>{}, tot);
+#else
+    std::uint64_t sum = 0;
+    for (const auto& px : hits) {
+        sum += tot(px);
+    }
+    return sum;
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <file recorded by a pixel sink in f_toa_tot mode>" << std::endl;
+        return 1;
+    }
+
+    try {
+        katherine::recording<mode> rec{argv[1]};
+
+        for (std::size_t i = 0; i < rec.frame_count(); ++i) {
+            const auto hits = rec.frame(i);
+            std::printf("frame %zu: %zu hits (%llu sent%s), ToT sum %llu\n", i, hits.size(),
+                        (unsigned long long) rec.frames()[i].sent_pixels,
+                        rec.frames()[i].completed ? "" : ", incomplete",
+                        (unsigned long long) sum_tot(hits));
+        }
+
+        std::printf("total: %zu hits, ToT sum %llu\n", rec.hits().size(), (unsigned long long) sum_tot(rec.hits()));
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -163,6 +163,7 @@ frame_ended(int frame_idx, bool completed, const katherine_frame_info_t& info)
     std::cerr << " - tpx3->katherine lost " << info.lost_pixels << " pixels" << std::endl
               << " - katherine->pc sent " << info.sent_pixels << " pixels" << std::endl
               << " - katherine->pc received " << info.received_pixels << " pixels (" << recv_perc << " %)" << std::endl
+              << " - pc dropped " << info.host_dropped_datagrams << " datagrams" << std::endl
               << " - state: " << (completed ? "completed" : "not completed") << std::endl
               << " - start time: " << info.start_time.d << std::endl
               << " - end time: " << info.end_time.d << std::endl;
@@ -195,7 +196,11 @@ run_acquisition(katherine::device& dev, const katherine::config& c)
     using namespace std::chrono;
     using namespace std::literals::chrono_literals;
 
-    katherine::acquisition<mode> acq{dev, katherine::md_size * 34952533, sizeof(mode::pixel_type) * 65536, 500ms, 10s, true};
+    // One batch of datagrams is all the read receives at once, and the
+    // buffers are faulted in up front, so that the first frame does not
+    // wait for the kernel to back them.
+    const katherine::allocator alloc{nullptr, nullptr, nullptr, KATHERINE_ALLOC_HUGEPAGES | KATHERINE_ALLOC_PREFAULT};
+    katherine::acquisition<mode> acq{dev, katherine::md_datagram_max_size * katherine::md_batch_max, sizeof(mode::pixel_type) * 65536, 500ms, 10s, true, &alloc};
 
     acq.set_frame_started_handler(frame_started);
     acq.set_frame_ended_handler(frame_ended);
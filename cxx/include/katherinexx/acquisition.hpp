@@ -12,10 +12,13 @@
 
 #pragma once
 
+#include <cerrno>
 #include <string>
 #include <functional>
 
 #include <katherine/acquisition.h>
+#include <katherine/replay.h>
+#include <katherine/sink.h>
 
 #include <katherinexx/device.hpp>
 #include <katherinexx/config.hpp>
@@ -27,7 +30,9 @@ namespace katherine {
  * @{
  */
 
-static constexpr std::size_t md_size = KATHERINE_MD_SIZE;
+static constexpr std::size_t md_size              = KATHERINE_MD_SIZE;
+static constexpr std::size_t md_datagram_max_size = KATHERINE_MD_DATAGRAM_MAX_SIZE;
+static constexpr std::size_t md_batch_max         = KATHERINE_MD_BATCH_MAX;
 
 enum class readout_type {
     sequential  = READOUT_SEQUENTIAL,
@@ -47,13 +52,42 @@ enum class acq_mode : int {
     event_itot = ACQUISITION_MODE_EVENT_ITOT
 };
 
+enum class px_layout : int {
+    structs  = KATHERINE_PX_LAYOUT_STRUCTS,
+    columns  = KATHERINE_PX_LAYOUT_COLUMNS,
+    packed16 = KATHERINE_PX_LAYOUT_PACKED16,
+    packed12 = KATHERINE_PX_LAYOUT_PACKED12
+};
+
+enum class timestamp_unit : int {
+    toa  = KATHERINE_TIMESTAMP_TOA,
+    fine = KATHERINE_TIMESTAMP_FINE
+};
+
 using frame_info = katherine_frame_info_t;
+using frame_maps = katherine_frame_maps_t;
+using cluster    = katherine_cluster_t;
+using clustering = katherine_clustering_t;
+using reordering = katherine_reordering_t;
+using px_filter  = katherine_px_filter_t;
+using px_columns = katherine_px_columns_t;
+using md_lease   = katherine_md_lease_t;
+using replay_source = katherine_replay_source_t;
+using acq_stats  = katherine_acquisition_stats_t;
+using allocator  = katherine_allocator_t;
+using realtime   = katherine_realtime_t;
+using realtime_status = katherine_realtime_status_t;
+using sink       = katherine_sink_t;
+using sink_frame = katherine_sink_frame_t;
 
 class base_acquisition {
 public:
     using frame_started_handler = std::function<void(int)>;
     using frame_ended_handler   = std::function<void(int, bool, const katherine::frame_info&)>;
     using data_received_handler = std::function<void(const char *, size_t)>;
+    using pixel_columns_received_handler = std::function<void(const katherine::px_columns&)>;
+    using data_leased_handler = std::function<void(katherine::md_lease *)>;
+    using clusters_received_handler = std::function<void(const katherine::cluster *, std::size_t)>;
 
 protected:
     katherine_acquisition_t acq_;
@@ -66,6 +100,9 @@ private:
     frame_started_handler frame_started_handler_;
     frame_ended_handler frame_ended_handler_;
     data_received_handler data_received_handler_;
+    pixel_columns_received_handler pixel_columns_received_handler_;
+    data_leased_handler data_leased_handler_;
+    clusters_received_handler clusters_received_handler_;
 
     static void
     forward_frame_started(void *user_ctx, int frame_idx)
@@ -88,20 +125,44 @@ private:
         self->data_received_handler_(px, count);
     }
 
+    static void
+    forward_pixel_columns_received(void *user_ctx, const katherine_px_columns_t *columns)
+    {
+        auto self = reinterpret_cast<base_acquisition *>(user_ctx);
+        self->pixel_columns_received_handler_(*columns);
+    }
+
+    static void
+    forward_data_leased(void *user_ctx, katherine_md_lease_t *lease)
+    {
+        auto self = reinterpret_cast<base_acquisition *>(user_ctx);
+        self->data_leased_handler_(lease);
+    }
+
+    static void
+    forward_clusters_received(void *user_ctx, const katherine_cluster_t *clusters, size_t count)
+    {
+        auto self = reinterpret_cast<base_acquisition *>(user_ctx);
+        self->clusters_received_handler_(clusters, count);
+    }
+
 public:
     template<typename Rep1, typename Period1, typename Rep2, typename Period2>
-    base_acquisition(device& dev, std::size_t md_buffer_size, std::size_t pixel_buffer_size, std::chrono::duration<Rep1, Period1> report_timeout, std::chrono::duration<Rep2, Period2> fail_timeout, acq_mode mode, bool fast_vco_enabled, bool decode_data)
+    base_acquisition(device& dev, std::size_t md_buffer_size, std::size_t pixel_buffer_size, std::chrono::duration<Rep1, Period1> report_timeout, std::chrono::duration<Rep2, Period2> fail_timeout, acq_mode mode, bool fast_vco_enabled, bool decode_data, const allocator *alloc = nullptr)
         : acq_{},
           mode_{mode},
           fast_vco_enabled_{fast_vco_enabled},
           decode_data_{decode_data},
           frame_started_handler_{[](int) { }},
           frame_ended_handler_{[](int, bool, const katherine::frame_info&) { }},
-          data_received_handler_{[](const char *, size_t) { }}
+          data_received_handler_{[](const char *, size_t) { }},
+          pixel_columns_received_handler_{[](const katherine::px_columns&) { }},
+          data_leased_handler_{[this](katherine::md_lease *lease) { release_lease(lease); }},
+          clusters_received_handler_{[](const katherine::cluster *, std::size_t) { }}
     {
         using namespace std::chrono;
 
-        int res = katherine_acquisition_init(&acq_, dev.c_dev(), reinterpret_cast<void *>(this), md_buffer_size, pixel_buffer_size, duration_cast<milliseconds>(report_timeout).count(), duration_cast<milliseconds>(fail_timeout).count());
+        int res = katherine_acquisition_init_with_allocator(&acq_, dev.c_dev(), reinterpret_cast<void *>(this), md_buffer_size, pixel_buffer_size, duration_cast<milliseconds>(report_timeout).count(), duration_cast<milliseconds>(fail_timeout).count(), alloc);
         if (res != 0) {
             throw katherine::system_error{res};
         }
@@ -112,6 +173,9 @@ public:
             /* .frame_started = */ base_acquisition::forward_frame_started,
             /* .frame_ended = */ base_acquisition::forward_frame_ended,
             /* .data_received = */ base_acquisition::forward_data_received,
+            /* .pixel_columns_received = */ base_acquisition::forward_pixel_columns_received,
+            /* .data_leased = */ base_acquisition::forward_data_leased,
+            /* .clusters_received = */ base_acquisition::forward_clusters_received,
         };
     }
 
@@ -138,6 +202,176 @@ public:
         data_received_handler_ = std::move(fn);
     }
 
+    void
+    set_pixel_columns_received_handler(pixel_columns_received_handler&& fn)
+    {
+        pixel_columns_received_handler_ = std::move(fn);
+    }
+
+    void
+    set_data_leased_handler(data_leased_handler&& fn)
+    {
+        data_leased_handler_ = std::move(fn);
+    }
+
+    void
+    set_clusters_received_handler(clusters_received_handler&& fn)
+    {
+        clusters_received_handler_ = std::move(fn);
+    }
+
+    void
+    set_decode_threads(std::size_t threads)
+    {
+        int res = katherine_acquisition_set_decode_threads(&acq_, threads);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    set_frame_maps(bool enabled)
+    {
+        int res = katherine_acquisition_set_frame_maps(&acq_, enabled);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    set_clustering(const clustering& params)
+    {
+        int res = katherine_acquisition_set_clustering(&acq_, &params);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    clear_clustering()
+    {
+        (void) katherine_acquisition_set_clustering(&acq_, nullptr);
+    }
+
+    void
+    set_px_filter(const px_filter& filter)
+    {
+        int res = katherine_acquisition_set_px_filter(&acq_, &filter);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    clear_px_filter()
+    {
+        (void) katherine_acquisition_set_px_filter(&acq_, nullptr);
+    }
+
+    void
+    set_reordering(const reordering& params)
+    {
+        int res = katherine_acquisition_set_reordering(&acq_, &params);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    clear_reordering()
+    {
+        (void) katherine_acquisition_set_reordering(&acq_, nullptr);
+    }
+
+    void
+    set_realtime(const realtime& rt)
+    {
+        int res = katherine_acquisition_set_realtime(&acq_, &rt);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    clear_realtime()
+    {
+        (void) katherine_acquisition_set_realtime(&acq_, nullptr);
+    }
+
+    void
+    set_sink(sink& s)
+    {
+        int res = katherine_acquisition_set_sink(&acq_, &s);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    clear_sink()
+    {
+        (void) katherine_acquisition_set_sink(&acq_, nullptr);
+    }
+
+    realtime_status
+    last_realtime_status() const
+    {
+        realtime_status status;
+        katherine_acquisition_get_realtime_status(&acq_, &status);
+        return status;
+    }
+
+    void
+    set_md_pool(std::size_t leases)
+    {
+        int res = katherine_acquisition_set_md_pool(&acq_, leases);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    release_lease(katherine::md_lease *lease)
+    {
+        katherine_acquisition_release_lease(&acq_, lease);
+    }
+
+    void
+    set_px_layout(px_layout layout)
+    {
+        int res = katherine_acquisition_set_px_layout(&acq_, (katherine_px_layout_t) layout);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    acq_stats
+    stats() const
+    {
+        acq_stats snapshot;
+        katherine_acquisition_get_stats(&acq_, &snapshot);
+        return snapshot;
+    }
+
+    void
+    set_timestamp_unit(timestamp_unit unit)
+    {
+        int res = katherine_acquisition_set_timestamp_unit(&acq_, (katherine_timestamp_unit_t) unit);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
     void
     begin(const katherine::config& config, katherine::readout_type readout_type)
     {
@@ -179,6 +413,58 @@ public:
         }
     }
 
+    void
+    replay(replay_source& source)
+    {
+        // The handlers were set up for the pixels of the mode of the
+        // acquisition, which the source must have been measured in.
+        if (static_cast<acq_mode>(source.acq_mode) != mode_ || source.fast_vco_enabled != fast_vco_enabled_) {
+            throw katherine::system_error{EINVAL};
+        }
+
+        int res = katherine_acquisition_replay(&acq_, &source);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    katherine_socket_t
+    fd() const
+    {
+        return katherine_acquisition_get_fd(&acq_);
+    }
+
+    void
+    pump(std::size_t max_datagrams)
+    {
+        int res = katherine_acquisition_pump(&acq_, max_datagrams);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    poll_timeouts()
+    {
+        int res = katherine_acquisition_poll_timeouts(&acq_);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
+    void
+    finish()
+    {
+        int res = katherine_acquisition_finish(&acq_);
+
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
     acq_state state() const { return (acq_state) acq_.state; }
     bool aborted() const { return acq_.aborted; }
     int requested_frames() const { return acq_.requested_frames; }
@@ -198,36 +484,100 @@ struct f_toa_tot {
     using pixel_type                       = katherine_px_f_toa_tot_t;
     static constexpr acq_mode mode         = acq_mode::toa_tot;
     static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::structs;
 };
 
 struct toa_tot {
     using pixel_type                       = katherine_px_toa_tot_t;
     static constexpr acq_mode mode         = acq_mode::toa_tot;
     static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::structs;
 };
 
 struct f_toa_only {
     using pixel_type                       = katherine_px_f_toa_only_t;
     static constexpr acq_mode mode         = acq_mode::only_toa;
     static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::structs;
 };
 
 struct toa_only {
     using pixel_type                       = katherine_px_toa_only_t;
     static constexpr acq_mode mode         = acq_mode::only_toa;
     static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::structs;
 };
 
 struct f_event_itot {
     using pixel_type                       = katherine_px_f_event_itot_t;
     static constexpr acq_mode mode         = acq_mode::event_itot;
     static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::structs;
 };
 
 struct event_itot {
     using pixel_type                       = katherine_px_event_itot_t;
     static constexpr acq_mode mode         = acq_mode::event_itot;
     static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::structs;
+};
+
+/* Packed records of the modes with a ToA, see katherine_acquisition_set_px_layout(). */
+
+struct f_toa_tot_p16 {
+    using pixel_type                       = katherine_px_f_toa_tot_p16_t;
+    static constexpr acq_mode mode         = acq_mode::toa_tot;
+    static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::packed16;
+};
+
+struct f_toa_tot_p12 {
+    using pixel_type                       = katherine_px_f_toa_tot_p12_t;
+    static constexpr acq_mode mode         = acq_mode::toa_tot;
+    static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::packed12;
+};
+
+struct toa_tot_p16 {
+    using pixel_type                       = katherine_px_toa_tot_p16_t;
+    static constexpr acq_mode mode         = acq_mode::toa_tot;
+    static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::packed16;
+};
+
+struct toa_tot_p12 {
+    using pixel_type                       = katherine_px_toa_tot_p12_t;
+    static constexpr acq_mode mode         = acq_mode::toa_tot;
+    static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::packed12;
+};
+
+struct f_toa_only_p16 {
+    using pixel_type                       = katherine_px_f_toa_only_p16_t;
+    static constexpr acq_mode mode         = acq_mode::only_toa;
+    static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::packed16;
+};
+
+struct f_toa_only_p12 {
+    using pixel_type                       = katherine_px_f_toa_only_p12_t;
+    static constexpr acq_mode mode         = acq_mode::only_toa;
+    static constexpr bool fast_vco_enabled = true;
+    static constexpr px_layout layout      = px_layout::packed12;
+};
+
+struct toa_only_p16 {
+    using pixel_type                       = katherine_px_toa_only_p16_t;
+    static constexpr acq_mode mode         = acq_mode::only_toa;
+    static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::packed16;
+};
+
+struct toa_only_p12 {
+    using pixel_type                       = katherine_px_toa_only_p12_t;
+    static constexpr acq_mode mode         = acq_mode::only_toa;
+    static constexpr bool fast_vco_enabled = false;
+    static constexpr px_layout layout      = px_layout::packed12;
 };
 
 /** @} */
@@ -254,11 +604,12 @@ private:
 
 public:
     template<typename Rep1, typename Period1, typename Rep2, typename Period2>
-    acquisition(device& dev, std::size_t md_buffer_size, std::size_t pixel_buffer_size, std::chrono::duration<Rep1, Period1> report_timeout, std::chrono::duration<Rep2, Period2> fail_timeout, bool decode_data)
-        : base_acquisition{dev, md_buffer_size, pixel_buffer_size, report_timeout, fail_timeout, AcqMode::mode, AcqMode::fast_vco_enabled, decode_data},
+    acquisition(device& dev, std::size_t md_buffer_size, std::size_t pixel_buffer_size, std::chrono::duration<Rep1, Period1> report_timeout, std::chrono::duration<Rep2, Period2> fail_timeout, bool decode_data, const allocator *alloc = nullptr)
+        : base_acquisition{dev, md_buffer_size, pixel_buffer_size, report_timeout, fail_timeout, AcqMode::mode, AcqMode::fast_vco_enabled, decode_data, alloc},
           pixels_received_handler_{[](const pixel_type *, std::size_t) { }}
     {
         acq_.handlers.pixels_received = acquisition::forward_pixels_received;
+        set_px_layout(AcqMode::layout);
     }
 
     void
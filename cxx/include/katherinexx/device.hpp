@@ -27,6 +27,8 @@ namespace katherine {
  * @{
  */
 
+using udp_tuning = katherine_udp_tuning_t;
+
 class device {
     katherine_device_t dev_;
 
@@ -39,6 +41,14 @@ public:
         }
     }
 
+    device(std::string addr, const udp_tuning& data_tuning, udp_tuning *granted = nullptr)
+    {
+        int res = katherine_device_init_tuned(&dev_, addr.c_str(), &data_tuning, granted);
+        if (res != 0) {
+            throw katherine::system_error{res};
+        }
+    }
+
     virtual ~device()
     {
         katherine_device_fini(&dev_);
@@ -22,3 +22,4 @@
 #include <katherinexx/device.hpp>
 #include <katherinexx/config.hpp>
 #include <katherinexx/px_config.hpp>
+#include <katherinexx/recording.hpp>
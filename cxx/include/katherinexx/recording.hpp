@@ -0,0 +1,285 @@
+/**
+ * @file
+ * @brief C++ reader of the pixels recorded by a sink, mapped to memory.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <katherine/global.h>
+#include <katherine/sink.h>
+
+#include <katherinexx/error.hpp>
+#include <katherinexx/acquisition.hpp>
+
+#ifdef KATHERINE_NIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace katherine {
+
+/**
+ * @addtogroup cxx_api
+ * @{
+ */
+
+/**
+ * Contiguous elements owned elsewhere. The iterators are pointers, so the
+ * algorithms of the standard library, parallel ones included, take them as
+ * they are.
+ */
+template<typename T>
+class span {
+public:
+    using element_type = T;
+    using value_type   = typename std::remove_cv<T>::type;
+    using size_type    = std::size_t;
+    using pointer      = T *;
+    using reference    = T&;
+    using iterator     = T *;
+
+private:
+    T *data_;
+    std::size_t size_;
+
+public:
+    constexpr span() noexcept
+        : data_{nullptr},
+          size_{0}
+    { }
+
+    constexpr span(T *data, std::size_t size) noexcept
+        : data_{data},
+          size_{size}
+    { }
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+
+    constexpr iterator begin() const noexcept { return data_; }
+    constexpr iterator end() const noexcept { return data_ + size_; }
+
+    constexpr T& operator[](std::size_t idx) const noexcept { return data_[idx]; }
+
+    constexpr span
+    subspan(std::size_t offset, std::size_t count) const noexcept
+    {
+        return span{data_ + offset, count};
+    }
+};
+
+/**
+ * File of a pixel sink (see katherine_sink_open()), mapped to memory for reading.
+ *
+ * The hits are the records of the file where they lie in the mapping, and the
+ * frames are spans of them, so nothing is copied or allocated to read them.
+ * The spans are valid for as long as the recording is.
+ */
+template<typename AcqMode>
+class recording {
+public:
+    using pixel_type = typename AcqMode::pixel_type;
+
+    static_assert(AcqMode::layout != px_layout::columns, "a sink records the pixels of the layouts of records only");
+
+private:
+    void *map_;
+    std::size_t length_;
+    katherine_sink_trailer_t trailer_;
+    span<const pixel_type> hits_;
+    span<const sink_frame> frames_;
+
+    void
+    unmap() noexcept
+    {
+#ifdef KATHERINE_NIX
+        if (map_ != nullptr) {
+            (void) munmap(map_, length_);
+        }
+#endif
+        map_    = nullptr;
+        length_ = 0;
+    }
+
+    /* Checks the trailer at the end of the mapping describes records of the
+       acquisition mode, and lays out the hits and the frames by it. */
+    int
+    index()
+    {
+        const char *base = static_cast<const char *>(map_);
+        const std::size_t frames_offset = length_ - sizeof(trailer_);
+        std::memcpy(&trailer_, base + frames_offset, sizeof(trailer_));
+
+        if (std::memcmp(trailer_.magic, KATHERINE_SINK_TRAILER_MAGIC, sizeof(KATHERINE_SINK_TRAILER_MAGIC)) != 0 || trailer_.byte_order != 0x01020304) {
+            return EPROTO;
+        }
+
+        if (trailer_.record_size != sizeof(pixel_type) ||
+            trailer_.acq_mode != static_cast<char>(AcqMode::mode) ||
+            trailer_.fast_vco_enabled != AcqMode::fast_vco_enabled ||
+            trailer_.px_layout != static_cast<char>(AcqMode::layout)) {
+            return EINVAL;
+        }
+
+        if (trailer_.index_offset % alignof(sink_frame) != 0 ||
+            trailer_.index_offset > frames_offset ||
+            (frames_offset - trailer_.index_offset) / sizeof(sink_frame) != trailer_.frames ||
+            (frames_offset - trailer_.index_offset) % sizeof(sink_frame) != 0 ||
+            trailer_.pixels > trailer_.index_offset / sizeof(pixel_type)) {
+            return EPROTO;
+        }
+
+        hits_   = span<const pixel_type>{reinterpret_cast<const pixel_type *>(base), static_cast<std::size_t>(trailer_.pixels)};
+        frames_ = span<const sink_frame>{reinterpret_cast<const sink_frame *>(base + trailer_.index_offset), static_cast<std::size_t>(trailer_.frames)};
+
+        for (const sink_frame& frame : frames_) {
+            if (frame.first_pixel > trailer_.pixels || frame.pixels > trailer_.pixels - frame.first_pixel) {
+                return EPROTO;
+            }
+        }
+
+        return 0;
+    }
+
+public:
+    explicit recording(const std::string& file_path)
+        : map_{nullptr},
+          length_{0},
+          trailer_{},
+          hits_{},
+          frames_{}
+    {
+#ifdef KATHERINE_NIX
+        int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw katherine::system_error{errno};
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            int res = errno;
+            (void) close(fd);
+            throw katherine::system_error{res};
+        }
+
+        if (static_cast<std::size_t>(st.st_size) < sizeof(trailer_)) {
+            (void) close(fd);
+            throw katherine::system_error{EPROTO};
+        }
+
+        length_ = static_cast<std::size_t>(st.st_size);
+        map_    = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+        int res = map_ == MAP_FAILED ? errno : 0;
+        (void) close(fd);
+
+        if (res != 0) {
+            map_    = nullptr;
+            length_ = 0;
+            throw katherine::system_error{res};
+        }
+
+        res = index();
+        if (res != 0) {
+            unmap();
+            throw katherine::system_error{res};
+        }
+#else
+        (void) file_path;
+        throw katherine::system_error{ENOTSUP};
+#endif
+    }
+
+    recording(const recording&) = delete;
+    recording& operator=(const recording&) = delete;
+
+    recording(recording&& other) noexcept
+        : map_{other.map_},
+          length_{other.length_},
+          trailer_{other.trailer_},
+          hits_{other.hits_},
+          frames_{other.frames_}
+    {
+        other.map_    = nullptr;
+        other.length_ = 0;
+        other.hits_   = {};
+        other.frames_ = {};
+    }
+
+    recording&
+    operator=(recording&& other) noexcept
+    {
+        if (this != &other) {
+            unmap();
+            std::swap(map_, other.map_);
+            std::swap(length_, other.length_);
+            std::swap(trailer_, other.trailer_);
+            std::swap(hits_, other.hits_);
+            std::swap(frames_, other.frames_);
+        }
+
+        return *this;
+    }
+
+    ~recording()
+    {
+        unmap();
+    }
+
+    /** All hits of the recording, in the order the acquisition delivered them. */
+    span<const pixel_type>
+    hits() const noexcept
+    {
+        return hits_;
+    }
+
+    /** Index of the frames which ended, with what the device told of each. */
+    span<const sink_frame>
+    frames() const noexcept
+    {
+        return frames_;
+    }
+
+    std::size_t
+    frame_count() const noexcept
+    {
+        return frames_.size();
+    }
+
+    /** Hits of a frame. */
+    span<const pixel_type>
+    frame(std::size_t idx) const
+    {
+        if (idx >= frames_.size()) {
+            throw katherine::system_error{ERANGE};
+        }
+
+        return hits_.subspan(static_cast<std::size_t>(frames_[idx].first_pixel), static_cast<std::size_t>(frames_[idx].pixels));
+    }
+
+    katherine::timestamp_unit
+    time_unit() const noexcept
+    {
+        return static_cast<katherine::timestamp_unit>(trailer_.timestamp_unit);
+    }
+};
+
+/** @} */
+
+}
@@ -25,10 +25,14 @@ cdef extern from 'katherine/acquisition.h':
         uint64_t received_pixels
         uint64_t sent_pixels
         uint64_t lost_pixels
+        uint64_t host_dropped_datagrams
         katherine_frame_info_time_t start_time
         katherine_frame_info_time_t end_time
         time_t start_time_observed
         time_t end_time_observed
+        uint64_t start_time_observed_ns
+        uint64_t end_time_observed_ns
+        uint64_t max_receive_gap_ns
         bool completed
 
     ctypedef struct katherine_acquisition_handlers_t:
@@ -83,6 +87,8 @@ cdef extern from 'katherine/acquisition.h':
         ACQUISITION_TIMED_OUT
 
     cdef int KATHERINE_MD_SIZE
+    cdef int KATHERINE_MD_DATAGRAM_MAX_SIZE
+    cdef int KATHERINE_MD_BATCH_MAX
 
     int katherine_acquisition_init(katherine_acquisition_t *acq, katherine_device_t *device, void *ctx, size_t md_buffer_size, size_t pixel_buffer_size, int report_timeout, int fail_timeout)
     void katherine_acquisition_fini(katherine_acquisition_t *acq)
@@ -126,6 +126,7 @@ class MyObserver(k.AcquisitionObserver):
         print(' - tpx3->katherine lost %d pixels' % info.lost_pixels)
         print(' - katherine->pc sent %d pixels' % info.sent_pixels)
         print(' - katherine->pc received %d pixels' % info.received_pixels)
+        print(' - pc dropped %d datagrams' % info.host_dropped_datagrams)
         print(' - state: %s' % ('completed' if completed else 'not completed'))
         print(' - start time: %d' % info.start_time)
         print(' - end time: %d' % info.end_time)
@@ -143,7 +144,7 @@ def print_chip_id(device):
 
 
 def run_acquisition(dev, c):
-    acq = k.Acquisition(dev, k.MD_SIZE() * 34952533, k.PxFastToaTot.RAW_SIZE() * 4096, 500, 10000)
+    acq = k.Acquisition(dev, k.MD_DATAGRAM_MAX_SIZE() * k.MD_BATCH_MAX(), k.PxFastToaTot.RAW_SIZE() * 4096, 500, 10000)
     acq.observer = MyObserver()
 
     print('Acquisition started')
@@ -730,6 +730,10 @@ cdef class FrameInfo:
     def lost_pixels(self):
        return self._c_info.lost_pixels
 
+    @property
+    def host_dropped_datagrams(self):
+       return self._c_info.host_dropped_datagrams
+
     @property
     def start_time(self):
        return self._c_info.start_time.d
@@ -746,6 +750,18 @@ cdef class FrameInfo:
     def end_time_observed(self):
        return self._c_info.end_time_observed
 
+    @property
+    def start_time_observed_ns(self):
+       return self._c_info.start_time_observed_ns
+
+    @property
+    def end_time_observed_ns(self):
+       return self._c_info.end_time_observed_ns
+
+    @property
+    def max_receive_gap_ns(self):
+       return self._c_info.max_receive_gap_ns
+
     @property
     def completed(self):
        return self._c_info.completed
@@ -1106,3 +1122,9 @@ cdef void _forward_pixels_received_event_itot(void *user_ctx, const void *px, si
 
 def MD_SIZE():
    return cacquisition.KATHERINE_MD_SIZE
+
+def MD_DATAGRAM_MAX_SIZE():
+   return cacquisition.KATHERINE_MD_DATAGRAM_MAX_SIZE
+
+def MD_BATCH_MAX():
+   return cacquisition.KATHERINE_MD_BATCH_MAX
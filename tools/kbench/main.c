@@ -0,0 +1,452 @@
+/**
+ * @file
+ * @brief Microbenchmarks of the hot paths of the library.
+ * @author Petr Mánek
+ * @date 17.10.26
+ *
+ * @copyright Copyright (c) 2018 Petr Mánek.
+ * This software is distributed under the terms of the MIT License, copied verbatim in the file "LICENSE".
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <katherine/acquisition.h>
+#include <katherine/codec.h>
+#include <katherine/device.h>
+#include <katherine/replay.h>
+#ifdef KBENCH_EMULATOR
+#include <katherine/emulator.h>
+#endif
+
+/* The pixel mapping functions of md.h are written against the acquisition,
+   so its declaration has to precede them. */
+#include "md.h"
+#include "md_simd.h"
+#include "msleep.h"
+
+/* Every benchmark runs its input several times over and reports the fastest
+ * round, which is the one least disturbed by the rest of the system. The
+ * input is synthetic and decoded from memory, so the figures are those of
+ * the decoder alone, with no sockets and no handlers involved.
+ *
+ * The codec of katherine/codec.h is timed on the same input, and on the
+ * streams of the emulator, if it is built, one block per datagram.
+ *
+ * Last, the same input is replayed through a whole acquisition, decoded by
+ * one thread and by pools of more, up to the given number, doubling, so
+ * that the figures tell how the parallel decoder scales with the cores of
+ * the host (or, with more threads than cores, what oversubscribing costs).
+ * The replay runs back to back, and then paced as a live read is, with the
+ * reader idle between batches, which is what the threads of the pool have
+ * to wake up from.
+ *
+ * Usage: kbench [hits [rounds [threads]]] */
+
+#define DEFAULT_HITS    (1u << 20)
+#define DEFAULT_ROUNDS  20
+#define DEFAULT_THREADS 8
+
+/* Data per datagram of a data-driven readout, the first of which is a
+   timestamp offset, so that runs of pixels are as long as they are on the
+   wire. */
+#define DATAGRAM_MDS (KATHERINE_MD_DATAGRAM_MAX_SIZE / KATHERINE_MD_SIZE)
+
+/* Hits the pixel buffer of a replayed acquisition holds, so that the
+   handler receiving them runs seldom; and those of a paced one, about a
+   batch of whole datagrams, which arrives every millisecond or so at the
+   rate of a 1 GbE link. */
+#define REPLAY_PIXEL_BUFFER_HITS 65536
+#define REPLAY_PACED_HITS        (KATHERINE_MD_BATCH_MAX * (DATAGRAM_MDS - 1))
+#define REPLAY_PACE_MS           1
+
+#define MD_HDR_PIXEL       0x4
+#define MD_HDR_TIME_OFFSET 0x5
+
+/* Opcodes of the commands which set up an acquisition of the emulator. */
+#define CMD_ACQUISITION_TIME_LSB 0x01
+#define CMD_ACQUISITION_START    0x03
+#define CMD_ACQUISITION_MODE     0x09
+#define CMD_NUMBER_OF_FRAMES     0x13
+
+/* Frames of the streams of the emulator, and how long each of them is, in
+   units of 10 ns: the hits are spread over a frame 100 ns apart or so. */
+#define EMU_HITS_PER_FRAME 65536
+#define EMU_FRAME_UNITS    (10 * EMU_HITS_PER_FRAME)
+
+typedef struct bench {
+    char *stream;
+    size_t mds;
+    size_t hits;
+    unsigned rounds;
+    katherine_acquisition_t acq;
+    volatile uint64_t sink; // keeps the decoded pixels alive
+} bench_t;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    (void) timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void
+report(const char *mode, const char *path, const bench_t *b, double seconds)
+{
+    printf("%-12s %-10s %8.3f ns/hit %10.1f Mhit/s\n", mode, path, 1e9 * seconds / (double) b->hits, (double) b->hits / seconds / 1e6);
+}
+
+static uint32_t
+next_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static int
+make_stream(bench_t *b)
+{
+    uint32_t seed = 42;
+
+    b->mds    = b->hits + (b->hits + DATAGRAM_MDS - 2) / (DATAGRAM_MDS - 1);
+    b->stream = (char *) malloc(b->mds * KATHERINE_MD_SIZE + sizeof(uint64_t));
+    if (b->stream == NULL) return 1;
+
+    for (size_t i = 0; i < b->mds; ++i) {
+        uint64_t md;
+        if (i % DATAGRAM_MDS == 0) {
+            md = INSERT((uint64_t) 0, md, header, (uint64_t) MD_HDR_TIME_OFFSET);
+            md = INSERT(md, md_time_offset, offset, (uint64_t) i);
+        } else {
+            md = ((uint64_t) next_random(&seed) << 24) | next_random(&seed);
+            md = INSERT(md, md, header, (uint64_t) MD_HDR_PIXEL);
+        }
+        for (size_t k = 0; k < KATHERINE_MD_SIZE; ++k) {
+            b->stream[i * KATHERINE_MD_SIZE + k] = (char) (md >> (8 * k));
+        }
+    }
+
+    // The offsets above are skipped by the benchmarks, as is every datum
+    // but the pixels, so the count of hits includes the trailing ones only.
+    b->hits = b->mds - (b->mds + DATAGRAM_MDS - 1) / DATAGRAM_MDS;
+    return 0;
+}
+
+/* For every pixel type, the current decoder (a run at a time, at each level
+ * of md_simd.h the processor supports) is timed against the per-datum loop
+ * it replaced, which classified and mapped every datum on its own. */
+#define DEFINE_BENCH(SUFFIX) \
+    static size_t \
+    decode_per_datum_##SUFFIX(const bench_t *b, katherine_px_##SUFFIX##_t *px) \
+    { \
+        const char *md = b->stream; \
+        size_t n       = 0; \
+\
+        for (size_t i = 0; i < b->mds; ++i, md += KATHERINE_MD_SIZE) { \
+            if (EXTRACT(*(const uint64_t *) md, md, header) == MD_HDR_PIXEL) { \
+                pmd_##SUFFIX##_map(px + n++, (const uint64_t *) md, &b->acq); \
+            } \
+        } \
+        return n; \
+    } \
+\
+    static size_t \
+    decode_runs_##SUFFIX(const bench_t *b, md_simd_level_t level, katherine_px_##SUFFIX##_t *px) \
+    { \
+        const char *md = b->stream; \
+        size_t n       = 0; \
+        size_t run; \
+\
+        for (size_t count = b->mds; count > 0; count -= run, md += run * KATHERINE_MD_SIZE) { \
+            run = md_pixel_run_length(md, count); \
+            if (run > 0) { \
+                pmd_##SUFFIX##_run_at(level, px + n, md, run, &b->acq); \
+                n += run; \
+            } else { \
+                run = 1; \
+            } \
+        } \
+        return n; \
+    } \
+\
+    static void \
+    bench_##SUFFIX(bench_t *b) \
+    { \
+        static const char *const paths[] = {"scalar", "sse4.1", "avx2"}; \
+        katherine_px_##SUFFIX##_t *px    = (katherine_px_##SUFFIX##_t *) malloc(b->hits * sizeof(*px)); \
+        double best, elapsed; \
+\
+        if (px == NULL) return; \
+\
+        best = 1e300; \
+        for (unsigned r = 0; r < b->rounds; ++r) { \
+            elapsed = now(); \
+            b->sink += decode_per_datum_##SUFFIX(b, px); \
+            elapsed = now() - elapsed; \
+            if (elapsed < best) best = elapsed; \
+        } \
+        b->sink += px[b->hits - 1].coord.x; \
+        report(#SUFFIX, "per datum", b, best); \
+\
+        for (int level = MD_SIMD_SCALAR; level <= (int) md_simd_detect(); ++level) { \
+            best = 1e300; \
+            for (unsigned r = 0; r < b->rounds; ++r) { \
+                elapsed = now(); \
+                b->sink += decode_runs_##SUFFIX(b, (md_simd_level_t) level, px); \
+                elapsed = now() - elapsed; \
+                if (elapsed < best) best = elapsed; \
+            } \
+            b->sink += px[b->hits - 1].coord.x; \
+            report(#SUFFIX, paths[level], b, best); \
+        } \
+\
+        free(px); \
+    }
+
+DEFINE_BENCH(f_toa_tot)
+DEFINE_BENCH(toa_tot)
+DEFINE_BENCH(f_toa_only)
+DEFINE_BENCH(toa_only)
+
+#undef DEFINE_BENCH
+
+/* Encodes and decodes a stream a datagram at a time, and reports the ratio
+ * of its size encoded, and the rate of either, in bytes of the stream. */
+static void
+bench_codec(bench_t *b, const char *name, const char *stream, size_t length)
+{
+    const size_t block   = KATHERINE_MD_DATAGRAM_MAX_SIZE;
+    const size_t blocks  = (length + block - 1) / block;
+    const size_t bound   = katherine_md_codec_bound(block);
+    char *encoded        = (char *) malloc(blocks * bound);
+    char *decoded        = (char *) malloc(length);
+    size_t *sizes        = (size_t *) malloc(blocks * sizeof(size_t));
+    size_t total         = 0;
+    double encode        = 1e300;
+    double decode        = 1e300;
+    katherine_md_codec_t codec;
+    double elapsed;
+    size_t n;
+
+    if (encoded == NULL || decoded == NULL || sizes == NULL) goto done;
+
+    for (unsigned r = 0; r < b->rounds; ++r) {
+        katherine_md_codec_init(&codec);
+        total   = 0;
+        elapsed = now();
+        for (size_t i = 0; i < blocks; ++i) {
+            n = i + 1 < blocks ? block : length - i * block;
+            (void) katherine_md_encode(&codec, stream + i * block, n, encoded + i * bound, bound, &sizes[i]);
+            total += sizes[i];
+        }
+        elapsed = now() - elapsed;
+        if (elapsed < encode) encode = elapsed;
+    }
+
+    for (unsigned r = 0; r < b->rounds; ++r) {
+        katherine_md_codec_init(&codec);
+        elapsed = now();
+        for (size_t i = 0; i < blocks; ++i) {
+            (void) katherine_md_decode(&codec, encoded + i * bound, sizes[i], decoded + i * block, length - i * block, &n);
+        }
+        elapsed = now() - elapsed;
+        if (elapsed < decode) decode = elapsed;
+    }
+
+    printf("%-12s %-10s %6.3f ratio %9.1f MB/s enc %9.1f MB/s dec%s\n", "codec", name, (double) total / (double) length,
+        (double) length / encode / 1e6, (double) length / decode / 1e6, memcmp(stream, decoded, length) == 0 ? "" : " MISMATCH");
+
+done:
+    free(sizes);
+    free(decoded);
+    free(encoded);
+}
+
+/* What the handler of a replayed acquisition counts. A paced replay sleeps
+   in the handler, as the reader of a live acquisition waits for the next
+   batch on the socket, and leaves the time asleep out of its figure. */
+typedef struct replay_probe {
+    size_t hits;
+    bool paced;
+    double paused;
+} replay_probe_t;
+
+static void
+count_pixels(void *ctx, const void *px, size_t count)
+{
+    replay_probe_t *probe = (replay_probe_t *) ctx;
+
+    (void) px;
+    probe->hits += count;
+    if (probe->paced) {
+        const double started = now();
+        katherine_msleep(REPLAY_PACE_MS);
+        probe->paused += now() - started;
+    }
+}
+
+/* Replays the input through an acquisition of a device which is not
+ * connected, in batches of as many whole datagrams as a read receives at
+ * once, decoded by the given number of threads. A paced replay delivers
+ * the hits of about a batch to the handler at a time. */
+static void
+bench_replay(bench_t *b, size_t threads, bool paced)
+{
+    const size_t buffer_hits = paced ? REPLAY_PACED_HITS : REPLAY_PIXEL_BUFFER_HITS;
+    char path[32];
+    katherine_device_t dev;
+    katherine_acquisition_t acq;
+    katherine_replay_source_t source;
+    replay_probe_t probe;
+    double best = 1e300;
+    double elapsed;
+
+    memset(&dev, 0, sizeof(dev));
+    memset(&probe, 0, sizeof(probe));
+    probe.paced = paced;
+
+    if (katherine_acquisition_init(&acq, &dev, &probe, KATHERINE_MD_BATCH_MAX * KATHERINE_MD_DATAGRAM_MAX_SIZE,
+            buffer_hits * sizeof(katherine_px_toa_tot_t), 0, 0) != 0) {
+        return;
+    }
+    acq.handlers.pixels_received = count_pixels;
+
+    if (katherine_acquisition_set_decode_threads(&acq, threads) != 0) {
+        katherine_acquisition_fini(&acq);
+        return;
+    }
+
+    for (unsigned r = 0; r < b->rounds; ++r) {
+        (void) katherine_replay_source_memory(&source, b->stream, b->mds * KATHERINE_MD_SIZE, 0, ACQUISITION_MODE_TOA_TOT, false);
+        probe.hits   = 0;
+        probe.paused = 0;
+        elapsed      = now();
+        (void) katherine_acquisition_replay(&acq, &source);
+        elapsed = now() - elapsed - probe.paused;
+        if (elapsed < best) best = elapsed;
+    }
+    b->sink += probe.hits;
+    katherine_acquisition_fini(&acq);
+
+    snprintf(path, sizeof(path), "%zu thread%s", threads, threads > 1 ? "s" : "");
+    report(paced ? "replay paced" : "replay", path, b, best);
+}
+
+#ifdef KBENCH_EMULATOR
+static void
+emu_command(katherine_emu_t *emu, uint8_t opcode, uint32_t payload)
+{
+    uint8_t cmd[8] = {0};
+
+    for (size_t k = 0; k < 4; ++k) {
+        cmd[k] = (uint8_t) (payload >> (8 * k));
+    }
+    cmd[6] = opcode;
+    (void) katherine_emu_cmd_in(emu, cmd, sizeof(cmd));
+}
+
+/* Runs a data-driven acquisition of the emulator in the given pattern, of
+   about as many hits as the benchmark, and collects its stream. */
+static char *
+make_emu_stream(const bench_t *b, katherine_emu_pattern_t pattern, size_t *length)
+{
+    const uint32_t frames = (uint32_t) ((b->hits + EMU_HITS_PER_FRAME - 1) / EMU_HITS_PER_FRAME);
+    const size_t capacity = ((size_t) frames * (EMU_HITS_PER_FRAME + 2 * EMU_HITS_PER_FRAME / 64 + 16)) * KATHERINE_MD_SIZE;
+    katherine_emu_profile_t profile;
+    katherine_emu_t *emu = (katherine_emu_t *) malloc(sizeof(katherine_emu_t));
+    char *stream         = (char *) malloc(capacity);
+    size_t got;
+
+    *length = 0;
+    if (emu == NULL || stream == NULL) goto err;
+
+    katherine_emu_profile_defaults(&profile);
+    profile.pattern        = pattern;
+    profile.hits_per_frame = EMU_HITS_PER_FRAME;
+    if (katherine_emu_init(emu, &profile) != 0) goto err;
+
+    emu_command(emu, CMD_ACQUISITION_MODE, ACQUISITION_MODE_TOA_TOT);
+    emu_command(emu, CMD_NUMBER_OF_FRAMES, frames);
+    emu_command(emu, CMD_ACQUISITION_TIME_LSB, EMU_FRAME_UNITS);
+    emu_command(emu, CMD_ACQUISITION_START, READOUT_DATA_DRIVEN);
+
+    // A millisecond of the clock at a time, and a frame more than it takes.
+    for (uint64_t ns = 0; ns < 10ull * EMU_FRAME_UNITS * (frames + 1); ns += 1000000) {
+        katherine_emu_advance(emu, 1000000);
+        while (katherine_emu_data_out(emu, stream + *length, capacity - *length, &got) == 0 && got > 0) {
+            *length += got;
+        }
+    }
+
+    katherine_emu_fini(emu);
+    free(emu);
+    return stream;
+
+err:
+    free(stream);
+    free(emu);
+    return NULL;
+}
+#endif /* KBENCH_EMULATOR */
+
+int
+main(int argc, char *argv[])
+{
+    bench_t b;
+
+    memset(&b, 0, sizeof(b));
+    b.hits                = argc > 1 ? (size_t) strtoull(argv[1], NULL, 10) : DEFAULT_HITS;
+    b.rounds              = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 10) : DEFAULT_ROUNDS;
+    b.acq.last_toa_offset = 1000 * (1ull << 14);
+
+    const size_t threads = argc > 3 ? (size_t) strtoull(argv[3], NULL, 10) : DEFAULT_THREADS;
+
+    if (b.hits == 0 || b.rounds == 0 || threads == 0) {
+        fprintf(stderr, "usage: %s [hits [rounds [threads]]]\n", argv[0]);
+        return 1;
+    }
+
+    if (make_stream(&b) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("decoding %zu hits in datagrams of %d data, best of %u rounds\n\n", b.hits, (int) DATAGRAM_MDS, b.rounds);
+    bench_f_toa_tot(&b);
+    bench_toa_tot(&b);
+    bench_f_toa_only(&b);
+    bench_toa_only(&b);
+
+    printf("\n");
+    bench_codec(&b, "synthetic", b.stream, b.mds * KATHERINE_MD_SIZE);
+
+#ifdef KBENCH_EMULATOR
+    static const char *const patterns[] = {"uniform", "hot column", "gradient"};
+    for (int pattern = KATHERINE_EMU_PATTERN_UNIFORM; pattern <= KATHERINE_EMU_PATTERN_GRADIENT; ++pattern) {
+        size_t length;
+        char *stream = make_emu_stream(&b, (katherine_emu_pattern_t) pattern, &length);
+        if (stream != NULL) {
+            bench_codec(&b, patterns[pattern], stream, length);
+            free(stream);
+        }
+    }
+#endif /* KBENCH_EMULATOR */
+
+    printf("\n");
+    for (size_t t = 1; t <= threads; t *= 2) {
+        bench_replay(&b, t, false);
+    }
+    for (size_t t = 1; t <= threads; t *= 2) {
+        bench_replay(&b, t, true);
+    }
+
+    free(b.stream);
+    return 0;
+}